@@ -10,10 +10,24 @@
 */
 //----------------------------------------------------------------------------------------
 
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
 #include <iostream>
 
 #include "pgr.h"
 #include "source/Scene.h"
+#include "source/Benchmark.h"
+#include "source/DynamicResolution.h"
+#include "source/GLDebug.h"
+#include "source/GLRenderDevice.h"
+#include "source/HeadlessContext.h"
+#include "source/InputQueue.h"
+#include "source/InputRecorder.h"
+#include "source/Profiler.h"
+#include "source/RedrawScheduler.h"
+#include "source/SoftwareRenderDevice.h"
 
 /// Scene object that keeps all the object
 Scene scene;
@@ -23,10 +37,43 @@ Camera camera = Camera(70.0f, (float)WINDOW_WIDTH / (float)WINDOW_HEIGHT, 0.01f,
 
 /// Global Variables
 GLuint shaderProgram = 0;
+GLuint upscaleProgram = 0;
+GLuint staticLayerProgram = 0;
+
+/// OpenGL render device used by the window
+GLRenderDevice glDevice;
+
+/// Render scale of the window, adjusted from the GPU time of the scene
+DynamicResolution resolution(resolutionBudgetMs, resolutionMinScale);
 
 /// Boolean array containing infrormation whether the key is pressed
 bool keystates[256];
 
+/// Events of the window callbacks, applied by the frame
+InputQueue input;
+
+/// Decides which timer ticks draw a frame
+RedrawScheduler redraw;
+
+/// Log of the applied input with --record
+InputRecorder recorder;
+
+/// Events come from a log, nothing is picked and the window is not touched
+bool replaying = false;
+
+/// Last pointer position, the pointer is recentered only when it drifts far from the center
+int lastMouseX = WINDOW_WIDTH / 2;
+int lastMouseY = WINDOW_HEIGHT / 2;
+
+/// Monitoring mode, the camera and the three static positions in one multi-view pass
+bool monitorMode = false;
+
+/// Polling the window during the late latch can run the display callback again
+bool insideFrame = false;
+bool redisplayPending = false;
+
+void handleInput(const InputQueue::Event& event);
+
 /// Load Shaders
 bool loadShaders()
 {
@@ -47,27 +94,95 @@ bool loadShaders()
   return true;
 }
 
+/// Load a full-screen pass of the render target, 0 on failure
+GLuint loadPassShaders(const char* vertexPath, const char* fragmentPath)
+{
+  GLuint shaders[] = {
+      pgr::createShaderFromFile(GL_VERTEX_SHADER, vertexPath),
+      pgr::createShaderFromFile(GL_FRAGMENT_SHADER, fragmentPath),
+      0
+  };
+
+  GLuint program = pgr::createProgram(shaders);
+
+  if (shaders[0] == 0 || shaders[1] == 0 || program == 0)
+  {
+    std::cout << "Failed to load shader file " << fragmentPath << std::endl;
+    return 0;
+  }
+
+  return program;
+}
+
 /// Callback on each frame
 void drawCallback()
 {
-  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-  glUseProgram(shaderProgram);
+  if (insideFrame)
+  {
+    redisplayPending = true;
+    return;
+  }
+  insideFrame = true;
+
+  Profiler::beginFrame();
+  int ticks = redraw.beginFrame();
+  scene.setFrameTicks(ticks);
+  recorder.beginFrame(ticks);
+  input.beginFrame();
+  input.apply(handleInput);
+
+  glDevice.setRenderScale(resolution.update(glDevice.getSceneGpuMs()), resolution.getSharpness());
+  glDevice.beginFrame();
+
+  camera.update();
+  std::vector<RenderDevice::ViewParams> views = camera.getMonitorViews(monitorMode ? RenderDevice::MAX_VIEWS : 1);
+  std::vector<RenderDevice::CameraParams> viewCameras;
+  for (const auto& view : views)
+    viewCameras.push_back(view.camera);
+  scene.prepare(glDevice, viewCameras);
+
+  /// Late latch: camera input that arrived during the CPU work still makes this frame
+  {
+    PROFILE_CPU_SCOPE("late latch");
+    glutMainLoopEvent();
+    recorder.latch();
+    input.apply(handleInput, true);
+    camera.latch();
+  }
 
-  camera.draw();
-  scene.draw();
+  if (monitorMode)
+  {
+    views[0].camera = camera.getParams();
+    glDevice.setViews(views);
+  }
+  else
+    camera.draw(glDevice);
+  scene.submit(glDevice, camera.getParams());
+  glDevice.endFrame();
   
-  CHECK_GL_ERROR();
-  glutSwapBuffers();
-}
+  {
+    PROFILE_CPU_SCOPE("glutSwapBuffers");
+    glutSwapBuffers();
+  }
 
+  input.present();
+  Profiler::endFrame();
 
-void keyboardDownCallback(unsigned char key, int mouseX, int mouseY)
+  insideFrame = false;
+  if (redisplayPending)
+  {
+    redisplayPending = false;
+    glutPostRedisplay();
+  }
+}
+
+void handleKeyDown(unsigned char key)
 {
   switch (key)
   {
   case ESC_BUTTON:
-    glutLeaveMainLoop();
+    if (!replaying)
+      glutLeaveMainLoop();
     break;
 
   case UP_KEY:
@@ -110,6 +225,60 @@ void keyboardDownCallback(unsigned char key, int mouseX, int mouseY)
     camera.startAnimation();
     break;
 
+  case 't':
+    scene.printStreamingStats();
+    glDevice.printTextureResidency();
+    break;
+
+  case 'o':
+    scene.switchOcclusionCulling();
+    break;
+
+  case 'v':
+    scene.switchPortalCulling();
+    break;
+
+  case 'm':
+    scene.printMemoryReport();
+    break;
+
+  case 'j':
+    scene.printTaskStats();
+    break;
+
+  case 'l':
+    input.printStats();
+    break;
+
+  case 'r':
+    resolution.setEnabled(!resolution.isEnabled());
+    resolution.printStats();
+    break;
+
+  case 'c':
+    glDevice.setStaticLayerEnabled(!glDevice.isStaticLayerEnabled());
+    glDevice.printStaticLayerStats();
+    break;
+
+  case 'n':
+    monitorMode = !monitorMode;
+    std::cout << "Monitoring views " << (monitorMode ? "on" : "off") << std::endl;
+    break;
+
+  case 'd':
+    redraw.setEnabled(!redraw.isEnabled());
+    redraw.printStats();
+    break;
+
+  case 'h':
+    scene.cycleHaze();
+    break;
+
+  case 'p':
+    if (Profiler::exportChromeTrace(profilerTracePath))
+      std::cout << "Profiler trace saved to " << profilerTracePath << std::endl;
+    break;
+
   }
 
   /// Key combinations
@@ -121,7 +290,7 @@ void keyboardDownCallback(unsigned char key, int mouseX, int mouseY)
     camera.switchStaticPosition(3);
 }
 
-void keyboardUpCallback(unsigned char keyPressed, int mouseX, int mouseY)
+void handleKeyUp(unsigned char keyPressed)
 {
   switch (keyPressed)
   {
@@ -144,7 +313,7 @@ void keyboardUpCallback(unsigned char keyPressed, int mouseX, int mouseY)
 }
 
 /// Keyboard event with arrow keys
-void keyboardSpecialCallback(int key, int mouseX, int mouseY)
+void handleSpecialKey(int key)
 {
   switch (key)
   {
@@ -170,49 +339,26 @@ void keyboardSpecialCallback(int key, int mouseX, int mouseY)
 }
 
 
-void mouseClickCallback(int button, int state, int mouseX, int mouseY)
+/// The object id under the pointer was picked when the release was applied
+void handleMouseClick(int state, int objectId)
 {
-
   if (state == GLUT_UP)
   {
-    /// Find the object id by clicking
-    int objectId = 404;
-    glReadPixels(mouseX, WINDOW_HEIGHT - mouseY, 1, 1, GL_STENCIL_INDEX, GL_UNSIGNED_BYTE, &objectId);
     std::cout << "Selected: " << objectId << std::endl;
 
-    if (objectId == 258)
+    if (objectId == 1)
     {
       scene.pushDoor();
       camera.disableCollision();
     }
-    else if (objectId == 262)
+    else if (objectId == 5)
     {
       scene.touchMouse();
     }
   }
 }
 
-/// OnMouseMove. Calculate the vector of movement, rotate the camera and set curson on center
-void mousePassiveCallback(int mouseX, int mouseY)
-{
-  int centerX = WINDOW_WIDTH / 2;
-  int centerY = WINDOW_HEIGHT / 2;
-
-  float deltaX = (mouseX - centerX) * mouseSensitivity;
-  float deltaY = (centerY - mouseY) * mouseSensitivity;
-
-  camera.rotate(deltaX, deltaY);
-  glutWarpPointer(centerX, centerY);
-}
-
-void timerCallback(int time)
-{
-  glutPostRedisplay();
-  glutTimerFunc(timerDelay, timerCallback, 0);
-}
-
-/// Simple GUI
-void menuCallback(int menuId)
+void handleMenu(int menuId)
 {
   switch (menuId)
   {
@@ -236,28 +382,465 @@ void menuCallback(int menuId)
   }
 }
 
-void init()
+void handleInput(const InputQueue::Event& queued)
+{
+  InputQueue::Event event = queued;
+
+  /// Find the object id by clicking, a replay keeps the recorded one
+  if (event.type == InputQueue::MOUSE_CLICK && event.state == GLUT_UP && !replaying)
+    event.objectId = glDevice.objectIdAt(event.x, event.y);
+
+  recorder.record(event);
+
+  switch (event.type)
+  {
+  case InputQueue::KEY_DOWN:
+    handleKeyDown((unsigned char)event.key);
+    break;
+
+  case InputQueue::KEY_UP:
+    handleKeyUp((unsigned char)event.key);
+    break;
+
+  case InputQueue::SPECIAL_KEY:
+    handleSpecialKey(event.key);
+    break;
+
+  case InputQueue::MOUSE_MOVE:
+    camera.rotate(event.deltaX, event.deltaY);
+    break;
+
+  case InputQueue::MOUSE_CLICK:
+    handleMouseClick(event.state, event.objectId);
+    break;
+
+  case InputQueue::MENU:
+    handleMenu(event.key);
+    break;
+  }
+}
+
+void keyboardDownCallback(unsigned char key, int mouseX, int mouseY)
+{
+  InputQueue::Event event;
+  event.type = InputQueue::KEY_DOWN;
+  event.key = key;
+  event.camera = key == UP_KEY || key == DOWN_KEY;
+  input.push(event);
+  redraw.notifyInput();
+}
+
+void keyboardUpCallback(unsigned char key, int mouseX, int mouseY)
+{
+  InputQueue::Event event;
+  event.type = InputQueue::KEY_UP;
+  event.key = key;
+  input.push(event);
+  redraw.notifyInput();
+}
+
+void keyboardSpecialCallback(int key, int mouseX, int mouseY)
+{
+  InputQueue::Event event;
+  event.type = InputQueue::SPECIAL_KEY;
+  event.key = key;
+  event.camera = true;
+  input.push(event);
+  redraw.notifyInput();
+}
+
+void mouseClickCallback(int button, int state, int mouseX, int mouseY)
+{
+  InputQueue::Event event;
+  event.type = InputQueue::MOUSE_CLICK;
+  event.key = button;
+  event.state = state;
+  event.x = mouseX;
+  event.y = mouseY;
+  input.push(event);
+  redraw.notifyInput();
+}
+
+/// OnMouseMove. Queue the movement since the last event, recenter the cursor only near the window edges
+void mousePassiveCallback(int mouseX, int mouseY)
+{
+  InputQueue::Event event;
+  event.type = InputQueue::MOUSE_MOVE;
+  event.x = mouseX;
+  event.y = mouseY;
+  event.deltaX = (mouseX - lastMouseX) * mouseSensitivity;
+  event.deltaY = (lastMouseY - mouseY) * mouseSensitivity;
+  event.camera = true;
+
+  lastMouseX = mouseX;
+  lastMouseY = mouseY;
+
+  if (event.deltaX != 0.0f || event.deltaY != 0.0f)
+  {
+    input.push(event);
+    redraw.notifyInput();
+  }
+
+  int centerX = WINDOW_WIDTH / 2;
+  int centerY = WINDOW_HEIGHT / 2;
+  if (std::abs(mouseX - centerX) > WINDOW_WIDTH / 4 || std::abs(mouseY - centerY) > WINDOW_HEIGHT / 4)
+  {
+    lastMouseX = centerX;
+    lastMouseY = centerY;
+    glutWarpPointer(centerX, centerY);
+  }
+}
+
+/// Window is about to be destroyed, release GPU resources while its context is still current
+void closeCallback()
+{
+  recorder.stop();
+  scene.unload();
+}
+
+/// Draw the tick only when the redraw scheduler has a frame due
+void timerCallback(int time)
+{
+  if (redraw.tick())
+    glutPostRedisplay();
+  glutTimerFunc(timerDelay, timerCallback, 0);
+}
+
+/// Simple GUI
+void menuCallback(int menuId)
+{
+  InputQueue::Event event;
+  event.type = InputQueue::MENU;
+  event.key = menuId;
+  input.push(event);
+  redraw.notifyInput();
+}
+
+void init(int width, int height)
 {
   glClearColor(0.2f, 0.1f, 0.3f, 1.0f);
   glEnable(GL_DEPTH_TEST);
-  glViewport(0, 0, glutGet(GLUT_WINDOW_WIDTH), glutGet(GLUT_WINDOW_HEIGHT));
+  glViewport(0, 0, width, height);
 
   if (!loadShaders()) 
     std::cout << "Shaders are not loaded" << std::endl;
   
-  camera.init(shaderProgram);
-  CHECK_GL_ERROR();
-  scene.init(shaderProgram);
-  CHECK_GL_ERROR();
+  GL_LABEL(GL_PROGRAM, shaderProgram, "shaderProgram");
+
+  glDevice.init(shaderProgram);
+  camera.setTerrain(&scene.getTerrain());
+  camera.init();
+  scene.init(glDevice);
 }
 
+/// Render frames with the software rasterizer, without a window or a GPU
+int renderSoftware(int frameCount)
+{
+  SoftwareRenderDevice device(WINDOW_WIDTH, WINDOW_HEIGHT);
+
+  scene.loadObjects();
+  scene.setStreamingSynchronous(true);
+  camera.setTerrain(&scene.getTerrain());
+  camera.init();
+  scene.init(device);
+
+  double totalMs = 0.0;
+
+  for (int frame = 0; frame < frameCount; frame++)
+  {
+    uint64_t start = Profiler::nowNs();
+
+    device.beginFrame();
+    camera.update();
+    camera.draw(device);
+    scene.draw(device, camera.getParams());
+    device.endFrame();
+
+    totalMs += (Profiler::nowNs() - start) / 1e6;
+  }
+
+  double frameMs = totalMs / std::max(frameCount, 1);
+  std::cout << "Software renderer: " << frameCount << " frames at " << WINDOW_WIDTH << "x" << WINDOW_HEIGHT
+            << " on " << device.getThreadCount() << " threads, " << frameMs << " ms/frame (" << 1000.0 / frameMs << " fps)" << std::endl;
+
+  Image image;
+  device.readPixels(image);
+  scene.unload();
+
+  if (!image.savePPM(softwareImagePath))
+  {
+    std::cout << "Failed to write " << softwareImagePath << std::endl;
+    return 1;
+  }
+
+  return 0;
+}
+
+/// Run the fly-through benchmark on a headless OpenGL context or on the software rasterizer
+int runBenchmark(bool software, bool updateGolden)
+{
+  Benchmark benchmark(software ? "software" : "opengl", !software);
+  bool passed;
+
+  if (software)
+  {
+    SoftwareRenderDevice device(WINDOW_WIDTH, WINDOW_HEIGHT);
+
+    scene.loadObjects();
+    scene.setStreamingSynchronous(true);
+    camera.setTerrain(&scene.getTerrain());
+    camera.init();
+    scene.init(device);
+
+    passed = benchmark.run(scene, camera, device, [&device](Image& image) { device.readPixels(image); }, updateGolden);
+    scene.unload();
+  }
+  else
+  {
+    HeadlessContext context;
+    if (!context.create(WINDOW_WIDTH, WINDOW_HEIGHT))
+      return 1;
+
+#if GL_VALIDATION
+    GLDebug::init();
+#endif
+    scene.loadObjects();
+    scene.setStreamingSynchronous(true);
+    glDevice.setTextureStreamingSynchronous(true);
+    init(WINDOW_WIDTH, WINDOW_HEIGHT);
+
+    passed = benchmark.run(scene, camera, glDevice, [&context](Image& image) { context.readPixels(image); }, updateGolden);
+    scene.unload();
+  }
+
+  benchmark.printSummary();
+  scene.printTaskStats();
+  if (!benchmark.writeReport(benchmarkReportPath))
+    std::cout << "Failed to write " << benchmarkReportPath << std::endl;
+
+  return passed ? 0 : 1;
+}
+
+/// Cost of the monitoring views on a headless OpenGL context or on the software rasterizer
+int runMultiViewBenchmark(bool software)
+{
+  Benchmark benchmark(software ? "software" : "opengl", !software);
+
+  if (software)
+  {
+    SoftwareRenderDevice device(WINDOW_WIDTH, WINDOW_HEIGHT);
+
+    scene.loadObjects();
+    scene.setStreamingSynchronous(true);
+    camera.setTerrain(&scene.getTerrain());
+    camera.init();
+    scene.init(device);
+
+    benchmark.runViews(scene, camera, device);
+    scene.unload();
+  }
+  else
+  {
+    HeadlessContext context;
+    if (!context.create(WINDOW_WIDTH, WINDOW_HEIGHT))
+      return 1;
+
+    scene.loadObjects();
+    scene.setStreamingSynchronous(true);
+    glDevice.setTextureStreamingSynchronous(true);
+    init(WINDOW_WIDTH, WINDOW_HEIGHT);
+
+    benchmark.runViews(scene, camera, glDevice);
+    scene.unload();
+  }
+
+  return 0;
+}
+
+/// Replay a recorded session frame by frame on a headless OpenGL context or on the software rasterizer
+int runReplay(const char* logPath, bool software)
+{
+  InputRecorder::Log log;
+  if (!InputRecorder::load(logPath, log))
+    return 1;
+
+  if (log.timerDelayMs != (uint32_t)timerDelay)
+    std::cout << "The log was recorded with a timer of " << log.timerDelayMs << " ms, this build ticks every " << timerDelay << " ms" << std::endl;
+
+  Benchmark benchmark(software ? "software" : "opengl", !software);
+  replaying = true;
+  scene.setSeed(log.seed);
+
+  /// Same order as drawCallback, with the recorded events in place of the queue
+  auto drawFrame = [](RenderDevice& device, const InputRecorder::Frame& frame)
+  {
+    scene.setFrameTicks(frame.ticks);
+    for (const InputQueue::Event& event : frame.events)
+      handleInput(event);
+
+    device.beginFrame();
+    camera.update();
+    std::vector<RenderDevice::ViewParams> views = camera.getMonitorViews(monitorMode ? RenderDevice::MAX_VIEWS : 1);
+    std::vector<RenderDevice::CameraParams> viewCameras;
+    for (const auto& view : views)
+      viewCameras.push_back(view.camera);
+    scene.prepare(device, viewCameras);
+
+    for (const InputQueue::Event& event : frame.latchedEvents)
+      handleInput(event);
+    camera.latch();
+
+    if (monitorMode)
+    {
+      views[0].camera = camera.getParams();
+      device.setViews(views);
+    }
+    else
+      camera.draw(device);
+    scene.submit(device, camera.getParams());
+    device.endFrame();
+  };
+
+  if (software)
+  {
+    SoftwareRenderDevice device(WINDOW_WIDTH, WINDOW_HEIGHT);
+
+    scene.loadObjects();
+    scene.setStreamingSynchronous(true);
+    camera.setTerrain(&scene.getTerrain());
+    camera.init();
+    scene.init(device);
+
+    benchmark.runReplay(log, [&](const InputRecorder::Frame& frame) { drawFrame(device, frame); },
+                        [&device](Image& image) { device.readPixels(image); });
+    scene.unload();
+  }
+  else
+  {
+    HeadlessContext context;
+    if (!context.create(WINDOW_WIDTH, WINDOW_HEIGHT))
+      return 1;
+
+#if GL_VALIDATION
+    GLDebug::init();
+#endif
+    scene.loadObjects();
+    scene.setStreamingSynchronous(true);
+    glDevice.setTextureStreamingSynchronous(true);
+    init(WINDOW_WIDTH, WINDOW_HEIGHT);
+
+    benchmark.runReplay(log, [&](const InputRecorder::Frame& frame) { drawFrame(glDevice, frame); },
+                        [&context](Image& image) { context.readPixels(image); });
+    scene.unload();
+  }
+
+  benchmark.printSummary();
+  if (!benchmark.writeReport(replayReportPath))
+    std::cout << "Failed to write " << replayReportPath << std::endl;
+
+  return 0;
+}
 
 int main(int argc, char* argv[]) 
 {
+  /// --benchmark [--software] [--update-golden]: headless fly-through, non-zero exit code on golden mismatch
+  if (argc > 1 && strcmp(argv[1], "--benchmark") == 0)
+  {
+    bool software = false;
+    bool updateGolden = false;
+    for (int i = 2; i < argc; i++)
+    {
+      software = software || strcmp(argv[i], "--software") == 0;
+      updateGolden = updateGolden || strcmp(argv[i], "--update-golden") == 0;
+    }
+    return runBenchmark(software, updateGolden);
+  }
+
+  /// --multiview-benchmark [--software]: frame cost of 1 to 4 monitoring views
+  if (argc > 1 && strcmp(argv[1], "--multiview-benchmark") == 0)
+    return runMultiViewBenchmark(argc > 2 && strcmp(argv[2], "--software") == 0);
+
+  /// --ocean-benchmark: ocean update times for several grid sizes and thread counts
+  if (argc > 1 && strcmp(argv[1], "--ocean-benchmark") == 0)
+  {
+    Ocean::benchmark();
+    return 0;
+  }
+
+  /// --fog-benchmark: froxel fog build times for several grid sizes and thread counts
+  if (argc > 1 && strcmp(argv[1], "--fog-benchmark") == 0)
+  {
+    VolumetricFog::benchmark();
+    return 0;
+  }
+
+  /// --job-benchmark: job system overhead per job and parallel loops against ThreadPool
+  if (argc > 1 && strcmp(argv[1], "--job-benchmark") == 0)
+  {
+    JobSystem::benchmark();
+    return 0;
+  }
+
+  /// --profiler-benchmark: frame time of many small CPU scopes with the profiler off and on
+  if (argc > 1 && strcmp(argv[1], "--profiler-benchmark") == 0)
+  {
+    Profiler::benchmark();
+    return 0;
+  }
+
+  /// --particle-benchmark: particle update cost per particle with a million particles
+  if (argc > 1 && strcmp(argv[1], "--particle-benchmark") == 0)
+  {
+    ParticleSystem::benchmark();
+    return 0;
+  }
+
+  /// --portal-benchmark: portal visibility cost and culled objects on grids of rooms
+  if (argc > 1 && strcmp(argv[1], "--portal-benchmark") == 0)
+  {
+    PortalSystem::benchmark();
+    return 0;
+  }
+
+  /// --bake-lightmaps [samples]: path-trace the lightmaps of the static meshes, no window or GPU
+  if (argc > 1 && strcmp(argv[1], "--bake-lightmaps") == 0)
+  {
+    scene.loadObjects();
+    return scene.bakeLightmaps(argc > 2 ? atoi(argv[2]) : lightmapSamples) ? 0 : 1;
+  }
+
+  /// --lightmap-benchmark [samples]: bake throughput and its scaling with the thread count
+  if (argc > 1 && strcmp(argv[1], "--lightmap-benchmark") == 0)
+  {
+    scene.loadObjects();
+    scene.benchmarkLightmaps(argc > 2 ? atoi(argv[2]) : lightmapBenchmarkSamples);
+    return 0;
+  }
+
+  /// --mesh-stats: vertex cache and fetch efficiency of every mesh before and after the load-time optimization
+  if (argc > 1 && strcmp(argv[1], "--mesh-stats") == 0)
+  {
+    scene.loadObjects();
+    scene.printMeshOptimization();
+    return 0;
+  }
+
+  /// --replay <log> [--software]: headless replay of a recorded session, timings and frame hashes per frame
+  if (argc > 2 && strcmp(argv[1], "--replay") == 0)
+    return runReplay(argv[2], argc > 3 && strcmp(argv[3], "--software") == 0);
+
+  /// --software [frames]: render with the CPU backend and exit
+  if (argc > 1 && strcmp(argv[1], "--software") == 0)
+    return renderSoftware(argc > 2 ? atoi(argv[2]) : 100);
+
   glutInit(&argc, argv);
 
   glutInitContextVersion(pgr::OGL_VER_MAJOR, pgr::OGL_VER_MINOR);
+#if GL_VALIDATION
+  glutInitContextFlags(GLUT_FORWARD_COMPATIBLE | GLUT_DEBUG);
+#else
   glutInitContextFlags(GLUT_FORWARD_COMPATIBLE);
+#endif
 
   glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGB | GLUT_DEPTH);
   glutInitWindowSize(WINDOW_WIDTH, WINDOW_HEIGHT);
@@ -269,6 +852,7 @@ int main(int argc, char* argv[])
   glutDisplayFunc(drawCallback);
   glutMouseFunc(mouseClickCallback);
   glutPassiveMotionFunc(mousePassiveCallback);
+  glutCloseFunc(closeCallback);
 
   glutCreateMenu(menuCallback);
   glutAddMenuEntry("Start Animation", 1);
@@ -278,12 +862,37 @@ int main(int argc, char* argv[])
   glutAttachMenu(GLUT_RIGHT_BUTTON);
 
   glutTimerFunc(timerDelay, timerCallback, 0);
+  redraw.setEnabled(redrawOnDemand);
 
   if(!pgr::initialize(pgr::OGL_VER_MAJOR, pgr::OGL_VER_MINOR))
     pgr::dieWithError("pgr init failed, required OpenGL not supported?");
+#if GL_VALIDATION
+  GLDebug::init();
+#endif
   scene.loadObjects();
 
-  init();
+  init(glutGet(GLUT_WINDOW_WIDTH), glutGet(GLUT_WINDOW_HEIGHT));
+  upscaleProgram = loadPassShaders(upscaleVertexShaderPath, upscaleFragmentShaderPath);
+  if (upscaleProgram != 0)
+  {
+    glDevice.initRenderTarget(glutGet(GLUT_WINDOW_WIDTH), glutGet(GLUT_WINDOW_HEIGHT), upscaleProgram);
+    staticLayerProgram = loadPassShaders(upscaleVertexShaderPath, staticLayerFragmentShaderPath);
+    if (staticLayerProgram != 0)
+      glDevice.initStaticLayer(staticLayerProgram);
+  }
+
+  redraw.addSource("camera animation", []() { return camera.isAnimating() ? 1 : 0; });
+  redraw.addSource("texture streaming", []() { return glDevice.isStreamingTextures() ? 1 : 0; });
+  scene.addRedrawSources(redraw);
+
+  /// --record <log>: log the input of the whole session for --replay
+  if (argc > 2 && strcmp(argv[1], "--record") == 0)
+  {
+    uint32_t seed = (uint32_t)time(nullptr);
+    scene.setSeed(seed);
+    recorder.start(argv[2], seed);
+  }
+
   glutMainLoop();
   return 0;
 }
@@ -1,27 +1,62 @@
 #version 330
 in vec2 ShadertextureCoord;
+in vec2 LightmapCoord;
 in vec3 normal;
 in vec3 FragPos;
 in vec3 cameraFragPos;
+in vec4 ParticleColor;
+flat in int viewIndex;
 
-uniform float sunAlpha;
 uniform vec3 sunDirection;
 uniform int flashLightEnabled;
 uniform int countOflights;
 uniform vec4 lights[6];
 uniform int objectType;
-uniform vec3 eyePos;
-uniform vec3 eyeDirection;
+/// Written once per frame by the late-latched camera, binding point 0. Draws are instanced
+/// once per view and every view is mapped into its rectangle of the target.
+layout(std140) uniform CameraBlock
+{
+	mat4 viewMatrices[4];
+	vec4 eyePositions[4];
+	vec4 eyeDirections[4];
+	vec4 viewRects[4];
+	int viewCount;
+};
+
+vec3 eyePos;
+vec3 eyeDirection;
 
 uniform sampler2D MTexture;
+uniform sampler2D normalMap;
+uniform sampler2D heightMap;
+uniform sampler2D lightmap;
+uniform int lightmapEnabled;
+uniform vec4 terrainHeightMapTransform;
+uniform int terrainCutoutCount;
+uniform vec3 terrainCutouts[8];
 uniform vec3 lightColor;
 uniform float ambientRegulator;
-uniform int waterFrame;
 uniform int fogEnabled;
 
 uniform vec3 	pointPosition;
 uniform vec3 	pointColor;
 uniform float pointIntensity;
+uniform int staticLayer;
+uniform int particleLit;
+
+// sky tables of Atmosphere.h, radii in km: ground, top, observer, and the Mie asymmetry
+uniform sampler2D skyTransmittance;
+uniform sampler2D skyRayleigh;
+uniform sampler2D skyMie;
+uniform vec3 skySamples;
+uniform vec4 atmosphereRadii;
+uniform float skyExposure;
+
+// froxel grid of VolumetricFog.h: in-scattered light and transmittance from the eye, slices
+// spaced exponentially in view depth from fogDepthRange.x, fogDepthRange.y is log(far / near)
+uniform sampler3D froxelFog;
+uniform mat4 fogViewProjection;
+uniform vec2 fogDepthRange;
 
 out vec4 color;
 
@@ -29,15 +64,19 @@ out vec4 color;
 float ambient = 0.5;
 float specularStrength = 0.8;
 float diffuseStrength = 0.8;
+vec3 surfaceNormal;
+float pointWeight = 0.0;
+const float PI = 3.14159265;
+const float SUN_ANGULAR_RADIUS = 0.00467;
 //================================================================================================
 float getPointLight()
 {
-	vec3 normalizedNormal = normalize(normal);
+	vec3 normalizedNormal = normalize(surfaceNormal);
 	vec3 lightDir = normalize(FragPos - pointPosition );
 	float diffuse = max(dot(normalizedNormal, lightDir), 0.0)  * diffuseStrength;
 
 	vec3 viewDir = normalize(eyePos - FragPos);
-	vec3 reflectDir = reflect(-lightDir, normal);
+	vec3 reflectDir = reflect(-lightDir, surfaceNormal);
 	float specular = pow(max(dot(viewDir, reflectDir), 0.0), 128) * specularStrength;
 	float distance = length(pointPosition - FragPos);
 	float attenuation = 1.0 / (0.5 * distance + 0.5 * distance * distance);
@@ -55,10 +94,10 @@ float getFlashlight()
 //================================================================================================
 float flashlighPhong()
 {
-	vec3 normalizedNormal = normalize(normal);
+	vec3 normalizedNormal = normalize(surfaceNormal);
 	vec3 lightDir = normalize(eyePos - FragPos);
 	vec3 viewDir = normalize(eyePos - FragPos);
-	vec3 reflectDir = reflect(-lightDir, normal);
+	vec3 reflectDir = reflect(-lightDir, surfaceNormal);
 	float specular = pow(max(dot(viewDir, reflectDir), 0.0), 128) * specularStrength;
 
 	float diffuse = max(dot(normalizedNormal, lightDir), 0.0)  * diffuseStrength ;
@@ -66,48 +105,134 @@ float flashlighPhong()
 	return ((diffuse + ambient  + specular) * getFlashlight());
 }
 //================================================================================================
-float fogLight()
+vec4 fogAt()
 {
-	const float LOG2 = 1.442695;
-	float z = gl_FragCoord.z / gl_FragCoord.w;
-	float fogFactor = exp2(-0.1 * 0.1 * z * z *LOG2);
-	fogFactor = clamp(fogFactor, 0.0, 1.0);
-
-	return fogFactor;
+	vec4 clip = fogViewProjection * vec4(FragPos, 1.0);
+	float depth = max(clip.w, 1e-4);
+	vec3 coord = vec3(clip.xy / depth * 0.5 + 0.5, log(max(depth / fogDepthRange.x, 1.0)) / fogDepthRange.y);
+	// the sky is infinitely far, behind all of the fog
+	if(objectType == 1)
+		coord.z = 1.0;
+	return textureLod(froxelFog, coord, 0);
 }
 //================================================================================================
-float directionPhong()
+float directionPhong(float skyLight)
 {
-	vec3 normalizedNormal = normalize(normal);
+	vec3 normalizedNormal = normalize(surfaceNormal);
 	vec3 lightDir = normalize(sunDirection);
 	vec3 viewDir = normalize(eyePos - FragPos);
-	vec3 reflectDir = reflect(-lightDir, normal);
+	vec3 reflectDir = reflect(-lightDir, surfaceNormal);
 	float specular = pow(max(dot(viewDir, reflectDir), 0.0), 128) * specularStrength;
 
 	float diffuse = max(dot(normalizedNormal, lightDir), 0.0)  * diffuseStrength ;
-	return (diffuse + ambient  + specular);
+	return (diffuse + ambient * skyLight + specular);
+}
+//================================================================================================
+float elevationToUnit(float elevation)
+{
+	return 0.5 + 0.5 * sign(elevation) * sqrt(min(abs(elevation) / (0.5 * PI), 1.0));
+}
+//================================================================================================
+// texel centers of the samples at both ends of [0, 1], the tables repeat
+vec2 tableCoord(vec2 unit, vec2 size)
+{
+	return (0.5 + unit * (size - 1.0)) / size;
+}
+//================================================================================================
+// one azimuth slice of a sky table, the slices lie side by side
+vec3 skySlice(sampler2D table, vec2 unit, float slice)
+{
+	vec2 coord = tableCoord(unit, skySamples.xy);
+	coord.x = (coord.x + slice) / skySamples.z;
+	return textureLod(table, coord, 0).rgb;
+}
+//================================================================================================
+vec3 transmittanceToTop(float r, float mu)
+{
+	float groundRadius = atmosphereRadii.x, topRadius = atmosphereRadii.y;
+	float horizon = sqrt(topRadius * topRadius - groundRadius * groundRadius);
+	float rho = sqrt(max(r * r - groundRadius * groundRadius, 0.0));
+	float distance = max(-r * mu + sqrt(max(r * r * (mu * mu - 1.0) + topRadius * topRadius, 0.0)), 0.0);
+	float minDistance = topRadius - r;
+	vec2 unit = vec2((distance - minDistance) / (rho + horizon - minDistance), rho / horizon);
+	return textureLod(skyTransmittance, tableCoord(unit, vec2(textureSize(skyTransmittance, 0))), 0).rgb;
 }
 //================================================================================================
-vec4 waterAnimationTexture()
+// sky radiance for a unit sun: Rayleigh and multiple scattering, Mie with its phase, the sun disk
+vec3 atmosphereSky(vec3 view, vec3 sun)
 {
-	float xPos  = ShadertextureCoord.x / 4;
-	float yPos  = ShadertextureCoord.y / 4;
-	float division = waterFrame / 4;
-	xPos += (waterFrame % 4) * 0.25f;
-	yPos += floor(division) * 0.25f;
+	vec2 viewFlat = view.xz, sunFlat = sun.xz;
+	float azimuth = (length(viewFlat) > 1e-4 && length(sunFlat) > 1e-4) ? acos(clamp(dot(normalize(viewFlat), normalize(sunFlat)), -1.0, 1.0)) : 0.0;
+	vec2 unit = vec2(elevationToUnit(asin(clamp(view.y, -1.0, 1.0))), elevationToUnit(asin(clamp(sun.y, -1.0, 1.0))));
+
+	float slice = azimuth / PI * (skySamples.z - 1.0);
+	float slice0 = min(floor(slice), skySamples.z - 2.0);
+	float sliceWeight = slice - slice0;
+	vec3 rayleigh = mix(skySlice(skyRayleigh, unit, slice0), skySlice(skyRayleigh, unit, slice0 + 1.0), sliceWeight);
+	vec3 mie = mix(skySlice(skyMie, unit, slice0), skySlice(skyMie, unit, slice0 + 1.0), sliceWeight);
 
-	return texture(MTexture, vec2(xPos, yPos));
+	float nu = dot(view, sun);
+	float g = atmosphereRadii.w;
+	float miePhase = 3.0 / (8.0 * PI) * (1.0 - g * g) * (1.0 + nu * nu) / ((2.0 + g * g) * pow(1.0 + g * g - 2.0 * g * nu, 1.5));
+	vec3 radiance = rayleigh + mie * miePhase;
+
+	// the sun disk, as bright as the sun illuminance spread over its solid angle
+	float disk = smoothstep(cos(SUN_ANGULAR_RADIUS * 1.2), cos(SUN_ANGULAR_RADIUS), nu);
+	if(disk > 0.0 && view.y > -0.01)
+		radiance += disk * transmittanceToTop(atmosphereRadii.z, view.y) / (PI * SUN_ANGULAR_RADIUS * SUN_ANGULAR_RADIUS);
+	return radiance;
+}
+//================================================================================================
+vec4 waterTexture()
+{
+	// first tile of the water atlas, explicit gradients avoid a seam where fract() wraps
+	vec2 tileCoord = ShadertextureCoord * 0.25f;
+	return textureGrad(MTexture, fract(ShadertextureCoord) * 0.25f, dFdx(tileCoord), dFdy(tileCoord));
 }
 //================================================================================================
 void main()
 {
-	vec3 lighting =	directionPhong() * lightColor;
+	eyePos = eyePositions[viewIndex].xyz;
+	eyeDirection = eyeDirections[viewIndex].xyz;
+
+	// particles: round soft sprites, the fog fades them out
+	if(objectType == 7)
+	{
+		color = ParticleColor * max(1.0 - dot(ShadertextureCoord, ShadertextureCoord), 0.0);
+		if(particleLit != 0)
+			color.rgb *= lightColor * (ambient + diffuseStrength * max(sunDirection.y, 0.0));
+		if(fogEnabled != 0)
+			color.a *= fogAt().a;
+		return;
+	}
+
+	if(objectType == 6)
+	{
+		for(int i = 0; i < terrainCutoutCount; i++)
+			if(all(greaterThan(FragPos, terrainCutouts[i * 2])) && all(lessThan(FragPos, terrainCutouts[i * 2 + 1])))
+				discard;
+	}
+
+	surfaceNormal = (objectType == 5) ? texture(normalMap, ShadertextureCoord).xyz : normal;
+	if(objectType == 6)
+		surfaceNormal = texture(heightMap, FragPos.xz * terrainHeightMapTransform.x + terrainHeightMapTransform.yz).yzw;
+	// baked meshes: torch irradiance per unit intensity and sky light, square-root encoded (Lightmap.h)
+	vec2 baked = vec2(0.0, 1.0);
+	if(lightmapEnabled != 0)
+	{
+		baked = textureLod(lightmap, LightmapCoord, 0).rg;
+		baked = baked * baked * vec2(4.0, 1.0);
+	}
+	vec3 lighting =	directionPhong(baked.y) * lightColor;
 
 	if(objectType != 5)
 	{
 		if(objectType == 1)
 		{
-			color = vec4(lightColor, 1.0f) * texture(MTexture, ShadertextureCoord) * (1 - sunAlpha);
+			// the sky texture shows through where the atmosphere is dark
+			vec3 sky = 1.0 - exp(-skyExposure * atmosphereSky(normalize(FragPos - eyePos), normalize(sunDirection)));
+			float night = 1.0 - clamp(dot(sky, vec3(0.2126, 0.7152, 0.0722)) * 4.0, 0.0, 1.0);
+			color = vec4(sky, 1.0f) + vec4(lightColor, 1.0f) * texture(MTexture, ShadertextureCoord) * night;
 		}
 		else
 		{
@@ -116,12 +241,18 @@ void main()
 
 			color = vec4(lighting, 1.0f) * texture(MTexture, ShadertextureCoord);
 
-			color += getPointLight() * pointIntensity * vec4(pointColor, 1.0f);
+			// the static layer keeps the torch weight, the flicker is added when it is composited
+			pointWeight = (lightmapEnabled != 0) ? baked.x : getPointLight();
+			if(staticLayer == 0)
+				color += pointWeight * pointIntensity * vec4(pointColor, 1.0f);
 		}
 	}
 	if(objectType == 5)
-		color = vec4(lighting, 1.0f) * waterAnimationTexture();
+		color = vec4(lighting, 1.0f) * waterTexture();
+
+	vec4 fog = (fogEnabled != 0) ? fogAt() : vec4(0.0, 0.0, 0.0, 1.0);
+	color.rgb = color.rgb * fog.a + fog.rgb;
 
-	if(fogEnabled != 0)
-		color = mix(vec4(0.87f, 0.87f, 0.87f, 0.1f), color, fogLight());
+	if(staticLayer != 0)
+		color.a = pointWeight * fog.a;
 }
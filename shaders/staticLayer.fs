@@ -0,0 +1,14 @@
+#version 330
+
+uniform sampler2D source;
+uniform vec3 pointColor;
+uniform float pointIntensity;
+
+out vec4 color;
+
+// the static layer has the same size as the drawn part of the target, no filtering
+void main()
+{
+	vec4 cached = texelFetch(source, ivec2(gl_FragCoord.xy), 0);
+	color = vec4(cached.rgb + cached.a * pointIntensity * pointColor, 1.0);
+}
@@ -0,0 +1,33 @@
+#version 330
+in vec2 uv;
+
+uniform sampler2D source;
+uniform vec2 texelSize;
+uniform vec2 uvMax;
+uniform float sharpness;
+
+out vec4 color;
+
+// stay inside the drawn part of the target, the rest holds older frames
+vec3 sampleSource(vec2 position)
+{
+	return texture(source, clamp(position, texelSize * 0.5, uvMax)).rgb;
+}
+
+// bilinear upscale followed by contrast adaptive sharpening: the cross of neighbours is
+// subtracted less where the contrast is already high, and the result stays within their range
+void main()
+{
+	vec3 center = sampleSource(uv);
+	vec3 north = sampleSource(uv + vec2(0.0, texelSize.y));
+	vec3 south = sampleSource(uv - vec2(0.0, texelSize.y));
+	vec3 east = sampleSource(uv + vec2(texelSize.x, 0.0));
+	vec3 west = sampleSource(uv - vec2(texelSize.x, 0.0));
+
+	vec3 low = min(center, min(min(north, south), min(east, west)));
+	vec3 high = max(center, max(max(north, south), max(east, west)));
+	vec3 amount = sqrt(clamp(min(low, 1.0 - high) / max(high, vec3(0.0001)), 0.0, 1.0)) * sharpness;
+
+	vec3 sharpened = center + (center * 4.0 - north - south - east - west) * amount * 0.25;
+	color = vec4(clamp(sharpened, low, high), 1.0);
+}
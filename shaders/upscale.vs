@@ -0,0 +1,13 @@
+#version 330
+
+uniform vec2 uvScale;
+
+out vec2 uv;
+
+// one triangle covering the screen, the drawn part of the render target maps onto the window
+void main()
+{
+	vec2 corner = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+	uv = corner * uvScale;
+	gl_Position = vec4(corner * 2.0 - 1.0, 0.0, 1.0);
+}
@@ -4,21 +4,103 @@
 layout(location = 0) in vec3 position;
 layout(location = 1) in vec3 vertexShaderNormal;
 layout(location = 2) in vec2 textureCoord;
+layout(location = 3) in vec4 terrainPatch;
+layout(location = 4) in vec2 lightmapCoord;
+layout(location = 5) in vec4 particle;
 
 
-uniform mat4 viewMatrix;
+/// Written once per frame by the late-latched camera, binding point 0. Draws are instanced
+/// once per view and every view is mapped into its rectangle of the target.
+layout(std140) uniform CameraBlock
+{
+	mat4 viewMatrices[4];
+	vec4 eyePositions[4];
+	vec4 eyeDirections[4];
+	vec4 viewRects[4];
+	int viewCount;
+};
 uniform mat4 transform;
+uniform int objectType;
+uniform sampler2D displacementMap;
+uniform float oceanPatchSize;
+
+uniform sampler2D heightMap;
+uniform vec4 terrainHeightMapTransform;
+uniform vec2 terrainMorph[8];
+uniform float terrainPatchQuads;
+
+uniform vec4 particleColors[2];
+uniform vec2 particleSize;
 
 out vec2 ShadertextureCoord;
+out vec2 LightmapCoord;
 out vec3 FragPos;
 out vec3 normal;
 out vec3 cameraFragPos;
+out vec4 ParticleColor;
+flat out int viewIndex;
+out float gl_ClipDistance[4];
+
+float terrainHeight(vec2 world)
+{
+	return textureLod(heightMap, world * terrainHeightMapTransform.x + terrainHeightMapTransform.yz, 0).x;
+}
 
 void main()
 {
-	gl_Position = viewMatrix * transform * vec4(position, 1.0f);
-	FragPos = vec3(transform * vec4(position, 1.0));
-	normal = mat3(transpose(inverse(transform))) * vertexShaderNormal;
+	// terrain patches repeat for every view, other draws have one instance per view
+	viewIndex = gl_InstanceID % viewCount;
+	vec3 eyePos = eyePositions[viewIndex].xyz;
 
+	vec4 worldPosition = transform * vec4(position, 1.0f);
 	ShadertextureCoord = textureCoord;
+	LightmapCoord = lightmapCoord;
+
+	// water: the ocean maps tile the world every oceanPatchSize units
+	if(objectType == 5)
+	{
+		ShadertextureCoord = worldPosition.xz / oceanPatchSize;
+		worldPosition.xyz += textureLod(displacementMap, ShadertextureCoord, 0).xyz;
+	}
+
+	// terrain: one instance per patch, odd vertices slide onto the coarser grid towards the end of the level
+	if(objectType == 6)
+	{
+		vec2 gridPos = position.xz;
+		vec2 world = terrainPatch.xy + gridPos * terrainPatch.z;
+		vec2 morph = terrainMorph[int(terrainPatch.w)];
+		float morphK = clamp((distance(eyePos, vec3(world.x, terrainHeight(world), world.y)) - morph.x) / (morph.y - morph.x), 0.0, 1.0);
+
+		gridPos -= fract(gridPos * terrainPatchQuads * 0.5) * 2.0 / terrainPatchQuads * morphK;
+		world = terrainPatch.xy + gridPos * terrainPatch.z;
+		worldPosition = vec4(world.x, terrainHeight(world), world.y, 1.0f);
+		ShadertextureCoord = world * terrainHeightMapTransform.w;
+	}
+
+	// particles: a quad facing the view from gl_VertexID, dead particles collapse to a point
+	if(objectType == 7)
+	{
+		vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1) * 2.0 - 1.0;
+		mat4 viewMatrix = viewMatrices[viewIndex];
+		vec3 right = normalize(vec3(viewMatrix[0][0], viewMatrix[1][0], viewMatrix[2][0]));
+		vec3 up = normalize(vec3(viewMatrix[0][1], viewMatrix[1][1], viewMatrix[2][1]));
+		float size = particle.w < 1.0 ? mix(particleSize.x, particleSize.y, particle.w) : 0.0;
+
+		worldPosition = vec4(particle.xyz + (right * corner.x + up * corner.y) * size, 1.0f);
+		ShadertextureCoord = corner;
+		ParticleColor = mix(particleColors[0], particleColors[1], particle.w);
+	}
+
+	// clip to the view's own frustum, then move it into the view's rectangle
+	vec4 clip = viewMatrices[viewIndex] * worldPosition;
+	vec4 rect = viewRects[viewIndex];
+	gl_ClipDistance[0] = clip.w + clip.x;
+	gl_ClipDistance[1] = clip.w - clip.x;
+	gl_ClipDistance[2] = clip.w + clip.y;
+	gl_ClipDistance[3] = clip.w - clip.y;
+	gl_Position = vec4((rect.x * 2.0 - 1.0) * clip.w + (clip.x + clip.w) * (rect.z - rect.x),
+	                   (rect.y * 2.0 - 1.0) * clip.w + (clip.y + clip.w) * (rect.w - rect.y),
+	                   clip.z, clip.w);
+	FragPos = vec3(worldPosition);
+	normal = mat3(transpose(inverse(transform))) * vertexShaderNormal;
 }
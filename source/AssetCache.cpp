@@ -0,0 +1,248 @@
+//----------------------------------------------------------------------------------------
+/**
+ * \file       AssetCache.cpp
+ * \author     Bogdan Putintsev
+ * \date       2021/05/13
+ * \brief      Reference-counted cache of device meshes and textures keyed by content
+ *
+*/
+//----------------------------------------------------------------------------------------
+
+#include "AssetCache.h"
+
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+
+AssetCache::Reference::Reference(Reference&& other) noexcept
+  : cache(other.cache), device(other.device), handle(other.handle), texture(other.texture)
+{
+  other.handle = 0;
+}
+
+AssetCache::Reference& AssetCache::Reference::operator=(Reference&& other) noexcept
+{
+  if (this != &other)
+  {
+    reset();
+    cache = other.cache;
+    device = other.device;
+    handle = other.handle;
+    texture = other.texture;
+    other.handle = 0;
+  }
+  return *this;
+}
+
+void AssetCache::Reference::reset()
+{
+  if (handle != 0)
+    cache->release(*device, handle, texture);
+  handle = 0;
+}
+
+size_t AssetCache::Reference::getBytes() const
+{
+  const Asset* asset = handle != 0 ? cache->find(texture ? cache->textures : cache->meshes, handle) : nullptr;
+  return asset != nullptr ? asset->bytes : 0;
+}
+
+int AssetCache::Reference::getReferences() const
+{
+  const Asset* asset = handle != 0 ? cache->find(texture ? cache->textures : cache->meshes, handle) : nullptr;
+  return asset != nullptr ? asset->references : 0;
+}
+
+AssetCache::Reference AssetCache::acquireMesh(RenderDevice& device, const std::vector<float>& vertices, const std::vector<uint32_t>& indices, const std::string& name)
+{
+  /// The index hash is folded into the vertex one, the same vertices drawn in another order are another mesh
+  Key key;
+  key.hash = hashBytes(vertices.data(), vertices.size() * sizeof(float)) ^ (hashBytes(indices.data(), indices.size() * sizeof(uint32_t)) * 31);
+  key.bytes = vertices.size() * sizeof(float) + indices.size() * sizeof(uint32_t);
+
+  RenderDevice::Handle mesh = acquire(meshes, key);
+  if (mesh == 0)
+  {
+    mesh = device.createMesh(vertices, indices, name);
+    insert(meshes, key, mesh, key.bytes);
+    stats.meshes++;
+  }
+
+  return makeReference(device, mesh, false);
+}
+
+AssetCache::Reference AssetCache::acquireTexture(RenderDevice& device, const std::string& path)
+{
+  std::string canonical = canonicalPath(path);
+  auto known = pathKeys.find(canonical);
+
+  RenderDevice::Handle texture = known != pathKeys.end() ? acquire(textures, known->second) : 0;
+  if (texture != 0)
+    return makeReference(device, texture, true);
+
+  /// The bytes that are hashed are the ones decoded, the file is read once
+  std::ifstream file(path, std::ios::binary);
+  std::vector<unsigned char> content((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+  Key key;
+  key.hash = hashBytes(content.data(), content.size());
+  key.bytes = content.size();
+  pathKeys[canonical] = key;
+
+  /// Another path may hold the same content
+  texture = acquire(textures, key);
+  if (texture == 0)
+  {
+    texture = device.createTexture(path, content);
+    if (texture == 0)
+      return Reference();
+
+    insert(textures, key, texture, device.getTextureBytes(texture));
+    stats.textures++;
+  }
+
+  return makeReference(device, texture, true);
+}
+
+void AssetCache::printStats() const
+{
+  std::cout << "Assets: " << stats.meshes << " meshes, " << stats.textures << " textures, "
+            << stats.uniqueBytes / 1048576.0 << " MB allocated, " << stats.savedBytes / 1048576.0 << " MB saved by sharing, "
+            << stats.hits << " hits, " << stats.misses << " misses" << std::endl;
+}
+
+std::string AssetCache::canonicalPath(const std::string& path)
+{
+  std::vector<std::string> segments;
+  std::string segment;
+  std::istringstream stream(path);
+
+  while (std::getline(stream, segment, '/'))
+  {
+    std::istringstream inner(segment);
+    std::string part;
+    while (std::getline(inner, part, '\\'))
+    {
+      if (part.empty() || part == ".")
+        continue;
+      if (part == ".." && !segments.empty() && segments.back() != "..")
+        segments.pop_back();
+      else
+        segments.push_back(part);
+    }
+  }
+
+  std::string result = (!path.empty() && (path[0] == '/' || path[0] == '\\')) ? "/" : "";
+  for (size_t i = 0; i < segments.size(); i++)
+    result += (i > 0 ? "/" : "") + segments[i];
+
+#ifdef _WIN32
+  std::transform(result.begin(), result.end(), result.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+#endif
+
+  return result;
+}
+
+AssetCache::Reference AssetCache::makeReference(RenderDevice& device, RenderDevice::Handle handle, bool texture)
+{
+  Reference reference;
+  reference.cache = this;
+  reference.device = &device;
+  reference.handle = handle;
+  reference.texture = texture;
+  return reference;
+}
+
+void AssetCache::release(RenderDevice& device, RenderDevice::Handle handle, bool texture)
+{
+  if (texture && release(textures, handle))
+  {
+    device.destroyTexture(handle);
+    stats.textures--;
+  }
+  else if (!texture && release(meshes, handle))
+  {
+    device.destroyMesh(handle);
+    stats.meshes--;
+  }
+}
+
+RenderDevice::Handle AssetCache::acquire(Table& table, const Key& key)
+{
+  auto found = table.assets.find(key);
+  if (found == table.assets.end())
+    return 0;
+
+  Asset& asset = found->second;
+  asset.references++;
+
+  stats.hits++;
+  stats.referencedBytes += asset.bytes;
+  stats.savedBytes = stats.referencedBytes - stats.uniqueBytes;
+  return asset.handle;
+}
+
+void AssetCache::insert(Table& table, const Key& key, RenderDevice::Handle handle, size_t bytes)
+{
+  Asset& asset = table.assets[key];
+  asset.handle = handle;
+  asset.bytes = bytes;
+  asset.references = 1;
+  table.keys[handle] = key;
+
+  stats.misses++;
+  stats.uniqueBytes += bytes;
+  stats.referencedBytes += bytes;
+  stats.savedBytes = stats.referencedBytes - stats.uniqueBytes;
+}
+
+/// Drop one reference, returns true when the handle has to be destroyed
+bool AssetCache::release(Table& table, RenderDevice::Handle handle)
+{
+  auto key = table.keys.find(handle);
+  if (key == table.keys.end())
+    return false;
+
+  auto found = table.assets.find(key->second);
+  Asset& asset = found->second;
+  asset.references--;
+  stats.referencedBytes -= asset.bytes;
+
+  bool destroy = asset.references == 0;
+  if (destroy)
+  {
+    stats.uniqueBytes -= asset.bytes;
+    table.assets.erase(found);
+    table.keys.erase(key);
+  }
+
+  stats.savedBytes = stats.referencedBytes - stats.uniqueBytes;
+  return destroy;
+}
+
+const AssetCache::Asset* AssetCache::find(const Table& table, RenderDevice::Handle handle) const
+{
+  auto key = table.keys.find(handle);
+  if (key == table.keys.end())
+    return nullptr;
+
+  return &table.assets.at(key->second);
+}
+
+/// 64-bit FNV-1a
+uint64_t AssetCache::hashBytes(const void* data, size_t size)
+{
+  const unsigned char* bytes = (const unsigned char*)data;
+  uint64_t hash = 14695981039346656037ull;
+
+  for (size_t i = 0; i < size; i++)
+  {
+    hash ^= bytes[i];
+    hash *= 1099511628211ull;
+  }
+
+  return hash;
+}
@@ -0,0 +1,127 @@
+//----------------------------------------------------------------------------------------
+/**
+ * \file       AssetCache.h
+ * \author     Bogdan Putintsev
+ * \date       2021/05/13
+ * \brief      Reference-counted cache of device meshes and textures keyed by content
+ *
+ *  Every asset is identified by a 64-bit FNV-1a hash of its content and the size of it: the
+ *  file bytes of a texture, which are read once and handed to the device to decode, the
+ *  vertex and index data of a mesh. A hit needs both to match. A canonical path remembers
+ *  the key of a texture, so a texture that is still alive is shared without reading its
+ *  file again. Objects asking for the same content share one
+ *  handle, which is destroyed when the last Reference to it goes away. References call into
+ *  the device, so they have to be released while the device is alive.
+ *
+*/
+//----------------------------------------------------------------------------------------
+
+#pragma once
+#include "RenderDevice.h"
+
+#include <cstdint>
+#include <unordered_map>
+
+class AssetCache
+{
+public:
+  /// Totals over all live assets
+  struct Stats
+  {
+    size_t uniqueBytes = 0;                     ///< Memory actually allocated on the device
+    size_t referencedBytes = 0;                 ///< Memory without sharing, every reference counted
+    size_t savedBytes = 0;                      ///< referencedBytes - uniqueBytes
+    int meshes = 0;
+    int textures = 0;
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+  };
+
+  /// Owning reference to a cached mesh or texture, move-only, releases the asset when destroyed
+  class Reference
+  {
+  public:
+    Reference() {}
+    Reference(Reference&& other) noexcept;
+    Reference& operator=(Reference&& other) noexcept;
+    Reference(const Reference&) = delete;
+    Reference& operator=(const Reference&) = delete;
+    ~Reference() { reset(); }
+
+    void reset();
+
+    RenderDevice::Handle get() const { return handle; }
+    explicit operator bool() const { return handle != 0; }
+
+    /// Device memory of the asset and how many references share it
+    size_t getBytes() const;
+    int getReferences() const;
+
+  private:
+    friend class AssetCache;
+
+    AssetCache* cache = nullptr;
+    RenderDevice* device = nullptr;
+    RenderDevice::Handle handle = 0;
+    bool texture = false;
+  };
+
+  Reference acquireMesh(RenderDevice& device, const std::vector<float>& vertices, const std::vector<uint32_t>& indices, const std::string& name);
+  Reference acquireMesh(RenderDevice& device, const std::vector<float>& vertices, const std::string& name)
+  {
+    return acquireMesh(device, vertices, std::vector<uint32_t>(), name);
+  }
+  Reference acquireTexture(RenderDevice& device, const std::string& path);
+
+  const Stats& getStats() const { return stats; }
+  void printStats() const;
+
+  /// Forward slashes, no "." or ".." segments, lower case on Windows
+  static std::string canonicalPath(const std::string& path);
+
+private:
+  /// One shared device resource
+  struct Asset
+  {
+    RenderDevice::Handle handle = 0;
+    size_t bytes = 0;
+    int references = 0;
+  };
+
+  /// Hash and size of the content, an asset is shared only when both match
+  struct Key
+  {
+    uint64_t hash = 0;
+    size_t bytes = 0;
+
+    bool operator==(const Key& other) const { return hash == other.hash && bytes == other.bytes; }
+  };
+
+  struct KeyHash
+  {
+    size_t operator()(const Key& key) const { return (size_t)(key.hash ^ (key.bytes * 0x9e3779b97f4a7c15ull)); }
+  };
+
+  /// Assets by content key and the key of each live handle
+  struct Table
+  {
+    std::unordered_map<Key, Asset, KeyHash> assets;
+    std::unordered_map<RenderDevice::Handle, Key> keys;
+  };
+
+  Table meshes;
+  Table textures;
+  std::unordered_map<std::string, Key> pathKeys;
+  Stats stats;
+
+  Reference makeReference(RenderDevice& device, RenderDevice::Handle handle, bool texture);
+  void release(RenderDevice& device, RenderDevice::Handle handle, bool texture);
+
+  /// Another reference to the asset with this content, 0 when there is none
+  RenderDevice::Handle acquire(Table& table, const Key& key);
+  void insert(Table& table, const Key& key, RenderDevice::Handle handle, size_t bytes);
+  bool release(Table& table, RenderDevice::Handle handle);
+  const Asset* find(const Table& table, RenderDevice::Handle handle) const;
+
+  static uint64_t hashBytes(const void* data, size_t size);
+};
@@ -0,0 +1,406 @@
+//----------------------------------------------------------------------------------------
+/**
+ * \file       Atmosphere.cpp
+ * \author     Bogdan Putintsev
+ * \date       2021/05/13
+ * \brief      Physically based sky from lookup tables precomputed on the CPU
+ *
+*/
+//----------------------------------------------------------------------------------------
+
+#include "Atmosphere.h"
+#include "Constants.h"
+#include "Profiler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+
+namespace
+{
+  const float PI = 3.14159265f;
+  const int TRANSMITTANCE_STEPS = 40;
+  const int MULTIPLE_SCATTERING_STEPS = 20;
+  const int SKY_STEPS = 40;                     ///< Spaced quadratically, short near the observer
+
+  /// Distance from radius r along zenith cosine mu to a sphere around the planet center, negative when it is missed
+  float distanceToSphere(float r, float mu, float radius, bool nearHit)
+  {
+    float discriminant = r * r * (mu * mu - 1.0f) + radius * radius;
+    if (discriminant < 0.0f)
+      return -1.0f;
+    float root = std::sqrt(discriminant);
+    return nearHit ? -r * mu - root : -r * mu + root;
+  }
+
+  bool hitsGround(float r, float mu, float groundRadius)
+  {
+    return mu < 0.0f && r * r * (mu * mu - 1.0f) + groundRadius * groundRadius >= 0.0f;
+  }
+
+  float rayleighPhase(float nu)
+  {
+    return 3.0f / (16.0f * PI) * (1.0f + nu * nu);
+  }
+
+  glm::vec3 divide(const glm::vec3& a, const glm::vec3& b)
+  {
+    return glm::vec3(b.x > 0.0f ? a.x / b.x : 0.0f, b.y > 0.0f ? a.y / b.y : 0.0f, b.z > 0.0f ? a.z / b.z : 0.0f);
+  }
+
+  /// Light scattered over a step of constant medium, integrated against its own transmittance
+  glm::vec3 stepIntegral(const glm::vec3& extinction, const glm::vec3& stepTransmittance, float length)
+  {
+    glm::vec3 result = divide(glm::vec3(1.0f) - stepTransmittance, extinction);
+    if (extinction.x <= 0.0f) result.x = length;
+    if (extinction.y <= 0.0f) result.y = length;
+    if (extinction.z <= 0.0f) result.z = length;
+    return result;
+  }
+
+  /// Bilinear read of a table at texel coordinates, texel centers at whole numbers
+  glm::vec3 bilinear(const std::vector<glm::vec3>& table, int width, int height, float x, float y)
+  {
+    x = std::min(std::max(x, 0.0f), (float)(width - 1));
+    y = std::min(std::max(y, 0.0f), (float)(height - 1));
+    int x0 = std::min((int)x, width - 2), y0 = std::min((int)y, height - 2);
+    float fx = x - x0, fy = y - y0;
+
+    const glm::vec3* row0 = &table[(size_t)y0 * width + x0];
+    const glm::vec3* row1 = row0 + width;
+    return (row0[0] * (1.0f - fx) + row0[1] * fx) * (1.0f - fy) + (row1[0] * (1.0f - fx) + row1[1] * fx) * fy;
+  }
+}
+
+bool Atmosphere::Params::operator==(const Params& other) const
+{
+  return groundRadius == other.groundRadius && topRadius == other.topRadius && observerAltitude == other.observerAltitude &&
+         rayleighScattering == other.rayleighScattering && rayleighHeight == other.rayleighHeight && mieScattering == other.mieScattering &&
+         mieAbsorption == other.mieAbsorption && mieHeight == other.mieHeight && mieG == other.mieG && ozoneAbsorption == other.ozoneAbsorption &&
+         ozoneCenter == other.ozoneCenter && ozoneHalfWidth == other.ozoneHalfWidth && groundAlbedo == other.groundAlbedo;
+}
+
+Atmosphere::Atmosphere(JobSystem& jobs)
+  : jobs(jobs)
+{
+}
+
+void Atmosphere::init(RenderDevice& renderDevice)
+{
+  device = &renderDevice;
+  transmittanceTexture = device->createDataTexture(TRANSMITTANCE_WIDTH, TRANSMITTANCE_HEIGHT);
+  skyRayleighTexture = device->createDataTexture(SKY_VIEW_SAMPLES * SKY_AZIMUTH_SAMPLES, SKY_SUN_SAMPLES);
+  skyMieTexture = device->createDataTexture(SKY_VIEW_SAMPLES * SKY_AZIMUTH_SAMPLES, SKY_SUN_SAMPLES);
+  stats.tableBytes = device->getTextureBytes(transmittanceTexture) + device->getTextureBytes(skyRayleighTexture) + device->getTextureBytes(skyMieTexture);
+
+  update();
+}
+
+void Atmosphere::release()
+{
+  if (device == nullptr)
+    return;
+
+  device->destroyTexture(transmittanceTexture);
+  device->destroyTexture(skyRayleighTexture);
+  device->destroyTexture(skyMieTexture);
+  transmittanceTexture = skyRayleighTexture = skyMieTexture = 0;
+  device = nullptr;
+  uploaded = false;
+}
+
+void Atmosphere::setParams(const Params& atmosphere)
+{
+  if (atmosphere == params)
+    return;
+
+  params = atmosphere;
+  dirty = true;
+}
+
+bool Atmosphere::update()
+{
+  if (!dirty)
+    return false;
+
+  PROFILE_CPU_SCOPE("Atmosphere::update");
+  uint64_t start = Profiler::nowNs();
+
+  /// Every table reads the ones before it
+  transmittance.resize((size_t)TRANSMITTANCE_WIDTH * TRANSMITTANCE_HEIGHT);
+  jobs.parallelFor(TRANSMITTANCE_HEIGHT, 1, [this](unsigned int begin, unsigned int end) {
+    for (unsigned int row = begin; row < end; row++)
+      buildTransmittance((int)row);
+  });
+  uint64_t transmittanceEnd = Profiler::nowNs();
+
+  multipleScattering.resize((size_t)MULTIPLE_SCATTERING_SIZE * MULTIPLE_SCATTERING_SIZE);
+  jobs.parallelFor(MULTIPLE_SCATTERING_SIZE, 1, [this](unsigned int begin, unsigned int end) {
+    for (unsigned int row = begin; row < end; row++)
+      buildMultipleScattering((int)row);
+  });
+  uint64_t multipleScatteringEnd = Profiler::nowNs();
+
+  skyRayleigh.resize((size_t)SKY_VIEW_SAMPLES * SKY_AZIMUTH_SAMPLES * SKY_SUN_SAMPLES);
+  skyMie.resize(skyRayleigh.size());
+  jobs.parallelFor(SKY_SUN_SAMPLES, 1, [this](unsigned int begin, unsigned int end) {
+    for (unsigned int row = begin; row < end; row++)
+      buildSky((int)row);
+  });
+  uint64_t end = Profiler::nowNs();
+
+  stats.builds++;
+  stats.transmittanceMs = (transmittanceEnd - start) / 1e6;
+  stats.multipleScatteringMs = (multipleScatteringEnd - transmittanceEnd) / 1e6;
+  stats.skyMs = (end - multipleScatteringEnd) / 1e6;
+  stats.buildMs = (end - start) / 1e6;
+  Profiler::counter("atmosphere build ms", stats.buildMs);
+
+  dirty = false;
+  uploaded = false;
+  return true;
+}
+
+void Atmosphere::draw(RenderDevice& renderDevice)
+{
+  if (!uploaded)
+  {
+    upload(renderDevice, transmittanceTexture, transmittance);
+    upload(renderDevice, skyRayleighTexture, skyRayleigh);
+    upload(renderDevice, skyMieTexture, skyMie);
+    uploaded = true;
+  }
+
+  RenderDevice::AtmosphereParams atmosphere;
+  atmosphere.transmittance = transmittanceTexture;
+  atmosphere.skyRayleigh = skyRayleighTexture;
+  atmosphere.skyMie = skyMieTexture;
+  atmosphere.skySamples = glm::vec3((float)SKY_VIEW_SAMPLES, (float)SKY_SUN_SAMPLES, (float)SKY_AZIMUTH_SAMPLES);
+  atmosphere.groundRadius = params.groundRadius;
+  atmosphere.topRadius = params.topRadius;
+  atmosphere.observerRadius = params.groundRadius + params.observerAltitude;
+  atmosphere.mieG = params.mieG;
+  atmosphere.exposure = skyExposure;
+  renderDevice.setAtmosphere(atmosphere);
+}
+
+void Atmosphere::upload(RenderDevice& device, RenderDevice::Handle texture, const std::vector<glm::vec3>& texels)
+{
+  std::vector<float> rgba(texels.size() * 4);
+  for (size_t i = 0; i < texels.size(); i++)
+  {
+    rgba[i * 4 + 0] = texels[i].x;
+    rgba[i * 4 + 1] = texels[i].y;
+    rgba[i * 4 + 2] = texels[i].z;
+    rgba[i * 4 + 3] = 1.0f;
+  }
+  device.updateDataTexture(texture, rgba.data());
+}
+
+float Atmosphere::elevationToUnit(float elevation)
+{
+  float side = elevation < 0.0f ? -1.0f : 1.0f;
+  return 0.5f + 0.5f * side * std::sqrt(std::min(std::abs(elevation) / (0.5f * PI), 1.0f));
+}
+
+float Atmosphere::unitToElevation(float unit)
+{
+  float signedUnit = 2.0f * unit - 1.0f;
+  return (signedUnit < 0.0f ? -1.0f : 1.0f) * signedUnit * signedUnit * 0.5f * PI;
+}
+
+Atmosphere::Medium Atmosphere::sampleMedium(float altitude) const
+{
+  altitude = std::max(altitude, 0.0f);
+  float rayleighDensity = std::exp(-altitude / params.rayleighHeight);
+  float mieDensity = std::exp(-altitude / params.mieHeight);
+  float ozoneDensity = std::max(0.0f, 1.0f - std::abs(altitude - params.ozoneCenter) / params.ozoneHalfWidth);
+
+  Medium medium;
+  medium.rayleigh = params.rayleighScattering * rayleighDensity;
+  medium.mie = glm::vec3(params.mieScattering * mieDensity);
+  medium.extinction = medium.rayleigh + glm::vec3((params.mieScattering + params.mieAbsorption) * mieDensity) + params.ozoneAbsorption * ozoneDensity;
+  return medium;
+}
+
+/// Bruneton's parameterization: the distance to the top relative to its range at the altitude
+/// along x, the distance to the horizon along y, both with texel centers at the ends
+glm::vec3 Atmosphere::lookupTransmittance(float r, float mu) const
+{
+  float horizon = std::sqrt(params.topRadius * params.topRadius - params.groundRadius * params.groundRadius);
+  float rho = std::sqrt(std::max(r * r - params.groundRadius * params.groundRadius, 0.0f));
+  float distance = std::max(distanceToSphere(r, mu, params.topRadius, false), 0.0f);
+  float minDistance = params.topRadius - r;
+  float maxDistance = rho + horizon;
+
+  float x = (distance - minDistance) / std::max(maxDistance - minDistance, 1e-6f);
+  float y = rho / horizon;
+  return bilinear(transmittance, TRANSMITTANCE_WIDTH, TRANSMITTANCE_HEIGHT, x * (TRANSMITTANCE_WIDTH - 1), y * (TRANSMITTANCE_HEIGHT - 1));
+}
+
+glm::vec3 Atmosphere::sunTransmittance(float r, float mu) const
+{
+  if (hitsGround(r, mu, params.groundRadius))
+    return glm::vec3(0.0f);
+  return lookupTransmittance(r, mu);
+}
+
+glm::vec3 Atmosphere::lookupMultipleScattering(float r, float muSun) const
+{
+  float x = (muSun * 0.5f + 0.5f) * (MULTIPLE_SCATTERING_SIZE - 1);
+  float y = (r - params.groundRadius) / (params.topRadius - params.groundRadius) * (MULTIPLE_SCATTERING_SIZE - 1);
+  return bilinear(multipleScattering, MULTIPLE_SCATTERING_SIZE, MULTIPLE_SCATTERING_SIZE, x, y);
+}
+
+void Atmosphere::buildTransmittance(int row)
+{
+  float horizon = std::sqrt(params.topRadius * params.topRadius - params.groundRadius * params.groundRadius);
+  float rho = horizon * row / (TRANSMITTANCE_HEIGHT - 1);
+  float r = std::sqrt(rho * rho + params.groundRadius * params.groundRadius);
+
+  for (int column = 0; column < TRANSMITTANCE_WIDTH; column++)
+  {
+    float minDistance = params.topRadius - r;
+    float maxDistance = rho + horizon;
+    float distance = minDistance + (maxDistance - minDistance) * column / (TRANSMITTANCE_WIDTH - 1);
+    float mu = distance <= 0.0f ? 1.0f : (horizon * horizon - rho * rho - distance * distance) / (2.0f * r * distance);
+    mu = std::min(std::max(mu, -1.0f), 1.0f);
+
+    /// Midpoint rule on the optical depth
+    float length = std::max(distanceToSphere(r, mu, params.topRadius, false), 0.0f);
+    float step = length / TRANSMITTANCE_STEPS;
+    glm::vec3 opticalDepth(0.0f);
+    for (int i = 0; i < TRANSMITTANCE_STEPS; i++)
+    {
+      float t = (i + 0.5f) * step;
+      float altitude = std::sqrt(r * r + t * t + 2.0f * r * mu * t) - params.groundRadius;
+      opticalDepth = opticalDepth + sampleMedium(altitude).extinction * step;
+    }
+
+    transmittance[(size_t)row * TRANSMITTANCE_WIDTH + column] = glm::exp(-opticalDepth);
+  }
+}
+
+/// Second order light arriving from every direction with an isotropic phase, and the share
+/// fMs of light scattered once more: all orders are the geometric series L2 / (1 - fMs)
+void Atmosphere::buildMultipleScattering(int row)
+{
+  float r = params.groundRadius + (params.topRadius - params.groundRadius) * std::max(row / (float)(MULTIPLE_SCATTERING_SIZE - 1), 1e-4f);
+  const float isotropicPhase = 1.0f / (4.0f * PI);
+  const int side = (int)std::sqrt((float)MULTIPLE_SCATTERING_DIRECTIONS);
+
+  for (int column = 0; column < MULTIPLE_SCATTERING_SIZE; column++)
+  {
+    float muSun = -1.0f + 2.0f * column / (MULTIPLE_SCATTERING_SIZE - 1);
+    glm::vec3 sun(std::sqrt(std::max(1.0f - muSun * muSun, 0.0f)), muSun, 0.0f);
+    glm::vec3 secondOrder(0.0f), scatteredShare(0.0f);
+
+    for (int direction = 0; direction < side * side; direction++)
+    {
+      /// Stratified uniform directions on the sphere
+      float cosTheta = 1.0f - 2.0f * ((direction / side) + 0.5f) / side;
+      float phi = 2.0f * PI * ((direction % side) + 0.5f) / side;
+      float sinTheta = std::sqrt(std::max(1.0f - cosTheta * cosTheta, 0.0f));
+      glm::vec3 ray(sinTheta * std::cos(phi), cosTheta, sinTheta * std::sin(phi));
+
+      bool ground = hitsGround(r, cosTheta, params.groundRadius);
+      float length = ground ? distanceToSphere(r, cosTheta, params.groundRadius, true) : distanceToSphere(r, cosTheta, params.topRadius, false);
+      float step = std::max(length, 0.0f) / MULTIPLE_SCATTERING_STEPS;
+
+      glm::vec3 throughput(1.0f), light(0.0f), share(0.0f);
+      for (int i = 0; i < MULTIPLE_SCATTERING_STEPS; i++)
+      {
+        glm::vec3 position = glm::vec3(0.0f, r, 0.0f) + ray * ((i + 0.5f) * step);
+        float height = glm::length(position);
+        Medium medium = sampleMedium(height - params.groundRadius);
+        glm::vec3 scattering = medium.rayleigh + medium.mie;
+        glm::vec3 stepTransmittance = glm::exp(-medium.extinction * step);
+        glm::vec3 integral = stepIntegral(medium.extinction, stepTransmittance, step);
+
+        glm::vec3 sunLight = sunTransmittance(height, glm::dot(position, sun) / height);
+        light = light + throughput * scattering * sunLight * integral * isotropicPhase;
+        share = share + throughput * scattering * integral;
+        throughput = throughput * stepTransmittance;
+      }
+
+      /// Lambertian ground lit by the sun
+      if (ground)
+      {
+        glm::vec3 position = glm::vec3(0.0f, r, 0.0f) + ray * length;
+        glm::vec3 normal = glm::normalize(position);
+        float cosSun = glm::dot(normal, sun);
+        light = light + throughput * lookupTransmittance(params.groundRadius, cosSun) * (std::max(cosSun, 0.0f) * params.groundAlbedo / PI);
+      }
+
+      secondOrder = secondOrder + light;
+      scatteredShare = scatteredShare + share * isotropicPhase;
+    }
+
+    /// Uniform sphere: solid angle 4 pi per sample count, the phase 1 / 4 pi of the next bounce
+    secondOrder = secondOrder / (float)(side * side);
+    scatteredShare = scatteredShare * (4.0f * PI / (side * side));
+    multipleScattering[(size_t)row * MULTIPLE_SCATTERING_SIZE + column] = divide(secondOrder, glm::vec3(1.0f) - scatteredShare);
+  }
+}
+
+void Atmosphere::buildSky(int row)
+{
+  float sunElevation = unitToElevation(row / (float)(SKY_SUN_SAMPLES - 1));
+  glm::vec3 sun(std::cos(sunElevation), std::sin(sunElevation), 0.0f);
+  float r0 = params.groundRadius + params.observerAltitude;
+
+  for (int slice = 0; slice < SKY_AZIMUTH_SAMPLES; slice++)
+  {
+    float azimuth = PI * slice / (SKY_AZIMUTH_SAMPLES - 1);
+
+    for (int column = 0; column < SKY_VIEW_SAMPLES; column++)
+    {
+      float viewElevation = unitToElevation(column / (float)(SKY_VIEW_SAMPLES - 1));
+      glm::vec3 view(std::cos(viewElevation) * std::cos(azimuth), std::sin(viewElevation), std::cos(viewElevation) * std::sin(azimuth));
+      float mu = view.y;
+
+      bool ground = hitsGround(r0, mu, params.groundRadius);
+      float length = ground ? distanceToSphere(r0, mu, params.groundRadius, true) : distanceToSphere(r0, mu, params.topRadius, false);
+      length = std::max(length, 0.0f);
+
+      glm::vec3 throughput(1.0f), rayleigh(0.0f), mie(0.0f), multiple(0.0f);
+      float previous = 0.0f;
+      for (int i = 0; i < SKY_STEPS; i++)
+      {
+        float next = length * ((i + 1.0f) / SKY_STEPS) * ((i + 1.0f) / SKY_STEPS);
+        float step = next - previous;
+        glm::vec3 position = glm::vec3(0.0f, r0, 0.0f) + view * (0.5f * (previous + next));
+        previous = next;
+
+        float height = glm::length(position);
+        float muSun = glm::dot(position, sun) / height;
+        Medium medium = sampleMedium(height - params.groundRadius);
+        glm::vec3 stepTransmittance = glm::exp(-medium.extinction * step);
+        glm::vec3 integral = throughput * stepIntegral(medium.extinction, stepTransmittance, step);
+
+        glm::vec3 sunLight = sunTransmittance(height, muSun);
+        rayleigh = rayleigh + medium.rayleigh * sunLight * integral;
+        mie = mie + medium.mie * sunLight * integral;
+        multiple = multiple + (medium.rayleigh + medium.mie) * lookupMultipleScattering(height, muSun) * integral;
+        throughput = throughput * stepTransmittance;
+      }
+
+      size_t index = (size_t)row * SKY_VIEW_SAMPLES * SKY_AZIMUTH_SAMPLES + (size_t)slice * SKY_VIEW_SAMPLES + column;
+      skyRayleigh[index] = rayleigh * rayleighPhase(glm::dot(view, sun)) + multiple;
+      skyMie[index] = mie;
+    }
+  }
+}
+
+void Atmosphere::printStats(double skyGpuMs) const
+{
+  std::cout << std::fixed << std::setprecision(2) << "Atmosphere: tables built " << stats.builds << " times, last in " << stats.buildMs
+            << " ms on " << jobs.getThreadCount() << " threads (transmittance " << stats.transmittanceMs << " ms, multiple scattering "
+            << stats.multipleScatteringMs << " ms, sky " << stats.skyMs << " ms), " << stats.tableBytes / 1024 << " KB, sky ";
+  if (skyGpuMs >= 0.0)
+    std::cout << skyGpuMs << " ms GPU per frame";
+  else
+    std::cout << "GPU time not measured yet";
+  std::cout << std::defaultfloat << std::endl;
+}
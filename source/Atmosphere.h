@@ -0,0 +1,127 @@
+//----------------------------------------------------------------------------------------
+/**
+ * \file       Atmosphere.h
+ * \author     Bogdan Putintsev
+ * \date       2021/05/13
+ * \brief      Physically based sky from lookup tables precomputed on the CPU
+ *
+ *  Rayleigh and Mie scattering and ozone absorption of an Earth-like atmosphere are
+ *  precomputed into three tables on the job system, following Hillaire's 2020 sky model:
+ *  the transmittance to the top of the atmosphere by altitude and zenith angle, the
+ *  isotropic multiple scattering by altitude and sun zenith angle summed over all orders
+ *  as a geometric series of the second order, and the light scattered towards an observer
+ *  near the ground by view elevation, sun elevation and their azimuth difference. The sky
+ *  shader then reads the last table twice for each of Rayleigh and Mie, applies the sharp
+ *  Mie phase function per pixel and adds the sun disk through the transmittance table.
+ *  The tables only depend on the atmosphere, the sun moving across the sky changes only
+ *  where they are read, so they are rebuilt only when the parameters change.
+ *
+*/
+//----------------------------------------------------------------------------------------
+
+#pragma once
+#include "RenderDevice.h"
+#include "JobSystem.h"
+
+class Atmosphere
+{
+public:
+  static const int TRANSMITTANCE_WIDTH = 256;   ///< Zenith angle samples
+  static const int TRANSMITTANCE_HEIGHT = 64;   ///< Altitude samples
+  static const int MULTIPLE_SCATTERING_SIZE = 32;
+  static const int MULTIPLE_SCATTERING_DIRECTIONS = 64;
+  static const int SKY_VIEW_SAMPLES = 64;       ///< View elevations, denser near the horizon
+  static const int SKY_SUN_SAMPLES = 32;        ///< Sun elevations, denser near the horizon
+  static const int SKY_AZIMUTH_SAMPLES = 32;    ///< Azimuth differences from 0 to pi, slices of the sky tables
+
+  /// Lengths in km, coefficients per km
+  struct Params
+  {
+    float groundRadius = 6360.0f;
+    float topRadius = 6460.0f;
+    float observerAltitude = 0.2f;              ///< The sky is seen from one altitude, the camera height is negligible
+    glm::vec3 rayleighScattering = glm::vec3(5.802e-3f, 13.558e-3f, 33.1e-3f);
+    float rayleighHeight = 8.0f;                ///< Scale height of the exponential density
+    float mieScattering = 3.996e-3f;
+    float mieAbsorption = 4.4e-4f;
+    float mieHeight = 1.2f;
+    float mieG = 0.8f;                          ///< Asymmetry of the Cornette-Shanks phase function
+    glm::vec3 ozoneAbsorption = glm::vec3(0.650e-3f, 1.881e-3f, 0.085e-3f);
+    float ozoneCenter = 25.0f;                  ///< Tent-shaped ozone layer
+    float ozoneHalfWidth = 15.0f;
+    float groundAlbedo = 0.3f;
+
+    bool operator==(const Params& other) const;
+    bool operator!=(const Params& other) const { return !(*this == other); }
+  };
+
+  struct Stats
+  {
+    int builds = 0;
+    double transmittanceMs = 0.0;               ///< Of the last build
+    double multipleScatteringMs = 0.0;
+    double skyMs = 0.0;
+    double buildMs = 0.0;
+    size_t tableBytes = 0;                      ///< Device memory of the tables
+  };
+
+  /// The tables are built on the job system of the frame
+  explicit Atmosphere(JobSystem& jobs);
+
+  /// Build the tables and create their device textures
+  void init(RenderDevice& device);
+  void release();
+
+  /// Tables are rebuilt by the next update
+  void setParams(const Params& atmosphere);
+  const Params& getParams() const { return params; }
+  /// Rebuild the tables when the parameters changed, true when they were
+  bool update();
+  /// Upload rebuilt tables and bind them for SHADER_SKYBOX draws
+  void draw(RenderDevice& device);
+
+  const Stats& getStats() const { return stats; }
+  /// Build times of the tables and the GPU time of the sky, skyGpuMs negative when not measured
+  void printStats(double skyGpuMs) const;
+
+  /// [0, 1] of an elevation in [-pi/2, pi/2], half the range within 25 degrees of the horizon
+  static float elevationToUnit(float elevation);
+  static float unitToElevation(float unit);
+
+private:
+  Params params;
+  bool dirty = true;
+  bool uploaded = false;                        ///< The device textures hold the last build
+  JobSystem& jobs;
+  Stats stats;
+
+  std::vector<glm::vec3> transmittance;         ///< TRANSMITTANCE_WIDTH x TRANSMITTANCE_HEIGHT
+  std::vector<glm::vec3> multipleScattering;    ///< MULTIPLE_SCATTERING_SIZE squared, sun zenith by altitude
+  std::vector<glm::vec3> skyRayleigh;           ///< Rayleigh with its phase and multiple scattering, azimuth slices side by side
+  std::vector<glm::vec3> skyMie;                ///< Mie without its phase, same layout
+
+  RenderDevice* device = nullptr;
+  RenderDevice::Handle transmittanceTexture = 0;
+  RenderDevice::Handle skyRayleighTexture = 0;
+  RenderDevice::Handle skyMieTexture = 0;
+
+  /// Scattering and extinction at an altitude
+  struct Medium
+  {
+    glm::vec3 rayleigh;
+    glm::vec3 mie;
+    glm::vec3 extinction;
+  };
+
+  Medium sampleMedium(float altitude) const;
+  /// Transmittance from radius r along zenith cosine mu to the top, 0 where the ground is in the way
+  glm::vec3 sunTransmittance(float r, float mu) const;
+  glm::vec3 lookupTransmittance(float r, float mu) const;
+  glm::vec3 lookupMultipleScattering(float r, float muSun) const;
+
+  void buildTransmittance(int row);
+  void buildMultipleScattering(int row);
+  void buildSky(int row);
+
+  static void upload(RenderDevice& device, RenderDevice::Handle texture, const std::vector<glm::vec3>& texels);
+};
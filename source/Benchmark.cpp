@@ -0,0 +1,367 @@
+//----------------------------------------------------------------------------------------
+/**
+ * \file       Benchmark.cpp
+ * \author     Bogdan Putintsev
+ * \date       2021/05/13
+ * \brief      Deterministic fly-through render benchmark with golden image comparison
+ *
+*/
+//----------------------------------------------------------------------------------------
+
+#include "Benchmark.h"
+#include "Constants.h"
+#include "GLDebug.h"
+#include "Profiler.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+
+namespace
+{
+  const int GOLDEN_FRAMES[] = { 0, 60, 120, 180, 239 };   ///< Frames compared against golden images
+
+  double percentile(std::vector<double> values, double p)
+  {
+    if (values.empty())
+      return 0.0;
+
+    std::sort(values.begin(), values.end());
+    size_t index = std::min(values.size() - 1, (size_t)(p * (values.size() - 1) + 0.5));
+    return values[index];
+  }
+
+  /// FNV-1a of the pixels, bytes in memory order
+  uint64_t hashPixels(const Image& image, uint64_t hash = 14695981039346656037ull)
+  {
+    const uint8_t* bytes = (const uint8_t*)image.pixels.data();
+    for (size_t i = 0; i < image.pixels.size() * sizeof(uint32_t); i++)
+      hash = (hash ^ bytes[i]) * 1099511628211ull;
+    return hash;
+  }
+}
+
+Benchmark::Benchmark(const std::string& backendName, bool openGL)
+  : backendName(backendName), openGL(openGL)
+{
+}
+
+bool Benchmark::run(Scene& scene, Camera& camera, RenderDevice& device, const PixelReader& readPixels, bool updateGolden)
+{
+  scene.setSeed(SEED);
+  timings.assign(FRAME_COUNT, FrameTiming());
+  frameHashes.clear();
+
+  std::vector<GLuint> queries;
+  if (openGL)
+  {
+    queries.resize(FRAME_COUNT);
+    glGenQueries(FRAME_COUNT, queries.data());
+  }
+
+  camera.startAnimation();
+  bool passed = true;
+
+  for (int frame = 0; frame < FRAME_COUNT; frame++)
+  {
+    if (openGL)
+      glBeginQuery(GL_TIME_ELAPSED, queries[frame]);
+
+    uint64_t start = Profiler::nowNs();
+
+    device.beginFrame();
+    camera.update();
+    camera.draw(device);
+    scene.draw(device, camera.getParams());
+    device.endFrame();
+
+    uint64_t submitted = Profiler::nowNs();
+
+    if (openGL)
+    {
+      glEndQuery(GL_TIME_ELAPSED);
+      glFinish();
+    }
+
+    uint64_t finished = Profiler::nowNs();
+
+    timings[frame].cpuMs = (submitted - start) / 1e6;
+    timings[frame].wallMs = (finished - start) / 1e6;
+    timings[frame].gpuMs = -1.0;
+
+    if (isGoldenFrame(frame))
+    {
+      Image image;
+      readPixels(image);
+      passed = checkGolden(frame, image, updateGolden) && passed;
+    }
+  }
+
+  /// Queries are read only after the run so the readback never stalls a measured frame
+  if (openGL)
+  {
+    for (int frame = 0; frame < FRAME_COUNT; frame++)
+    {
+      GLuint64 elapsed = 0;
+      glGetQueryObjectui64v(queries[frame], GL_QUERY_RESULT, &elapsed);
+      timings[frame].gpuMs = elapsed / 1e6;
+    }
+    glDeleteQueries(FRAME_COUNT, queries.data());
+  }
+
+  return passed;
+}
+
+void Benchmark::runViews(Scene& scene, Camera& camera, RenderDevice& device)
+{
+  scene.setSeed(SEED);
+
+  FrameTiming single = measureViews(scene, camera, device, 1, false);
+  std::cout << "Multi-view (" << backendName << "), median of " << VIEW_FRAMES << " frames:" << std::endl;
+
+  for (int views = 1; views <= RenderDevice::MAX_VIEWS; views++)
+  {
+    FrameTiming shared = views == 1 ? single : measureViews(scene, camera, device, views, false);
+    FrameTiming separate = views == 1 ? single : measureViews(scene, camera, device, views, true);
+
+    std::cout << "  " << views << " views: single pass cpu " << shared.cpuMs << " ms";
+    if (openGL)
+      std::cout << ", gpu " << shared.gpuMs << " ms";
+    std::cout << "; pass per view cpu " << separate.cpuMs << " ms";
+    if (openGL)
+      std::cout << ", gpu " << separate.gpuMs << " ms";
+
+    if (views > 1)
+    {
+      std::cout << "; per extra view cpu " << (shared.cpuMs - single.cpuMs) / (views - 1) << " ms";
+      if (openGL)
+        std::cout << ", gpu " << (shared.gpuMs - single.gpuMs) / (views - 1) << " ms";
+    }
+    std::cout << std::endl;
+  }
+}
+
+void Benchmark::runReplay(const InputRecorder::Log& log, const FrameDrawer& drawFrame, const PixelReader& readPixels)
+{
+  size_t frameCount = log.frames.size();
+  timings.assign(frameCount, FrameTiming());
+  frameHashes.assign(frameCount, 0);
+
+  std::vector<GLuint> queries;
+  if (openGL && frameCount > 0)
+  {
+    queries.resize(frameCount);
+    glGenQueries((GLsizei)frameCount, queries.data());
+  }
+
+  for (size_t frame = 0; frame < frameCount; frame++)
+  {
+    if (openGL)
+      glBeginQuery(GL_TIME_ELAPSED, queries[frame]);
+
+    uint64_t start = Profiler::nowNs();
+    drawFrame(log.frames[frame]);
+    uint64_t submitted = Profiler::nowNs();
+
+    if (openGL)
+    {
+      glEndQuery(GL_TIME_ELAPSED);
+      glFinish();
+    }
+
+    uint64_t finished = Profiler::nowNs();
+
+    timings[frame].cpuMs = (submitted - start) / 1e6;
+    timings[frame].wallMs = (finished - start) / 1e6;
+    timings[frame].gpuMs = -1.0;
+
+    /// The readback stays outside the measured time
+    Image image;
+    readPixels(image);
+    frameHashes[frame] = hashPixels(image);
+  }
+
+  if (openGL && frameCount > 0)
+  {
+    for (size_t frame = 0; frame < frameCount; frame++)
+    {
+      GLuint64 elapsed = 0;
+      glGetQueryObjectui64v(queries[frame], GL_QUERY_RESULT, &elapsed);
+      timings[frame].gpuMs = elapsed / 1e6;
+    }
+    glDeleteQueries((GLsizei)frameCount, queries.data());
+  }
+}
+
+Benchmark::FrameTiming Benchmark::measureViews(Scene& scene, Camera& camera, RenderDevice& device, int viewCount, bool multiPass)
+{
+  GLuint query = 0;
+  if (openGL)
+    glGenQueries(1, &query);
+
+  std::vector<double> cpu, wall, gpu;
+  camera.startAnimation();
+
+  for (int frame = 0; frame < VIEW_FRAMES; frame++)
+  {
+    if (openGL)
+      glBeginQuery(GL_TIME_ELAPSED, query);
+
+    uint64_t start = Profiler::nowNs();
+
+    device.beginFrame();
+    camera.update();
+    std::vector<RenderDevice::ViewParams> views = camera.getMonitorViews(viewCount);
+
+    if (multiPass)
+    {
+      for (const RenderDevice::ViewParams& view : views)
+      {
+        device.setViews(std::vector<RenderDevice::ViewParams>(1, view));
+        scene.draw(device, view.camera);
+      }
+    }
+    else
+    {
+      std::vector<RenderDevice::CameraParams> cameras;
+      for (const RenderDevice::ViewParams& view : views)
+        cameras.push_back(view.camera);
+
+      device.setViews(views);
+      scene.prepare(device, cameras);
+      scene.submit(device, camera.getParams());
+    }
+    device.endFrame();
+
+    uint64_t submitted = Profiler::nowNs();
+
+    if (openGL)
+    {
+      glEndQuery(GL_TIME_ELAPSED);
+      glFinish();
+
+      GLuint64 elapsed = 0;
+      glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+      gpu.push_back(elapsed / 1e6);
+    }
+
+    uint64_t finished = Profiler::nowNs();
+    cpu.push_back((submitted - start) / 1e6);
+    wall.push_back((finished - start) / 1e6);
+  }
+
+  if (openGL)
+    glDeleteQueries(1, &query);
+
+  FrameTiming timing;
+  timing.cpuMs = percentile(cpu, 0.5);
+  timing.wallMs = percentile(wall, 0.5);
+  timing.gpuMs = openGL ? percentile(gpu, 0.5) : -1.0;
+  return timing;
+}
+
+bool Benchmark::isGoldenFrame(int frame)
+{
+  for (int golden : GOLDEN_FRAMES)
+    if (golden == frame)
+      return true;
+  return false;
+}
+
+std::string Benchmark::goldenPath(int frame) const
+{
+  return std::string(benchmarkGoldenDirectory) + backendName + "_" + std::to_string(frame) + ".ppm";
+}
+
+bool Benchmark::checkGolden(int frame, const Image& image, bool updateGolden) const
+{
+  std::string path = goldenPath(frame);
+
+  if (updateGolden)
+  {
+    if (!image.savePPM(path))
+    {
+      std::cout << "Failed to write golden image " << path << std::endl;
+      return false;
+    }
+    std::cout << "Golden image updated: " << path << std::endl;
+    return true;
+  }
+
+  Image golden;
+  if (!golden.loadPPM(path))
+  {
+    std::cout << "Missing golden image " << path << ", run with --update-golden" << std::endl;
+    return false;
+  }
+
+  double mismatch = image.mismatch(golden, CHANNEL_TOLERANCE);
+  bool passed = mismatch * 1000.0 <= MAX_MISMATCH_PERMILLE;
+
+  std::cout << "Frame " << frame << ": " << mismatch * 100.0 << "% pixels differ from golden, " << (passed ? "ok" : "FAILED") << std::endl;
+
+  if (!passed)
+    image.savePPM(std::string(benchmarkFailedDirectory) + backendName + "_" + std::to_string(frame) + ".ppm");
+
+  return passed;
+}
+
+bool Benchmark::writeReport(const std::string& path) const
+{
+  std::ofstream out(path);
+  if (!out)
+    return false;
+
+  bool hashed = frameHashes.size() == timings.size() && !timings.empty();
+
+  out << "frame,cpu_ms,wall_ms,gpu_ms" << (hashed ? ",hash" : "") << std::endl;
+  for (size_t frame = 0; frame < timings.size(); frame++)
+  {
+    out << frame << "," << timings[frame].cpuMs << "," << timings[frame].wallMs << "," << timings[frame].gpuMs;
+    if (hashed)
+      out << "," << std::hex << std::setw(16) << std::setfill('0') << frameHashes[frame] << std::dec << std::setfill(' ');
+    out << std::endl;
+  }
+
+  return true;
+}
+
+void Benchmark::printSummary() const
+{
+  std::vector<double> cpu, wall, gpu;
+  for (const auto& timing : timings)
+  {
+    cpu.push_back(timing.cpuMs);
+    wall.push_back(timing.wallMs);
+    gpu.push_back(timing.gpuMs);
+  }
+
+  double total = 0.0;
+  for (double ms : wall)
+    total += ms;
+  double average = wall.empty() ? 0.0 : total / wall.size();
+
+  std::cout << "Benchmark (" << backendName << "): " << timings.size() << " frames, " << average << " ms/frame, "
+            << (average > 0.0 ? 1000.0 / average : 0.0) << " fps" << std::endl;
+  std::cout << "  cpu  median " << percentile(cpu, 0.5) << " ms, p95 " << percentile(cpu, 0.95) << " ms" << std::endl;
+  std::cout << "  wall median " << percentile(wall, 0.5) << " ms, p95 " << percentile(wall, 0.95) << " ms" << std::endl;
+  if (openGL)
+  {
+    std::cout << "  gpu  median " << percentile(gpu, 0.5) << " ms, p95 " << percentile(gpu, 0.95) << " ms" << std::endl;
+    /// Compare the ms/frame of a build with GL_VALIDATION against one without
+    if (GLDebug::isActive())
+      std::cout << "  GL validation on (" << (GL_VALIDATION_SYNC ? "synchronous" : "asynchronous") << "): " << GLDebug::errorCount() << " errors, " << GLDebug::warningCount() << " warnings" << std::endl;
+    else
+      std::cout << "  GL validation " << (GL_VALIDATION ? "on without KHR_debug, glGetError per scope" : "off") << std::endl;
+  }
+
+  if (!frameHashes.empty())
+  {
+    /// One hash of the whole run compares two replays at a glance
+    uint64_t run = 14695981039346656037ull;
+    for (uint64_t hash : frameHashes)
+      run = (run ^ hash) * 1099511628211ull;
+    std::cout << "  frames hash " << std::hex << std::setw(16) << std::setfill('0') << run << std::dec << std::setfill(' ') << std::endl;
+  }
+}
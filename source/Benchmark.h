@@ -0,0 +1,72 @@
+//----------------------------------------------------------------------------------------
+/**
+ * \file       Benchmark.h
+ * \author     Bogdan Putintsev
+ * \date       2021/05/13
+ * \brief      Deterministic fly-through render benchmark with golden image comparison
+ *
+ *  Replays the camera Bezier fly-through at a fixed step per frame, records CPU, wall and
+ *  GPU time of every frame and compares selected frames against stored golden images.
+ *
+*/
+//----------------------------------------------------------------------------------------
+
+#pragma once
+#include "Camera.h"
+#include "Image.h"
+#include "InputRecorder.h"
+#include "RenderDevice.h"
+#include "Scene.h"
+
+#include <functional>
+#include <string>
+#include <vector>
+
+class Benchmark
+{
+public:
+  static const int FRAME_COUNT = 240;           ///< Length of Camera::startAnimation (120 frames, 0.5 per step)
+  static const unsigned int SEED = 1;           ///< Scene seed, keeps the torch flicker reproducible
+  static const int CHANNEL_TOLERANCE = 8;       ///< Allowed difference per color channel
+  static const int MAX_MISMATCH_PERMILLE = 10;  ///< Allowed share of differing pixels, in 1/1000
+  static const int VIEW_FRAMES = 60;            ///< Frames per configuration of runViews
+
+  typedef std::function<void(Image&)> PixelReader;
+  /// Draws one recorded frame: its ticks, its events and the late latched ones
+  typedef std::function<void(const InputRecorder::Frame&)> FrameDrawer;
+
+  /// Timings of one frame in milliseconds, gpuMs is negative without GPU timers
+  struct FrameTiming
+  {
+    double cpuMs;
+    double wallMs;
+    double gpuMs;
+  };
+
+  Benchmark(const std::string& backendName, bool openGL);
+
+  /// Run the fly-through. Returns false when a frame does not match its golden image.
+  bool run(Scene& scene, Camera& camera, RenderDevice& device, const PixelReader& readPixels, bool updateGolden);
+
+  /// Frame cost of 1 to MAX_VIEWS monitoring views, in one multi-view pass and in one pass per view
+  void runViews(Scene& scene, Camera& camera, RenderDevice& device);
+
+  /// Time every frame of a recorded session and hash its pixels, equal hashes mean equal frames
+  void runReplay(const InputRecorder::Log& log, const FrameDrawer& drawFrame, const PixelReader& readPixels);
+
+  bool writeReport(const std::string& path) const;
+  void printSummary() const;
+
+private:
+  std::string backendName;
+  bool openGL;
+  std::vector<FrameTiming> timings;
+  std::vector<uint64_t> frameHashes;            ///< Of every frame of a replay
+
+  /// Median CPU and GPU time of VIEW_FRAMES frames
+  FrameTiming measureViews(Scene& scene, Camera& camera, RenderDevice& device, int viewCount, bool multiPass);
+
+  static bool isGoldenFrame(int frame);
+  std::string goldenPath(int frame) const;
+  bool checkGolden(int frame, const Image& image, bool updateGolden) const;
+};
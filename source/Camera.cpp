@@ -10,7 +10,10 @@
 
 #include "Camera.h"
 #include "Collider.h"
+#include "Constants.h"
+#include "Profiler.h"
 
+#include <algorithm>
 #include <iostream>
 
 Camera::Camera(float fov, float ratio, float zNear, float zFar, glm::vec3& startPosition, glm::vec3& startDirection, float startSpeed)
@@ -26,26 +29,63 @@ Camera::Camera(float fov, float ratio, float zNear, float zFar, glm::vec3& start
   speed = startSpeed;
 }
 
-void Camera::init(GLuint shaderProgram)
+void Camera::init()
 {
   loadCollisions();
-
-  viewMatrix = glGetUniformLocation(shaderProgram, "viewMatrix");
-  eyePos = glGetUniformLocation(shaderProgram, "eyePos");
-  eyeDirection = glGetUniformLocation(shaderProgram, "eyeDirection");
-  CHECK_GL_ERROR();
 }
 
-void Camera::draw()
+void Camera::update()
 {
-  glUniformMatrix4fv(viewMatrix, 1, GL_FALSE, glm::value_ptr(this->getViewProjection()));
+  params.viewProjection = this->getViewProjection();
 
   if(cameraFrame > 0)
     animation();
 
-  glUniform3f(eyePos, positionVector.x, positionVector.y, positionVector.z);
-  glUniform3f(eyeDirection, directionVector.x, directionVector.y, directionVector.z);
-  CHECK_GL_ERROR();
+  params.eyePosition = positionVector;
+  params.eyeDirection = directionVector;
+}
+
+void Camera::latch()
+{
+  params.viewProjection = this->getViewProjection();
+  params.eyePosition = positionVector;
+  params.eyeDirection = directionVector;
+}
+
+void Camera::draw(RenderDevice& device)
+{
+  PROFILE_GPU_SCOPE("Camera::draw");
+
+  device.setCamera(params);
+}
+
+std::vector<RenderDevice::ViewParams> Camera::getMonitorViews(int count) const
+{
+  const StaticPosition* positions[] = { &staticPosition1, &staticPosition2, &staticPosition3 };
+  count = std::min(std::max(count, 1), RenderDevice::MAX_VIEWS);
+
+  std::vector<RenderDevice::ViewParams> views(count);
+  for (int i = 0; i < count; i++)
+  {
+    RenderDevice::ViewParams& view = views[i];
+    view.viewport = glm::vec4((i % 2) * 0.5f, (1 - i / 2) * 0.5f, (i % 2) * 0.5f + 0.5f, (1 - i / 2) * 0.5f + 0.5f);
+
+    if (i == 0)
+    {
+      view.camera = params;
+      continue;
+    }
+
+    /// Quadrants keep the aspect ratio of the window, the projection stays the same
+    const StaticPosition& position = *positions[i - 1];
+    glm::vec3 direction(sin(glm::radians(position.yaw)) * cos(glm::radians(position.pitch)), sin(glm::radians(position.pitch)),
+                        -cos(glm::radians(position.yaw)) * cos(glm::radians(position.pitch)));
+    view.camera.viewProjection = perspectiveMatrix * glm::lookAt(position.position, position.position + direction, upVector);
+    view.camera.eyePosition = position.position;
+    view.camera.eyeDirection = direction;
+  }
+
+  return views;
 }
 
 glm::mat4 Camera::getViewProjection()
@@ -59,6 +99,11 @@ void Camera::move(Camera::Direction direction)
     return;
 
   glm::vec3 moveVector = positionVector + getMoveVector(direction);
+  /// The ground holds the camera up, except in the doorway and under the hill the doorway leads into
+  bool aboveGround = terrain != nullptr && positionVector.y >= terrain->heightAt(positionVector.x, positionVector.z);
+  if (aboveGround && !terrain->isCutOut(moveVector))
+    moveVector.y = std::max(moveVector.y, terrain->heightAt(moveVector.x, moveVector.z) + terrainEyeHeight);
+
   if (checkCollisions(moveVector))
     positionVector = moveVector;
 
@@ -131,7 +176,9 @@ void Camera::clamp(float& value, const float minRange, const float maxRange)
 
 void Camera::loadCollisions()
 {
-  Collider skyboxCollider = Collider(-250.0f, 250.0f, -250.0f, 250.0f, -250.0f, 250.0f, true);
+  /// The skybox follows the camera, only the edge of the terrain limits the movement
+  float edge = terrain != nullptr ? terrain->getSize() * 0.5f : 250.0f;
+  Collider skyboxCollider = Collider(-edge, edge, -250.0f, 250.0f, -edge, edge, true);
   Collider doorCollider = Collider(2.682f, 17.88f, 38.58f, 61.18f, -41.73f, -56.54f, false);
   colliderList.push_back(skyboxCollider);
   colliderList.push_back(doorCollider);
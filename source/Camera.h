@@ -11,6 +11,8 @@
 #pragma once
 #include "pgr.h"
 #include "Collider.h"
+#include "RenderDevice.h"
+#include "Terrain.h"
 
 class Camera
 {
@@ -28,12 +30,18 @@ public:
     RIGHT         ///< Right arrow key
   };
 
-  void init(GLuint shaderProgram);
-  void draw();
+  void init();
+  /// Advance the animation and compute the parameters of the frame
+  void update();
+  /// Recompute the parameters from input applied after update, without advancing the animation
+  void latch();
+  /// Send the parameters to the device, right before the draws that use them
+  void draw(RenderDevice& device);
   void move(Direction direction);
   void rotate(const float mouseX, const float mouseY);
   
   void startAnimation();
+  bool isAnimating() const { return cameraFrame > 0.0f; }
   void changePosition(const float x, const float y, const float z);
   void changeDirection(const float x, const float y, const float z);
   void loadCollisions();
@@ -41,14 +49,17 @@ public:
   void unlockView();
   void disableCollision();
 
-private:
-  glm::mat4 perspectiveMatrix;
-  uint32_t viewMatrix;
+  const glm::vec3& getPosition() const { return positionVector; }
+  /// Values of the current frame, sent to the device by draw
+  const RenderDevice::CameraParams& getParams() const { return params; }
+  /// Monitoring views in a 2x2 grid: this camera top left, then the static positions 1 to 3
+  std::vector<RenderDevice::ViewParams> getMonitorViews(int count) const;
 
-  GLuint eyePos;
-  GLuint eyeDirection;
+  /// Keep the camera above the terrain while it moves freely
+  void setTerrain(const Terrain* ground) { terrain = ground; }
 
-  GLuint texturePosition;
+private:
+  glm::mat4 perspectiveMatrix;
 
   glm::vec3 positionVector;
   glm::vec3 directionVector;
@@ -60,6 +71,8 @@ private:
   float speed;
 
   std::vector<Collider> colliderList;
+  const Terrain* terrain = nullptr;
+  RenderDevice::CameraParams params;
 
   /// Structure containing information about position. Used in static positions.
   struct StaticPosition
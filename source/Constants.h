@@ -16,8 +16,53 @@ static const char* WINDOW_TITLE = "Semester Work";            ///< Window title
 
 static const char* vertexShaderPath = "vertexShader.vs";      ///< Path to a vertex shader
 static const char* fragmentShaderPath = "fragmentShader.fs";  ///< Path to a fragment shader
+static const char* upscaleVertexShaderPath = "upscale.vs";    ///< Full-screen pass of the dynamic resolution
+static const char* upscaleFragmentShaderPath = "upscale.fs";  ///< Upscaling and sharpening filter
+static const char* staticLayerFragmentShaderPath = "staticLayer.fs"; ///< Composite of the cached static layer
 
 static const int timerDelay = 33;                             ///< Timer event is called each 1/33 seconds
+static const bool redrawOnDemand = true;                      ///< Draw only the timer ticks where something on screen changes
+static const int redrawAmbientTicks = 2;                      ///< Ticks between frames while only water, fire and spray move
+static const double resolutionBudgetMs = 12.0;                ///< GPU time of the scene the render scale aims for
+static const float resolutionMinScale = 0.5f;                 ///< Lowest share of the window size drawn
+static const char* profilerTracePath = "trace.json";          ///< Chrome trace written by the profiler
+static const char* softwareImagePath = "software.ppm";        ///< Last frame of the software renderer
+static const char* benchmarkReportPath = "benchmark.csv";     ///< Per-frame timings of the benchmark
+static const char* replayReportPath = "replay.csv";           ///< Per-frame timings and pixel hashes of --replay
+static const char* benchmarkGoldenDirectory = "data/golden/"; ///< Reference frames of the benchmark
+static const char* benchmarkFailedDirectory = "";             ///< Where frames failing the comparison are saved
+
+static const int lightmapSamples = 64;                        ///< Paths per texel of --bake-lightmaps
+static const int lightmapBenchmarkSamples = 8;                ///< Paths per texel of --lightmap-benchmark
+
+static const float streamingTileSize = 50.0f;                 ///< Edge of a world streaming tile
+static const int streamingRadius = 2;                         ///< Tiles around the camera kept loaded
+static const unsigned int streamingBudgetMB = 256;            ///< Memory budget of streamed meshes and textures
+static const char* streamingBoundsPath = "streaming_bounds.txt"; ///< Cached OBJ bounds that place objects into tiles, written by the window
+static const unsigned int textureBudgetMB = 128;              ///< Video memory for texture mips above TextureStreamer::RESIDENT_SIZE
+
+static const float particleFireRate = 600.0f;                 ///< Flames per second of the torch
+static const float particleEmberRate = 40.0f;                 ///< Embers per second of the torch
+static const float particleSprayRate = 3000.0f;               ///< Droplets per second of each spray emitter
+static const int particleSprayEmitters = 4;                   ///< Spread over the water
+
+static const float oceanPatchSize = 64.0f;                    ///< World size of one tile of the ocean maps
+static const float oceanWindSpeed = 8.0f;                     ///< Wind speed of the ocean spectrum in m/s
+static const float oceanAmplitude = 0.0008f;                  ///< Phillips spectrum constant
+static const float oceanChoppiness = 1.2f;                    ///< Scale of the horizontal displacement
+
+static const float terrainSize = 2048.0f;                     ///< World size of the terrain, centered on the origin
+static const int terrainResolution = 1025;                    ///< Height map samples per side, 32 * 2^n + 1
+static const float terrainLodRange = 256.0f;                  ///< Distance drawn at the finest terrain level, doubles per level
+static const float terrainTextureRepeat = 16.0f;              ///< World size of one repeat of the terrain texture
+static const float terrainEyeHeight = 2.0f;                   ///< Lowest camera height above the terrain
+static const char* terrainFloorMeshPath = "data/floor/floor.obj";   ///< Mesh baked into the terrain height map
+static const char* terrainTexturePath = "data/floor/grass.jpg";     ///< Texture of the terrain
+static const float skyboxScale = 3.5f;                        ///< The skybox follows the camera at this scale, inside the far plane
+static const float skyExposure = 20.0f;                       ///< Sky radiance per unit of sun illuminance to display value
+static const float fogDensity = 0.08f;                        ///< Extinction of the volumetric fog per world unit
+static const float fogNearDepth = 0.5f;                       ///< View depth of the first froxel slice
+static const float fogFarDepth = 80.0f;                       ///< View depth of the last froxel slice, the fog is opaque beyond
 
 static const float mouseSensitivity = 0.3f;                   ///< Mouse sensitivity
 static const float YAW_MIN = 0.0f;                            ///< Min value for yaw
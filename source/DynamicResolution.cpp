@@ -0,0 +1,130 @@
+//----------------------------------------------------------------------------------------
+/**
+ * \file       DynamicResolution.cpp
+ * \author     Bogdan Putintsev
+ * \date       2021/05/13
+ * \brief      Render scale controller driven by the measured GPU time of the scene
+ *
+*/
+//----------------------------------------------------------------------------------------
+
+#include "DynamicResolution.h"
+#include "Profiler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+namespace
+{
+  const double TARGET = 0.9;                    ///< Share of the budget a lowered scale aims for
+  const double RAISE_MARGIN = 0.8;              ///< A raised scale must be predicted under this share
+  const float RAISE_STEP = 0.05f;
+}
+
+DynamicResolution::DynamicResolution(double budgetMs, float minScale, float maxScale)
+  : budgetMs(budgetMs), minScale(minScale), maxScale(maxScale), scale(maxScale)
+{
+}
+
+float DynamicResolution::update(double gpuMs)
+{
+  bool changed = false;
+
+  if (!enabled || gpuMs < 0.0)
+  {
+    record(gpuMs, false);
+    return getScale();
+  }
+
+  if (settleFrames > 0)
+    settleFrames--;
+  else if (gpuMs > budgetMs)
+  {
+    /// The cost follows the pixel count, the square of the scale
+    float lowered = std::max(minScale, scale * (float)std::sqrt(budgetMs * TARGET / gpuMs));
+    changed = lowered < scale;
+    scale = lowered;
+    underBudgetFrames = 0;
+  }
+  else
+  {
+    float raised = std::min(maxScale, scale + RAISE_STEP);
+    double predictedMs = gpuMs * (raised * raised) / (scale * scale);
+
+    underBudgetFrames = predictedMs < budgetMs * RAISE_MARGIN ? underBudgetFrames + 1 : 0;
+    if (underBudgetFrames >= RAISE_FRAMES && raised > scale)
+    {
+      scale = raised;
+      changed = true;
+      underBudgetFrames = 0;
+    }
+  }
+
+  if (changed)
+    settleFrames = SETTLE_FRAMES;
+
+  record(gpuMs, changed);
+  return scale;
+}
+
+float DynamicResolution::getSharpness() const
+{
+  if (maxScale <= minScale)
+    return 0.0f;
+  return std::min(1.0f, std::max(0.0f, (maxScale - getScale()) / (maxScale - minScale)));
+}
+
+void DynamicResolution::setEnabled(bool enable)
+{
+  enabled = enable;
+  settleFrames = SETTLE_FRAMES;
+  underBudgetFrames = 0;
+}
+
+void DynamicResolution::record(double gpuMs, bool changed)
+{
+  scaleHistory[historyNext] = getScale();
+  gpuHistory[historyNext] = std::max(gpuMs, 0.0);
+  changeHistory[historyNext] = changed;
+  historyNext = (historyNext + 1) % HISTORY;
+  historyCount = std::min(historyCount + 1, HISTORY);
+
+  Stats result;
+  result.frames = historyCount;
+  result.scale = getScale();
+  result.minScale = result.maxScale = scaleHistory[0];
+
+  double scaleSum = 0.0;
+  double gpuSum = 0.0;
+  for (int i = 0; i < historyCount; i++)
+  {
+    result.minScale = std::min(result.minScale, scaleHistory[i]);
+    result.maxScale = std::max(result.maxScale, scaleHistory[i]);
+    result.maxGpuMs = std::max(result.maxGpuMs, gpuHistory[i]);
+    result.overBudget += gpuHistory[i] > budgetMs ? 1 : 0;
+    result.changes += changeHistory[i] ? 1 : 0;
+    scaleSum += scaleHistory[i];
+    gpuSum += gpuHistory[i];
+  }
+  result.averageScale = (float)(scaleSum / historyCount);
+  result.averageGpuMs = gpuSum / historyCount;
+
+  double variance = 0.0;
+  for (int i = 0; i < historyCount; i++)
+    variance += (gpuHistory[i] - result.averageGpuMs) * (gpuHistory[i] - result.averageGpuMs);
+  result.deviationGpuMs = std::sqrt(variance / historyCount);
+
+  stats = result;
+
+  Profiler::counter("render scale", result.scale);
+  Profiler::counter("scene gpu ms", std::max(gpuMs, 0.0));
+}
+
+void DynamicResolution::printStats() const
+{
+  std::cout << "Dynamic resolution " << (enabled ? "on" : "off") << ": scale " << stats.scale << " (min " << stats.minScale
+            << ", average " << stats.averageScale << ", max " << stats.maxScale << ", " << stats.changes << " changes) over "
+            << stats.frames << " frames; scene GPU " << stats.averageGpuMs << " ms +- " << stats.deviationGpuMs << " ms, max "
+            << stats.maxGpuMs << " ms, " << stats.overBudget << " frames over the " << budgetMs << " ms budget" << std::endl;
+}
@@ -0,0 +1,77 @@
+//----------------------------------------------------------------------------------------
+/**
+ * \file       DynamicResolution.h
+ * \author     Bogdan Putintsev
+ * \date       2021/05/13
+ * \brief      Render scale controller driven by the measured GPU time of the scene
+ *
+ *  The scene is drawn into an offscreen target at a fraction of the window size and
+ *  upscaled with a sharpening filter. Each frame the controller reads the GPU time of the
+ *  scene, a few frames old, and adjusts the scale: down at once when the frame is over
+ *  budget, by the square root of the ratio since the cost follows the pixel count, and up
+ *  in small steps only after the frames have stayed well under budget for a while. After
+ *  every change the measurements still in flight are ignored, so the scale does not
+ *  oscillate around the budget.
+ *
+*/
+//----------------------------------------------------------------------------------------
+
+#pragma once
+
+class DynamicResolution
+{
+public:
+  static const int HISTORY = 128;               ///< Frames kept for the statistics
+  static const int SETTLE_FRAMES = 4;           ///< Measurements ignored after a change, older than the change
+  static const int RAISE_FRAMES = 30;           ///< Frames under the raise threshold before the scale goes up
+
+  /// Statistics over the last HISTORY frames
+  struct Stats
+  {
+    int frames = 0;
+    int overBudget = 0;                         ///< Frames whose GPU time exceeded the budget
+    int changes = 0;                            ///< Scale changes
+    float scale = 1.0f;
+    float minScale = 1.0f;
+    float maxScale = 1.0f;
+    float averageScale = 1.0f;
+    double averageGpuMs = 0.0;
+    double deviationGpuMs = 0.0;                ///< Standard deviation, the frame-time stability
+    double maxGpuMs = 0.0;
+  };
+
+  DynamicResolution(double budgetMs, float minScale, float maxScale = 1.0f);
+
+  /// Feed the GPU time of the latest measured frame, negative when none is available yet.
+  /// Returns the scale of the next frame.
+  float update(double gpuMs);
+
+  float getScale() const { return enabled ? scale : maxScale; }
+  /// Strength of the upscaling filter, 0 at full resolution
+  float getSharpness() const;
+  double getBudgetMs() const { return budgetMs; }
+
+  void setEnabled(bool enable);
+  bool isEnabled() const { return enabled; }
+  const Stats& getStats() const { return stats; }
+  void printStats() const;
+
+private:
+  double budgetMs;
+  float minScale;
+  float maxScale;
+  bool enabled = true;
+
+  float scale;
+  int settleFrames = 0;
+  int underBudgetFrames = 0;
+
+  float scaleHistory[HISTORY] = {};
+  double gpuHistory[HISTORY] = {};
+  bool changeHistory[HISTORY] = {};
+  int historyCount = 0;
+  int historyNext = 0;
+  Stats stats;
+
+  void record(double gpuMs, bool changed);
+};
@@ -0,0 +1,186 @@
+//----------------------------------------------------------------------------------------
+/**
+ * \file       GLDebug.cpp
+ * \author     Bogdan Putintsev
+ * \date       2021/05/13
+ * \brief      GL validation built on the KHR_debug callback
+ *
+*/
+//----------------------------------------------------------------------------------------
+
+#include "GLDebug.h"
+
+#include <atomic>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <vector>
+
+namespace
+{
+  bool active = false;
+
+  std::atomic<unsigned int> errors(0);
+  std::atomic<unsigned int> warnings(0);
+
+  std::mutex callbackMutex;
+#if GL_VALIDATION_SYNC
+  /// Debug groups as seen by the callback, open around the call a message is about
+  std::vector<std::string> groups;
+#endif
+
+  const char* sourceName(GLenum source)
+  {
+    switch (source)
+    {
+    case GL_DEBUG_SOURCE_API:             return "API";
+    case GL_DEBUG_SOURCE_WINDOW_SYSTEM:   return "window system";
+    case GL_DEBUG_SOURCE_SHADER_COMPILER: return "shader compiler";
+    case GL_DEBUG_SOURCE_THIRD_PARTY:     return "third party";
+    case GL_DEBUG_SOURCE_APPLICATION:     return "application";
+    default:                              return "other";
+    }
+  }
+
+  const char* typeName(GLenum type)
+  {
+    switch (type)
+    {
+    case GL_DEBUG_TYPE_ERROR:               return "error";
+    case GL_DEBUG_TYPE_DEPRECATED_BEHAVIOR: return "deprecated";
+    case GL_DEBUG_TYPE_UNDEFINED_BEHAVIOR:  return "undefined behavior";
+    case GL_DEBUG_TYPE_PORTABILITY:         return "portability";
+    case GL_DEBUG_TYPE_PERFORMANCE:         return "performance";
+    default:                                return "other";
+    }
+  }
+
+  const char* severityName(GLenum severity)
+  {
+    switch (severity)
+    {
+    case GL_DEBUG_SEVERITY_HIGH:   return "high";
+    case GL_DEBUG_SEVERITY_MEDIUM: return "medium";
+    case GL_DEBUG_SEVERITY_LOW:    return "low";
+    default:                       return "notification";
+    }
+  }
+
+  void APIENTRY debugCallback(GLenum source, GLenum type, GLuint id, GLenum severity, GLsizei length, const GLchar* message, const void* userParam)
+  {
+    std::lock_guard<std::mutex> lock(callbackMutex);
+
+#if GL_VALIDATION_SYNC
+    if (type == GL_DEBUG_TYPE_PUSH_GROUP)
+    {
+      groups.push_back(std::string(message, length));
+      return;
+    }
+
+    if (type == GL_DEBUG_TYPE_POP_GROUP)
+    {
+      if (!groups.empty())
+        groups.pop_back();
+      return;
+    }
+#endif
+
+    if (type == GL_DEBUG_TYPE_ERROR)
+      errors++;
+    else
+      warnings++;
+
+    std::cerr << "GL " << typeName(type) << " [" << severityName(severity) << ", " << sourceName(source) << ", #" << id << "]";
+#if GL_VALIDATION_SYNC
+    if (!groups.empty())
+      std::cerr << " in " << groups.back();
+#endif
+    std::cerr << ": " << std::string(message, length) << std::endl;
+  }
+
+  const char* baseName(const char* path)
+  {
+    const char* result = path;
+    for (const char* c = path; *c; c++)
+      if (*c == '/' || *c == '\\')
+        result = c + 1;
+    return result;
+  }
+}
+
+/// Install the debug callback. Returns false when the context does not expose KHR_debug.
+bool GLDebug::init()
+{
+  /// Queried from the context, the headless benchmark has no GLUT
+  bool supported = false;
+  GLint extensionCount = 0;
+  glGetIntegerv(GL_NUM_EXTENSIONS, &extensionCount);
+  for (GLint i = 0; i < extensionCount && !supported; i++)
+    supported = std::strcmp((const char*)glGetStringi(GL_EXTENSIONS, i), "GL_KHR_debug") == 0;
+
+  if (!supported)
+  {
+    std::cout << "GL_KHR_debug is not supported, falling back to glGetError per scope" << std::endl;
+    active = false;
+    return false;
+  }
+
+  glEnable(GL_DEBUG_OUTPUT);
+#if GL_VALIDATION_SYNC
+  /// The callback runs inside the failing call, so the innermost open group is the function
+  /// and line that issued it. Asynchronous delivery could come from a driver thread after
+  /// that group was popped, so it is only attributed in this mode.
+  glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+#endif
+  glDebugMessageCallback(debugCallback, nullptr);
+
+  /// Drop chatty notifications, group markers included unless they are used for attribution
+  glDebugMessageControl(GL_DONT_CARE, GL_DONT_CARE, GL_DEBUG_SEVERITY_NOTIFICATION, 0, nullptr, GL_FALSE);
+#if GL_VALIDATION_SYNC
+  glDebugMessageControl(GL_DEBUG_SOURCE_APPLICATION, GL_DEBUG_TYPE_PUSH_GROUP, GL_DONT_CARE, 0, nullptr, GL_TRUE);
+  glDebugMessageControl(GL_DEBUG_SOURCE_APPLICATION, GL_DEBUG_TYPE_POP_GROUP, GL_DONT_CARE, 0, nullptr, GL_TRUE);
+#endif
+
+  active = true;
+  return true;
+}
+
+bool GLDebug::isActive()
+{
+  return active;
+}
+
+void GLDebug::label(GLenum identifier, GLuint name, const std::string& label)
+{
+  if (active)
+    glObjectLabel(identifier, name, (GLsizei)label.size(), label.c_str());
+}
+
+unsigned int GLDebug::errorCount()
+{
+  return errors;
+}
+
+unsigned int GLDebug::warningCount()
+{
+  return warnings;
+}
+
+GLDebug::Scope::Scope(const char* function, const char* file, int line)
+  : function(function), line(line)
+{
+  if (!active)
+    return;
+
+  char name[256];
+  snprintf(name, sizeof(name), "%s (%s:%d)", function, baseName(file), line);
+  glPushDebugGroup(GL_DEBUG_SOURCE_APPLICATION, line, -1, name);
+}
+
+GLDebug::Scope::~Scope()
+{
+  if (active)
+    glPopDebugGroup();
+  else
+    pgr::checkGLError(function, line);
+}
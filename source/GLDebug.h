@@ -0,0 +1,78 @@
+//----------------------------------------------------------------------------------------
+/**
+ * \file       GLDebug.h
+ * \author     Bogdan Putintsev
+ * \date       2021/05/13
+ * \brief      GL validation built on the KHR_debug callback
+ *
+ *  Errors are reported by the driver through glDebugMessageCallback instead of polling
+ *  glGetError after every call. GL_DEBUG_SCOPE pushes a debug group named after the
+ *  calling function and source line, so reported messages carry their origin, and
+ *  GL_LABEL attaches readable names to GL objects. Output is asynchronous by default, so the driver
+ *  may report from its own thread without stalling the pipeline, and messages are only
+ *  attributed to their group by tools that capture the groups. GL_VALIDATION_SYNC makes
+ *  output synchronous, the callback then runs inside the call that caused the message
+ *  while its group is still open and names it.
+ *
+ *  The whole layer is controlled by GL_VALIDATION. It is on in debug builds and off in
+ *  release builds, where every macro expands to nothing.
+ *
+*/
+//----------------------------------------------------------------------------------------
+
+#pragma once
+#include "pgr.h"
+
+#include <string>
+
+#ifndef GL_VALIDATION
+#ifdef _DEBUG
+#define GL_VALIDATION 1
+#else
+#define GL_VALIDATION 0
+#endif
+#endif
+
+#ifndef GL_VALIDATION_SYNC
+#define GL_VALIDATION_SYNC 0
+#endif
+
+#if GL_VALIDATION
+
+#define GL_DEBUG_CONCAT_INNER(a, b) a##b
+#define GL_DEBUG_CONCAT(a, b) GL_DEBUG_CONCAT_INNER(a, b)
+
+/// Attribute GL messages issued in the enclosing block to this function and line
+#define GL_DEBUG_SCOPE() GLDebug::Scope GL_DEBUG_CONCAT(glDebugScope, __LINE__)(__FUNCTION__, __FILE__, __LINE__)
+/// Attach a readable name to a GL object
+#define GL_LABEL(identifier, name, text) GLDebug::label(identifier, name, text)
+
+#else
+
+#define GL_DEBUG_SCOPE() ((void)0)
+#define GL_LABEL(identifier, name, text) ((void)0)
+
+#endif
+
+class GLDebug
+{
+public:
+  /// Debug group covering one function. Falls back to a single glGetError at scope exit without KHR_debug.
+  class Scope
+  {
+  public:
+    Scope(const char* function, const char* file, int line);
+    ~Scope();
+  private:
+    const char* function;
+    int line;
+  };
+
+  static bool init();
+  static bool isActive();
+
+  static void label(GLenum identifier, GLuint name, const std::string& label);
+
+  static unsigned int errorCount();
+  static unsigned int warningCount();
+};
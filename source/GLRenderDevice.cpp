@@ -0,0 +1,847 @@
+//----------------------------------------------------------------------------------------
+/**
+ * \file       GLRenderDevice.cpp
+ * \author     Bogdan Putintsev
+ * \date       2021/05/13
+ * \brief      OpenGL backend of the render device
+ *
+*/
+//----------------------------------------------------------------------------------------
+
+#include "GLRenderDevice.h"
+#include "GLDebug.h"
+#include "GLState.h"
+#include "Profiler.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+namespace
+{
+  const int OCEAN_DISPLACEMENT_UNIT = 1;
+  const int OCEAN_NORMAL_UNIT = 2;
+  const int TERRAIN_HEIGHT_MAP_UNIT = 3;
+  const int LIGHTMAP_UNIT = 4;
+  const int SKY_TRANSMITTANCE_UNIT = 5;
+  const int SKY_RAYLEIGH_UNIT = 6;
+  const int SKY_MIE_UNIT = 7;
+  const int FROXEL_FOG_UNIT = 8;
+  const GLuint TERRAIN_PATCH_ATTRIBUTE = 3;
+  const GLuint LIGHTMAP_UV_ATTRIBUTE = 4;
+  const GLuint PARTICLE_ATTRIBUTE = 5;
+  const GLuint CAMERA_BLOCK_BINDING = 0;
+
+  /// std140 layout of CameraBlock, array elements are aligned to 16 bytes
+  struct CameraBlock
+  {
+    float viewMatrices[RenderDevice::MAX_VIEWS][16];
+    float eyePositions[RenderDevice::MAX_VIEWS][4];
+    float eyeDirections[RenderDevice::MAX_VIEWS][4];
+    float viewRects[RenderDevice::MAX_VIEWS][4];
+    int viewCount;
+    int padding[3];
+  };
+}
+
+void GLRenderDevice::init(GLuint shaderProgram)
+{
+  GL_DEBUG_SCOPE();
+
+  program = shaderProgram;
+  textureStreamer.init();
+
+  GLuint cameraBlockIndex = glGetUniformBlockIndex(program, "CameraBlock");
+  if (cameraBlockIndex != GL_INVALID_INDEX)
+    glUniformBlockBinding(program, cameraBlockIndex, CAMERA_BLOCK_BINDING);
+
+  glGenBuffers(1, &cameraBuffer);
+  glBindBuffer(GL_UNIFORM_BUFFER, cameraBuffer);
+  glBufferData(GL_UNIFORM_BUFFER, sizeof(CameraBlock), nullptr, GL_DYNAMIC_DRAW);
+  glBindBufferBase(GL_UNIFORM_BUFFER, CAMERA_BLOCK_BINDING, cameraBuffer);
+  GL_LABEL(GL_BUFFER, cameraBuffer, "camera");
+
+  sunDirectionPosition = glGetUniformLocation(program, "sunDirection");
+  lightColorPosition = glGetUniformLocation(program, "lightColor");
+  flashLightEnabledPosition = glGetUniformLocation(program, "flashLightEnabled");
+  fogEnabledPosition = glGetUniformLocation(program, "fogEnabled");
+  pointPositionPosition = glGetUniformLocation(program, "pointPosition");
+  pointColorPosition = glGetUniformLocation(program, "pointColor");
+  pointIntensityPosition = glGetUniformLocation(program, "pointIntensity");
+
+  objectTypePosition = glGetUniformLocation(program, "objectType");
+  transformPosition = glGetUniformLocation(program, "transform");
+  textureSamplerPosition = glGetUniformLocation(program, "MTexture");
+  oceanPatchSizePosition = glGetUniformLocation(program, "oceanPatchSize");
+  lightmapEnabledPosition = glGetUniformLocation(program, "lightmapEnabled");
+
+  terrainHeightMapTransformPosition = glGetUniformLocation(program, "terrainHeightMapTransform");
+  terrainPatchQuadsPosition = glGetUniformLocation(program, "terrainPatchQuads");
+  terrainMorphPosition = glGetUniformLocation(program, "terrainMorph");
+  terrainCutoutCountPosition = glGetUniformLocation(program, "terrainCutoutCount");
+  terrainCutoutsPosition = glGetUniformLocation(program, "terrainCutouts");
+  staticLayerPosition = glGetUniformLocation(program, "staticLayer");
+  particleColorsPosition = glGetUniformLocation(program, "particleColors");
+  particleSizePosition = glGetUniformLocation(program, "particleSize");
+  particleLitPosition = glGetUniformLocation(program, "particleLit");
+  skySamplesPosition = glGetUniformLocation(program, "skySamples");
+  atmosphereRadiiPosition = glGetUniformLocation(program, "atmosphereRadii");
+  skyExposurePosition = glGetUniformLocation(program, "skyExposure");
+  fogViewProjectionPosition = glGetUniformLocation(program, "fogViewProjection");
+  fogDepthRangePosition = glGetUniformLocation(program, "fogDepthRange");
+
+  GLState::useProgram(program);
+  GLState::uniform1i(textureSamplerPosition, 0);
+  GLState::uniform1i(glGetUniformLocation(program, "displacementMap"), OCEAN_DISPLACEMENT_UNIT);
+  GLState::uniform1i(glGetUniformLocation(program, "normalMap"), OCEAN_NORMAL_UNIT);
+  GLState::uniform1i(glGetUniformLocation(program, "heightMap"), TERRAIN_HEIGHT_MAP_UNIT);
+  GLState::uniform1i(glGetUniformLocation(program, "lightmap"), LIGHTMAP_UNIT);
+  GLState::uniform1i(glGetUniformLocation(program, "skyTransmittance"), SKY_TRANSMITTANCE_UNIT);
+  GLState::uniform1i(glGetUniformLocation(program, "skyRayleigh"), SKY_RAYLEIGH_UNIT);
+  GLState::uniform1i(glGetUniformLocation(program, "skyMie"), SKY_MIE_UNIT);
+  GLState::uniform1i(glGetUniformLocation(program, "froxelFog"), FROXEL_FOG_UNIT);
+
+  glGenBuffers(1, &terrainPatchBuffer);
+  GL_LABEL(GL_BUFFER, terrainPatchBuffer, "terrain patches");
+
+  glGenBuffers(1, &particleBuffer);
+  glBindBuffer(GL_ARRAY_BUFFER, particleBuffer);
+  GL_LABEL(GL_BUFFER, particleBuffer, "particles");
+  glGenVertexArrays(1, &particleVao);
+  GLState::bindVertexArray(particleVao);
+  glEnableVertexAttribArray(PARTICLE_ATTRIBUTE);
+  glVertexAttribPointer(PARTICLE_ATTRIBUTE, 4, GL_FLOAT, GL_FALSE, sizeof(glm::vec4), 0);
+  GL_LABEL(GL_VERTEX_ARRAY, particleVao, "particles");
+
+  const GLubyte white[] = { 255, 255, 255, 255 };
+  glGenTextures(1, &whiteTexture);
+  GLState::activeTexture(GL_TEXTURE0);
+  GLState::bindTexture(GL_TEXTURE_2D, whiteTexture);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, white);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  GL_LABEL(GL_TEXTURE, whiteTexture, "white");
+}
+
+RenderDevice::Handle GLRenderDevice::createMesh(const std::vector<float>& vertices, const std::vector<uint32_t>& indices, const std::string& name)
+{
+  GL_DEBUG_SCOPE();
+
+  Mesh mesh;
+
+  glGenBuffers(1, &mesh.arrayBuffer);
+  glBindBuffer(GL_ARRAY_BUFFER, mesh.arrayBuffer);
+  glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), vertices.data(), GL_STATIC_DRAW);
+  GL_LABEL(GL_BUFFER, mesh.arrayBuffer, name);
+
+  glGenVertexArrays(1, &mesh.vao);
+  GLState::bindVertexArray(mesh.vao);
+  GL_LABEL(GL_VERTEX_ARRAY, mesh.vao, name);
+
+  /// position
+  glEnableVertexAttribArray(0);
+  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), 0);
+
+  /// normal
+  glEnableVertexAttribArray(1);
+  glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(5 * sizeof(float)));
+
+  /// texture coordinates
+  glEnableVertexAttribArray(2);
+  glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(3 * sizeof(float)));
+
+  /// The element buffer binding is part of the VAO
+  if (!indices.empty())
+  {
+    glGenBuffers(1, &mesh.elementBuffer);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.elementBuffer);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(uint32_t), indices.data(), GL_STATIC_DRAW);
+    GL_LABEL(GL_BUFFER, mesh.elementBuffer, name);
+  }
+
+  if (!freeMeshes.empty())
+  {
+    Handle handle = freeMeshes.back();
+    freeMeshes.pop_back();
+    meshes[handle - 1] = mesh;
+    return handle;
+  }
+
+  meshes.push_back(mesh);
+  return (Handle)meshes.size();
+}
+
+void GLRenderDevice::setMeshLightmapUvs(Handle handle, const std::vector<float>& uvs)
+{
+  GL_DEBUG_SCOPE();
+
+  Mesh& mesh = meshes[handle - 1];
+  if (mesh.lightmapBuffer == 0)
+    glGenBuffers(1, &mesh.lightmapBuffer);
+
+  glBindBuffer(GL_ARRAY_BUFFER, mesh.lightmapBuffer);
+  glBufferData(GL_ARRAY_BUFFER, uvs.size() * sizeof(float), uvs.data(), GL_STATIC_DRAW);
+  GL_LABEL(GL_BUFFER, mesh.lightmapBuffer, "lightmap uvs");
+
+  GLState::bindVertexArray(mesh.vao);
+  glEnableVertexAttribArray(LIGHTMAP_UV_ATTRIBUTE);
+  glVertexAttribPointer(LIGHTMAP_UV_ATTRIBUTE, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), 0);
+}
+
+RenderDevice::Handle GLRenderDevice::createTexture(const std::string& path, const std::vector<unsigned char>& content)
+{
+  GL_DEBUG_SCOPE();
+
+  /// Only the coarse mips are uploaded now, the streamer adds the finer ones the draws ask for
+  GLuint texture = textureStreamer.create(path, content);
+  if (texture == 0)
+    pgr::dieWithError("Failed to load texture.");
+
+  return texture;
+}
+
+void GLRenderDevice::destroyMesh(Handle handle)
+{
+  GL_DEBUG_SCOPE();
+
+  Mesh& mesh = meshes[handle - 1];
+  glDeleteVertexArrays(1, &mesh.vao);
+  glDeleteBuffers(1, &mesh.arrayBuffer);
+  if (mesh.elementBuffer != 0)
+    glDeleteBuffers(1, &mesh.elementBuffer);
+  if (mesh.lightmapBuffer != 0)
+    glDeleteBuffers(1, &mesh.lightmapBuffer);
+  mesh = Mesh();
+
+  /// A deleted name can be handed out again, the cache must not treat it as bound
+  GLState::invalidate();
+  freeMeshes.push_back(handle);
+}
+
+void GLRenderDevice::destroyTexture(Handle texture)
+{
+  GL_DEBUG_SCOPE();
+
+  textureStreamer.destroy(texture);
+  glDeleteTextures(1, &texture);
+  textureBytes.erase(texture);
+  dataTextureSizes.erase(texture);
+  volumeTextureSizes.erase(texture);
+  GLState::invalidate();
+}
+
+RenderDevice::Handle GLRenderDevice::createDataTexture(int width, int height)
+{
+  GL_DEBUG_SCOPE();
+
+  GLuint texture;
+  glGenTextures(1, &texture);
+  GLState::activeTexture(GL_TEXTURE0);
+  GLState::bindTexture(GL_TEXTURE_2D, texture);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, width, height, 0, GL_RGBA, GL_FLOAT, nullptr);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+  GL_LABEL(GL_TEXTURE, texture, "data");
+
+  textureBytes[texture] = (size_t)width * height * 4 * sizeof(float);
+  dataTextureSizes[texture] = glm::ivec2(width, height);
+  return texture;
+}
+
+void GLRenderDevice::updateDataTexture(Handle texture, const float* texels)
+{
+  GL_DEBUG_SCOPE();
+
+  const glm::ivec2& size = dataTextureSizes.at(texture);
+  GLState::activeTexture(GL_TEXTURE0);
+  GLState::bindTexture(GL_TEXTURE_2D, texture);
+  glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, size.x, size.y, GL_RGBA, GL_FLOAT, texels);
+}
+
+RenderDevice::Handle GLRenderDevice::createVolumeTexture(int width, int height, int depth)
+{
+  GL_DEBUG_SCOPE();
+
+  GLuint texture;
+  glGenTextures(1, &texture);
+  GLState::activeTexture(GL_TEXTURE0);
+  GLState::bindTexture(GL_TEXTURE_3D, texture);
+  glTexImage3D(GL_TEXTURE_3D, 0, GL_RGBA32F, width, height, depth, 0, GL_RGBA, GL_FLOAT, nullptr);
+  glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+  GL_LABEL(GL_TEXTURE, texture, "volume");
+
+  textureBytes[texture] = (size_t)width * height * depth * 4 * sizeof(float);
+  volumeTextureSizes[texture] = glm::ivec3(width, height, depth);
+  return texture;
+}
+
+void GLRenderDevice::updateVolumeTexture(Handle texture, const float* texels)
+{
+  GL_DEBUG_SCOPE();
+
+  const glm::ivec3& size = volumeTextureSizes.at(texture);
+  GLState::activeTexture(GL_TEXTURE0);
+  GLState::bindTexture(GL_TEXTURE_3D, texture);
+  glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, 0, size.x, size.y, size.z, GL_RGBA, GL_FLOAT, texels);
+}
+
+size_t GLRenderDevice::getTextureBytes(Handle texture) const
+{
+  if (textureStreamer.isStreamed(texture))
+    return textureStreamer.getBytes(texture);
+
+  auto found = textureBytes.find(texture);
+  return found != textureBytes.end() ? found->second : 0;
+}
+
+void GLRenderDevice::initRenderTarget(int width, int height, GLuint upscaleShaderProgram)
+{
+  GL_DEBUG_SCOPE();
+
+  targetWidth = width;
+  targetHeight = height;
+  upscaleProgram = upscaleShaderProgram;
+
+  glGenTextures(1, &targetColor);
+  GLState::activeTexture(GL_TEXTURE0);
+  GLState::bindTexture(GL_TEXTURE_2D, targetColor);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  GL_LABEL(GL_TEXTURE, targetColor, "render target color");
+
+  /// The stencil keeps the object ids used for picking
+  glGenRenderbuffers(1, &targetDepthStencil);
+  glBindRenderbuffer(GL_RENDERBUFFER, targetDepthStencil);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+
+  GLint previous = 0;
+  glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previous);
+
+  glGenFramebuffers(1, &targetFramebuffer);
+  glBindFramebuffer(GL_FRAMEBUFFER, targetFramebuffer);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, targetColor, 0);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, targetDepthStencil);
+  GL_LABEL(GL_FRAMEBUFFER, targetFramebuffer, "render target");
+
+  if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+  {
+    std::cout << "Render target is incomplete, drawing at the window resolution" << std::endl;
+    glDeleteFramebuffers(1, &targetFramebuffer);
+    targetFramebuffer = 0;
+  }
+  glBindFramebuffer(GL_FRAMEBUFFER, previous);
+
+  glGenVertexArrays(1, &upscaleVao);
+  glGenQueries(TIMER_FRAMES * 2, &timerQueries[0][0]);
+
+  upscaleUvScalePosition = glGetUniformLocation(upscaleProgram, "uvScale");
+  upscaleTexelSizePosition = glGetUniformLocation(upscaleProgram, "texelSize");
+  upscaleUvMaxPosition = glGetUniformLocation(upscaleProgram, "uvMax");
+  upscaleSharpnessPosition = glGetUniformLocation(upscaleProgram, "sharpness");
+
+  GLState::useProgram(upscaleProgram);
+  glUniform1i(glGetUniformLocation(upscaleProgram, "source"), 0);
+  GLState::useProgram(program);
+}
+
+void GLRenderDevice::initStaticLayer(GLuint compositeShaderProgram)
+{
+  GL_DEBUG_SCOPE();
+
+  if (targetFramebuffer == 0)
+    return;
+
+  staticProgram = compositeShaderProgram;
+
+  /// Half floats keep the colors unclamped and the torch weight above one near the torch
+  glGenTextures(1, &staticColor);
+  GLState::activeTexture(GL_TEXTURE0);
+  GLState::bindTexture(GL_TEXTURE_2D, staticColor);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, targetWidth, targetHeight, 0, GL_RGBA, GL_HALF_FLOAT, nullptr);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  GL_LABEL(GL_TEXTURE, staticColor, "static layer color");
+
+  glGenRenderbuffers(1, &staticDepthStencil);
+  glBindRenderbuffer(GL_RENDERBUFFER, staticDepthStencil);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, targetWidth, targetHeight);
+
+  GLint previous = 0;
+  glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previous);
+
+  glGenFramebuffers(1, &staticFramebuffer);
+  glBindFramebuffer(GL_FRAMEBUFFER, staticFramebuffer);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, staticColor, 0);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, staticDepthStencil);
+  GL_LABEL(GL_FRAMEBUFFER, staticFramebuffer, "static layer");
+
+  if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+  {
+    std::cout << "Static layer target is incomplete, every frame is drawn in full" << std::endl;
+    glDeleteFramebuffers(1, &staticFramebuffer);
+    staticFramebuffer = 0;
+  }
+  glBindFramebuffer(GL_FRAMEBUFFER, previous);
+
+  staticPointColorPosition = glGetUniformLocation(staticProgram, "pointColor");
+  staticPointIntensityPosition = glGetUniformLocation(staticProgram, "pointIntensity");
+
+  GLState::useProgram(staticProgram);
+  glUniform1i(glGetUniformLocation(staticProgram, "source"), 0);
+  GLState::useProgram(program);
+}
+
+void GLRenderDevice::setStaticLayerEnabled(bool enable)
+{
+  staticLayerEnabled = enable;
+  staticLayerValid = false;
+  staticLayerFrames = staticLayerHits = 0;
+}
+
+void GLRenderDevice::printStaticLayerStats() const
+{
+  std::cout << "Static layer " << (staticFramebuffer == 0 ? "unavailable" : staticLayerEnabled ? "on" : "off") << ": "
+            << staticLayerHits << " of " << staticLayerFrames << " frames reused it ("
+            << (staticLayerFrames > 0 ? 100.0 * staticLayerHits / staticLayerFrames : 0.0) << "% hit rate)" << std::endl;
+}
+
+void GLRenderDevice::setRenderScale(float scale, float sharpnessAmount)
+{
+  renderScale = std::min(1.0f, std::max(0.1f, scale));
+  sharpness = sharpnessAmount;
+}
+
+unsigned char GLRenderDevice::objectIdAt(int windowX, int windowY) const
+{
+  GLint viewport[4];
+  glGetIntegerv(GL_VIEWPORT, viewport);
+
+  unsigned char objectId = 0;
+  if (targetFramebuffer == 0)
+  {
+    glReadPixels(windowX, viewport[3] - 1 - windowY, 1, 1, GL_STENCIL_INDEX, GL_UNSIGNED_BYTE, &objectId);
+    return objectId;
+  }
+
+  /// The target still holds the last frame, at the size it was drawn with
+  int x = std::min(renderWidth - 1, windowX * renderWidth / std::max(viewport[2], 1));
+  int y = std::min(renderHeight - 1, (viewport[3] - 1 - windowY) * renderHeight / std::max(viewport[3], 1));
+
+  GLint previous = 0;
+  glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &previous);
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, targetFramebuffer);
+  glReadPixels(x, y, 1, 1, GL_STENCIL_INDEX, GL_UNSIGNED_BYTE, &objectId);
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, previous);
+  return objectId;
+}
+
+void GLRenderDevice::beginFrame()
+{
+  GLState::beginFrame();
+
+  /// Redundant state changes the cache filtered out in the last frame
+  Profiler::counter("gl calls issued", GLState::lastFrame().issued);
+  Profiler::counter("gl calls skipped", GLState::lastFrame().skipped);
+
+  if (targetFramebuffer != 0)
+  {
+    readSceneTimer();
+
+    GLint output = 0;
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &output);
+    outputFramebuffer = output;
+
+    renderWidth = std::max(1, (int)(targetWidth * renderScale + 0.5f));
+    renderHeight = std::max(1, (int)(targetHeight * renderScale + 0.5f));
+    glBindFramebuffer(GL_FRAMEBUFFER, targetFramebuffer);
+    glViewport(0, 0, renderWidth, renderHeight);
+    sceneStarted = false;
+  }
+
+  /// Mips are chosen for the output, the render scale changes too often to stream after it
+  if (targetFramebuffer != 0)
+    outputHeight = targetHeight;
+  else
+  {
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    outputHeight = viewport[3];
+  }
+
+  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+  GLState::useProgram(program);
+
+  glEnable(GL_STENCIL_TEST);
+  glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
+}
+
+void GLRenderDevice::setCamera(const CameraParams& camera)
+{
+  ViewParams view;
+  view.camera = camera;
+  setViews(std::vector<ViewParams>(1, view));
+}
+
+void GLRenderDevice::setViews(const std::vector<ViewParams>& views)
+{
+  GL_DEBUG_SCOPE();
+
+  /// The scene timer starts with the first camera, the CPU work before it would count as GPU time
+  if (targetFramebuffer != 0 && !sceneStarted)
+  {
+    glQueryCounter(timerQueries[timerFrame][0], GL_TIMESTAMP);
+    sceneStarted = true;
+  }
+
+  viewCount = std::min((int)views.size(), MAX_VIEWS);
+
+  CameraBlock block = {};
+  for (int i = 0; i < viewCount; i++)
+  {
+    const CameraParams& camera = views[i].camera;
+    std::memcpy(block.viewMatrices[i], glm::value_ptr(camera.viewProjection), sizeof(block.viewMatrices[i]));
+    std::memcpy(block.eyePositions[i], glm::value_ptr(camera.eyePosition), 3 * sizeof(float));
+    std::memcpy(block.eyeDirections[i], glm::value_ptr(camera.eyeDirection), 3 * sizeof(float));
+    std::memcpy(block.viewRects[i], glm::value_ptr(views[i].viewport), sizeof(block.viewRects[i]));
+  }
+  block.viewCount = viewCount;
+
+  /// Orphan the previous contents so the write does not wait for frames still in flight
+  glBindBuffer(GL_UNIFORM_BUFFER, cameraBuffer);
+  glBufferData(GL_UNIFORM_BUFFER, sizeof(CameraBlock), nullptr, GL_DYNAMIC_DRAW);
+  glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(CameraBlock), &block);
+
+  /// One view covers the target, more views are cut out of it by the clip distances
+  setClipDistances(viewCount > 1);
+}
+
+/// The full-screen passes write no clip distances, they must be off around them
+void GLRenderDevice::setClipDistances(bool enable)
+{
+  for (int plane = 0; plane < 4; plane++)
+  {
+    if (enable)
+      glEnable(GL_CLIP_DISTANCE0 + plane);
+    else
+      glDisable(GL_CLIP_DISTANCE0 + plane);
+  }
+}
+
+void GLRenderDevice::setLights(const LightParams& lights)
+{
+  GL_DEBUG_SCOPE();
+
+  lastLights = lights;
+
+  GLState::uniform3f(sunDirectionPosition, lights.sunDirection.x, lights.sunDirection.y, lights.sunDirection.z);
+  GLState::uniform3f(lightColorPosition, lights.color.x, lights.color.y, lights.color.z);
+
+  GLState::uniform1i(flashLightEnabledPosition, lights.flashLightEnabled ? 1 : 0);
+  GLState::uniform1i(fogEnabledPosition, lights.fogEnabled ? 1 : 0);
+
+  GLState::uniform3f(pointPositionPosition, lights.pointPosition.x, lights.pointPosition.y, lights.pointPosition.z);
+  GLState::uniform3f(pointColorPosition, lights.pointColor.x, lights.pointColor.y, lights.pointColor.z);
+  GLState::uniform1f(pointIntensityPosition, lights.pointIntensity);
+}
+
+void GLRenderDevice::setOcean(const OceanParams& ocean)
+{
+  GL_DEBUG_SCOPE();
+
+  GLState::activeTexture(GL_TEXTURE0 + OCEAN_DISPLACEMENT_UNIT);
+  GLState::bindTexture(GL_TEXTURE_2D, ocean.displacementMap);
+  GLState::activeTexture(GL_TEXTURE0 + OCEAN_NORMAL_UNIT);
+  GLState::bindTexture(GL_TEXTURE_2D, ocean.normalMap);
+  GLState::uniform1f(oceanPatchSizePosition, ocean.patchSize);
+}
+
+void GLRenderDevice::setAtmosphere(const AtmosphereParams& atmosphere)
+{
+  GL_DEBUG_SCOPE();
+
+  GLState::activeTexture(GL_TEXTURE0 + SKY_TRANSMITTANCE_UNIT);
+  GLState::bindTexture(GL_TEXTURE_2D, atmosphere.transmittance);
+  GLState::activeTexture(GL_TEXTURE0 + SKY_RAYLEIGH_UNIT);
+  GLState::bindTexture(GL_TEXTURE_2D, atmosphere.skyRayleigh);
+  GLState::activeTexture(GL_TEXTURE0 + SKY_MIE_UNIT);
+  GLState::bindTexture(GL_TEXTURE_2D, atmosphere.skyMie);
+  GLState::activeTexture(GL_TEXTURE0);
+
+  GLState::uniform3f(skySamplesPosition, atmosphere.skySamples.x, atmosphere.skySamples.y, atmosphere.skySamples.z);
+  glUniform4f(atmosphereRadiiPosition, atmosphere.groundRadius, atmosphere.topRadius, atmosphere.observerRadius, atmosphere.mieG);
+  GLState::uniform1f(skyExposurePosition, atmosphere.exposure);
+}
+
+void GLRenderDevice::setFog(const FogParams& fog)
+{
+  GL_DEBUG_SCOPE();
+
+  GLState::activeTexture(GL_TEXTURE0 + FROXEL_FOG_UNIT);
+  GLState::bindTexture(GL_TEXTURE_3D, fog.volume);
+  GLState::activeTexture(GL_TEXTURE0);
+
+  GLState::uniformMatrix4fv(fogViewProjectionPosition, glm::value_ptr(fog.viewProjection));
+  glUniform2f(fogDepthRangePosition, fog.nearDepth, std::log(fog.farDepth / fog.nearDepth));
+}
+
+void GLRenderDevice::draw(const DrawCall& call)
+{
+  GL_DEBUG_SCOPE();
+
+  glStencilFunc(GL_ALWAYS, call.objectId, 255);
+
+  GLState::uniform1i(objectTypePosition, call.shaderType);
+
+  GLState::uniformMatrix4fv(transformPosition, glm::value_ptr(call.transform));
+
+  /// Baked meshes read the torch and sky light from their lightmap
+  GLState::uniform1i(lightmapEnabledPosition, call.lightmap != 0 ? 1 : 0);
+  if (call.lightmap != 0)
+  {
+    GLState::activeTexture(GL_TEXTURE0 + LIGHTMAP_UNIT);
+    GLState::bindTexture(GL_TEXTURE_2D, call.lightmap);
+  }
+
+  GLState::activeTexture(GL_TEXTURE0);
+  GLState::bindTexture(GL_TEXTURE_2D, call.texture != 0 ? call.texture : whiteTexture);
+
+  /// One instance per view, the vertex shader picks the view from gl_InstanceID
+  const Mesh& mesh = meshes[call.mesh - 1];
+  GLState::bindVertexArray(mesh.vao);
+  if (mesh.elementBuffer != 0 && viewCount > 1)
+    glDrawElementsInstanced(GL_TRIANGLES, call.vertexCount, GL_UNSIGNED_INT, 0, viewCount);
+  else if (mesh.elementBuffer != 0)
+    glDrawElements(GL_TRIANGLES, call.vertexCount, GL_UNSIGNED_INT, 0);
+  else if (viewCount > 1)
+    glDrawArraysInstanced(GL_TRIANGLES, 0, call.vertexCount, viewCount);
+  else
+    glDrawArrays(GL_TRIANGLES, 0, call.vertexCount);
+}
+
+void GLRenderDevice::drawTerrain(const TerrainCall& call)
+{
+  GL_DEBUG_SCOPE();
+
+  glStencilFunc(GL_ALWAYS, call.objectId, 255);
+
+  GLState::uniform1i(objectTypePosition, SHADER_TERRAIN);
+  GLState::uniform1i(lightmapEnabledPosition, 0);
+  GLState::uniformMatrix4fv(transformPosition, glm::value_ptr(glm::mat4(1.0f)));
+
+  GLState::uniform1f(terrainPatchQuadsPosition, (float)call.patchQuads);
+
+  /// Vectors and arrays bypass the uniform cache
+  glUniform4fv(terrainHeightMapTransformPosition, 1, glm::value_ptr(call.heightMapTransform));
+  glUniform2fv(terrainMorphPosition, (GLsizei)call.morphRanges.size(), &call.morphRanges[0].x);
+  glUniform1i(terrainCutoutCountPosition, (GLint)call.cutouts.size() / 2);
+  if (!call.cutouts.empty())
+    glUniform3fv(terrainCutoutsPosition, (GLsizei)call.cutouts.size(), &call.cutouts[0].x);
+
+  GLState::activeTexture(GL_TEXTURE0 + TERRAIN_HEIGHT_MAP_UNIT);
+  GLState::bindTexture(GL_TEXTURE_2D, call.heightMap);
+  GLState::activeTexture(GL_TEXTURE0);
+  GLState::bindTexture(GL_TEXTURE_2D, call.texture != 0 ? call.texture : whiteTexture);
+
+  glBindBuffer(GL_ARRAY_BUFFER, terrainPatchBuffer);
+  glBufferData(GL_ARRAY_BUFFER, call.patches.size() * sizeof(glm::vec4), call.patches.data(), GL_STREAM_DRAW);
+
+  /// The patch attribute only exists in the VAO of the terrain mesh
+  GLState::bindVertexArray(meshes[call.mesh - 1].vao);
+  glEnableVertexAttribArray(TERRAIN_PATCH_ATTRIBUTE);
+  glVertexAttribPointer(TERRAIN_PATCH_ATTRIBUTE, 4, GL_FLOAT, GL_FALSE, sizeof(glm::vec4), 0);
+  glVertexAttribDivisor(TERRAIN_PATCH_ATTRIBUTE, viewCount);
+
+  /// Each patch is repeated for every view before the next one starts
+  glDrawArraysInstanced(GL_TRIANGLES, 0, call.vertexCount, (GLsizei)call.patches.size() * viewCount);
+}
+
+void GLRenderDevice::drawParticles(const ParticleCall& call)
+{
+  GL_DEBUG_SCOPE();
+
+  GLState::uniform1i(objectTypePosition, SHADER_PARTICLES);
+  GLState::uniform1i(lightmapEnabledPosition, 0);
+  GLState::uniform1i(particleLitPosition, call.lit ? 1 : 0);
+
+  /// Vectors and arrays bypass the uniform cache
+  glm::vec4 colors[2] = { call.startColor, call.endColor };
+  glUniform4fv(particleColorsPosition, 2, glm::value_ptr(colors[0]));
+  glUniform2f(particleSizePosition, call.size.x, call.size.y);
+
+  /// Orphaned every draw, the driver hands out fresh storage while the last frame still reads the old one
+  glBindBuffer(GL_ARRAY_BUFFER, particleBuffer);
+  glBufferData(GL_ARRAY_BUFFER, call.particleCount * sizeof(glm::vec4), nullptr, GL_STREAM_DRAW);
+  glBufferSubData(GL_ARRAY_BUFFER, 0, call.particleCount * sizeof(glm::vec4), call.particles);
+
+  /// Picking ids and depth stay with the surfaces behind the particles
+  glEnable(GL_BLEND);
+  glBlendFunc(GL_SRC_ALPHA, call.additive ? GL_ONE : GL_ONE_MINUS_SRC_ALPHA);
+  glDepthMask(GL_FALSE);
+  glStencilMask(0);
+
+  /// Each particle is repeated for every view before the next one starts
+  GLState::bindVertexArray(particleVao);
+  glVertexAttribDivisor(PARTICLE_ATTRIBUTE, viewCount);
+  glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, call.particleCount * viewCount);
+
+  glStencilMask(255);
+  glDepthMask(GL_TRUE);
+  glDisable(GL_BLEND);
+}
+
+bool GLRenderDevice::beginStaticLayer(uint64_t key)
+{
+  if (staticFramebuffer == 0 || !staticLayerEnabled)
+    return false;
+
+  GL_DEBUG_SCOPE();
+
+  /// A new render scale changes every pixel of the layer
+  key ^= ((uint64_t)renderWidth << 48) ^ ((uint64_t)renderHeight << 32);
+
+  staticLayerActive = true;
+  staticLayerFrames++;
+
+  bool hit = staticLayerValid && key == staticLayerKey;
+  Profiler::counter("static layer hit", hit ? 1.0 : 0.0);
+  if (hit)
+  {
+    staticLayerHits++;
+    return true;
+  }
+
+  staticLayerKey = key;
+  staticLayerValid = true;
+
+  /// Pixels without static geometry get no torch light, the clear alpha is 0
+  GLfloat clearColor[4];
+  glGetFloatv(GL_COLOR_CLEAR_VALUE, clearColor);
+  glBindFramebuffer(GL_FRAMEBUFFER, staticFramebuffer);
+  glClearColor(clearColor[0], clearColor[1], clearColor[2], 0.0f);
+  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+  glClearColor(clearColor[0], clearColor[1], clearColor[2], clearColor[3]);
+
+  GLState::uniform1i(staticLayerPosition, 1);
+  return false;
+}
+
+void GLRenderDevice::endStaticLayer()
+{
+  if (!staticLayerActive)
+    return;
+
+  GL_DEBUG_SCOPE();
+
+  staticLayerActive = false;
+  GLState::uniform1i(staticLayerPosition, 0);
+  composite();
+}
+
+/// Copy the depth and the object ids of the layer, then its color with the current torch
+void GLRenderDevice::composite()
+{
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, staticFramebuffer);
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, targetFramebuffer);
+  glBlitFramebuffer(0, 0, renderWidth, renderHeight, 0, 0, renderWidth, renderHeight, GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT, GL_NEAREST);
+  glBindFramebuffer(GL_FRAMEBUFFER, targetFramebuffer);
+
+  glDisable(GL_DEPTH_TEST);
+  glDisable(GL_STENCIL_TEST);
+  setClipDistances(false);
+
+  /// The composite program has its own uniforms, they bypass the cache keyed by location
+  GLState::useProgram(staticProgram);
+  glUniform3f(staticPointColorPosition, lastLights.pointColor.x, lastLights.pointColor.y, lastLights.pointColor.z);
+  glUniform1f(staticPointIntensityPosition, lastLights.pointIntensity);
+
+  GLState::activeTexture(GL_TEXTURE0);
+  GLState::bindTexture(GL_TEXTURE_2D, staticColor);
+  GLState::bindVertexArray(upscaleVao);
+  glDrawArrays(GL_TRIANGLES, 0, 3);
+
+  GLState::useProgram(program);
+  glEnable(GL_DEPTH_TEST);
+  glEnable(GL_STENCIL_TEST);
+  setClipDistances(viewCount > 1);
+}
+
+void GLRenderDevice::endFrame()
+{
+  glDisable(GL_STENCIL_TEST);
+
+  if (targetFramebuffer != 0)
+    upscale();
+
+  /// The cached static layer was drawn with the old mips
+  if (textureStreamer.update())
+    staticLayerValid = false;
+}
+
+void GLRenderDevice::requestTextureDetail(Handle texture, float uvPerViewHeight)
+{
+  textureStreamer.request(texture, uvPerViewHeight, outputHeight);
+}
+
+void GLRenderDevice::upscale()
+{
+  GL_DEBUG_SCOPE();
+
+  glBindFramebuffer(GL_FRAMEBUFFER, outputFramebuffer);
+  glViewport(0, 0, targetWidth, targetHeight);
+  glDisable(GL_DEPTH_TEST);
+  setClipDistances(false);
+
+  /// The upscale program has its own uniforms, they bypass the cache keyed by location
+  GLState::useProgram(upscaleProgram);
+  glUniform2f(upscaleUvScalePosition, (float)renderWidth / targetWidth, (float)renderHeight / targetHeight);
+  glUniform2f(upscaleTexelSizePosition, 1.0f / targetWidth, 1.0f / targetHeight);
+  glUniform2f(upscaleUvMaxPosition, (renderWidth - 0.5f) / targetWidth, (renderHeight - 0.5f) / targetHeight);
+  glUniform1f(upscaleSharpnessPosition, sharpness);
+
+  GLState::activeTexture(GL_TEXTURE0);
+  GLState::bindTexture(GL_TEXTURE_2D, targetColor);
+  GLState::bindVertexArray(upscaleVao);
+  glDrawArrays(GL_TRIANGLES, 0, 3);
+
+  glEnable(GL_DEPTH_TEST);
+
+  if (sceneStarted)
+  {
+    glQueryCounter(timerQueries[timerFrame][1], GL_TIMESTAMP);
+    timerPending[timerFrame] = true;
+    timerFrame = (timerFrame + 1) % TIMER_FRAMES;
+  }
+}
+
+/// Reads the oldest timestamps only once they are available, the CPU never waits for them
+void GLRenderDevice::readSceneTimer()
+{
+  if (!timerPending[timerFrame])
+    return;
+
+  GLint available = 0;
+  glGetQueryObjectiv(timerQueries[timerFrame][1], GL_QUERY_RESULT_AVAILABLE, &available);
+  if (!available)
+  {
+    /// Still in flight after TIMER_FRAMES frames, its slot is needed again
+    timerPending[timerFrame] = false;
+    return;
+  }
+
+  GLuint64 start = 0;
+  GLuint64 end = 0;
+  glGetQueryObjectui64v(timerQueries[timerFrame][0], GL_QUERY_RESULT, &start);
+  glGetQueryObjectui64v(timerQueries[timerFrame][1], GL_QUERY_RESULT, &end);
+  sceneGpuMs = (end - start) / 1e6;
+  timerPending[timerFrame] = false;
+}
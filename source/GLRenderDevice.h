@@ -0,0 +1,175 @@
+//----------------------------------------------------------------------------------------
+/**
+ * \file       GLRenderDevice.h
+ * \author     Bogdan Putintsev
+ * \date       2021/05/13
+ * \brief      OpenGL backend of the render device
+ *
+*/
+//----------------------------------------------------------------------------------------
+
+#pragma once
+#include "RenderDevice.h"
+#include "TextureStreamer.h"
+
+#include <unordered_map>
+
+class GLRenderDevice : public RenderDevice
+{
+public:
+  void init(GLuint shaderProgram);
+
+  /// Draw the scene into an offscreen target of at most width x height and upscale it to the
+  /// framebuffer bound at beginFrame with the sharpening program. Without it draws go directly
+  /// to that framebuffer.
+  void initRenderTarget(int width, int height, GLuint upscaleShaderProgram);
+  /// Share of the target size drawn from the next frame on, sharpness 0 to 1
+  void setRenderScale(float scale, float sharpness);
+  /// GPU time from the camera upload to the end of the upscale, a few frames old, negative until measured
+  double getSceneGpuMs() const { return sceneGpuMs; }
+  /// Keep the static layer in a second target and composite it with the torch relit by the
+  /// composite program. Needs the render target.
+  void initStaticLayer(GLuint compositeShaderProgram);
+  void setStaticLayerEnabled(bool enable);
+  bool isStaticLayerEnabled() const { return staticLayerEnabled; }
+  void printStaticLayerStats() const;
+
+  /// Resident and needed mips of every file texture, see TextureStreamer
+  void printTextureResidency() const { textureStreamer.printResidency(); }
+  void setTextureStreamingSynchronous(bool enable) { textureStreamer.setSynchronous(enable); }
+  /// Mips are being decoded or uploaded, frames are needed to bring them in
+  bool isStreamingTextures() const { return textureStreamer.getStats().requestsInFlight > 0; }
+
+  /// Object id written by the draw under a window pixel in the last frame, y from the top
+  unsigned char objectIdAt(int windowX, int windowY) const;
+
+  Handle createMesh(const std::vector<float>& vertices, const std::vector<uint32_t>& indices, const std::string& name) override;
+  Handle createTexture(const std::string& path, const std::vector<unsigned char>& content) override;
+  void setMeshLightmapUvs(Handle mesh, const std::vector<float>& uvs) override;
+  void destroyMesh(Handle mesh) override;
+  void destroyTexture(Handle texture) override;
+  Handle createDataTexture(int width, int height) override;
+  void updateDataTexture(Handle texture, const float* texels) override;
+  Handle createVolumeTexture(int width, int height, int depth) override;
+  void updateVolumeTexture(Handle texture, const float* texels) override;
+  size_t getTextureBytes(Handle texture) const override;
+  void requestTextureDetail(Handle texture, float uvPerViewHeight) override;
+
+  void beginFrame() override;
+  void setCamera(const CameraParams& camera) override;
+  void setViews(const std::vector<ViewParams>& views) override;
+  void setLights(const LightParams& lights) override;
+  void setOcean(const OceanParams& ocean) override;
+  void setAtmosphere(const AtmosphereParams& atmosphere) override;
+  void setFog(const FogParams& fog) override;
+  void draw(const DrawCall& call) override;
+  void drawTerrain(const TerrainCall& call) override;
+  void drawParticles(const ParticleCall& call) override;
+  bool beginStaticLayer(uint64_t key) override;
+  void endStaticLayer() override;
+  void endFrame() override;
+
+private:
+  /// GL names of an uploaded mesh
+  struct Mesh
+  {
+    GLuint arrayBuffer;
+    GLuint vao;
+    GLuint elementBuffer = 0;                   ///< 0 for meshes drawn in vertex order
+    GLuint lightmapBuffer = 0;
+  };
+
+  static const int TIMER_FRAMES = 4;            ///< Frames of scene timestamps in flight
+
+  GLuint program = 0;
+  std::vector<Mesh> meshes;
+  std::vector<Handle> freeMeshes;               ///< Slots of destroyed meshes, reused first
+
+  TextureStreamer textureStreamer;              ///< Owns the mips of every createTexture texture
+  int outputHeight = 0;                         ///< Pixels the texture requests of a frame are measured in
+
+  GLuint whiteTexture = 0;                      ///< Bound for texture handle 0
+  GLuint terrainPatchBuffer = 0;                ///< Per-instance patches of drawTerrain
+  GLuint particleBuffer = 0;                    ///< Per-instance particles of drawParticles
+  GLuint particleVao = 0;                       ///< Only the particle attribute, quad corners come from gl_VertexID
+  GLuint cameraBuffer = 0;                      ///< CameraBlock uniform buffer written by setViews
+  int viewCount = 1;                            ///< Instances of every draw
+
+  GLuint targetFramebuffer = 0;                 ///< 0 without initRenderTarget
+  GLuint targetColor = 0;
+  GLuint targetDepthStencil = 0;
+  GLuint outputFramebuffer = 0;                 ///< Bound when the frame began, receives the upscaled image
+  int targetWidth = 0;
+  int targetHeight = 0;
+  int renderWidth = 0;                          ///< Part of the target drawn this frame
+  int renderHeight = 0;
+  float renderScale = 1.0f;
+  float sharpness = 0.0f;
+
+  GLuint upscaleProgram = 0;
+  GLuint upscaleVao = 0;                        ///< Empty, the full-screen triangle comes from gl_VertexID
+  GLint upscaleUvScalePosition;
+  GLint upscaleTexelSizePosition;
+  GLint upscaleUvMaxPosition;
+  GLint upscaleSharpnessPosition;
+
+  GLuint timerQueries[TIMER_FRAMES][2] = {};
+  bool timerPending[TIMER_FRAMES] = {};
+  int timerFrame = 0;
+  bool sceneStarted = false;
+  double sceneGpuMs = -1.0;
+
+  GLuint staticFramebuffer = 0;                 ///< 0 without initStaticLayer
+  GLuint staticColor = 0;                       ///< Color without the torch, torch weight in alpha
+  GLuint staticDepthStencil = 0;
+  GLuint staticProgram = 0;
+  GLint staticPointColorPosition;
+  GLint staticPointIntensityPosition;
+  GLint staticLayerPosition;                    ///< staticLayer uniform of the scene program
+  bool staticLayerEnabled = true;
+  bool staticLayerValid = false;
+  bool staticLayerActive = false;               ///< Between beginStaticLayer and endStaticLayer
+  uint64_t staticLayerKey = 0;
+  uint64_t staticLayerFrames = 0;
+  uint64_t staticLayerHits = 0;
+  LightParams lastLights;
+
+  void upscale();
+  void composite();
+  void setClipDistances(bool enable);
+  void readSceneTimer();
+  std::unordered_map<GLuint, size_t> textureBytes;
+  std::unordered_map<GLuint, glm::ivec2> dataTextureSizes;
+  std::unordered_map<GLuint, glm::ivec3> volumeTextureSizes;
+
+  GLint sunDirectionPosition;
+  GLint lightColorPosition;
+  GLint flashLightEnabledPosition;
+  GLint fogEnabledPosition;
+  GLint pointPositionPosition;
+  GLint pointColorPosition;
+  GLint pointIntensityPosition;
+
+  GLint objectTypePosition;
+  GLint transformPosition;
+  GLint textureSamplerPosition;
+  GLint oceanPatchSizePosition;
+  GLint lightmapEnabledPosition;
+
+  GLint terrainHeightMapTransformPosition;
+  GLint terrainPatchQuadsPosition;
+  GLint terrainMorphPosition;
+  GLint terrainCutoutCountPosition;
+  GLint terrainCutoutsPosition;
+
+  GLint particleColorsPosition;
+  GLint particleSizePosition;
+  GLint particleLitPosition;
+
+  GLint skySamplesPosition;
+  GLint atmosphereRadiiPosition;
+  GLint skyExposurePosition;
+
+  GLint fogViewProjectionPosition;
+  GLint fogDepthRangePosition;                  ///< Near depth and log(far / near) of the froxel slices
+};
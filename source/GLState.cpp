@@ -0,0 +1,188 @@
+//----------------------------------------------------------------------------------------
+/**
+ * \file       GLState.cpp
+ * \author     Bogdan Putintsev
+ * \date       2021/05/13
+ * \brief      Thin state-tracking layer in front of OpenGL
+ *
+*/
+//----------------------------------------------------------------------------------------
+
+#include "GLState.h"
+
+#include <cstdint>
+#include <unordered_map>
+
+namespace
+{
+  const unsigned int MAX_TEXTURE_UNITS = 32;    ///< Tracked texture units
+  const GLuint UNKNOWN = 0xFFFFFFFF;            ///< Value that never matches a real GL name
+
+  /// Cached uniform value, stored as raw 32-bit words so ints and floats compare exactly
+  struct UniformValue
+  {
+    uint32_t words[16];
+    int count = 0;
+  };
+
+  GLuint currentProgram = UNKNOWN;
+  GLuint currentVao = UNKNOWN;
+  GLenum currentUnit = UNKNOWN;
+  GLuint boundTextures[MAX_TEXTURE_UNITS];
+
+  /// Uniform values per program, keyed by program name in the high and location in the low bits
+  std::unordered_map<uint64_t, UniformValue> uniforms;
+
+  GLState::FrameStats frameStats;
+  GLState::FrameStats previousFrameStats;
+
+  bool texturesValid = false;
+
+  void resetTextures()
+  {
+    for (unsigned int i = 0; i < MAX_TEXTURE_UNITS; i++)
+      boundTextures[i] = UNKNOWN;
+    texturesValid = true;
+  }
+}
+
+void GLState::useProgram(GLuint program)
+{
+  if (currentProgram == program)
+  {
+    frameStats.skipped++;
+    return;
+  }
+
+  glUseProgram(program);
+  currentProgram = program;
+  frameStats.issued++;
+}
+
+void GLState::bindVertexArray(GLuint vao)
+{
+  if (currentVao == vao)
+  {
+    frameStats.skipped++;
+    return;
+  }
+
+  glBindVertexArray(vao);
+  currentVao = vao;
+  frameStats.issued++;
+}
+
+void GLState::activeTexture(GLenum unit)
+{
+  if (currentUnit == unit)
+  {
+    frameStats.skipped++;
+    return;
+  }
+
+  glActiveTexture(unit);
+  currentUnit = unit;
+  frameStats.issued++;
+}
+
+void GLState::bindTexture(GLenum target, GLuint texture)
+{
+  if (!texturesValid)
+    resetTextures();
+
+  unsigned int unitIndex = currentUnit - GL_TEXTURE0;
+
+  /// Only 2D textures on known units are tracked, everything else goes straight through
+  if (target != GL_TEXTURE_2D || currentUnit == UNKNOWN || unitIndex >= MAX_TEXTURE_UNITS)
+  {
+    glBindTexture(target, texture);
+    frameStats.issued++;
+    return;
+  }
+
+  if (boundTextures[unitIndex] == texture)
+  {
+    frameStats.skipped++;
+    return;
+  }
+
+  glBindTexture(target, texture);
+  boundTextures[unitIndex] = texture;
+  frameStats.issued++;
+}
+
+void GLState::uniform1i(GLint location, int value)
+{
+  float packed;
+  memcpy(&packed, &value, sizeof(int));
+
+  if (uniformChanged(location, &packed, 1))
+    glUniform1i(location, value);
+}
+
+void GLState::uniform1f(GLint location, float value)
+{
+  if (uniformChanged(location, &value, 1))
+    glUniform1f(location, value);
+}
+
+void GLState::uniform3f(GLint location, float x, float y, float z)
+{
+  float values[3] = { x, y, z };
+
+  if (uniformChanged(location, values, 3))
+    glUniform3f(location, x, y, z);
+}
+
+void GLState::uniformMatrix4fv(GLint location, const float* value)
+{
+  if (uniformChanged(location, value, 16))
+    glUniformMatrix4fv(location, 1, GL_FALSE, value);
+}
+
+bool GLState::uniformChanged(GLint location, const float* values, int count)
+{
+  /// Location -1 is silently ignored by GL, there is nothing to upload and no call was saved
+  if (location < 0)
+    return false;
+
+  uint64_t key = ((uint64_t)currentProgram << 32) | (uint32_t)location;
+  UniformValue& cached = uniforms[key];
+
+  if (cached.count == count && memcmp(cached.words, values, count * sizeof(float)) == 0)
+  {
+    frameStats.skipped++;
+    return false;
+  }
+
+  memcpy(cached.words, values, count * sizeof(float));
+  cached.count = count;
+  frameStats.issued++;
+  return true;
+}
+
+void GLState::beginFrame()
+{
+  previousFrameStats = frameStats;
+  frameStats = FrameStats();
+}
+
+/// Forget the shadowed state. Must be called after GL state was changed behind the cache (e.g. by pgr helpers)
+void GLState::invalidate()
+{
+  currentProgram = UNKNOWN;
+  currentVao = UNKNOWN;
+  currentUnit = UNKNOWN;
+  texturesValid = false;
+  uniforms.clear();
+}
+
+const GLState::FrameStats& GLState::lastFrame()
+{
+  return previousFrameStats;
+}
+
+const GLState::FrameStats& GLState::currentFrame()
+{
+  return frameStats;
+}
@@ -0,0 +1,45 @@
+//----------------------------------------------------------------------------------------
+/**
+ * \file       GLState.h
+ * \author     Bogdan Putintsev
+ * \date       2021/05/13
+ * \brief      Thin state-tracking layer in front of OpenGL
+ *
+ *  Shadows the bound program, VAO, texture units and uniform values and skips
+ *  calls that would not change anything. All modules bind and upload through it.
+ *
+*/
+//----------------------------------------------------------------------------------------
+
+#pragma once
+#include "pgr.h"
+
+class GLState
+{
+public:
+  /// Number of issued and skipped GL calls in one frame
+  struct FrameStats
+  {
+    unsigned int issued = 0;
+    unsigned int skipped = 0;
+  };
+
+  static void useProgram(GLuint program);
+  static void bindVertexArray(GLuint vao);
+  static void activeTexture(GLenum unit);
+  static void bindTexture(GLenum target, GLuint texture);
+
+  static void uniform1i(GLint location, int value);
+  static void uniform1f(GLint location, float value);
+  static void uniform3f(GLint location, float x, float y, float z);
+  static void uniformMatrix4fv(GLint location, const float* value);
+
+  static void beginFrame();
+  static void invalidate();
+
+  static const FrameStats& lastFrame();
+  static const FrameStats& currentFrame();
+
+private:
+  static bool uniformChanged(GLint location, const float* values, int count);
+};
@@ -0,0 +1,135 @@
+//----------------------------------------------------------------------------------------
+/**
+ * \file       HeadlessContext.cpp
+ * \author     Bogdan Putintsev
+ * \date       2021/05/13
+ * \brief      Window-less OpenGL context rendering into an offscreen framebuffer
+ *
+*/
+//----------------------------------------------------------------------------------------
+
+#include "HeadlessContext.h"
+#include "GLDebug.h"
+
+#include <algorithm>
+#include <iostream>
+
+#ifndef _WIN32
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+HeadlessContext::~HeadlessContext()
+{
+#ifndef _WIN32
+  if (framebuffer != 0)
+  {
+    glDeleteFramebuffers(1, &framebuffer);
+    glDeleteRenderbuffers(1, &colorRenderbuffer);
+    glDeleteRenderbuffers(1, &depthRenderbuffer);
+  }
+
+  if (context != nullptr)
+  {
+    eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    eglDestroyContext(display, context);
+  }
+
+  if (display != nullptr)
+    eglTerminate(display);
+#endif
+}
+
+bool HeadlessContext::create(int newWidth, int newHeight)
+{
+#ifdef _WIN32
+  std::cout << "This build has no headless OpenGL context, run with --software" << std::endl;
+  return false;
+#else
+  width = newWidth;
+  height = newHeight;
+
+  PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+  if (getPlatformDisplay != nullptr)
+    display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+  if (display == EGL_NO_DISPLAY)
+    display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+  EGLint major, minor;
+  if (display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor))
+  {
+    std::cout << "Failed to initialize EGL" << std::endl;
+    display = nullptr;
+    return false;
+  }
+
+  eglBindAPI(EGL_OPENGL_API);
+
+  /// No surface is ever created, the default EGL_WINDOW_BIT would rule out surfaceless displays
+  const EGLint configAttributes[] = { EGL_SURFACE_TYPE, 0, EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE };
+  EGLConfig config;
+  EGLint configCount = 0;
+  if (!eglChooseConfig(display, configAttributes, &config, 1, &configCount) || configCount == 0)
+  {
+    std::cout << "No EGL config with desktop OpenGL" << std::endl;
+    return false;
+  }
+
+  const EGLint contextAttributes[] = {
+    EGL_CONTEXT_MAJOR_VERSION, pgr::OGL_VER_MAJOR,
+    EGL_CONTEXT_MINOR_VERSION, pgr::OGL_VER_MINOR,
+    EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+#if GL_VALIDATION
+    EGL_CONTEXT_OPENGL_DEBUG, EGL_TRUE,
+#endif
+    EGL_NONE
+  };
+
+  context = eglCreateContext(display, config, EGL_NO_CONTEXT, contextAttributes);
+  if (context == EGL_NO_CONTEXT || !eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context))
+  {
+    std::cout << "Failed to create a surfaceless OpenGL " << pgr::OGL_VER_MAJOR << "." << pgr::OGL_VER_MINOR << " context" << std::endl;
+    context = nullptr;
+    return false;
+  }
+
+  if (!pgr::initialize(pgr::OGL_VER_MAJOR, pgr::OGL_VER_MINOR))
+    return false;
+
+  /// There is no default framebuffer, everything is rendered into this one
+  glGenRenderbuffers(1, &colorRenderbuffer);
+  glBindRenderbuffer(GL_RENDERBUFFER, colorRenderbuffer);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+
+  glGenRenderbuffers(1, &depthRenderbuffer);
+  glBindRenderbuffer(GL_RENDERBUFFER, depthRenderbuffer);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+
+  glGenFramebuffers(1, &framebuffer);
+  glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colorRenderbuffer);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, depthRenderbuffer);
+
+  if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+  {
+    std::cout << "Offscreen framebuffer is incomplete" << std::endl;
+    return false;
+  }
+
+  std::cout << "Headless OpenGL: " << glGetString(GL_RENDERER) << std::endl;
+  return true;
+#endif
+}
+
+/// Read the offscreen color buffer, flipped so the first row is at the top
+void HeadlessContext::readPixels(Image& image) const
+{
+  image = Image(width, height);
+
+  std::vector<uint32_t> rows(width * height);
+  glPixelStorei(GL_PACK_ALIGNMENT, 4);
+  glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, rows.data());
+
+  for (int y = 0; y < height; y++)
+    std::copy(&rows[(height - 1 - y) * width], &rows[(height - y) * width], &image.pixels[y * width]);
+}
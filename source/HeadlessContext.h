@@ -0,0 +1,37 @@
+//----------------------------------------------------------------------------------------
+/**
+ * \file       HeadlessContext.h
+ * \author     Bogdan Putintsev
+ * \date       2021/05/13
+ * \brief      Window-less OpenGL context rendering into an offscreen framebuffer
+ *
+ *  Written against EGL on the Mesa surfaceless platform. The only build definition of the
+ *  project is the Windows one, where create() fails, so no shipped build has a headless
+ *  OpenGL context yet: the command line modes run headless only with --software.
+ *
+*/
+//----------------------------------------------------------------------------------------
+
+#pragma once
+#include "pgr.h"
+#include "Image.h"
+
+class HeadlessContext
+{
+public:
+  ~HeadlessContext();
+
+  bool create(int width, int height);
+  void readPixels(Image& image) const;
+
+private:
+  void* display = nullptr;
+  void* context = nullptr;
+
+  int width = 0;
+  int height = 0;
+
+  GLuint framebuffer = 0;
+  GLuint colorRenderbuffer = 0;
+  GLuint depthRenderbuffer = 0;
+};
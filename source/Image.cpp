@@ -0,0 +1,96 @@
+//----------------------------------------------------------------------------------------
+/**
+ * \file       Image.cpp
+ * \author     Bogdan Putintsev
+ * \date       2021/05/13
+ * \brief      RGBA8 image with PPM input/output and tolerant comparison
+ *
+*/
+//----------------------------------------------------------------------------------------
+
+#include "Image.h"
+
+#include <cstdlib>
+#include <fstream>
+
+Image::Image(int width, int height)
+  : width(width), height(height), pixels(width * height, 0)
+{
+}
+
+/// Write the image as a binary PPM, alpha is dropped
+bool Image::savePPM(const std::string& path) const
+{
+  std::ofstream out(path, std::ios::binary);
+  if (!out)
+    return false;
+
+  out << "P6\n" << width << " " << height << "\n255\n";
+
+  std::vector<unsigned char> row(width * 3);
+  for (int y = 0; y < height; y++)
+  {
+    for (int x = 0; x < width; x++)
+    {
+      uint32_t pixel = pixels[y * width + x];
+      row[x * 3 + 0] = pixel & 0xFF;
+      row[x * 3 + 1] = (pixel >> 8) & 0xFF;
+      row[x * 3 + 2] = (pixel >> 16) & 0xFF;
+    }
+    out.write((const char*)row.data(), row.size());
+  }
+
+  return (bool)out;
+}
+
+bool Image::loadPPM(const std::string& path)
+{
+  std::ifstream in(path, std::ios::binary);
+  if (!in)
+    return false;
+
+  std::string magic;
+  int maxValue = 0;
+  in >> magic >> width >> height >> maxValue;
+  in.get();
+
+  if (magic != "P6" || maxValue != 255 || width <= 0 || height <= 0)
+    return false;
+
+  pixels.assign(width * height, 0);
+
+  std::vector<unsigned char> row(width * 3);
+  for (int y = 0; y < height; y++)
+  {
+    if (!in.read((char*)row.data(), row.size()))
+      return false;
+
+    for (int x = 0; x < width; x++)
+      pixels[y * width + x] = 0xFF000000 | (row[x * 3 + 2] << 16) | (row[x * 3 + 1] << 8) | row[x * 3 + 0];
+  }
+
+  return true;
+}
+
+double Image::mismatch(const Image& other, int channelTolerance) const
+{
+  if (width != other.width || height != other.height)
+    return 1.0;
+
+  size_t different = 0;
+  for (size_t i = 0; i < pixels.size(); i++)
+  {
+    for (int shift = 0; shift < 24; shift += 8)
+    {
+      int a = (pixels[i] >> shift) & 0xFF;
+      int b = (other.pixels[i] >> shift) & 0xFF;
+      if (abs(a - b) > channelTolerance)
+      {
+        different++;
+        break;
+      }
+    }
+  }
+
+  return pixels.empty() ? 0.0 : (double)different / pixels.size();
+}
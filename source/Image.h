@@ -0,0 +1,32 @@
+//----------------------------------------------------------------------------------------
+/**
+ * \file       Image.h
+ * \author     Bogdan Putintsev
+ * \date       2021/05/13
+ * \brief      RGBA8 image with PPM input/output and tolerant comparison
+ *
+*/
+//----------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class Image
+{
+public:
+  int width = 0;
+  int height = 0;
+  std::vector<uint32_t> pixels;           ///< RGBA8, first row at the top
+
+  Image() {}
+  Image(int width, int height);
+
+  bool savePPM(const std::string& path) const;
+  bool loadPPM(const std::string& path);
+
+  /// Fraction of pixels where any channel differs by more than channelTolerance
+  double mismatch(const Image& other, int channelTolerance) const;
+};
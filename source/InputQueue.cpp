@@ -0,0 +1,90 @@
+//----------------------------------------------------------------------------------------
+/**
+ * \file       InputQueue.cpp
+ * \author     Bogdan Putintsev
+ * \date       2021/05/13
+ * \brief      Timestamped input events applied in batches by the frame
+ *
+*/
+//----------------------------------------------------------------------------------------
+
+#include "InputQueue.h"
+#include "Profiler.h"
+
+#include <algorithm>
+#include <iostream>
+
+void InputQueue::push(Event event)
+{
+  event.timeNs = Profiler::nowNs();
+
+  /// Mouse moves between two frames are one rotation, keep the time of the first one
+  if (event.type == MOUSE_MOVE && !events.empty() && events.back().type == MOUSE_MOVE)
+  {
+    events.back().deltaX += event.deltaX;
+    events.back().deltaY += event.deltaY;
+    events.back().x = event.x;
+    events.back().y = event.y;
+    return;
+  }
+
+  events.push_back(event);
+}
+
+void InputQueue::beginFrame()
+{
+  oldestAppliedNs = 0;
+}
+
+void InputQueue::apply(const std::function<void(const Event&)>& handler, bool cameraOnly)
+{
+  PROFILE_CPU_SCOPE("InputQueue::apply");
+
+  /// The handler may push new events, only the ones queued now are applied
+  size_t count = events.size();
+  for (size_t i = 0; i < count; i++)
+  {
+    if (cameraOnly && !events.front().camera)
+      break;
+
+    Event event = events.front();
+    events.pop_front();
+
+    if (event.camera && (oldestAppliedNs == 0 || event.timeNs < oldestAppliedNs))
+      oldestAppliedNs = event.timeNs;
+
+    handler(event);
+  }
+}
+
+void InputQueue::present()
+{
+  if (oldestAppliedNs == 0)
+    return;
+
+  double latencyMs = (Profiler::nowNs() - oldestAppliedNs) / 1e6;
+  Profiler::counter("input latency ms", latencyMs);
+
+  history[historyNext] = latencyMs;
+  historyNext = (historyNext + 1) % LATENCY_HISTORY;
+  historyCount = std::min(historyCount + 1, LATENCY_HISTORY);
+
+  double sum = 0.0;
+  double maxMs = 0.0;
+  for (int i = 0; i < historyCount; i++)
+  {
+    sum += history[i];
+    maxMs = std::max(maxMs, history[i]);
+  }
+
+  stats.samples = historyCount;
+  stats.lastMs = latencyMs;
+  stats.averageMs = sum / historyCount;
+  stats.maxMs = maxMs;
+}
+
+void InputQueue::printStats() const
+{
+  std::cout << "Input latency over " << stats.samples << " frames: last " << stats.lastMs
+            << " ms, average " << stats.averageMs << " ms, max " << stats.maxMs << " ms" << std::endl;
+}
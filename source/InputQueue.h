@@ -0,0 +1,80 @@
+//----------------------------------------------------------------------------------------
+/**
+ * \file       InputQueue.h
+ * \author     Bogdan Putintsev
+ * \date       2021/05/13
+ * \brief      Timestamped input events applied in batches by the frame
+ *
+ *  Window callbacks only push events. The frame applies all of them at its start, then
+ *  after the CPU work polls the window once more and applies the new camera events right
+ *  before the camera is sent to the device (late latch). The time from the oldest camera
+ *  event of the frame to the return of the buffer swap is kept as the input latency.
+ *
+*/
+//----------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+
+class InputQueue
+{
+public:
+  static const int LATENCY_HISTORY = 128;       ///< Frames kept for the latency statistics
+
+  enum Type
+  {
+    KEY_DOWN,
+    KEY_UP,
+    SPECIAL_KEY,
+    MOUSE_MOVE,                                 ///< Consecutive moves are merged into one
+    MOUSE_CLICK,
+    MENU                                        ///< Entry of the right button menu in key
+  };
+
+  struct Event
+  {
+    Type type = KEY_DOWN;
+    int key = 0;                                ///< Key, special key or mouse button
+    int state = 0;                              ///< Button state of clicks
+    int objectId = 0;                           ///< Picked under the pointer when a click is applied
+    int x = 0;
+    int y = 0;
+    float deltaX = 0.0f;                        ///< Accumulated movement of MOUSE_MOVE
+    float deltaY = 0.0f;
+    bool camera = false;                        ///< Only moves the camera, may be latched late
+    uint64_t timeNs = 0;
+  };
+
+  struct Stats
+  {
+    int samples = 0;
+    double lastMs = 0.0;
+    double averageMs = 0.0;
+    double maxMs = 0.0;
+  };
+
+  void push(Event event);
+
+  /// Start of a frame, forget the events applied by the previous one
+  void beginFrame();
+  /// Pass the queued events to the handler in order. With cameraOnly the camera events
+  /// up to the first other event are applied, the rest waits for the next frame.
+  void apply(const std::function<void(const Event&)>& handler, bool cameraOnly = false);
+  /// Called after the swap returns, records the latency of the frame's camera input
+  void present();
+
+  const Stats& getStats() const { return stats; }
+  void printStats() const;
+
+private:
+  std::deque<Event> events;
+  uint64_t oldestAppliedNs = 0;                 ///< 0 when no camera event was applied this frame
+
+  double history[LATENCY_HISTORY] = {};
+  int historyCount = 0;
+  int historyNext = 0;
+  Stats stats;
+};
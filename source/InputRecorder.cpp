@@ -0,0 +1,295 @@
+//----------------------------------------------------------------------------------------
+/**
+ * \file       InputRecorder.cpp
+ * \author     Bogdan Putintsev
+ * \date       2021/05/13
+ * \brief      Compact binary log of a session's input for deterministic replay
+ *
+*/
+//----------------------------------------------------------------------------------------
+
+#include "InputRecorder.h"
+#include "Constants.h"
+#include "Profiler.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <iterator>
+
+namespace
+{
+  const int CAMERA_FLAG = 8;                    ///< Next to the event type in its first byte
+
+  void writeVarint(std::string& buffer, uint64_t value)
+  {
+    do
+    {
+      uint8_t byte = value & 0x7F;
+      value >>= 7;
+      buffer.push_back((char)(byte | (value != 0 ? 0x80 : 0)));
+    } while (value != 0);
+  }
+
+  void writeSigned(std::string& buffer, int64_t value)
+  {
+    writeVarint(buffer, ((uint64_t)value << 1) ^ (uint64_t)(value >> 63));
+  }
+
+  void writeFloat(std::string& buffer, float value)
+  {
+    char bytes[sizeof(float)];
+    std::memcpy(bytes, &value, sizeof(float));
+    buffer.append(bytes, sizeof(float));
+  }
+
+  void writeUint32(std::string& buffer, uint32_t value)
+  {
+    for (int i = 0; i < 4; i++)
+      buffer.push_back((char)((value >> (8 * i)) & 0xFF));
+  }
+
+  /// Reads a whole log from memory, any read past the end marks it failed
+  struct Reader
+  {
+    const std::string& data;
+    size_t position = 0;
+    bool failed = false;
+
+    explicit Reader(const std::string& data) : data(data) {}
+
+    bool atEnd() const { return position >= data.size(); }
+
+    uint8_t byte()
+    {
+      if (atEnd())
+      {
+        failed = true;
+        return 0;
+      }
+      return (uint8_t)data[position++];
+    }
+
+    uint64_t varint()
+    {
+      uint64_t value = 0;
+      for (int shift = 0; shift < 64 && !failed; shift += 7)
+      {
+        uint8_t next = byte();
+        value |= (uint64_t)(next & 0x7F) << shift;
+        if ((next & 0x80) == 0)
+          break;
+      }
+      return value;
+    }
+
+    int64_t signedVarint()
+    {
+      uint64_t value = varint();
+      return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+    }
+
+    float float32()
+    {
+      float value = 0.0f;
+      if (position + sizeof(float) > data.size())
+      {
+        failed = true;
+        return value;
+      }
+      std::memcpy(&value, data.data() + position, sizeof(float));
+      position += sizeof(float);
+      return value;
+    }
+
+    uint32_t uint32()
+    {
+      uint32_t value = 0;
+      for (int i = 0; i < 4; i++)
+        value |= (uint32_t)byte() << (8 * i);
+      return value;
+    }
+  };
+
+  void writeEvent(std::string& buffer, const InputQueue::Event& event, uint64_t frameTimeUs, uint64_t startNs)
+  {
+    buffer.push_back((char)(event.type | (event.camera ? CAMERA_FLAG : 0)));
+    writeSigned(buffer, event.key);
+    int64_t eventUs = event.timeNs > startNs ? (int64_t)((event.timeNs - startNs) / 1000) : 0;
+    writeSigned(buffer, eventUs - (int64_t)frameTimeUs);
+
+    if (event.type == InputQueue::MOUSE_MOVE)
+    {
+      writeFloat(buffer, event.deltaX);
+      writeFloat(buffer, event.deltaY);
+    }
+    else if (event.type == InputQueue::MOUSE_CLICK)
+    {
+      writeSigned(buffer, event.state);
+      writeSigned(buffer, event.x);
+      writeSigned(buffer, event.y);
+      writeSigned(buffer, event.objectId);
+    }
+  }
+
+  InputQueue::Event readEvent(Reader& reader, uint64_t frameTimeUs)
+  {
+    InputQueue::Event event;
+    uint8_t first = reader.byte();
+    event.type = (InputQueue::Type)(first & (CAMERA_FLAG - 1));
+    event.camera = (first & CAMERA_FLAG) != 0;
+    event.key = (int)reader.signedVarint();
+    event.timeNs = (uint64_t)std::max<int64_t>(0, (int64_t)frameTimeUs + reader.signedVarint()) * 1000;
+
+    if (event.type == InputQueue::MOUSE_MOVE)
+    {
+      event.deltaX = reader.float32();
+      event.deltaY = reader.float32();
+    }
+    else if (event.type == InputQueue::MOUSE_CLICK)
+    {
+      event.state = (int)reader.signedVarint();
+      event.x = (int)reader.signedVarint();
+      event.y = (int)reader.signedVarint();
+      event.objectId = (int)reader.signedVarint();
+    }
+
+    if (event.type > InputQueue::MENU)
+      reader.failed = true;
+    return event;
+  }
+}
+
+bool InputRecorder::start(const std::string& logPath, uint32_t seed)
+{
+  stop();
+
+  out.open(logPath, std::ios::binary | std::ios::trunc);
+  if (!out)
+  {
+    std::cout << "Failed to open the input log " << logPath << std::endl;
+    return false;
+  }
+
+  path = logPath;
+  startNs = Profiler::nowNs();
+  lastTimeUs = 0;
+  frameOpen = false;
+  frames = events = 0;
+
+  std::string header;
+  writeUint32(header, MAGIC);
+  writeUint32(header, VERSION);
+  writeUint32(header, seed);
+  writeUint32(header, (uint32_t)timerDelay);
+  out.write(header.data(), header.size());
+  bytes = header.size();
+
+  std::cout << "Recording input to " << logPath << ", seed " << seed << std::endl;
+  return true;
+}
+
+void InputRecorder::stop()
+{
+  if (!out.is_open())
+    return;
+
+  if (frameOpen)
+    writeFrame();
+  out.close();
+
+  std::cout << "Input log " << path << ": " << frames << " frames, " << events << " events, " << bytes << " bytes ("
+            << (frames > 0 ? (double)bytes / frames : 0.0) << " per frame)" << std::endl;
+}
+
+void InputRecorder::beginFrame(int ticks)
+{
+  if (!out.is_open())
+    return;
+
+  if (frameOpen)
+    writeFrame();
+
+  frame.ticks = ticks;
+  frame.timeUs = (Profiler::nowNs() - startNs) / 1000;
+  frame.events.clear();
+  frame.latchedEvents.clear();
+  frameOpen = true;
+  latched = false;
+}
+
+void InputRecorder::record(const InputQueue::Event& event)
+{
+  if (!frameOpen)
+    return;
+
+  (latched ? frame.latchedEvents : frame.events).push_back(event);
+}
+
+void InputRecorder::writeFrame()
+{
+  std::string buffer;
+  writeVarint(buffer, (uint64_t)frame.ticks);
+  writeVarint(buffer, frame.timeUs - lastTimeUs);
+  writeVarint(buffer, frame.events.size());
+  writeVarint(buffer, frame.latchedEvents.size());
+
+  for (const InputQueue::Event& event : frame.events)
+    writeEvent(buffer, event, frame.timeUs, startNs);
+  for (const InputQueue::Event& event : frame.latchedEvents)
+    writeEvent(buffer, event, frame.timeUs, startNs);
+
+  out.write(buffer.data(), buffer.size());
+  lastTimeUs = frame.timeUs;
+  frameOpen = false;
+
+  frames++;
+  events += frame.events.size() + frame.latchedEvents.size();
+  bytes += buffer.size();
+}
+
+bool InputRecorder::load(const std::string& logPath, Log& log)
+{
+  std::ifstream in(logPath, std::ios::binary);
+  if (!in)
+  {
+    std::cout << "Failed to open the input log " << logPath << std::endl;
+    return false;
+  }
+
+  std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+  Reader reader(data);
+
+  if (reader.uint32() != MAGIC || reader.uint32() != VERSION)
+  {
+    std::cout << logPath << " is not an input log of version " << VERSION << std::endl;
+    return false;
+  }
+
+  log.seed = reader.uint32();
+  log.timerDelayMs = reader.uint32();
+  log.frames.clear();
+
+  uint64_t timeUs = 0;
+  while (!reader.atEnd() && !reader.failed)
+  {
+    Frame frame;
+    frame.ticks = (int)reader.varint();
+    timeUs += reader.varint();
+    frame.timeUs = timeUs;
+
+    uint64_t eventCount = reader.varint();
+    uint64_t latchedCount = reader.varint();
+    for (uint64_t i = 0; i < eventCount && !reader.failed; i++)
+      frame.events.push_back(readEvent(reader, timeUs));
+    for (uint64_t i = 0; i < latchedCount && !reader.failed; i++)
+      frame.latchedEvents.push_back(readEvent(reader, timeUs));
+
+    if (!reader.failed)
+      log.frames.push_back(frame);
+  }
+
+  if (reader.failed)
+    std::cout << "Input log " << logPath << " is truncated, replaying its first " << log.frames.size() << " frames" << std::endl;
+  return true;
+}
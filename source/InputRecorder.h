@@ -0,0 +1,84 @@
+//----------------------------------------------------------------------------------------
+/**
+ * \file       InputRecorder.h
+ * \author     Bogdan Putintsev
+ * \date       2021/05/13
+ * \brief      Compact binary log of a session's input for deterministic replay
+ *
+ *  A session recorded from its start is fully described by the seed of the scene's random
+ *  numbers and, for every drawn frame, the timer ticks it stood for and the input events
+ *  it applied, split into those applied at its start and those applied by the late latch.
+ *  Picking reads the last rendered frame, so a button release keeps the object id it
+ *  resolved to instead of its pixel. Replaying the frames in order at their ticks gives the
+ *  same scene state on any backend, whatever the frame rate of the recording.
+ *
+ *  Layout, little endian: the header (magic, version, seed, timer delay in ms) and then one
+ *  record per frame. Counts, ticks, keys and times are LEB128 varints, times are deltas in
+ *  microseconds, mouse deltas are raw floats, so most frames take a few bytes.
+ *
+*/
+//----------------------------------------------------------------------------------------
+
+#pragma once
+#include "InputQueue.h"
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+class InputRecorder
+{
+public:
+  static const uint32_t MAGIC = 0x474F4C49;     ///< "ILOG"
+  static const uint32_t VERSION = 1;
+
+  /// One drawn frame of the session
+  struct Frame
+  {
+    int ticks = 1;                              ///< Timer ticks the frame stood for
+    uint64_t timeUs = 0;                        ///< Start of the frame since the recording started
+    std::vector<InputQueue::Event> events;      ///< Applied at the start of the frame
+    std::vector<InputQueue::Event> latchedEvents; ///< Applied by the late latch
+  };
+
+  struct Log
+  {
+    uint32_t seed = 0;
+    uint32_t timerDelayMs = 0;
+    std::vector<Frame> frames;
+  };
+
+  ~InputRecorder() { stop(); }
+
+  /// Start a log at path, the scene must be seeded with seed
+  bool start(const std::string& path, uint32_t seed);
+  /// Write the last frame and close the log
+  void stop();
+  bool isRecording() const { return out.is_open(); }
+
+  /// A drawn frame begins, events recorded from now on are applied at its start
+  void beginFrame(int ticks);
+  /// Events recorded from now on were applied by the late latch
+  void latch() { latched = true; }
+  /// An event as it was applied, timeNs is the push time of the queue
+  void record(const InputQueue::Event& event);
+
+  /// Read a whole log, false when it is missing or not a log of this version
+  static bool load(const std::string& path, Log& log);
+
+private:
+  std::ofstream out;
+  std::string path;
+  uint64_t startNs = 0;
+  uint64_t lastTimeUs = 0;                      ///< Of the previous frame or event, times are deltas
+  bool frameOpen = false;
+  bool latched = false;
+  Frame frame;
+
+  uint64_t frames = 0;
+  uint64_t events = 0;
+  uint64_t bytes = 0;
+
+  void writeFrame();
+};
@@ -0,0 +1,366 @@
+//----------------------------------------------------------------------------------------
+/**
+ * \file       JobSystem.cpp
+ * \author     Bogdan Putintsev
+ * \date       2021/05/13
+ * \brief      Work-stealing job scheduler with child jobs and dependencies
+ *
+*/
+//----------------------------------------------------------------------------------------
+
+#include "JobSystem.h"
+#include "Profiler.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+
+namespace
+{
+  const int SPIN_ROUNDS = 64;                   ///< Failed searches of an idle worker before it sleeps
+
+  /// Which system and thread the current thread works for
+  struct ThreadContext
+  {
+    const JobSystem* system = nullptr;
+    unsigned int thread = 0;
+  };
+
+  thread_local ThreadContext context;
+}
+
+bool JobSystem::WorkQueue::push(Job* job)
+{
+  int64_t b = bottom.load(std::memory_order_relaxed);
+  int64_t t = top.load(std::memory_order_acquire);
+  if (b - t >= JOB_CAPACITY)
+    return false;
+
+  slots[b & (JOB_CAPACITY - 1)].store(job, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  bottom.store(b + 1, std::memory_order_relaxed);
+  return true;
+}
+
+JobSystem::Job* JobSystem::WorkQueue::pop()
+{
+  int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+  bottom.store(b, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  int64_t t = top.load(std::memory_order_relaxed);
+
+  if (t > b)
+  {
+    bottom.store(b + 1, std::memory_order_relaxed);
+    return nullptr;
+  }
+
+  Job* job = slots[b & (JOB_CAPACITY - 1)].load(std::memory_order_relaxed);
+  if (t == b)
+  {
+    /// The last job, a thief may be taking it at the same time
+    if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+      job = nullptr;
+    bottom.store(b + 1, std::memory_order_relaxed);
+  }
+  return job;
+}
+
+JobSystem::Job* JobSystem::WorkQueue::steal()
+{
+  int64_t t = top.load(std::memory_order_acquire);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  int64_t b = bottom.load(std::memory_order_acquire);
+  if (t >= b)
+    return nullptr;
+
+  Job* job = slots[t & (JOB_CAPACITY - 1)].load(std::memory_order_relaxed);
+  if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+    return nullptr;
+  return job;
+}
+
+JobSystem::JobSystem(unsigned int threadCount)
+{
+  if (threadCount == 0)
+    threadCount = std::max(1u, std::thread::hardware_concurrency());
+
+  for (unsigned int i = 0; i < threadCount; i++)
+  {
+    workers.push_back(std::unique_ptr<Worker>(new Worker()));
+    workers.back()->victim = i + 1;
+  }
+
+  for (unsigned int i = 1; i < threadCount; i++)
+    threads.push_back(std::thread(&JobSystem::workerLoop, this, i));
+}
+
+JobSystem::~JobSystem()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stop = true;
+  }
+  wake.notify_all();
+
+  for (auto& thread : threads)
+    thread.join();
+}
+
+unsigned int JobSystem::getCurrentThread() const
+{
+  return context.system == this ? context.thread : 0;
+}
+
+JobSystem::Job* JobSystem::allocate()
+{
+  unsigned int thread = getCurrentThread();
+  Worker& worker = *workers[thread];
+
+  /// Slots come round again after JOB_CAPACITY jobs, the ones still in flight are skipped
+  while (true)
+  {
+    for (int probe = 0; probe < JOB_CAPACITY; probe++)
+    {
+      Job* job = &worker.jobs[worker.allocated++ & (JOB_CAPACITY - 1)];
+      if (isFinished(job))
+        return job;
+    }
+
+    /// Every slot is in flight, help until one finishes
+    Job* other = findJob(thread);
+    if (other != nullptr)
+      execute(other);
+    else
+      std::this_thread::yield();
+  }
+}
+
+bool JobSystem::addDependency(Job* before, Job* after)
+{
+  int slot = before->continuationCount.load(std::memory_order_relaxed);
+  if (slot >= MAX_CONTINUATIONS)
+    return false;
+
+  after->pending.fetch_add(1, std::memory_order_relaxed);
+  before->continuations[slot] = after;
+  before->continuationCount.store(slot + 1, std::memory_order_relaxed);
+  return true;
+}
+
+void JobSystem::run(Job* job)
+{
+  if (job->pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    push(job);
+}
+
+void JobSystem::push(Job* job)
+{
+  /// A full deque runs the job right away
+  if (!workers[getCurrentThread()]->queue.push(job))
+  {
+    execute(job);
+    return;
+  }
+
+  pushes.fetch_add(1);
+  if (sleeping.load() > 0)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    wake.notify_one();
+  }
+}
+
+JobSystem::Job* JobSystem::findJob(unsigned int thread)
+{
+  Worker& worker = *workers[thread];
+  Job* job = worker.queue.pop();
+  if (job != nullptr)
+    return job;
+
+  unsigned int count = (unsigned int)workers.size();
+  for (unsigned int attempt = 1; attempt < count; attempt++)
+  {
+    unsigned int victim = worker.victim++ % count;
+    if (victim == thread)
+      victim = worker.victim++ % count;
+
+    job = workers[victim]->queue.steal();
+    if (job != nullptr)
+      return job;
+  }
+  return nullptr;
+}
+
+void JobSystem::execute(Job* job)
+{
+  job->invoke(job->payload);
+  job->destroy(job->payload);
+  finish(job);
+}
+
+void JobSystem::finish(Job* job)
+{
+  /// Read before the count drops, a finished slot may be reused at once
+  Job* parent = job->parent;
+  int count = job->continuationCount.load(std::memory_order_relaxed);
+  Job* continuations[MAX_CONTINUATIONS];
+  std::copy(job->continuations, job->continuations + count, continuations);
+
+  if (job->unfinished.fetch_sub(1, std::memory_order_acq_rel) != 1)
+    return;
+
+  for (int i = 0; i < count; i++)
+    run(continuations[i]);
+
+  if (parent != nullptr)
+    finish(parent);
+}
+
+void JobSystem::wait(const Job* job)
+{
+  unsigned int thread = getCurrentThread();
+  while (!isFinished(job))
+  {
+    Job* other = findJob(thread);
+    if (other != nullptr)
+      execute(other);
+    else
+      std::this_thread::yield();
+  }
+}
+
+void JobSystem::workerLoop(unsigned int thread)
+{
+  context.system = this;
+  context.thread = thread;
+
+  int idle = 0;
+  while (!stop)
+  {
+    uint64_t seen = pushes.load();
+    Job* job = findJob(thread);
+    if (job != nullptr)
+    {
+      execute(job);
+      idle = 0;
+      continue;
+    }
+
+    if (++idle < SPIN_ROUNDS)
+    {
+      std::this_thread::yield();
+      continue;
+    }
+
+    /// A push after the load of seen changes pushes, so no job is missed while asleep
+    std::unique_lock<std::mutex> lock(mutex);
+    sleeping++;
+    wake.wait(lock, [this, seen] { return stop || pushes.load() != seen; });
+    sleeping--;
+    idle = 0;
+  }
+}
+
+void JobSystem::splitRange(Job* root, unsigned int begin, unsigned int end, unsigned int grain,
+                           const std::function<void(unsigned int, unsigned int)>& body)
+{
+  /// Hand the upper half to the deque and keep halving the lower one
+  while (end - begin > grain)
+  {
+    unsigned int middle = begin + (end - begin) / 2;
+    run(create([this, root, middle, end, grain, &body] { splitRange(root, middle, end, grain, body); }, root));
+    end = middle;
+  }
+  body(begin, end);
+}
+
+void JobSystem::parallelFor(unsigned int count, unsigned int grain, const std::function<void(unsigned int, unsigned int)>& body)
+{
+  if (count == 0)
+    return;
+
+  Job* root = create([] {});
+  run(create([this, root, count, grain, &body] { splitRange(root, 0, count, std::max(grain, 1u), body); }, root));
+  run(root);
+  wait(root);
+}
+
+void JobSystem::benchmark()
+{
+  const int EMPTY_JOBS = 1000;                  ///< Children of one root, fits in the job ring of one thread
+  const int EMPTY_BATCHES = 100;
+  const int CHAIN_LENGTH = 1000;                ///< Fits in the job ring of one thread
+  const int CHAINS = 20;
+  const unsigned int LOOP_COUNT = 1 << 22;
+  const unsigned int LOOP_GRAIN = 4096;
+  const int LOOPS = 20;
+
+  unsigned int hardware = std::max(1u, std::thread::hardware_concurrency());
+  std::vector<unsigned int> threadCounts = { 1, 2, 4, hardware };
+  std::sort(threadCounts.begin(), threadCounts.end());
+  threadCounts.erase(std::unique(threadCounts.begin(), threadCounts.end()), threadCounts.end());
+
+  std::vector<float> values(LOOP_COUNT);
+  auto work = [&values](unsigned int begin, unsigned int end) {
+    for (unsigned int i = begin; i < end; i++)
+      values[i] = std::sqrt((float)i) * 0.5f + values[i] * 0.25f;
+  };
+
+  std::cout << "Job system benchmark (" << EMPTY_BATCHES << " batches of " << EMPTY_JOBS << " empty jobs, " << CHAINS << " chains of " << CHAIN_LENGTH
+            << " dependent jobs, " << LOOPS << " loops over " << LOOP_COUNT << " items in ranges of " << LOOP_GRAIN << ")" << std::endl;
+  std::cout << std::setw(9) << "threads" << std::setw(14) << "ns/empty job" << std::setw(14) << "ns/chain job" << std::setw(12) << "loop ms"
+            << std::setw(16) << "ThreadPool ms" << std::endl;
+  std::cout << std::fixed << std::setprecision(3);
+
+  for (unsigned int threads : threadCounts)
+  {
+    JobSystem jobs(threads);
+    ThreadPool pool(threads);
+
+    /// Spawn, schedule and finish cost: empty children of one root
+    uint64_t start = Profiler::nowNs();
+    for (int batch = 0; batch < EMPTY_BATCHES; batch++)
+    {
+      Job* root = jobs.create([] {});
+      for (int i = 0; i < EMPTY_JOBS; i++)
+        jobs.run(jobs.create([] {}, root));
+      jobs.run(root);
+      jobs.wait(root);
+    }
+    double emptyNs = (double)(Profiler::nowNs() - start) / (EMPTY_BATCHES * EMPTY_JOBS);
+
+    /// Each job started by the finish of the previous one
+    start = Profiler::nowNs();
+    for (int chain = 0; chain < CHAINS; chain++)
+    {
+      std::vector<Job*> chainJobs(CHAIN_LENGTH);
+      for (int i = 0; i < CHAIN_LENGTH; i++)
+      {
+        chainJobs[i] = jobs.create([] {});
+        if (i > 0)
+          jobs.addDependency(chainJobs[i - 1], chainJobs[i]);
+      }
+      for (Job* job : chainJobs)
+        jobs.run(job);
+      jobs.wait(chainJobs.back());
+    }
+    double chainNs = (double)(Profiler::nowNs() - start) / (CHAINS * CHAIN_LENGTH);
+
+    start = Profiler::nowNs();
+    for (int loop = 0; loop < LOOPS; loop++)
+      jobs.parallelFor(LOOP_COUNT, LOOP_GRAIN, work);
+    double loopMs = (Profiler::nowNs() - start) / 1e6 / LOOPS;
+
+    start = Profiler::nowNs();
+    for (int loop = 0; loop < LOOPS; loop++)
+      pool.parallelFor(LOOP_COUNT / LOOP_GRAIN, [&work](unsigned int block) { work(block * LOOP_GRAIN, (block + 1) * LOOP_GRAIN); });
+    double poolMs = (Profiler::nowNs() - start) / 1e6 / LOOPS;
+
+    std::cout << std::setw(9) << threads << std::setw(14) << emptyNs << std::setw(14) << chainNs << std::setw(12) << loopMs
+              << std::setw(16) << poolMs << std::endl;
+  }
+  std::cout << std::defaultfloat;
+}
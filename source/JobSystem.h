@@ -0,0 +1,147 @@
+//----------------------------------------------------------------------------------------
+/**
+ * \file       JobSystem.h
+ * \author     Bogdan Putintsev
+ * \date       2021/05/13
+ * \brief      Work-stealing job scheduler with child jobs and dependencies
+ *
+ *  Every thread owns a deque of ready jobs (Chase-Lev, lock free): it pushes and pops at
+ *  the bottom, idle threads steal the oldest job from the top of another deque. A job runs
+ *  a small callable stored in the job itself, so creating one allocates nothing: jobs come
+ *  from a ring of JOB_CAPACITY slots per thread and a slot is reused once its job finished.
+ *
+ *  A job finishes when it ran and all of its children finished, which is how waiting for a
+ *  whole batch works. Dependencies start a job when the last job it depends on finished,
+ *  they are declared before either job is run. A thread waiting for a job runs other jobs
+ *  meanwhile, so jobs may wait for their own children. Idle workers spin briefly and then
+ *  sleep until a job is pushed.
+ *
+ *  The system belongs to the thread that creates it: jobs are created, run and waited for
+ *  by that thread and by the jobs themselves. A thread can have at most JOB_CAPACITY jobs
+ *  created and not finished, a job pointer is only valid until its job finished.
+ *
+*/
+//----------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+class JobSystem
+{
+public:
+  static const int JOB_CAPACITY = 2048;         ///< Job slots and deque size per thread, a power of two
+  static const int MAX_CONTINUATIONS = 8;       ///< Jobs that may depend on one job
+  static const int PAYLOAD_SIZE = 64;           ///< Bytes of the callable stored in a job
+
+  struct Job
+  {
+    void (*invoke)(void* payload) = nullptr;
+    void (*destroy)(void* payload) = nullptr;
+    Job* parent = nullptr;
+    std::atomic<int> unfinished{ 0 };           ///< The job itself and its unfinished children
+    std::atomic<int> pending{ 0 };              ///< Unfinished dependencies, plus one until it is run
+    std::atomic<int> continuationCount{ 0 };
+    Job* continuations[MAX_CONTINUATIONS] = {};
+    alignas(std::max_align_t) unsigned char payload[PAYLOAD_SIZE];
+  };
+
+  /// threadCount 0 uses all hardware threads, the creating thread counts as one of them
+  explicit JobSystem(unsigned int threadCount = 0);
+  ~JobSystem();
+
+  /// A job calling function, it only starts with run. A parent finishes after its children.
+  template <typename Function>
+  Job* create(Function&& function, Job* parent = nullptr);
+  /// after starts once before finished, false when before has no room for another continuation
+  bool addDependency(Job* before, Job* after);
+  /// Let the job start as soon as its dependencies finished
+  void run(Job* job);
+  /// Run other jobs until this one and its children finished
+  void wait(const Job* job);
+  bool isFinished(const Job* job) const { return job->unfinished.load(std::memory_order_acquire) == 0; }
+
+  /// Run body(begin, end) over ranges of at most grain items on all threads and wait for them.
+  /// The range is halved recursively, so idle threads steal large halves first.
+  void parallelFor(unsigned int count, unsigned int grain, const std::function<void(unsigned int, unsigned int)>& body);
+
+  unsigned int getThreadCount() const { return (unsigned int)workers.size(); }
+  /// 0 on the creating thread, 1 .. getThreadCount() - 1 on the workers
+  unsigned int getCurrentThread() const;
+
+  /// Print the cost of empty jobs, of dependency chains and of parallel loops against ThreadPool
+  static void benchmark();
+
+private:
+  /// Chase-Lev deque of one thread, only its owner pushes and pops
+  class WorkQueue
+  {
+  public:
+    bool push(Job* job);
+    Job* pop();
+    Job* steal();
+
+  private:
+    alignas(64) std::atomic<int64_t> top{ 0 };
+    alignas(64) std::atomic<int64_t> bottom{ 0 };
+    std::atomic<Job*> slots[JOB_CAPACITY];
+  };
+
+  struct Worker
+  {
+    WorkQueue queue;
+    std::unique_ptr<Job[]> jobs{ new Job[JOB_CAPACITY] };
+    uint32_t allocated = 0;
+    uint32_t victim = 0;                        ///< Next deque tried when stealing
+  };
+
+  std::vector<std::unique_ptr<Worker>> workers;
+  std::vector<std::thread> threads;
+
+  std::atomic<bool> stop{ false };
+  std::atomic<uint64_t> pushes{ 0 };            ///< Sleeping workers wake when it changes
+  std::atomic<int> sleeping{ 0 };
+  std::mutex mutex;
+  std::condition_variable wake;
+
+  Job* allocate();
+  void push(Job* job);
+  Job* findJob(unsigned int thread);
+  void execute(Job* job);
+  void finish(Job* job);
+  void workerLoop(unsigned int thread);
+  void splitRange(Job* root, unsigned int begin, unsigned int end, unsigned int grain,
+                  const std::function<void(unsigned int, unsigned int)>& body);
+};
+
+template <typename Function>
+JobSystem::Job* JobSystem::create(Function&& function, Job* parent)
+{
+  typedef typename std::decay<Function>::type Callable;
+  static_assert(sizeof(Callable) <= PAYLOAD_SIZE, "the job function captures too much, capture a pointer instead");
+  static_assert(alignof(Callable) <= alignof(std::max_align_t), "the job function is over-aligned");
+
+  Job* job = allocate();
+  new (job->payload) Callable(std::forward<Function>(function));
+  job->invoke = [](void* payload) { (*static_cast<Callable*>(payload))(); };
+  job->destroy = [](void* payload) { static_cast<Callable*>(payload)->~Callable(); };
+  job->parent = parent;
+  job->pending.store(1, std::memory_order_relaxed);
+  job->continuationCount.store(0, std::memory_order_relaxed);
+  job->unfinished.store(1, std::memory_order_release);
+
+  if (parent != nullptr)
+    parent->unfinished.fetch_add(1, std::memory_order_relaxed);
+  return job;
+}
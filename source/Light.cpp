@@ -10,8 +10,17 @@
 
 
 #include "Light.h"
+#include "Profiler.h"
+#include <algorithm>
+#include <cmath>
 #include <iostream>
 
+namespace
+{
+  const float SUN_SPEED = 0.0005f;              ///< Day cycle per timer tick
+  const float SUN_STEP = 0.005f;                ///< Sun movement tolerated by a cached static layer, 10 ticks
+}
+
 Light::Light(glm::vec3 lightColor, glm::vec3 lightDirection)
 {
   flashLightEnabled = false;
@@ -25,53 +34,49 @@ Light::Light(glm::vec3 lightColor, glm::vec3 lightDirection)
   pointLight.intensity = 5.0f;
 }
 
-void Light::init(GLuint shaderProgram)
+void Light::update(int ticks)
 {
-  directionPosition = glGetUniformLocation(shaderProgram, "sunDirection");
-  colorPosition = glGetUniformLocation(shaderProgram, "lightColor");
-  flashLightEnabledPosition = glGetUniformLocation(shaderProgram, "flashLightEnabled");
-  fogEnabledPosition = glGetUniformLocation(shaderProgram, "fogEnabled");
-  sunAlphaPosition = glGetUniformLocation(shaderProgram, "sunAlpha");
+  frameParams = getParams();
+  direction = frameParams.sunDirection;
 
-  pointLight.transformPos = glGetUniformLocation(shaderProgram, "pointPosition");
-  pointLight.colorPos = glGetUniformLocation(shaderProgram, "pointColor");
-  pointLight.intensityPos = glGetUniformLocation(shaderProgram, "pointIntensity");
+  sunAlpha += SUN_SPEED * ticks;
+  if (sunAlpha > 1.0f)
+    sunAlpha = std::fmod(sunAlpha, 1.0f);
 
-  CHECK_GL_ERROR();
+  drawPointLight(frameParams);
 }
 
-void Light::draw()
+void Light::draw(RenderDevice& device)
 {
-  direction.x = cos(sunAlpha * 2 * M_PI);
-  direction.y = sin(sunAlpha * 2 * M_PI);
-  direction.z = 0.0f;
+  PROFILE_GPU_SCOPE("Light::draw");
 
-  sunAlpha += 0.0005f;
-  if (sunAlpha > 1.0f)
-    sunAlpha = 0.0f;
-
-  float sunFunction = (4 * sunAlpha * sunAlpha) - (4 * sunAlpha) + 1;
-  glUniform1f(sunAlphaPosition, sunFunction);
+  device.setLights(frameParams);
+}
 
-  glUniform3f(directionPosition, direction.x, direction.y, direction.z);
-  glUniform3f(colorPosition, color.x, color.y, color.z);
+RenderDevice::LightParams Light::getParams() const
+{
+  RenderDevice::LightParams params;
 
-  glUniform1i(flashLightEnabledPosition, flashLightEnabled ? 1 : 0);
-  glUniform1i(fogEnabledPosition, fogEnabled ? 1 : 0);
+  params.sunDirection = glm::vec3(cos(sunAlpha * 2 * M_PI), sin(sunAlpha * 2 * M_PI), 0.0f);
+  params.color = color;
 
-  drawPointLight();
+  params.flashLightEnabled = flashLightEnabled;
+  params.fogEnabled = fogEnabled;
 
-  CHECK_GL_ERROR();
+  params.pointPosition = pointLight.transform;
+  params.pointColor = pointLight.color;
+  params.pointIntensity = pointLight.intensity;
+  return params;
 }
 
-void Light::drawPointLight()
+void Light::drawPointLight(RenderDevice::LightParams& params)
 {
-  pointLight.intensity = std::max(2.0f, pointLight.intensity + (rand() % 4) - 2);
-  pointLight.color.y = std::max(std::min(0.0f, pointLight.color.y + (rand() / 10) - 0.05f), 0.5f);
+  pointLight.intensity = std::max(2.0f, pointLight.intensity + (nextRandom() % 4) - 2);
+  pointLight.color.y = std::max(std::min(0.0f, pointLight.color.y + (nextRandom() / 10) - 0.05f), 0.5f);
 
-  glUniform3f(pointLight.transformPos, pointLight.transform.x, pointLight.transform.y, pointLight.transform.z);
-  glUniform3f(pointLight.colorPos, pointLight.color.x, pointLight.color.y, pointLight.color.z);
-  glUniform1f(pointLight.intensityPos, pointLight.intensity);
+  params.pointPosition = pointLight.transform;
+  params.pointColor = pointLight.color;
+  params.pointIntensity = pointLight.intensity;
 }
 
 void Light::switchFlashLight()
@@ -82,5 +87,16 @@ void Light::switchFlashLight()
 void Light::switchFog()
 {
   fogEnabled = !fogEnabled;
-  glUniform1i(fogEnabledPosition, fogEnabled);
-}
\ No newline at end of file
+}
+
+int Light::ticksToNextStep() const
+{
+  float nextStep = (std::floor(sunAlpha / SUN_STEP) + 1.0f) * SUN_STEP;
+  return std::max(1, (int)std::ceil((nextStep - sunAlpha) / SUN_SPEED));
+}
+
+uint64_t Light::getStaticKey() const
+{
+  uint64_t sunStep = (uint64_t)(sunAlpha / SUN_STEP);
+  return (sunStep << 2) | (flashLightEnabled ? 2 : 0) | (fogEnabled ? 1 : 0);
+}
@@ -10,6 +10,10 @@
 
 #pragma once
 #include "pgr.h"
+#include "RenderDevice.h"
+
+#include <cstdint>
+#include <random>
 
 class Light
 {
@@ -21,33 +25,45 @@ private:
   bool fogEnabled;
   float sunAlpha = 0.0f;
 
-  unsigned int colorPosition;
-  unsigned int directionPosition;
-  unsigned int flashLightEnabledPosition;
-  unsigned int fogEnabledPosition;
-  unsigned int sunAlphaPosition;
-
   /// A structure for a point light with its color and position
   struct PointLight
   {
     glm::vec3 transform = glm::vec3(0.0f, 0.0f, 0.0f);
     glm::vec3 color = glm::vec3(1.0f, 1.0f, 1.0f);
     float intensity = 0.0f;
-
-    unsigned int transformPos;
-    unsigned int intensityPos;
-    unsigned int colorPos;
   };
 
   PointLight pointLight;
+  RenderDevice::LightParams frameParams;        ///< Of the last update, sent by draw
+
+  /// Drives the torch flicker, seeded so recorded sessions replay the same flicker
+  std::mt19937 random;
+  /// Non-negative like rand()
+  int nextRandom() { return (int)(random() >> 1); }
 
 public:
   Light(glm::vec3 lightColor, glm::vec3 lightDirection);
 
-  void init(GLuint program);
-  void draw();
-  void drawPointLight();
+  /// Lights of the frame, then the sun moves on by the timer ticks the frame stands for
+  void update(int ticks = 1);
+  /// Sends the lights of the last update
+  void draw(RenderDevice& device);
+  void drawPointLight(RenderDevice::LightParams& params);
+  /// Lights the next update takes, before it moves the sun on and flickers the torch
+  RenderDevice::LightParams getParams() const;
+  const RenderDevice::LightParams& getFrameParams() const { return frameParams; }
+
+  void setSeed(uint32_t seed) { random.seed(seed); }
 
   void switchFlashLight();
   void switchFog();
+  bool isFogEnabled() const { return fogEnabled; }
+
+  const glm::vec3& getPointPosition() const { return pointLight.transform; }
+
+  /// Changes when the lighting of static geometry does: fog, flashlight or a sun step. The
+  /// torch flicker is left out, the static layer keeps its weight and relights it every frame.
+  uint64_t getStaticKey() const;
+  /// Timer ticks until the sun moves by a step of the static key, the rate its shading changes at
+  int ticksToNextStep() const;
 };
\ No newline at end of file
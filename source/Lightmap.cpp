@@ -0,0 +1,156 @@
+//----------------------------------------------------------------------------------------
+/**
+ * \file       Lightmap.cpp
+ * \author     Bogdan Putintsev
+ * \date       2021/05/13
+ * \brief      Lightmap atlas layout shared by the baker and the runtime
+ *
+*/
+//----------------------------------------------------------------------------------------
+
+#include "Lightmap.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+
+namespace
+{
+  const int MAX_ATTEMPTS = 8;                   ///< Density reductions before an oversized atlas is accepted
+
+  /// One triangle laid flat: corner k sits at corners[k] in world units, the chart at x, y in texels
+  struct Chart
+  {
+    glm::vec2 corners[3];
+    int width = 0;
+    int height = 0;
+    int x = 0;
+    int y = 0;
+  };
+
+  void layOut(const std::vector<float>& vertices, size_t triangle, Chart& chart)
+  {
+    glm::vec3 p[3];
+    for (int k = 0; k < 3; k++)
+    {
+      const float* v = &vertices[(triangle * 3 + k) * 8];
+      p[k] = glm::vec3(v[0], v[1], v[2]);
+    }
+
+    /// The longest edge is the base, the opposite corner projects inside it
+    int base = 0;
+    float longest = -1.0f;
+    for (int k = 0; k < 3; k++)
+    {
+      float length = glm::length(p[(k + 1) % 3] - p[k]);
+      if (length > longest)
+      {
+        longest = length;
+        base = k;
+      }
+    }
+
+    int a = base, b = (base + 1) % 3, c = (base + 2) % 3;
+    glm::vec3 u = longest > 0.0f ? (p[b] - p[a]) / longest : glm::vec3(1.0f, 0.0f, 0.0f);
+    glm::vec3 ac = p[c] - p[a];
+    float along = glm::dot(ac, u);
+
+    chart.corners[a] = glm::vec2(0.0f, 0.0f);
+    chart.corners[b] = glm::vec2(longest, 0.0f);
+    chart.corners[c] = glm::vec2(along, glm::length(ac - u * along));
+  }
+}
+
+void Lightmap::build(const std::vector<float>& vertices, Atlas& atlas)
+{
+  size_t triangles = vertices.size() / 24;
+  std::vector<Chart> charts(triangles);
+  for (size_t i = 0; i < triangles; i++)
+    layOut(vertices, i, charts[i]);
+
+  /// Tallest charts first, equal heights keep the triangle order so the layout is reproducible
+  std::vector<size_t> order(triangles);
+  for (size_t i = 0; i < triangles; i++)
+    order[i] = i;
+
+  float density = TEXELS_PER_UNIT;
+  for (int attempt = 0; attempt < MAX_ATTEMPTS; attempt++)
+  {
+    size_t area = 0;
+    int widest = 1;
+    for (Chart& chart : charts)
+    {
+      glm::vec2 size = glm::max(glm::max(chart.corners[0], chart.corners[1]), chart.corners[2]);
+      chart.width = std::max(1, (int)std::ceil(size.x * density)) + 2 * BORDER;
+      chart.height = std::max(1, (int)std::ceil(size.y * density)) + 2 * BORDER;
+      area += (size_t)chart.width * chart.height;
+      widest = std::max(widest, chart.width);
+    }
+
+    std::stable_sort(order.begin(), order.end(), [&charts](size_t a, size_t b) { return charts[a].height > charts[b].height; });
+
+    /// Shelves across a square of the total chart area
+    int width = std::max(widest, (int)std::ceil(std::sqrt((double)area)));
+    int x = 0, y = 0, shelf = 0;
+    for (size_t i : order)
+    {
+      Chart& chart = charts[i];
+      if (x + chart.width > width)
+      {
+        x = 0;
+        y += shelf;
+        shelf = 0;
+      }
+      chart.x = x;
+      chart.y = y;
+      x += chart.width;
+      shelf = std::max(shelf, chart.height);
+    }
+
+    atlas.width = width;
+    atlas.height = std::max(1, y + shelf);
+    atlas.texelsPerUnit = density;
+
+    if (std::max(atlas.width, atlas.height) <= MAX_SIZE)
+      break;
+
+    /// The chart area follows the square of the density, the borders make it shrink slower
+    density *= 0.9f * (float)MAX_SIZE / std::max(atlas.width, atlas.height);
+  }
+
+  atlas.uvs.resize(triangles * 6);
+  for (size_t i = 0; i < triangles; i++)
+  {
+    const Chart& chart = charts[i];
+    for (int k = 0; k < 3; k++)
+    {
+      glm::vec2 texel = glm::vec2(chart.x + BORDER, chart.y + BORDER) + chart.corners[k] * density;
+      atlas.uvs[i * 6 + k * 2] = texel.x / atlas.width;
+      atlas.uvs[i * 6 + k * 2 + 1] = texel.y / atlas.height;
+    }
+  }
+}
+
+std::string Lightmap::pathFor(const std::string& meshPath)
+{
+  size_t dot = meshPath.find_last_of('.');
+  size_t slash = meshPath.find_last_of('/');
+  std::string stem = (dot != std::string::npos && (slash == std::string::npos || dot > slash)) ? meshPath.substr(0, dot) : meshPath;
+  return stem + "_lightmap.ppm";
+}
+
+bool Lightmap::readSize(const std::string& path, int& width, int& height)
+{
+  std::ifstream in(path, std::ios::binary);
+  std::string magic;
+  if (!(in >> magic >> width >> height))
+    return false;
+  return magic == "P6";
+}
+
+uint32_t Lightmap::encode(float torch, float sky)
+{
+  int red = (int)std::lround(std::sqrt(std::min(std::max(torch / TORCH_RANGE, 0.0f), 1.0f)) * 255.0f);
+  int green = (int)std::lround(std::sqrt(std::min(std::max(sky, 0.0f), 1.0f)) * 255.0f);
+  return 0xFF000000 | (green << 8) | red;
+}
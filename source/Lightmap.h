@@ -0,0 +1,50 @@
+//----------------------------------------------------------------------------------------
+/**
+ * \file       Lightmap.h
+ * \author     Bogdan Putintsev
+ * \date       2021/05/13
+ * \brief      Lightmap atlas layout shared by the baker and the runtime
+ *
+ *  Every triangle of a static mesh gets its own chart: it is laid flat with its longest
+ *  edge along u, surrounded by a border of BORDER texels and shelf-packed into the atlas.
+ *  The layout depends only on the vertices, so the runtime rebuilds the uvs the baker used
+ *  instead of storing them. A texel holds the torch irradiance per unit of intensity in red
+ *  and the sky light in green, square-root encoded for more precision in the dark.
+ *
+*/
+//----------------------------------------------------------------------------------------
+
+#pragma once
+#include "pgr.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class Lightmap
+{
+public:
+  static constexpr float TEXELS_PER_UNIT = 2.0f;
+  static const int MAX_SIZE = 2048;             ///< Texels per side, the density drops for larger meshes
+  static const int BORDER = 1;                  ///< Texels around each chart, bilinear filtering reads into them
+  static constexpr float TORCH_RANGE = 4.0f;    ///< Torch irradiance stored as 255, fragmentShader.fs decodes with it
+
+  struct Atlas
+  {
+    int width = 0;
+    int height = 0;
+    float texelsPerUnit = TEXELS_PER_UNIT;
+    std::vector<float> uvs;                     ///< Two per vertex, v up like the OBJ texture coordinates
+  };
+
+  /// Lay out the charts of interleaved vertices (position 3, uv 2, normal 3)
+  static void build(const std::vector<float>& vertices, Atlas& atlas);
+
+  /// The PPM written next to the OBJ file, data/indoor/indoor.obj -> data/indoor/indoor_lightmap.ppm
+  static std::string pathFor(const std::string& meshPath);
+  /// Size of a baked lightmap without reading its texels, false when there is none
+  static bool readSize(const std::string& path, int& width, int& height);
+
+  /// RGBA8 texel of Image, torch and sky clamped to their ranges
+  static uint32_t encode(float torch, float sky);
+};
@@ -0,0 +1,535 @@
+//----------------------------------------------------------------------------------------
+/**
+ * \file       LightmapBaker.cpp
+ * \author     Bogdan Putintsev
+ * \date       2021/05/13
+ * \brief      Offline path tracer baking the torch and sky light of static meshes
+ *
+*/
+//----------------------------------------------------------------------------------------
+
+#include "LightmapBaker.h"
+#include "Profiler.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <iostream>
+#include <limits>
+
+namespace
+{
+  const float DIFFUSE = 0.8f;                   ///< diffuseStrength of fragmentShader.fs
+  const float ALBEDO = 0.5f;                    ///< Reflectance of every static surface, the textures are not read
+  const float GROUND = 0.3f;                    ///< Light of paths leaving below the horizon, the island under the sky
+  const float OFFSET = 0.01f;                   ///< Ray origins are moved off their surface by this distance
+  const float COVERAGE = 1.5f;                  ///< Texels this far outside a triangle are still baked, filtering reads them
+  const unsigned int TEXEL_BLOCK = 64;          ///< Texels per ThreadPool job
+
+  /// PCG hash, one stream per texel
+  struct Random
+  {
+    uint32_t state;
+
+    explicit Random(uint32_t seed) : state(seed) {}
+
+    float next()
+    {
+      state = state * 747796405u + 2891336453u;
+      uint32_t word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+      return ((word >> 22u) ^ word) * (1.0f / 4294967296.0f);
+    }
+  };
+
+  uint32_t hashSeed(uint32_t a, uint32_t b, uint32_t c)
+  {
+    uint32_t hash = 2166136261u;
+    for (uint32_t value : { a, b, c })
+      hash = (hash ^ value) * 16777619u;
+    return hash;
+  }
+
+  /// Direction around normal with a probability proportional to the cosine
+  glm::vec3 cosineSample(const glm::vec3& normal, Random& random)
+  {
+    float phi = 2.0f * (float)M_PI * random.next();
+    float r2 = random.next();
+    float r = std::sqrt(r2);
+
+    float sign = normal.z >= 0.0f ? 1.0f : -1.0f;
+    float a = -1.0f / (sign + normal.z);
+    float b = normal.x * normal.y * a;
+    glm::vec3 tangent(1.0f + sign * normal.x * normal.x * a, sign * b, -sign * normal.x);
+    glm::vec3 bitangent(b, sign + normal.y * normal.y * a, -normal.y);
+
+    return glm::normalize(tangent * (r * std::cos(phi)) + bitangent * (r * std::sin(phi)) + normal * std::sqrt(1.0f - r2));
+  }
+
+  /// Barycentric weights of the point of triangle abc closest to p
+  glm::vec3 closestBarycentric(const glm::vec2& p, const glm::vec2& a, const glm::vec2& b, const glm::vec2& c)
+  {
+    glm::vec2 ab = b - a, ac = c - a, ap = p - a;
+    float area = ab.x * ac.y - ab.y * ac.x;
+    if (std::fabs(area) > 1e-8f)
+    {
+      float v = (ap.x * ac.y - ap.y * ac.x) / area;
+      float w = (ab.x * ap.y - ab.y * ap.x) / area;
+      if (v >= 0.0f && w >= 0.0f && v + w <= 1.0f)
+        return glm::vec3(1.0f - v - w, v, w);
+    }
+
+    /// Outside: the closest point lies on one of the edges
+    const glm::vec2* corners[3] = { &a, &b, &c };
+    glm::vec3 best(1.0f, 0.0f, 0.0f);
+    float bestDistance = std::numeric_limits<float>::max();
+    for (int k = 0; k < 3; k++)
+    {
+      const glm::vec2& from = *corners[k];
+      glm::vec2 edge = *corners[(k + 1) % 3] - from;
+      float length = glm::dot(edge, edge);
+      float t = length > 0.0f ? glm::clamp(glm::dot(p - from, edge) / length, 0.0f, 1.0f) : 0.0f;
+      glm::vec2 point = from + edge * t;
+      float distance = glm::dot(p - point, p - point);
+      if (distance < bestDistance)
+      {
+        bestDistance = distance;
+        best = glm::vec3(0.0f);
+        best[k] = 1.0f - t;
+        best[(k + 1) % 3] = t;
+      }
+    }
+    return best;
+  }
+
+  float surfaceArea(const glm::vec3& boundsMin, const glm::vec3& boundsMax)
+  {
+    glm::vec3 size = glm::max(boundsMax - boundsMin, glm::vec3(0.0f));
+    return size.x * size.y + size.y * size.z + size.z * size.x;
+  }
+
+  /// Entry distance of the ray into the box, infinity when it misses or starts beyond maxDistance
+  float intersectBox(const glm::vec3& boundsMin, const glm::vec3& boundsMax, const glm::vec3& origin, const glm::vec3& inverseDirection, float maxDistance)
+  {
+    glm::vec3 t0 = (boundsMin - origin) * inverseDirection;
+    glm::vec3 t1 = (boundsMax - origin) * inverseDirection;
+    glm::vec3 lower = glm::min(t0, t1);
+    glm::vec3 upper = glm::max(t0, t1);
+    float enter = std::max(std::max(lower.x, lower.y), std::max(lower.z, 0.0f));
+    float exit = std::min(std::min(upper.x, upper.y), std::min(upper.z, maxDistance));
+    return enter <= exit ? enter : std::numeric_limits<float>::infinity();
+  }
+}
+
+void LightmapBaker::addOccluder(const std::vector<float>& vertices, const glm::mat4& transform)
+{
+  addTriangles(vertices, transform, nullptr);
+}
+
+int LightmapBaker::addReceiver(const std::vector<float>& vertices, const glm::mat4& transform)
+{
+  receivers.emplace_back();
+  Receiver& receiver = receivers.back();
+  Lightmap::build(vertices, receiver.atlas);
+  addTriangles(vertices, transform, &receiver);
+  return (int)receivers.size() - 1;
+}
+
+void LightmapBaker::addTriangles(const std::vector<float>& vertices, const glm::mat4& transform, Receiver* receiver)
+{
+  glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(transform)));
+
+  for (size_t i = 0; i + 24 <= vertices.size(); i += 24)
+  {
+    glm::vec3 p[3];
+    for (int k = 0; k < 3; k++)
+    {
+      const float* v = &vertices[i + k * 8];
+      p[k] = glm::vec3(transform * glm::vec4(v[0], v[1], v[2], 1.0f));
+
+      if (receiver)
+      {
+        receiver->positions.push_back(p[k]);
+        receiver->normals.push_back(glm::normalize(normalMatrix * glm::vec3(v[5], v[6], v[7])));
+      }
+    }
+
+    Triangle triangle;
+    triangle.v0 = p[0];
+    triangle.edge1 = p[1] - p[0];
+    triangle.edge2 = p[2] - p[0];
+    triangle.normal = glm::cross(triangle.edge1, triangle.edge2);
+    triangles.push_back(triangle);
+  }
+}
+
+void LightmapBaker::build()
+{
+  PROFILE_CPU_SCOPE("LightmapBaker::build");
+
+  std::vector<glm::vec3> centroids(triangles.size());
+  for (size_t i = 0; i < triangles.size(); i++)
+    centroids[i] = triangles[i].v0 + (triangles[i].edge1 + triangles[i].edge2) / 3.0f;
+
+  nodes.clear();
+  nodes.reserve(triangles.size() * 2);
+  nodes.emplace_back();
+  nodes[0].first = 0;
+  nodes[0].count = (int)triangles.size();
+  split(0, centroids);
+}
+
+void LightmapBaker::split(int index, std::vector<glm::vec3>& centroids)
+{
+  int first = nodes[index].first;
+  int count = nodes[index].count;
+
+  glm::vec3 boundsMin(std::numeric_limits<float>::max());
+  glm::vec3 boundsMax(-std::numeric_limits<float>::max());
+  glm::vec3 centroidMin = boundsMin, centroidMax = boundsMax;
+  for (int i = first; i < first + count; i++)
+  {
+    const Triangle& triangle = triangles[i];
+    boundsMin = glm::min(glm::min(boundsMin, triangle.v0), glm::min(triangle.v0 + triangle.edge1, triangle.v0 + triangle.edge2));
+    boundsMax = glm::max(glm::max(boundsMax, triangle.v0), glm::max(triangle.v0 + triangle.edge1, triangle.v0 + triangle.edge2));
+    centroidMin = glm::min(centroidMin, centroids[i]);
+    centroidMax = glm::max(centroidMax, centroids[i]);
+  }
+  nodes[index].boundsMin = boundsMin;
+  nodes[index].boundsMax = boundsMax;
+
+  if (count <= LEAF_TRIANGLES)
+    return;
+
+  /// Binned surface area heuristic over the centroid bounds of every axis
+  float bestCost = count * surfaceArea(boundsMin, boundsMax);
+  int bestAxis = -1;
+  int bestBin = 0;
+
+  for (int axis = 0; axis < 3; axis++)
+  {
+    float extent = centroidMax[axis] - centroidMin[axis];
+    if (extent <= 0.0f)
+      continue;
+
+    int binCounts[BINS] = {};
+    glm::vec3 binMin[BINS], binMax[BINS];
+    std::fill(binMin, binMin + BINS, glm::vec3(std::numeric_limits<float>::max()));
+    std::fill(binMax, binMax + BINS, glm::vec3(-std::numeric_limits<float>::max()));
+
+    for (int i = first; i < first + count; i++)
+    {
+      int bin = std::min(BINS - 1, (int)((centroids[i][axis] - centroidMin[axis]) / extent * BINS));
+      const Triangle& triangle = triangles[i];
+      binCounts[bin]++;
+      binMin[bin] = glm::min(glm::min(binMin[bin], triangle.v0), glm::min(triangle.v0 + triangle.edge1, triangle.v0 + triangle.edge2));
+      binMax[bin] = glm::max(glm::max(binMax[bin], triangle.v0), glm::max(triangle.v0 + triangle.edge1, triangle.v0 + triangle.edge2));
+    }
+
+    /// Right side areas swept from the end, then the left side from the start
+    float rightArea[BINS];
+    int rightCount[BINS];
+    glm::vec3 sweepMin(std::numeric_limits<float>::max()), sweepMax(-std::numeric_limits<float>::max());
+    int sweepCount = 0;
+    for (int bin = BINS - 1; bin > 0; bin--)
+    {
+      sweepMin = glm::min(sweepMin, binMin[bin]);
+      sweepMax = glm::max(sweepMax, binMax[bin]);
+      sweepCount += binCounts[bin];
+      rightArea[bin] = surfaceArea(sweepMin, sweepMax);
+      rightCount[bin] = sweepCount;
+    }
+
+    sweepMin = glm::vec3(std::numeric_limits<float>::max());
+    sweepMax = glm::vec3(-std::numeric_limits<float>::max());
+    sweepCount = 0;
+    for (int bin = 0; bin < BINS - 1; bin++)
+    {
+      sweepMin = glm::min(sweepMin, binMin[bin]);
+      sweepMax = glm::max(sweepMax, binMax[bin]);
+      sweepCount += binCounts[bin];
+      if (sweepCount == 0 || rightCount[bin + 1] == 0)
+        continue;
+
+      float cost = sweepCount * surfaceArea(sweepMin, sweepMax) + rightCount[bin + 1] * rightArea[bin + 1];
+      if (cost < bestCost)
+      {
+        bestCost = cost;
+        bestAxis = axis;
+        bestBin = bin;
+      }
+    }
+  }
+
+  if (bestAxis < 0)
+    return;
+
+  /// Partition the triangles and their centroids around the chosen bin
+  float extent = centroidMax[bestAxis] - centroidMin[bestAxis];
+  int middle = first;
+  for (int i = first; i < first + count; i++)
+  {
+    int bin = std::min(BINS - 1, (int)((centroids[i][bestAxis] - centroidMin[bestAxis]) / extent * BINS));
+    if (bin <= bestBin)
+    {
+      std::swap(triangles[i], triangles[middle]);
+      std::swap(centroids[i], centroids[middle]);
+      middle++;
+    }
+  }
+
+  int left = (int)nodes.size();
+  nodes.emplace_back();
+  nodes.emplace_back();
+  nodes[left].first = first;
+  nodes[left].count = middle - first;
+  nodes[left + 1].first = middle;
+  nodes[left + 1].count = first + count - middle;
+  nodes[index].first = left;
+  nodes[index].count = 0;
+
+  split(left, centroids);
+  split(left + 1, centroids);
+}
+
+LightmapBaker::Hit LightmapBaker::trace(const glm::vec3& origin, const glm::vec3& direction, float maxDistance, bool anyHit) const
+{
+  Hit hit;
+  hit.distance = maxDistance;
+  if (nodes.empty())
+    return hit;
+
+  glm::vec3 inverseDirection = glm::vec3(1.0f) / direction;
+
+  /// Nodes waiting with their entry distance, skipped once a closer hit is known
+  struct Entry
+  {
+    int node;
+    float distance;
+  };
+  Entry stack[64];
+  int top = 0;
+  stack[top++] = { 0, intersectBox(nodes[0].boundsMin, nodes[0].boundsMax, origin, inverseDirection, hit.distance) };
+
+  while (top > 0)
+  {
+    Entry entry = stack[--top];
+    if (entry.distance >= hit.distance)
+      continue;
+
+    const Node& node = nodes[entry.node];
+    if (node.count == 0)
+    {
+      /// The nearer child is popped first
+      const Node& left = nodes[node.first];
+      const Node& right = nodes[node.first + 1];
+      Entry closer = { node.first, intersectBox(left.boundsMin, left.boundsMax, origin, inverseDirection, hit.distance) };
+      Entry farther = { node.first + 1, intersectBox(right.boundsMin, right.boundsMax, origin, inverseDirection, hit.distance) };
+      if (farther.distance < closer.distance)
+        std::swap(closer, farther);
+      if (farther.distance < hit.distance)
+        stack[top++] = farther;
+      if (closer.distance < hit.distance)
+        stack[top++] = closer;
+      continue;
+    }
+
+    /// Moller-Trumbore
+    for (int i = node.first; i < node.first + node.count; i++)
+    {
+      const Triangle& triangle = triangles[i];
+      glm::vec3 p = glm::cross(direction, triangle.edge2);
+      float determinant = glm::dot(triangle.edge1, p);
+      if (std::fabs(determinant) < 1e-12f)
+        continue;
+
+      float inverse = 1.0f / determinant;
+      glm::vec3 s = origin - triangle.v0;
+      float u = glm::dot(s, p) * inverse;
+      if (u < 0.0f || u > 1.0f)
+        continue;
+
+      glm::vec3 q = glm::cross(s, triangle.edge1);
+      float v = glm::dot(direction, q) * inverse;
+      if (v < 0.0f || u + v > 1.0f)
+        continue;
+
+      float t = glm::dot(triangle.edge2, q) * inverse;
+      if (t > 0.0f && t < hit.distance)
+      {
+        hit.distance = t;
+        hit.triangle = i;
+        if (anyHit)
+          return hit;
+      }
+    }
+  }
+
+  return hit;
+}
+
+float LightmapBaker::sampleTorch(const glm::vec3& position, const glm::vec3& normal, uint64_t& rays) const
+{
+  glm::vec3 toTorch = torch - position;
+  float distance = glm::length(toTorch);
+  if (distance <= OFFSET)
+    return 0.0f;
+
+  glm::vec3 direction = toTorch / distance;
+  float cosine = glm::dot(normal, direction);
+  if (cosine <= 0.0f)
+    return 0.0f;
+
+  rays++;
+  if (trace(position + normal * OFFSET, direction, distance - OFFSET, true).triangle >= 0)
+    return 0.0f;
+
+  /// The attenuation of getPointLight in fragmentShader.fs
+  return DIFFUSE * cosine / (0.5f * distance + 0.5f * distance * distance);
+}
+
+void LightmapBaker::bakeTexel(const Receiver& receiver, int triangle, int x, int y, uint32_t seed, const Settings& settings,
+                              float& torchLight, float& skyLight, uint64_t& rays) const
+{
+  const Lightmap::Atlas& atlas = receiver.atlas;
+  glm::vec2 corners[3];
+  for (int k = 0; k < 3; k++)
+    corners[k] = glm::vec2(atlas.uvs[triangle * 6 + k * 2] * atlas.width, atlas.uvs[triangle * 6 + k * 2 + 1] * atlas.height);
+
+  const glm::vec3* positions = &receiver.positions[triangle * 3];
+  const glm::vec3* normals = &receiver.normals[triangle * 3];
+
+  Random random(seed);
+  float torchSum = 0.0f;
+  float skySum = 0.0f;
+
+  for (int sample = 0; sample < settings.samples; sample++)
+  {
+    /// A jittered point of the texel, texels on the border take the nearest point of the triangle
+    glm::vec2 point(x + random.next(), y + random.next());
+    glm::vec3 weights = closestBarycentric(point, corners[0], corners[1], corners[2]);
+    glm::vec3 position = positions[0] * weights.x + positions[1] * weights.y + positions[2] * weights.z;
+    glm::vec3 normal = glm::normalize(normals[0] * weights.x + normals[1] * weights.y + normals[2] * weights.z);
+
+    torchSum += sampleTorch(position, normal, rays);
+
+    /// Every bounce reflects ALBEDO of the light, the torch is sampled at every vertex of the path
+    float throughput = 1.0f;
+    for (int bounce = 0; bounce < settings.bounces; bounce++)
+    {
+      glm::vec3 origin = position + normal * OFFSET;
+      glm::vec3 direction = cosineSample(normal, random);
+      rays++;
+
+      Hit hit = trace(origin, direction, std::numeric_limits<float>::max(), false);
+      if (hit.triangle < 0)
+      {
+        skySum += throughput * (direction.y > 0.0f ? 1.0f : GROUND);
+        break;
+      }
+
+      position = origin + direction * hit.distance;
+      normal = glm::normalize(triangles[hit.triangle].normal);
+      if (glm::dot(normal, direction) > 0.0f)
+        normal = -normal;
+
+      throughput *= ALBEDO;
+      torchSum += throughput * sampleTorch(position, normal, rays);
+    }
+  }
+
+  torchLight = torchSum / settings.samples;
+  skyLight = skySum / settings.samples;
+}
+
+LightmapBaker::Stats LightmapBaker::bake(const Settings& settings, std::vector<Image>* lightmaps) const
+{
+  PROFILE_CPU_SCOPE("LightmapBaker::bake");
+
+  /// Texels near a triangle of its chart, charts never overlap so every texel is baked once
+  struct Texel
+  {
+    int receiver;
+    int triangle;
+    int x;
+    int y;
+  };
+  std::vector<Texel> texels;
+
+  if (lightmaps)
+    lightmaps->clear();
+
+  for (size_t r = 0; r < receivers.size(); r++)
+  {
+    const Lightmap::Atlas& atlas = receivers[r].atlas;
+    if (lightmaps)
+      lightmaps->emplace_back(atlas.width, atlas.height);
+
+    for (int t = 0; t < (int)receivers[r].positions.size() / 3; t++)
+    {
+      glm::vec2 corners[3];
+      for (int k = 0; k < 3; k++)
+        corners[k] = glm::vec2(atlas.uvs[t * 6 + k * 2] * atlas.width, atlas.uvs[t * 6 + k * 2 + 1] * atlas.height);
+
+      glm::vec2 low = glm::min(glm::min(corners[0], corners[1]), corners[2]);
+      glm::vec2 high = glm::max(glm::max(corners[0], corners[1]), corners[2]);
+      int x0 = std::max(0, (int)std::floor(low.x) - Lightmap::BORDER);
+      int y0 = std::max(0, (int)std::floor(low.y) - Lightmap::BORDER);
+      int x1 = std::min(atlas.width, (int)std::ceil(high.x) + Lightmap::BORDER);
+      int y1 = std::min(atlas.height, (int)std::ceil(high.y) + Lightmap::BORDER);
+
+      for (int y = y0; y < y1; y++)
+      {
+        for (int x = x0; x < x1; x++)
+        {
+          glm::vec2 center(x + 0.5f, y + 0.5f);
+          glm::vec3 weights = closestBarycentric(center, corners[0], corners[1], corners[2]);
+          glm::vec2 closest = corners[0] * weights.x + corners[1] * weights.y + corners[2] * weights.z;
+          if (glm::length(center - closest) <= COVERAGE)
+            texels.push_back({ (int)r, t, x, y });
+        }
+      }
+    }
+  }
+
+  ThreadPool pool(settings.threads);
+  std::atomic<uint64_t> rays(0);
+  uint64_t start = Profiler::nowNs();
+
+  unsigned int blocks = (unsigned int)((texels.size() + TEXEL_BLOCK - 1) / TEXEL_BLOCK);
+  pool.parallelFor(blocks, [&](unsigned int block)
+  {
+    uint64_t blockRays = 0;
+    size_t end = std::min(texels.size(), (size_t)(block + 1) * TEXEL_BLOCK);
+    for (size_t i = (size_t)block * TEXEL_BLOCK; i < end; i++)
+    {
+      const Texel& texel = texels[i];
+      const Receiver& receiver = receivers[texel.receiver];
+
+      float torchLight, skyLight;
+      bakeTexel(receiver, texel.triangle, texel.x, texel.y, hashSeed(texel.receiver, texel.x, texel.y), settings, torchLight, skyLight, blockRays);
+
+      /// The first image row is the top of the atlas, v points up
+      if (lightmaps)
+      {
+        Image& image = (*lightmaps)[texel.receiver];
+        image.pixels[(image.height - 1 - texel.y) * image.width + texel.x] = Lightmap::encode(torchLight, skyLight);
+      }
+    }
+    rays += blockRays;
+  });
+
+  Stats stats;
+  stats.rays = rays;
+  stats.texels = (int)texels.size();
+  stats.threads = pool.getThreadCount();
+  stats.seconds = (Profiler::nowNs() - start) / 1e9;
+  stats.raysPerSecond = stats.seconds > 0.0 ? stats.rays / stats.seconds : 0.0;
+  return stats;
+}
+
+void LightmapBaker::printStats(const Stats& stats)
+{
+  std::cout << "Baked " << stats.texels << " texels with " << stats.rays << " rays in " << stats.seconds << " s on "
+            << stats.threads << " threads, " << stats.raysPerSecond / 1e6 << " Mrays/s" << std::endl;
+}
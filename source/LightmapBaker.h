@@ -0,0 +1,108 @@
+//----------------------------------------------------------------------------------------
+/**
+ * \file       LightmapBaker.h
+ * \author     Bogdan Putintsev
+ * \date       2021/05/13
+ * \brief      Offline path tracer baking the torch and sky light of static meshes
+ *
+ *  All static triangles go into a bounding volume hierarchy built with the binned surface
+ *  area heuristic. Every covered texel of a receiver's atlas traces paths from a jittered
+ *  point inside its texel: at each vertex a shadow ray samples the torch, a cosine-weighted
+ *  ray continues the path and a path leaving the scene upwards sees the sky. Texels are
+ *  split across a ThreadPool and every texel seeds its own random numbers, so the lightmaps
+ *  do not depend on the thread count.
+ *
+*/
+//----------------------------------------------------------------------------------------
+
+#pragma once
+#include "Image.h"
+#include "Lightmap.h"
+
+#include <cstdint>
+#include <vector>
+
+class LightmapBaker
+{
+public:
+  struct Settings
+  {
+    int samples = 64;                           ///< Paths per texel
+    int bounces = 3;
+    unsigned int threads = 0;                   ///< 0 uses all hardware threads
+  };
+
+  struct Stats
+  {
+    uint64_t rays = 0;
+    int texels = 0;
+    unsigned int threads = 0;
+    double seconds = 0.0;
+    double raysPerSecond = 0.0;
+  };
+
+  /// Triangles that cast shadows and bounce light, interleaved vertices (position 3, uv 2, normal 3)
+  void addOccluder(const std::vector<float>& vertices, const glm::mat4& transform);
+  /// Occluder that also gets a lightmap, returns its index in bake's output
+  int addReceiver(const std::vector<float>& vertices, const glm::mat4& transform);
+  void setTorch(const glm::vec3& position) { torch = position; }
+
+  /// Build the hierarchy, after the last add
+  void build();
+  /// Bake every receiver, lightmaps may be null when only the throughput matters
+  Stats bake(const Settings& settings, std::vector<Image>* lightmaps) const;
+
+  static void printStats(const Stats& stats);
+
+private:
+  static const int LEAF_TRIANGLES = 4;
+  static const int BINS = 16;
+
+  struct Triangle
+  {
+    glm::vec3 v0;
+    glm::vec3 edge1;
+    glm::vec3 edge2;
+    glm::vec3 normal;                           ///< Geometric, not normalized by the winding
+  };
+
+  struct Node
+  {
+    glm::vec3 boundsMin;
+    int first = 0;                              ///< Left child of an inner node, first triangle of a leaf
+    glm::vec3 boundsMax;
+    int count = 0;                              ///< 0 for inner nodes
+  };
+
+  /// Vertices of a receiver in world space and its atlas
+  struct Receiver
+  {
+    std::vector<glm::vec3> positions;
+    std::vector<glm::vec3> normals;
+    Lightmap::Atlas atlas;
+  };
+
+  struct Hit
+  {
+    float distance;
+    int triangle = -1;
+  };
+
+  std::vector<Triangle> triangles;
+  std::vector<Node> nodes;
+  std::vector<Receiver> receivers;
+  glm::vec3 torch = glm::vec3(0.0f);
+
+  void addTriangles(const std::vector<float>& vertices, const glm::mat4& transform, Receiver* receiver);
+  void split(int node, std::vector<glm::vec3>& centroids);
+
+  /// Closest hit within maxDistance, or any hit when anyHit is set
+  Hit trace(const glm::vec3& origin, const glm::vec3& direction, float maxDistance, bool anyHit) const;
+
+  /// Irradiance from the torch per unit of intensity, one shadow ray
+  float sampleTorch(const glm::vec3& position, const glm::vec3& normal, uint64_t& rays) const;
+
+  /// Average torch and sky light of the paths from one texel of a receiver's triangle
+  void bakeTexel(const Receiver& receiver, int triangle, int x, int y, uint32_t seed, const Settings& settings,
+                 float& torchLight, float& skyLight, uint64_t& rays) const;
+};
@@ -0,0 +1,365 @@
+//----------------------------------------------------------------------------------------
+/**
+ * \file       MeshOptimizer.cpp
+ * \author     Bogdan Putintsev
+ * \date       2021/05/13
+ * \brief      Load-time reordering of indexed meshes for the vertex cache, overdraw and fetch
+ *
+*/
+//----------------------------------------------------------------------------------------
+
+#include "MeshOptimizer.h"
+#include "Profiler.h"
+#include "pgr.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+  const uint32_t EMPTY = 0xFFFFFFFF;
+
+  /// Stamps start at 0, a clock starting past the cache size makes every vertex a miss
+  const uint32_t COLD = MeshOptimizer::CACHE_SIZE + 1;
+
+  /// 64-bit FNV-1a of the bits of one vertex
+  uint64_t hashVertex(const float* vertex, int stride)
+  {
+    const unsigned char* bytes = (const unsigned char*)vertex;
+    uint64_t hash = 14695981039346656037ull;
+
+    for (size_t i = 0; i < stride * sizeof(float); i++)
+    {
+      hash ^= bytes[i];
+      hash *= 1099511628211ull;
+    }
+
+    return hash;
+  }
+
+  glm::vec3 positionOf(const MeshOptimizer::Mesh& mesh, uint32_t vertex)
+  {
+    const float* v = &mesh.vertices[(size_t)vertex * mesh.stride];
+    return glm::vec3(v[0], v[1], v[2]);
+  }
+
+  /// FIFO cache by time stamps: a vertex is cached while fewer than CACHE_SIZE misses followed its own
+  bool touch(std::vector<uint32_t>& stamps, uint32_t& time, uint32_t vertex)
+  {
+    if (time - stamps[vertex] <= (uint32_t)MeshOptimizer::CACHE_SIZE)
+      return false;
+
+    stamps[vertex] = time++;
+    return true;
+  }
+}
+
+MeshOptimizer::Mesh MeshOptimizer::weld(const std::vector<float>& soup, int stride)
+{
+  Mesh mesh;
+  mesh.stride = stride;
+
+  size_t corners = soup.size() / stride;
+  mesh.indices.resize(corners);
+
+  /// Open addressing at a load of at most one half
+  size_t buckets = 1;
+  while (buckets < corners * 2)
+    buckets <<= 1;
+  std::vector<uint32_t> table(buckets, EMPTY);
+
+  for (size_t i = 0; i < corners; i++)
+  {
+    const float* corner = &soup[i * stride];
+    size_t slot = (size_t)hashVertex(corner, stride) & (buckets - 1);
+
+    while (table[slot] != EMPTY && memcmp(&mesh.vertices[(size_t)table[slot] * stride], corner, stride * sizeof(float)) != 0)
+      slot = (slot + 1) & (buckets - 1);
+
+    if (table[slot] == EMPTY)
+    {
+      table[slot] = (uint32_t)(mesh.vertices.size() / stride);
+      mesh.vertices.insert(mesh.vertices.end(), corner, corner + stride);
+    }
+
+    mesh.indices[i] = table[slot];
+  }
+
+  return mesh;
+}
+
+void MeshOptimizer::optimize(Mesh& mesh)
+{
+  PROFILE_CPU_SCOPE("MeshOptimizer::optimize");
+
+  std::vector<uint32_t> clusters;
+  optimizeVertexCache(mesh, clusters);
+  optimizeOverdraw(mesh, clusters);
+  optimizeVertexFetch(mesh);
+}
+
+void MeshOptimizer::optimizeVertexCache(Mesh& mesh, std::vector<uint32_t>& clusters)
+{
+  clusters.clear();
+
+  const std::vector<uint32_t>& indices = mesh.indices;
+  size_t triangles = indices.size() / 3;
+  size_t vertexCount = mesh.vertices.size() / mesh.stride;
+  if (triangles == 0)
+    return;
+
+  /// Triangles around every vertex, live counts the ones not emitted yet
+  std::vector<uint32_t> live(vertexCount, 0);
+  for (uint32_t index : indices)
+    live[index]++;
+
+  std::vector<uint32_t> offsets(vertexCount + 1, 0);
+  for (size_t v = 0; v < vertexCount; v++)
+    offsets[v + 1] = offsets[v] + live[v];
+
+  std::vector<uint32_t> adjacency(indices.size());
+  std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+  for (size_t i = 0; i < indices.size(); i++)
+    adjacency[fill[indices[i]]++] = (uint32_t)(i / 3);
+
+  std::vector<uint32_t> stamps(vertexCount, 0);
+  uint32_t time = COLD;
+  std::vector<char> emitted(triangles, 0);
+  std::vector<uint32_t> deadEnds;
+  std::vector<uint32_t> candidates;
+  std::vector<uint32_t> output;
+  output.reserve(indices.size());
+
+  size_t cursor = 0;
+  int64_t fan = indices[0];
+  bool cold = true;
+
+  while (fan >= 0)
+  {
+    /// Emit every remaining triangle around the fanning vertex
+    candidates.clear();
+    for (uint32_t a = offsets[fan]; a < offsets[fan + 1]; a++)
+    {
+      uint32_t triangle = adjacency[a];
+      if (emitted[triangle])
+        continue;
+
+      if (cold)
+      {
+        clusters.push_back((uint32_t)(output.size() / 3));
+        cold = false;
+      }
+
+      for (int k = 0; k < 3; k++)
+      {
+        uint32_t v = indices[triangle * 3 + k];
+        output.push_back(v);
+        deadEnds.push_back(v);
+        candidates.push_back(v);
+        live[v]--;
+        touch(stamps, time, v);
+      }
+      emitted[triangle] = 1;
+    }
+
+    /// The oldest candidate that stays cached while its own fan is emitted, two new vertices per triangle at most
+    fan = -1;
+    int64_t best = -1;
+    for (uint32_t v : candidates)
+    {
+      if (live[v] == 0)
+        continue;
+
+      int64_t age = time - stamps[v];
+      int64_t priority = age + 2 * live[v] <= CACHE_SIZE ? age : 0;
+      if (priority > best)
+      {
+        best = priority;
+        fan = v;
+      }
+    }
+
+    if (fan >= 0)
+      continue;
+
+    /// Dead end: the most recently used vertex with triangles left, then the exporter's order
+    while (!deadEnds.empty() && fan < 0)
+    {
+      uint32_t v = deadEnds.back();
+      deadEnds.pop_back();
+      if (live[v] > 0)
+        fan = v;
+    }
+
+    while (fan < 0 && cursor < triangles)
+    {
+      if (!emitted[cursor])
+        fan = indices[cursor * 3];
+      else
+        cursor++;
+    }
+
+    cold = fan >= 0 && time - stamps[fan] > (uint32_t)CACHE_SIZE;
+  }
+
+  mesh.indices.swap(output);
+}
+
+void MeshOptimizer::optimizeOverdraw(Mesh& mesh, const std::vector<uint32_t>& hardClusters)
+{
+  const std::vector<uint32_t>& indices = mesh.indices;
+  uint32_t triangles = (uint32_t)(indices.size() / 3);
+  if (triangles == 0)
+    return;
+
+  /// A long cluster wraps around the mesh, cut it wherever the cache reuse so far is already good
+  std::vector<uint32_t> clusters;
+  std::vector<uint32_t> stamps(mesh.vertices.size() / mesh.stride, 0);
+  uint32_t time = COLD;
+
+  for (size_t c = 0; c < hardClusters.size(); c++)
+  {
+    uint32_t end = c + 1 < hardClusters.size() ? hardClusters[c + 1] : triangles;
+    uint32_t start = hardClusters[c];
+    int misses = 0;
+    time += COLD;
+    clusters.push_back(start);
+
+    for (uint32_t t = start; t < end; t++)
+    {
+      for (int k = 0; k < 3; k++)
+        misses += touch(stamps, time, indices[t * 3 + k]) ? 1 : 0;
+
+      if (t + 1 < end && misses <= CLUSTER_ACMR * (t + 1 - start))
+      {
+        start = t + 1;
+        misses = 0;
+        time += COLD;
+        clusters.push_back(start);
+      }
+    }
+  }
+
+  /// Clusters far out along their own normal are likely in front of the rest, they go first
+  glm::vec3 meshCentroid(0.0f);
+  float meshArea = 0.0f;
+  std::vector<glm::vec3> centroids(clusters.size(), glm::vec3(0.0f));
+  std::vector<glm::vec3> normals(clusters.size(), glm::vec3(0.0f));
+
+  for (size_t c = 0; c < clusters.size(); c++)
+  {
+    uint32_t end = c + 1 < clusters.size() ? clusters[c + 1] : triangles;
+    float clusterArea = 0.0f;
+
+    for (uint32_t t = clusters[c]; t < end; t++)
+    {
+      glm::vec3 p0 = positionOf(mesh, indices[t * 3]);
+      glm::vec3 p1 = positionOf(mesh, indices[t * 3 + 1]);
+      glm::vec3 p2 = positionOf(mesh, indices[t * 3 + 2]);
+      glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+      float area = glm::length(normal);
+
+      centroids[c] += (p0 + p1 + p2) * (area / 3.0f);
+      normals[c] += normal;
+      clusterArea += area;
+    }
+
+    meshCentroid += centroids[c];
+    meshArea += clusterArea;
+    if (clusterArea > 0.0f)
+      centroids[c] = centroids[c] / clusterArea;
+  }
+
+  if (meshArea > 0.0f)
+    meshCentroid = meshCentroid / meshArea;
+
+  std::vector<float> keys(clusters.size(), 0.0f);
+  for (size_t c = 0; c < clusters.size(); c++)
+  {
+    float length = glm::length(normals[c]);
+    if (length > 0.0f)
+      keys[c] = glm::dot(centroids[c] - meshCentroid, normals[c] / length);
+  }
+
+  std::vector<size_t> order(clusters.size());
+  for (size_t c = 0; c < order.size(); c++)
+    order[c] = c;
+  std::stable_sort(order.begin(), order.end(), [&keys](size_t a, size_t b) { return keys[a] > keys[b]; });
+
+  std::vector<uint32_t> output;
+  output.reserve(indices.size());
+  for (size_t c : order)
+  {
+    uint32_t end = c + 1 < clusters.size() ? clusters[c + 1] : triangles;
+    output.insert(output.end(), indices.begin() + clusters[c] * 3, indices.begin() + end * 3);
+  }
+
+  mesh.indices.swap(output);
+}
+
+void MeshOptimizer::optimizeVertexFetch(Mesh& mesh)
+{
+  size_t vertexCount = mesh.vertices.size() / mesh.stride;
+  std::vector<uint32_t> remap(vertexCount, EMPTY);
+  std::vector<float> vertices;
+  vertices.reserve(mesh.vertices.size());
+
+  /// Vertices in the order the index buffer first reads them, unreferenced ones are dropped
+  for (uint32_t& index : mesh.indices)
+  {
+    if (remap[index] == EMPTY)
+    {
+      remap[index] = (uint32_t)(vertices.size() / mesh.stride);
+      const float* vertex = &mesh.vertices[(size_t)index * mesh.stride];
+      vertices.insert(vertices.end(), vertex, vertex + mesh.stride);
+    }
+    index = remap[index];
+  }
+
+  mesh.vertices.swap(vertices);
+}
+
+MeshOptimizer::Stats MeshOptimizer::analyze(const Mesh& mesh)
+{
+  Stats stats;
+  size_t triangles = mesh.indices.size() / 3;
+  size_t vertexCount = mesh.vertices.size() / mesh.stride;
+  if (triangles == 0)
+    return stats;
+
+  size_t vertexBytes = mesh.stride * sizeof(float);
+  std::vector<uint32_t> stamps(vertexCount, 0);
+  uint32_t time = COLD;
+  std::vector<uint32_t> lineStamps((vertexCount * vertexBytes + FETCH_LINE - 1) / FETCH_LINE, 0);
+  uint32_t lineTime = FETCH_LINES + 1;
+  std::vector<char> referenced(vertexCount, 0);
+
+  size_t misses = 0, unique = 0, lines = 0;
+  for (uint32_t index : mesh.indices)
+  {
+    if (!referenced[index])
+    {
+      referenced[index] = 1;
+      unique++;
+    }
+
+    if (!touch(stamps, time, index))
+      continue;
+    misses++;
+
+    /// Every vertex shader run fetches the lines its vertex spans
+    for (size_t line = index * vertexBytes / FETCH_LINE; line <= ((index + 1) * vertexBytes - 1) / FETCH_LINE; line++)
+    {
+      if (lineTime - lineStamps[line] > (uint32_t)FETCH_LINES)
+      {
+        lineStamps[line] = lineTime++;
+        lines++;
+      }
+    }
+  }
+
+  stats.acmr = (float)misses / triangles;
+  stats.atvr = (float)misses / unique;
+  stats.overfetch = (float)(lines * FETCH_LINE) / (unique * vertexBytes);
+  return stats;
+}
@@ -0,0 +1,59 @@
+//----------------------------------------------------------------------------------------
+/**
+ * \file       MeshOptimizer.h
+ * \author     Bogdan Putintsev
+ * \date       2021/05/13
+ * \brief      Load-time reordering of indexed meshes for the vertex cache, overdraw and fetch
+ *
+ *  readOBJ returns a triangle soup in the order the exporter wrote it. weld merges its
+ *  identical corners into an index buffer, then optimize runs three passes: Tipsify
+ *  (Sander et al. 2007) fans triangles around vertices that are still in a simulated
+ *  post-transform cache, the fans are cut into clusters that are sorted so outward facing
+ *  ones are drawn first and hide what lies behind them, and the vertices are renumbered in
+ *  the order the index buffer first reads them.
+ *
+*/
+//----------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+class MeshOptimizer
+{
+public:
+  static const int CACHE_SIZE = 16;             ///< FIFO post-transform cache the order is tuned and measured for
+  static constexpr float CLUSTER_ACMR = 0.7f;   ///< A cluster is cut once its own ACMR drops to this
+  static const int FETCH_LINE = 64;             ///< Bytes per vertex fetch cache line
+  static const int FETCH_LINES = 64;            ///< Lines of the simulated FIFO vertex fetch cache
+
+  /// Indexed triangle list, the first 8 floats of a vertex are position 3, uv 2, normal 3
+  struct Mesh
+  {
+    std::vector<float> vertices;
+    std::vector<uint32_t> indices;
+    int stride = 8;                             ///< Floats per vertex, extra attributes follow the first 8
+  };
+
+  struct Stats
+  {
+    float acmr = 0.0f;                          ///< Vertex shader runs per triangle, 3 without reuse
+    float atvr = 0.0f;                          ///< Vertex shader runs per referenced vertex, 1 at best
+    float overfetch = 0.0f;                     ///< Vertex buffer bytes read per byte referenced, 1 at best
+  };
+
+  /// Merge bitwise identical corners of a triangle soup, the triangle order is kept
+  static Mesh weld(const std::vector<float>& soup, int stride);
+
+  /// All three passes in order
+  static void optimize(Mesh& mesh);
+  /// Tipsify, clusters gets the first triangle of every run that started with a cold cache
+  static void optimizeVertexCache(Mesh& mesh, std::vector<uint32_t>& clusters);
+  /// Cut the clusters further where their ACMR reaches CLUSTER_ACMR and sort them outside in
+  static void optimizeOverdraw(Mesh& mesh, const std::vector<uint32_t>& clusters);
+  static void optimizeVertexFetch(Mesh& mesh);
+
+  /// Simulated vertex cache and fetch cost of the current order
+  static Stats analyze(const Mesh& mesh);
+};
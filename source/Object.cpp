@@ -12,132 +12,289 @@
 
 
 #include "Object.h"
+#include "Lightmap.h"
+#include "MeshOptimizer.h"
 #include "OBJParser.h"
+#include "Ocean.h"
+#include "Profiler.h"
 
-#include <ctime> 
+namespace
+{
+  const glm::vec3 DOOR_HINGE = glm::vec3(11.313f, 46.65f, -46.494f);
+
+  /// Texture requests treat anything nearer as this far, a surface is never seen closer than the near plane
+  const float MIN_TEXTURE_DISTANCE = 0.1f;
+
+  /// Interleave the lightmap uvs of a soup after each vertex, 10 floats per vertex
+  void appendLightmapUvs(std::vector<float>& vertices, const std::vector<float>& uvs)
+  {
+    std::vector<float> interleaved;
+    interleaved.reserve(vertices.size() / 8 * 10);
+    for (size_t i = 0; i < vertices.size() / 8; i++)
+    {
+      interleaved.insert(interleaved.end(), vertices.begin() + i * 8, vertices.begin() + i * 8 + 8);
+      interleaved.insert(interleaved.end(), uvs.begin() + i * 2, uvs.begin() + i * 2 + 2);
+    }
+    vertices.swap(interleaved);
+  }
+
+  /// Back to the layout of createMesh and a separate lightmap uv stream
+  void splitLightmapUvs(MeshOptimizer::Mesh& mesh, std::vector<float>& uvs)
+  {
+    size_t count = mesh.vertices.size() / 10;
+    std::vector<float> vertices;
+    vertices.reserve(count * 8);
+    uvs.clear();
+    uvs.reserve(count * 2);
+    for (size_t i = 0; i < count; i++)
+    {
+      vertices.insert(vertices.end(), mesh.vertices.begin() + i * 10, mesh.vertices.begin() + i * 10 + 8);
+      uvs.insert(uvs.end(), mesh.vertices.begin() + i * 10 + 8, mesh.vertices.begin() + i * 10 + 10);
+    }
+    mesh.vertices.swap(vertices);
+    mesh.stride = 8;
+  }
+}
 
 Object::Object(std::string meshPath, std::string firstTextureName, ObjectType type)
 {
   objectType = type;
+  profileName = Profiler::intern(meshPath);
   position = glm::vec3(0.0f, 0.0f, 0.0f);
   translate = glm::mat4(1.0f);
   localRotation = glm::mat4(1.0f);
   globalRotation = glm::mat4(1.0f);
-  waterFrame = 0;
-
-  if (!readOBJ(meshPath.c_str(), vertices))
-    std::cout << "Failed to read file: " << meshPath << "." << std::endl;
 
+  this->meshPath = meshPath;
   textureName = firstTextureName;
 
+  /// The door is placed before its first draw, culling and the portal use its transform
+  if (objectType == DOOR)
+    transition(DOOR_HINGE.x, DOOR_HINGE.y, DOOR_HINGE.z);
 }
 
-void Object::init(GLuint shaderProgram)
+bool Object::readMesh(const std::string& path, std::vector<float>& vertices)
 {
-  glGenBuffers(1, &arrayBuffer);
-  CHECK_GL_ERROR();
+  if (!readOBJ(path.c_str(), vertices))
+  {
+    std::cout << "Failed to read file: " << path << "." << std::endl;
+    return false;
+  }
 
-  glBindBuffer(GL_ARRAY_BUFFER, arrayBuffer);
-  CHECK_GL_ERROR();
+  return true;
+}
 
-  glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), &vertices[0], GL_STATIC_DRAW);
-  CHECK_GL_ERROR();
+bool Object::readBounds(const std::string& path, glm::vec3& minimum, glm::vec3& maximum)
+{
+  std::ifstream file(path);
+  if (!file)
+    return false;
 
-  glGenVertexArrays(1, &vao);
-  CHECK_GL_ERROR();
+  bool found = false;
+  std::string line;
+  while (std::getline(file, line))
+  {
+    glm::vec3 position;
+    if (line.compare(0, 2, "v ") != 0 || sscanf(line.c_str() + 2, "%f %f %f", &position.x, &position.y, &position.z) != 3)
+      continue;
 
-  glBindVertexArray(vao);
-  CHECK_GL_ERROR();
+    minimum = found ? glm::min(minimum, position) : position;
+    maximum = found ? glm::max(maximum, position) : position;
+    found = true;
+  }
 
-  vertexAtribPointerPos = 0;
-  glEnableVertexAttribArray(vertexAtribPointerPos);
-  CHECK_GL_ERROR();
+  return found;
+}
 
-  glVertexAttribPointer(vertexAtribPointerPos, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), 0);
-  CHECK_GL_ERROR();
+void Object::setBounds(const glm::vec3& minimum, const glm::vec3& maximum)
+{
+  boundsMin = minimum;
+  boundsMax = maximum;
+  boundsKnown = true;
+}
 
-  normalPosition = 1;
-  glEnableVertexAttribArray(normalPosition);
-  CHECK_GL_ERROR();
+size_t Object::upload(RenderDevice& device, AssetCache& assets, std::vector<float>&& vertices)
+{
+  vertexCount = (int)(vertices.size() / 8);
 
-  glVertexAttribPointer(normalPosition, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(5 * sizeof(float)));
-  CHECK_GL_ERROR();
+  if (!vertices.empty())
+  {
+    boundsMin = boundsMax = glm::vec3(vertices[0], vertices[1], vertices[2]);
+    for (size_t i = 0; i < vertices.size(); i += 8)
+    {
+      glm::vec3 position = glm::vec3(vertices[i], vertices[i + 1], vertices[i + 2]);
+      boundsMin = glm::min(boundsMin, position);
+      boundsMax = glm::max(boundsMax, position);
+    }
+    boundsKnown = true;
+  }
 
-  objectTypePosition = glGetUniformLocation(shaderProgram, "objectType");
-  CHECK_GL_ERROR();
+  /// The modelled water plane is too coarse to displace, the ocean gets a dense grid over the same extent
+  if (objectType == WATER && boundsKnown)
+  {
+    vertices = Ocean::gridMesh(boundsMin, boundsMax, Ocean::GRID_QUADS);
+    vertexCount = (int)(vertices.size() / 8);
+  }
 
-  transformMatrixPosition = glGetUniformLocation(shaderProgram, "transform");
-  CHECK_GL_ERROR();
+  if (occluder)
+  {
+    occluderTriangles.resize(vertexCount);
+    for (int i = 0; i < vertexCount; i++)
+      occluderTriangles[i] = glm::vec3(vertices[i * 8], vertices[i * 8 + 1], vertices[i * 8 + 2]);
+  }
 
   if (textureName != "")
   {
-    texturePosition = pgr::createTexture(textureName, true);
-    glActiveTexture(GL_TEXTURE0);
-    CHECK_GL_ERROR();
-
-    glBindTexture(GL_TEXTURE_2D, texturePosition);
-    CHECK_GL_ERROR();
+    texture = assets.acquireTexture(device, textureName);
+
+    /// One density for the whole mesh, the square root of the uv area over the surface area
+    double uvArea = 0.0, worldArea = 0.0;
+    for (size_t i = 0; i + 24 <= vertices.size(); i += 24)
+    {
+      const float* v = &vertices[i];
+      glm::vec3 e1 = glm::vec3(v[8], v[9], v[10]) - glm::vec3(v[0], v[1], v[2]);
+      glm::vec3 e2 = glm::vec3(v[16], v[17], v[18]) - glm::vec3(v[0], v[1], v[2]);
+      worldArea += glm::length(glm::cross(e1, e2));
+      uvArea += std::abs((v[11] - v[3]) * (v[20] - v[4]) - (v[19] - v[3]) * (v[12] - v[4]));
+    }
+    uvDensity = worldArea > 0.0 ? (float)std::sqrt(uvArea / worldArea) : 0.0f;
+  }
 
-    if (texturePosition == 0) {
-      pgr::dieWithError("Failed to load texture.");
+  /// The atlas is rebuilt from the soup, it must match the size the baker used
+  std::string lightmapPath;
+  std::vector<float> lightmapUvs;
+  if (lightmapped)
+  {
+    lightmapPath = Lightmap::pathFor(meshPath);
+    int width = 0, height = 0;
+    if (Lightmap::readSize(lightmapPath, width, height))
+    {
+      Lightmap::Atlas atlas;
+      Lightmap::build(vertices, atlas);
+      if (atlas.width == width && atlas.height == height)
+      {
+        lightmapUvs.swap(atlas.uvs);
+        lightmapUvDensity = atlas.texelsPerUnit / std::max(atlas.width, atlas.height);
+      }
+      else
+        std::cout << lightmapPath << " was baked for another mesh, run --bake-lightmaps again" << std::endl;
     }
+  }
 
-    textureSamplerPosition = glGetUniformLocation(shaderProgram, "MTexture");
-    CHECK_GL_ERROR();
+  /// Lightmap uvs are welded as two more floats per vertex, corners on different charts stay apart
+  if (!lightmapUvs.empty())
+    appendLightmapUvs(vertices, lightmapUvs);
 
-    glUseProgram(shaderProgram);
-    CHECK_GL_ERROR();
+  MeshOptimizer::Mesh optimized = MeshOptimizer::weld(vertices, lightmapUvs.empty() ? 8 : 10);
+  MeshOptimizer::optimize(optimized);
 
-    glUniform1i(textureSamplerPosition, 0);
-    CHECK_GL_ERROR();
+  if (!lightmapUvs.empty())
+    splitLightmapUvs(optimized, lightmapUvs);
 
-    textureCoordsPosition = 2;
-    glVertexAttribPointer(textureCoordsPosition, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(3 * sizeof(float)));
-    CHECK_GL_ERROR();
+  mesh = assets.acquireMesh(device, optimized.vertices, optimized.indices, profileName);
 
-    glEnableVertexAttribArray(textureCoordsPosition);
-    CHECK_GL_ERROR();
+  if (!lightmapUvs.empty())
+  {
+    device.setMeshLightmapUvs(mesh.get(), lightmapUvs);
+    lightmap = assets.acquireTexture(device, lightmapPath);
   }
 
-   waterFramePos = glGetUniformLocation(shaderProgram, "waterFrame");
+  std::vector<float>().swap(vertices);
+  return getGpuBytes();
+}
+
+void Object::release()
+{
+  mesh.reset();
+  texture.reset();
+  lightmap.reset();
+  std::vector<glm::vec3>().swap(occluderTriangles);
 }
 
-void Object::draw()
+size_t Object::getCpuBytes() const
 {
+  return sizeof(Object) + meshPath.capacity() + textureName.capacity() + occluderTriangles.capacity() * sizeof(glm::vec3);
+}
+
+void Object::printMemory() const
+{
+  std::cout << "  " << meshPath << ": CPU " << getCpuBytes() << " B, mesh " << mesh.getBytes() << " B";
+  if (mesh.getReferences() > 1)
+    std::cout << " (shared by " << mesh.getReferences() << ")";
+  std::cout << ", texture " << texture.getBytes() << " B";
+  if (texture.getReferences() > 1)
+    std::cout << " (shared by " << texture.getReferences() << ")";
+  if (lightmap)
+    std::cout << ", lightmap " << lightmap.getBytes() << " B";
+  std::cout << (isResident() ? "" : ", not resident") << std::endl;
+}
+
+void Object::draw(RenderDevice& device, int objectId)
+{
+  PROFILE_GPU_SCOPE(profileName);
+
+  RenderDevice::DrawCall call;
+
   if (objectType == SKYBOX)
-    glUniform1i(objectTypePosition, 1);
+    call.shaderType = RenderDevice::SHADER_SKYBOX;
   else if (objectType == WATER)
-    glUniform1i(objectTypePosition, 5);
+    call.shaderType = RenderDevice::SHADER_WATER;
   else
-    glUniform1i(objectTypePosition, 2);
+    call.shaderType = RenderDevice::SHADER_MESH;
+
+  call.mesh = mesh.get();
+  call.texture = texture.get();
+  call.lightmap = lightmap.get();
+  call.vertexCount = vertexCount;
+  call.objectId = objectId;
+  call.transform = globalRotation * translate * localRotation;
+
+  device.draw(call);
+}
 
-  if (objectType == Object::DOOR)
-    drawDoor();
-  else if (objectType == Object::ANIMATED)
-    drawMouse();
-  else if (objectType == Object::WATER)
+void Object::requestTextures(RenderDevice& device, const RenderDevice::CameraParams& camera) const
+{
+  if (!boundsKnown || (!texture && !lightmap))
+    return;
+
+  /// World box of the transformed bounds, the eye inside it is as near as its nearest face
+  glm::mat4 transform = getTransform();
+  glm::vec3 worldMin(0.0f), worldMax(0.0f);
+  for (int corner = 0; corner < 8; corner++)
   {
-    glUniform1i(waterFramePos, waterFrame);
-    waterFrame = (waterFrame + 0.35);
+    glm::vec3 local((corner & 1) ? boundsMax.x : boundsMin.x, (corner & 2) ? boundsMax.y : boundsMin.y, (corner & 4) ? boundsMax.z : boundsMin.z);
+    glm::vec3 world = glm::vec3(transform * glm::vec4(local, 1.0f));
+    worldMin = corner == 0 ? world : glm::min(worldMin, world);
+    worldMax = corner == 0 ? world : glm::max(worldMax, world);
   }
-  
-  glUniformMatrix4fv(transformMatrixPosition, 1, GL_FALSE, glm::value_ptr(globalRotation * translate * localRotation));
 
-  if (textureName != "")
+  const glm::vec3& eye = camera.eyePosition;
+  float distance = glm::length(glm::max(worldMin, glm::min(eye, worldMax)) - eye);
+  if (distance == 0.0f)
   {
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, texturePosition);
+    glm::vec3 toMin = eye - worldMin, toMax = worldMax - eye;
+    distance = std::min(std::min(std::min(toMin.x, toMin.y), std::min(toMin.z, toMax.x)), std::min(toMax.y, toMax.z));
   }
 
+  /// The largest axis scale, a uv unit shrinks by it on screen
+  float scale = std::max(std::max(glm::length(glm::vec3(transform[0])), glm::length(glm::vec3(transform[1]))), glm::length(glm::vec3(transform[2])));
+  float worldPerViewHeight = camera.viewHeightAt(std::max(distance, MIN_TEXTURE_DISTANCE)) / std::max(scale, 1e-6f);
 
-  glBindVertexArray(vao);
-  glDrawArrays(GL_TRIANGLES, 0, vertices.size() / 8);
-
-  CHECK_GL_ERROR();
+  if (texture && uvDensity > 0.0f)
+    device.requestTextureDetail(texture.get(), uvDensity * worldPerViewHeight);
+  if (lightmap)
+    device.requestTextureDetail(lightmap.get(), lightmapUvDensity * worldPerViewHeight);
+}
 
+void Object::animate()
+{
+  if (objectType == DOOR)
+    animateDoor();
+  else if (objectType == ANIMATED)
+    animateMouse();
 }
 
-void Object::drawMouse()
+void Object::animateMouse()
 {
   if (!mouseEnabled)
     return;
@@ -167,14 +324,13 @@ void Object::drawMouse()
   lastRotation = rotationDegree;
 }
 
-glm::vec3 Object::randomPointInCircle()
+glm::vec3 Object::randomPointInCircle(std::mt19937& random)
 {
   glm::vec3 result = glm::vec3(-20.78f, 42.09f, -33.3f);
 
-  srand((unsigned)time(0));
-
-  result.x += (rand() % 23) - 11;
-  result.z -= (rand() % 23) - 11;
+  std::uniform_int_distribution<int> offset(-11, 11);
+  result.x += offset(random);
+  result.z -= offset(random);
 
   return result;
 }
@@ -205,9 +361,9 @@ glm::vec3 Object::bezierPosition(const glm::vec3 startPosition, const glm::vec3
 }
 
 
-void Object::drawDoor()
+void Object::animateDoor()
 {
-  transition(11.313f, 46.65f, -46.494f);
+  transition(DOOR_HINGE.x, DOOR_HINGE.y, DOOR_HINGE.z);
 
   if (doorFrame > 0.0f)
   {
@@ -238,7 +394,13 @@ void Object::doorAnimation(const float keyOffset)
   else
     localRotation = glm::rotate(glm::mat4(), glm::radians(-keyOffset), glm::vec3(0.0f, 1.0f, 0.0f)) * localRotation;
 
-  transition(11.313f, 46.65f, -46.494f);
+  transition(DOOR_HINGE.x, DOOR_HINGE.y, DOOR_HINGE.z);
+}
+
+void Object::setPlacement(const glm::vec3& position, float scale)
+{
+  translate = glm::scale(glm::mat4(1.0f), glm::vec3(scale));
+  transition(position.x, position.y, position.z);
 }
 
 void Object::transition(const float x, const float y, const float z)
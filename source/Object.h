@@ -5,7 +5,8 @@
  * \date       2021/05/13
  * \brief      Class for all objects on a scene.
  *
- *  Contains vertices, texture infromation, animation implementation and curves.
+ *  Contains mesh and texture references, animation implementation and curves. Objects are
+ *  move-only: they own their asset references, and the vertices are dropped after upload.
  *
 */
 //----------------------------------------------------------------------------------------
@@ -15,6 +16,9 @@
 
 #include <pgr.h>
 #include <iostream>
+#include <random>
+
+#include "AssetCache.h"
 
 class Object
 {
@@ -27,16 +31,59 @@ public:
     MESH = 2,         ///< Static mesh
     DOOR = 3,         ///< Door with animation of opening
     ANIMATED = 4,     ///< Mouse object that moves throught the curve
-    WATER = 5         ///< Water with dynamic texture
+    WATER = 5         ///< Water displaced by the FFT ocean
   };
 
   Object(std::string meshPath, std::string firstTextureName, ObjectType type);
-
-  void init(GLuint shaderProgram);
-  void draw();
-
-  void drawDoor();
+  Object(Object&& other) = default;
+  Object& operator=(Object&& other) = default;
+  Object(const Object&) = delete;
+  Object& operator=(const Object&) = delete;
+
+  /// Parse the OBJ file into interleaved vertices. Touches no object or GL state, so it can run on a loader thread.
+  static bool readMesh(const std::string& path, std::vector<float>& vertices);
+  /// Model-space bounds of the vertex positions of an OBJ file, without parsing the faces
+  static bool readBounds(const std::string& path, glm::vec3& minimum, glm::vec3& maximum);
+
+  /// Upload the parsed vertices and acquire the texture, only bounds and vertex count stay on the CPU.
+  /// Returns the device bytes used by the object, shared assets included.
+  size_t upload(RenderDevice& device, AssetCache& assets, std::vector<float>&& vertices);
+  void release();
+  void draw(RenderDevice& device, int objectId);
+  /// Ask the device for the texture and lightmap mips the object needs at its nearest point to the eye
+  void requestTextures(RenderDevice& device, const RenderDevice::CameraParams& camera) const;
+
+  bool isResident() const { return (bool)mesh; }
+  ObjectType getType() const { return objectType; }
+  size_t getCpuBytes() const;
+  size_t getGpuBytes() const { return mesh.getBytes() + texture.getBytes() + lightmap.getBytes(); }
+  void printMemory() const;
+  bool hasBounds() const { return boundsKnown; }
+  /// Bounds known before the first upload, which replaces them with the bounds of the parsed mesh
+  void setBounds(const glm::vec3& minimum, const glm::vec3& maximum);
+  const glm::vec3& getBoundsMin() const { return boundsMin; }
+  const glm::vec3& getBoundsMax() const { return boundsMax; }
+  const std::string& getMeshPath() const { return meshPath; }
+  glm::mat4 getTransform() const { return globalRotation * translate * localRotation; }
+
+  /// Occluders keep their triangle positions on the CPU while resident, for the occlusion culler
+  void setOccluder(bool enable) { occluder = enable; }
+  const std::vector<glm::vec3>& getOccluderTriangles() const { return occluderTriangles; }
+
+  /// Static meshes with a baked lightmap next to their OBJ file sample it instead of the torch and sky
+  void setLightmapped(bool enable) { lightmapped = enable; }
+  bool isLightmapped() const { return lightmapped; }
+
+  /// Move and uniformly scale a static object
+  void setPlacement(const glm::vec3& position, float scale);
+
+  /// Advance the door or the mouse by one frame, before visibility reads the transform
+  void animate();
+
+  void animateDoor();
   void pushDoor();
+  bool isDoorClosed() const { return !doorOpen && doorFrame <= 0.0f; }
+  bool isDoorMoving() const { return doorFrame > 0.0f; }
   void doorAnimation(const float keyOffset);
 
   void mouseClick()
@@ -44,31 +91,36 @@ public:
     mouseEnabled = !mouseEnabled;
   }
 
-  void drawMouse();
+  bool isMouseEnabled() const { return mouseEnabled; }
+
+  void animateMouse();
 private:
-  int objectId;
   ObjectType objectType;
-  unsigned int objectTypePosition;
+  const char* profileName;
 
   glm::vec3 position;
   glm::mat4 translate;
   glm::mat4 localRotation;
   glm::mat4 globalRotation;
 
-  std::vector<float> vertices;
+  std::string meshPath;
+  int vertexCount = 0;
+  AssetCache::Reference mesh;
 
-  GLuint arrayBuffer;
-  GLuint vao;
-  GLuint vertexAtribPointerPos;
-  GLuint normalPosition;
-  unsigned int transformMatrixPosition;
+  bool boundsKnown = false;                     ///< Kept after release, placeholders use it
+  glm::vec3 boundsMin;
+  glm::vec3 boundsMax;
 
-  GLuint texturePosition;
-  GLuint textureSamplerPosition;
-  GLuint textureCoordsPosition;
   std::string textureName; 
-  unsigned int skyboxTexture;
-  unsigned int skyboxTextureSamplerPos;
+  AssetCache::Reference texture;
+  float uvDensity = 0.0f;                       ///< Texture uv units per model-space unit, from the uv and triangle areas
+
+  bool lightmapped = false;
+  AssetCache::Reference lightmap;
+  float lightmapUvDensity = 0.0f;
+
+  bool occluder = false;
+  std::vector<glm::vec3> occluderTriangles;     ///< Model-space positions, three per triangle
 
   bool doorOpen = false;
   float doorFrame = 0.0f;
@@ -79,10 +131,7 @@ private:
   glm::vec3 lastMousePos = glm::vec3(0.0f, 0.0f, 0.0f);
   float lastRotation = 0.0f;
 
-  float waterFrame = 0.0f;
-  unsigned int waterFramePos;
-
   void transition(const float x, const float y, const float z);
   glm::vec3 bezierPosition(const glm::vec3 startPosition, const glm::vec3 middlePosition, const glm::vec3 finishPosition, const bool future);
-  glm::vec3 randomPointInCircle();
+  glm::vec3 randomPointInCircle(std::mt19937& random);
 };
\ No newline at end of file
@@ -0,0 +1,391 @@
+//----------------------------------------------------------------------------------------
+/**
+ * \file       OcclusionCuller.cpp
+ * \author     Bogdan Putintsev
+ * \date       2021/05/13
+ * \brief      Software occlusion culling against a low-resolution CPU depth buffer
+ *
+*/
+//----------------------------------------------------------------------------------------
+
+#include "OcclusionCuller.h"
+#include "Profiler.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <iostream>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define OCCLUSION_CULLER_SSE 1
+#include <emmintrin.h>
+#else
+#define OCCLUSION_CULLER_SSE 0
+#endif
+
+namespace
+{
+  const float GUARD_BAND = 2.0f;                ///< Occluders are clipped to twice the viewport in x and y
+  const int MAX_CLIPPED_VERTICES = 3 + 5;       ///< Triangle clipped by the near and four guard planes
+
+  /// Signed distance of a clip-space vertex to clipping plane i (inside when >= 0)
+  float clipDistance(const glm::vec4& clip, int plane)
+  {
+    switch (plane)
+    {
+    case 0:  return clip.z + clip.w;                     ///< near
+    case 1:  return GUARD_BAND * clip.w + clip.x;        ///< left guard band
+    case 2:  return GUARD_BAND * clip.w - clip.x;        ///< right guard band
+    case 3:  return GUARD_BAND * clip.w + clip.y;        ///< bottom guard band
+    default: return GUARD_BAND * clip.w - clip.y;        ///< top guard band
+    }
+  }
+
+  /// Bits set for view frustum planes the vertex is outside of, used for trivial rejection
+  int outcode(const glm::vec4& clip)
+  {
+    int code = 0;
+    if (clip.x < -clip.w) code |= 1;
+    if (clip.x > clip.w) code |= 2;
+    if (clip.y < -clip.w) code |= 4;
+    if (clip.y > clip.w) code |= 8;
+    if (clip.z < -clip.w) code |= 16;
+    if (clip.z > clip.w) code |= 32;
+    return code;
+  }
+
+  bool needsClipping(const glm::vec4& clip)
+  {
+    for (int plane = 0; plane < 5; plane++)
+      if (clipDistance(clip, plane) < 0.0f)
+        return true;
+    return false;
+  }
+}
+
+OcclusionCuller::OcclusionCuller(JobSystem& jobs)
+  : depth(WIDTH * HEIGHT, 0.0f), blockDepth(BLOCKS_X * BLOCKS_Y, 0.0f), jobs(jobs)
+{
+}
+
+void OcclusionCuller::begin(const glm::mat4& viewProjection)
+{
+  this->viewProjection = viewProjection;
+  active = enabled;
+  stats = Stats();
+  rasterizeNs = 0;
+  testNs = 0;
+
+  triangles.clear();
+  for (auto& bin : tileBins)
+    bin.clear();
+}
+
+void OcclusionCuller::addOccluder(const std::vector<glm::vec3>& vertices, const glm::mat4& transform)
+{
+  if (!active)
+    return;
+
+  uint64_t start = Profiler::nowNs();
+  glm::mat4 modelViewProjection = viewProjection * transform;
+  glm::vec4 polygon[2][MAX_CLIPPED_VERTICES + 1];
+
+  for (size_t i = 0; i + 2 < vertices.size(); i += 3)
+  {
+    glm::vec4* input = polygon[0];
+    for (int k = 0; k < 3; k++)
+      input[k] = modelViewProjection * glm::vec4(vertices[i + k], 1.0f);
+
+    stats.occluderTriangles++;
+
+    if (outcode(input[0]) & outcode(input[1]) & outcode(input[2]))
+      continue;
+
+    if (!needsClipping(input[0]) && !needsClipping(input[1]) && !needsClipping(input[2]))
+    {
+      setupTriangle(input[0], input[1], input[2]);
+      continue;
+    }
+
+    /// Sutherland-Hodgman against the near plane and the guard band
+    int count = 3;
+    int current = 0;
+
+    for (int plane = 0; plane < 5 && count >= 3; plane++)
+    {
+      const glm::vec4* in = polygon[current];
+      glm::vec4* out = polygon[1 - current];
+      int outCount = 0;
+
+      for (int v = 0; v < count; v++)
+      {
+        const glm::vec4& a = in[v];
+        const glm::vec4& b = in[(v + 1) % count];
+        float distanceA = clipDistance(a, plane);
+        float distanceB = clipDistance(b, plane);
+
+        if (distanceA >= 0.0f)
+          out[outCount++] = a;
+
+        if ((distanceA >= 0.0f) != (distanceB >= 0.0f))
+          out[outCount++] = a + (b - a) * (distanceA / (distanceA - distanceB));
+      }
+
+      count = outCount;
+      current = 1 - current;
+    }
+
+    for (int v = 1; v + 1 < count; v++)
+      setupTriangle(polygon[current][0], polygon[current][v], polygon[current][v + 1]);
+  }
+
+  rasterizeNs += Profiler::nowNs() - start;
+}
+
+void OcclusionCuller::setupTriangle(const glm::vec4& v0, const glm::vec4& v1, const glm::vec4& v2)
+{
+  const glm::vec4* vertices[3] = { &v0, &v1, &v2 };
+  Triangle triangle;
+
+  for (int k = 0; k < 3; k++)
+  {
+    float invW = 1.0f / vertices[k]->w;
+    triangle.x[k] = (vertices[k]->x * invW * 0.5f + 0.5f) * WIDTH;
+    triangle.y[k] = (0.5f - vertices[k]->y * invW * 0.5f) * HEIGHT;
+    triangle.invW[k] = invW;
+  }
+
+  const float* x = triangle.x;
+  const float* y = triangle.y;
+
+  double area = (double)x[0] * (y[1] - y[2]) + (double)x[1] * (y[2] - y[0]) + (double)x[2] * (y[0] - y[1]);
+  if (fabs(area) < 1e-8)
+    return;
+
+  /// Pixel centers lie at +0.5, only pixels whose center is inside the bounds can be covered
+  triangle.minX = std::max(0, (int)ceilf(std::min(x[0], std::min(x[1], x[2])) - 0.5f));
+  triangle.maxX = std::min(WIDTH - 1, (int)floorf(std::max(x[0], std::max(x[1], x[2])) - 0.5f));
+  triangle.minY = std::max(0, (int)ceilf(std::min(y[0], std::min(y[1], y[2])) - 0.5f));
+  triangle.maxY = std::min(HEIGHT - 1, (int)floorf(std::max(y[0], std::max(y[1], y[2])) - 0.5f));
+
+  if (triangle.minX > triangle.maxX || triangle.minY > triangle.maxY)
+    return;
+
+  triangle.orientation = area > 0.0 ? 1.0f : -1.0f;
+  triangles.push_back(triangle);
+  stats.rasterizedTriangles++;
+}
+
+void OcclusionCuller::rasterize()
+{
+  if (!active)
+    return;
+
+  PROFILE_CPU_SCOPE("OcclusionCuller::rasterize");
+  uint64_t start = Profiler::nowNs();
+
+  for (uint32_t i = 0; i < triangles.size(); i++)
+  {
+    const Triangle& triangle = triangles[i];
+
+    for (int tileY = triangle.minY / TILE_HEIGHT; tileY <= triangle.maxY / TILE_HEIGHT; tileY++)
+      for (int tileX = triangle.minX / TILE_WIDTH; tileX <= triangle.maxX / TILE_WIDTH; tileX++)
+        tileBins[tileY * TILES_X + tileX].push_back(i);
+  }
+
+  jobs.parallelFor(TILES_X * TILES_Y, 1, [this](unsigned int begin, unsigned int end) {
+    for (unsigned int i = begin; i < end; i++)
+      rasterizeTile((int)i);
+  });
+
+  rasterizeNs += Profiler::nowNs() - start;
+}
+
+void OcclusionCuller::rasterizeTile(int tileIndex)
+{
+  int tileMinX = (tileIndex % TILES_X) * TILE_WIDTH;
+  int tileMinY = (tileIndex / TILES_X) * TILE_HEIGHT;
+
+  for (int y = tileMinY; y < tileMinY + TILE_HEIGHT; y++)
+    std::fill(&depth[y * WIDTH + tileMinX], &depth[y * WIDTH + tileMinX + TILE_WIDTH], 0.0f);
+
+  for (uint32_t triangleIndex : tileBins[tileIndex])
+  {
+    const Triangle& t = triangles[triangleIndex];
+
+    /// Rows start on a multiple of four pixels so the SSE lanes never leave the tile
+    int minX = tileMinX + ((std::max(t.minX, tileMinX) - tileMinX) & ~3);
+    int maxX = std::min(t.maxX, tileMinX + TILE_WIDTH - 1);
+    int minY = std::max(t.minY, tileMinY);
+    int maxY = std::min(t.maxY, tileMinY + TILE_HEIGHT - 1);
+
+    /// Edge functions relative to the tile origin, as in the software rasterizer
+    float edgeA[3], edgeB[3], edgeC[3];
+    for (int k = 0; k < 3; k++)
+    {
+      int a = (k + 1) % 3;
+      int b = (k + 2) % 3;
+      float xa = t.x[a] - tileMinX, ya = t.y[a] - tileMinY;
+      float xb = t.x[b] - tileMinX, yb = t.y[b] - tileMinY;
+
+      edgeA[k] = (ya - yb) * t.orientation;
+      edgeB[k] = (xb - xa) * t.orientation;
+      edgeC[k] = (xa * yb - xb * ya) * t.orientation;
+    }
+
+    for (int y = minY; y <= maxY; y++)
+    {
+      float py = y - tileMinY + 0.5f;
+      float* depthRow = &depth[y * WIDTH];
+
+#if OCCLUSION_CULLER_SSE
+      __m128 rowC0 = _mm_set1_ps(edgeB[0] * py + edgeC[0]);
+      __m128 rowC1 = _mm_set1_ps(edgeB[1] * py + edgeC[1]);
+      __m128 rowC2 = _mm_set1_ps(edgeB[2] * py + edgeC[2]);
+      __m128 zero = _mm_setzero_ps();
+
+      for (int x = minX; x <= maxX; x += 4)
+      {
+        __m128 px = _mm_add_ps(_mm_set1_ps(x - tileMinX + 0.5f), _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f));
+        __m128 e0 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(edgeA[0]), px), rowC0);
+        __m128 e1 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(edgeA[1]), px), rowC1);
+        __m128 e2 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(edgeA[2]), px), rowC2);
+
+        __m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(e0, zero), _mm_cmpge_ps(e1, zero)), _mm_cmpge_ps(e2, zero));
+        if (_mm_movemask_ps(inside) == 0)
+          continue;
+
+        __m128 invSum = _mm_div_ps(_mm_set1_ps(1.0f), _mm_add_ps(_mm_add_ps(e0, e1), e2));
+        __m128 invW = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e0, _mm_set1_ps(t.invW[0])), _mm_mul_ps(e1, _mm_set1_ps(t.invW[1]))),
+                                 _mm_mul_ps(e2, _mm_set1_ps(t.invW[2])));
+        invW = _mm_and_ps(_mm_mul_ps(invW, invSum), inside);
+
+        _mm_storeu_ps(depthRow + x, _mm_max_ps(_mm_loadu_ps(depthRow + x), invW));
+      }
+#else
+      for (int x = minX; x <= maxX; x++)
+      {
+        float px = x - tileMinX + 0.5f;
+        float e0 = edgeA[0] * px + edgeB[0] * py + edgeC[0];
+        float e1 = edgeA[1] * px + edgeB[1] * py + edgeC[1];
+        float e2 = edgeA[2] * px + edgeB[2] * py + edgeC[2];
+
+        if (e0 < 0.0f || e1 < 0.0f || e2 < 0.0f)
+          continue;
+
+        float invW = (e0 * t.invW[0] + e1 * t.invW[1] + e2 * t.invW[2]) / (e0 + e1 + e2);
+        depthRow[x] = std::max(depthRow[x], invW);
+      }
+#endif
+    }
+  }
+
+  /// Farthest depth of each block inside the tile
+  for (int blockY = tileMinY / BLOCK_SIZE; blockY < (tileMinY + TILE_HEIGHT) / BLOCK_SIZE; blockY++)
+  {
+    for (int blockX = tileMinX / BLOCK_SIZE; blockX < (tileMinX + TILE_WIDTH) / BLOCK_SIZE; blockX++)
+    {
+      float farthest = FLT_MAX;
+      for (int y = blockY * BLOCK_SIZE; y < (blockY + 1) * BLOCK_SIZE; y++)
+        for (int x = blockX * BLOCK_SIZE; x < (blockX + 1) * BLOCK_SIZE; x++)
+          farthest = std::min(farthest, depth[y * WIDTH + x]);
+
+      blockDepth[blockY * BLOCKS_X + blockX] = farthest;
+    }
+  }
+}
+
+bool OcclusionCuller::isVisible(const glm::vec3& boundsMin, const glm::vec3& boundsMax, const glm::mat4& transform)
+{
+  if (!active)
+    return true;
+
+  uint64_t start = Profiler::nowNs();
+  stats.tested++;
+
+  glm::mat4 modelViewProjection = viewProjection * transform;
+  float minX = FLT_MAX, minY = FLT_MAX;
+  float maxX = -FLT_MAX, maxY = -FLT_MAX;
+  float nearest = 0.0f;
+  bool crossesNear = false;
+
+  for (int corner = 0; corner < 8; corner++)
+  {
+    glm::vec3 position((corner & 1) ? boundsMax.x : boundsMin.x,
+                       (corner & 2) ? boundsMax.y : boundsMin.y,
+                       (corner & 4) ? boundsMax.z : boundsMin.z);
+    glm::vec4 clip = modelViewProjection * glm::vec4(position, 1.0f);
+
+    /// Boxes reaching in front of the near plane cannot be projected conservatively
+    if (clip.w <= 0.0f || clip.z < -clip.w)
+    {
+      crossesNear = true;
+      break;
+    }
+
+    float invW = 1.0f / clip.w;
+    float x = (clip.x * invW * 0.5f + 0.5f) * WIDTH;
+    float y = (0.5f - clip.y * invW * 0.5f) * HEIGHT;
+    minX = std::min(minX, x);
+    maxX = std::max(maxX, x);
+    minY = std::min(minY, y);
+    maxY = std::max(maxY, y);
+    nearest = std::max(nearest, invW);
+  }
+
+  bool visible = crossesNear;
+
+  if (!crossesNear)
+  {
+    /// Every pixel the box touches, not only those whose center it covers
+    int x0 = std::max(0, (int)floorf(minX));
+    int x1 = std::min(WIDTH - 1, (int)floorf(maxX));
+    int y0 = std::max(0, (int)floorf(minY));
+    int y1 = std::min(HEIGHT - 1, (int)floorf(maxY));
+
+    if (x0 > x1 || y0 > y1)
+      stats.outside++;
+
+    for (int blockY = y0 / BLOCK_SIZE; blockY <= y1 / BLOCK_SIZE && !visible && x0 <= x1; blockY++)
+    {
+      for (int blockX = x0 / BLOCK_SIZE; blockX <= x1 / BLOCK_SIZE && !visible; blockX++)
+      {
+        if (blockDepth[blockY * BLOCKS_X + blockX] > nearest)
+          continue;
+
+        /// The block is not hidden as a whole, look at its pixels under the box
+        int pixelY1 = std::min(y1, (blockY + 1) * BLOCK_SIZE - 1);
+        int pixelX1 = std::min(x1, (blockX + 1) * BLOCK_SIZE - 1);
+        for (int y = std::max(y0, blockY * BLOCK_SIZE); y <= pixelY1 && !visible; y++)
+          for (int x = std::max(x0, blockX * BLOCK_SIZE); x <= pixelX1 && !visible; x++)
+            visible = depth[y * WIDTH + x] <= nearest;
+      }
+    }
+
+    if (!visible && x0 <= x1 && y0 <= y1)
+      stats.occluded++;
+  }
+
+  testNs += Profiler::nowNs() - start;
+  return visible;
+}
+
+void OcclusionCuller::end()
+{
+  stats.rasterizeMs = rasterizeNs / 1e6;
+  stats.testMs = testNs / 1e6;
+
+  if (!active)
+    return;
+
+  Profiler::counter("occluded objects", stats.occluded);
+  Profiler::counter("occlusion culling ms", stats.rasterizeMs + stats.testMs);
+  active = false;
+}
+
+void OcclusionCuller::printStats() const
+{
+  std::cout << "Occlusion culling " << (enabled ? "on" : "off") << ": " << stats.occluded << " of " << stats.tested
+            << " objects occluded, " << stats.outside << " off screen, " << stats.occluderTriangles << " occluder triangles ("
+            << stats.rasterizedTriangles << " rasterized), " << stats.rasterizeMs << " ms rasterizing on "
+            << jobs.getThreadCount() << " threads, " << stats.testMs << " ms testing" << std::endl;
+}
@@ -0,0 +1,95 @@
+//----------------------------------------------------------------------------------------
+/**
+ * \file       OcclusionCuller.h
+ * \author     Bogdan Putintsev
+ * \date       2021/05/13
+ * \brief      Software occlusion culling against a low-resolution CPU depth buffer
+ *
+ *  A few designated occluders are rasterized every frame into a small buffer of 1/w, in
+ *  parallel over screen tiles and four pixels at a time with SSE2. Each tile then keeps the
+ *  farthest depth of every 8x8 block. An object is culled when the nearest corner of its
+ *  bounding box lies behind the farthest occluder depth of every block the box covers; only
+ *  blocks that are not fully hidden are tested pixel by pixel.
+ *
+*/
+//----------------------------------------------------------------------------------------
+
+#pragma once
+#include "JobSystem.h"
+
+#include <pgr.h>
+#include <cstdint>
+#include <vector>
+
+class OcclusionCuller
+{
+public:
+  static const int WIDTH = 256;                 ///< Depth buffer width in pixels
+  static const int HEIGHT = 128;                ///< Depth buffer height in pixels
+  static const int TILE_WIDTH = 64;             ///< Tile rasterized by one job, a multiple of BLOCK_SIZE
+  static const int TILE_HEIGHT = 32;
+  static const int BLOCK_SIZE = 8;              ///< Pixels per side of a block of the coarse level
+
+  /// Telemetry of the last frame
+  struct Stats
+  {
+    int occluderTriangles = 0;                  ///< Triangles submitted as occluders
+    int rasterizedTriangles = 0;                ///< Of those, triangles left after clipping
+    int tested = 0;
+    int occluded = 0;
+    int outside = 0;                            ///< Culled because the box is off screen
+    double rasterizeMs = 0.0;
+    double testMs = 0.0;
+  };
+
+  /// Tiles are rasterized on the job system of the frame
+  explicit OcclusionCuller(JobSystem& jobs);
+
+  /// Start a frame, drops the occluders of the previous one
+  void begin(const glm::mat4& viewProjection);
+  /// Queue triangles, three vertices each, placed by the model transform
+  void addOccluder(const std::vector<glm::vec3>& triangles, const glm::mat4& transform);
+  /// Rasterize the queued occluders and build the coarse level
+  void rasterize();
+  /// False when the box is certainly hidden behind the occluders or off screen
+  bool isVisible(const glm::vec3& boundsMin, const glm::vec3& boundsMax, const glm::mat4& transform);
+  /// Publish the statistics of the frame to the profiler
+  void end();
+
+  void setEnabled(bool enable) { enabled = enable; }
+  bool isEnabled() const { return enabled; }
+  const Stats& getStats() const { return stats; }
+  void printStats() const;
+
+private:
+  static const int TILES_X = WIDTH / TILE_WIDTH;
+  static const int TILES_Y = HEIGHT / TILE_HEIGHT;
+  static const int BLOCKS_X = WIDTH / BLOCK_SIZE;
+  static const int BLOCKS_Y = HEIGHT / BLOCK_SIZE;
+
+  /// Screen-space occluder triangle
+  struct Triangle
+  {
+    float x[3], y[3];                           ///< Pixel coordinates, first row at the top
+    float invW[3];
+    float orientation;                          ///< 1 or -1, makes edge functions positive inside
+    int minX, minY, maxX, maxY;
+  };
+
+  bool enabled = true;
+  bool active = false;                          ///< Between begin and end of an enabled frame
+  glm::mat4 viewProjection;
+
+  std::vector<Triangle> triangles;
+  std::vector<uint32_t> tileBins[TILES_X * TILES_Y];
+  std::vector<float> depth;                     ///< 1/w of the nearest occluder, 0 where there is none
+  std::vector<float> blockDepth;                ///< Smallest 1/w of each block, the farthest depth
+
+  Stats stats;
+  uint64_t rasterizeNs = 0;
+  uint64_t testNs = 0;
+  JobSystem& jobs;
+
+  void setupTriangle(const glm::vec4& v0, const glm::vec4& v1, const glm::vec4& v2);
+  void rasterizeTile(int tileIndex);
+};
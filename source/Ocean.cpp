@@ -0,0 +1,453 @@
+//----------------------------------------------------------------------------------------
+/**
+ * \file       Ocean.cpp
+ * \author     Bogdan Putintsev
+ * \date       2021/05/13
+ * \brief      Tessendorf FFT ocean evaluated on the CPU
+ *
+*/
+//----------------------------------------------------------------------------------------
+
+#include "Ocean.h"
+#include "Constants.h"
+#include "Profiler.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <random>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define OCEAN_SSE 1
+#include <emmintrin.h>
+#else
+#define OCEAN_SSE 0
+#endif
+
+namespace
+{
+  const float PI = 3.14159265f;
+  const unsigned int SEED = 1337;               ///< Fixed so every run has the same waves
+  const int ROWS_PER_JOB = 8;
+  const int COLUMNS_PER_JOB = 16;               ///< Multiple of 4, one cache line of floats
+
+  /// Complex butterfly a' = a + w b, b' = a - w b on four lanes
+#if OCEAN_SSE
+  inline void butterfly4(float* ar, float* ai, float* br, float* bi, __m128 wr, __m128 wi)
+  {
+    __m128 xr = _mm_loadu_ps(br);
+    __m128 xi = _mm_loadu_ps(bi);
+    __m128 tr = _mm_sub_ps(_mm_mul_ps(xr, wr), _mm_mul_ps(xi, wi));
+    __m128 ti = _mm_add_ps(_mm_mul_ps(xr, wi), _mm_mul_ps(xi, wr));
+    __m128 yr = _mm_loadu_ps(ar);
+    __m128 yi = _mm_loadu_ps(ai);
+    _mm_storeu_ps(br, _mm_sub_ps(yr, tr));
+    _mm_storeu_ps(bi, _mm_sub_ps(yi, ti));
+    _mm_storeu_ps(ar, _mm_add_ps(yr, tr));
+    _mm_storeu_ps(ai, _mm_add_ps(yi, ti));
+  }
+#endif
+
+  inline void butterfly(float& ar, float& ai, float& br, float& bi, float wr, float wi)
+  {
+    float tr = br * wr - bi * wi;
+    float ti = br * wi + bi * wr;
+    br = ar - tr;
+    bi = ai - ti;
+    ar += tr;
+    ai += ti;
+  }
+}
+
+Ocean::Ocean(JobSystem& jobs, int resolution)
+  : resolution(resolution), patchSize(oceanPatchSize), choppiness(oceanChoppiness), jobs(jobs)
+{
+  log2Resolution = 0;
+  while ((1 << log2Resolution) < resolution)
+    log2Resolution++;
+
+  int count = resolution * resolution;
+  for (int field = 0; field < 3; field++)
+  {
+    fieldRe[field].resize(count);
+    fieldIm[field].resize(count);
+  }
+  displacementMap.resize(count * 4);
+  normalMap.resize(count * 4);
+
+  bitReverse.resize(resolution);
+  for (int i = 0; i < resolution; i++)
+  {
+    int reversed = 0;
+    for (int bit = 0; bit < log2Resolution; bit++)
+      reversed |= ((i >> bit) & 1) << (log2Resolution - 1 - bit);
+    bitReverse[i] = reversed;
+  }
+
+  /// Inverse transform: w = e^(+i pi j / half)
+  twiddleRe.resize(resolution);
+  twiddleIm.resize(resolution);
+  for (int half = 1; half < resolution; half *= 2)
+  {
+    for (int j = 0; j < half; j++)
+    {
+      twiddleRe[half - 1 + j] = cosf(PI * j / half);
+      twiddleIm[half - 1 + j] = sinf(PI * j / half);
+    }
+  }
+
+  initSpectrum(oceanWindSpeed, glm::normalize(glm::vec2(1.0f, 0.6f)), oceanAmplitude);
+}
+
+void Ocean::init(RenderDevice& renderDevice)
+{
+  release();
+
+  device = &renderDevice;
+  displacementTexture = device->createDataTexture(resolution, resolution);
+  normalTexture = device->createDataTexture(resolution, resolution);
+}
+
+void Ocean::release()
+{
+  if (device == nullptr)
+    return;
+
+  device->destroyTexture(displacementTexture);
+  device->destroyTexture(normalTexture);
+  displacementTexture = normalTexture = 0;
+  device = nullptr;
+}
+
+/// Phillips spectrum, h0(k) = (xi_r + i xi_i) sqrt(P(k) / 2) dk
+void Ocean::initSpectrum(float windSpeed, const glm::vec2& windDirection, float amplitude)
+{
+  int count = resolution * resolution;
+  h0Re.resize(count);
+  h0Im.resize(count);
+  h0ConjRe.resize(count);
+  h0ConjIm.resize(count);
+  omega.resize(count);
+  kx.resize(count);
+  kz.resize(count);
+
+  std::mt19937 random(SEED);
+  std::normal_distribution<float> gaussian(0.0f, 1.0f);
+
+  float largestWave = windSpeed * windSpeed / GRAVITY;
+  float smallestWave = largestWave * 0.001f;
+  float dk = 2.0f * PI / patchSize;
+
+  for (int m = 0; m < resolution; m++)
+  {
+    for (int n = 0; n < resolution; n++)
+    {
+      int i = m * resolution + n;
+
+      /// FFT order: indices above N/2 are the negative frequencies
+      float waveX = dk * (n < resolution / 2 ? n : n - resolution);
+      float waveZ = dk * (m < resolution / 2 ? m : m - resolution);
+      float k = sqrtf(waveX * waveX + waveZ * waveZ);
+
+      /// The Nyquist row and column have no mirrored partner, leaving them empty keeps the packed fields exact
+      float phillips = 0.0f;
+      if (k > 0.0f && n != resolution / 2 && m != resolution / 2)
+      {
+        float alignment = (waveX * windDirection.x + waveZ * windDirection.y) / k;
+        phillips = amplitude * expf(-1.0f / (k * k * largestWave * largestWave)) / (k * k * k * k) * alignment * alignment;
+        phillips *= expf(-k * k * smallestWave * smallestWave);
+
+        /// Waves travelling against the wind are damped
+        if (alignment < 0.0f)
+          phillips *= 0.07f;
+
+        kx[i] = waveX / k;
+        kz[i] = waveZ / k;
+      }
+      else
+        kx[i] = kz[i] = 0.0f;
+
+      omega[i] = sqrtf(GRAVITY * k);
+
+      float scale = sqrtf(phillips * 0.5f) * dk;
+      h0Re[i] = gaussian(random) * scale;
+      h0Im[i] = gaussian(random) * scale;
+    }
+  }
+
+  for (int m = 0; m < resolution; m++)
+  {
+    for (int n = 0; n < resolution; n++)
+    {
+      int i = m * resolution + n;
+      int opposite = ((resolution - m) % resolution) * resolution + (resolution - n) % resolution;
+      h0ConjRe[i] = h0Re[opposite];
+      h0ConjIm[i] = -h0Im[opposite];
+    }
+  }
+}
+
+void Ocean::update(float time)
+{
+  PROFILE_CPU_SCOPE("Ocean::update");
+
+  uint64_t start = Profiler::nowNs();
+
+  jobs.parallelFor(resolution, ROWS_PER_JOB, [&](unsigned int begin, unsigned int end) {
+    for (unsigned int row = begin; row < end; row++)
+      evaluateSpectrum(time, (int)row);
+  });
+
+  uint64_t spectrumDone = Profiler::nowNs();
+  inverseFft();
+  uint64_t fftDone = Profiler::nowNs();
+
+  jobs.parallelFor(resolution, ROWS_PER_JOB, [&](unsigned int begin, unsigned int end) {
+    for (unsigned int row = begin; row < end; row++)
+      writeMaps((int)row);
+  });
+
+  fftMs = (fftDone - spectrumDone) / 1e6;
+  spectrumMs = (Profiler::nowNs() - fftDone + spectrumDone - start) / 1e6;
+}
+
+void Ocean::draw(RenderDevice& renderDevice)
+{
+  renderDevice.updateDataTexture(displacementTexture, displacementMap.data());
+  renderDevice.updateDataTexture(normalTexture, normalMap.data());
+
+  RenderDevice::OceanParams params;
+  params.displacementMap = displacementTexture;
+  params.normalMap = normalTexture;
+  params.patchSize = patchSize;
+  renderDevice.setOcean(params);
+}
+
+/// h(k, t) = h0(k) e^(i w t) + conj(h0(-k)) e^(-i w t) and its derivatives, packed two real fields per complex one
+void Ocean::evaluateSpectrum(float time, int row)
+{
+  float dk = 2.0f * PI / patchSize;
+  float waveZ = dk * (row < resolution / 2 ? row : row - resolution);
+
+  for (int n = 0; n < resolution; n++)
+  {
+    int i = row * resolution + n;
+    float waveX = dk * (n < resolution / 2 ? n : n - resolution);
+
+    float c = cosf(omega[i] * time);
+    float s = sinf(omega[i] * time);
+
+    float hRe = (h0Re[i] + h0ConjRe[i]) * c - (h0Im[i] - h0ConjIm[i]) * s;
+    float hIm = (h0Im[i] + h0ConjIm[i]) * c + (h0Re[i] - h0ConjRe[i]) * s;
+
+    /// Choppy displacement D = -i k/|k| h, slope = i k h
+    float dxRe = kx[i] * hIm, dxIm = -kx[i] * hRe;
+    float dzRe = kz[i] * hIm, dzIm = -kz[i] * hRe;
+    float sxRe = -waveX * hIm, sxIm = waveX * hRe;
+    float szRe = -waveZ * hIm, szIm = waveZ * hRe;
+
+    /// a + i b for real fields a and b
+    fieldRe[0][i] = hRe - dxIm;
+    fieldIm[0][i] = hIm + dxRe;
+    fieldRe[1][i] = dzRe - sxIm;
+    fieldIm[1][i] = dzIm + sxRe;
+    fieldRe[2][i] = szRe;
+    fieldIm[2][i] = szIm;
+  }
+}
+
+void Ocean::inverseFft()
+{
+  int columnsPerJob = std::min(COLUMNS_PER_JOB, resolution);
+  unsigned int columnJobs = (unsigned int)(resolution / columnsPerJob);
+
+  /// The rows of the three fields one after another
+  jobs.parallelFor(3 * resolution, ROWS_PER_JOB, [&](unsigned int begin, unsigned int end) {
+    for (unsigned int i = begin; i < end; i++)
+    {
+      int field = i / resolution;
+      int row = i % resolution;
+      fftRow(&fieldRe[field][row * resolution], &fieldIm[field][row * resolution]);
+    }
+  });
+
+  jobs.parallelFor(3 * columnJobs, 1, [&](unsigned int begin, unsigned int end) {
+    for (unsigned int job = begin; job < end; job++)
+    {
+      int field = job / columnJobs;
+      fftColumns(fieldRe[field].data(), fieldIm[field].data(), (job % columnJobs) * columnsPerJob, columnsPerJob);
+    }
+  });
+}
+
+/// Radix-2 decimation in time over one row
+void Ocean::fftRow(float* re, float* im) const
+{
+  for (int i = 0; i < resolution; i++)
+  {
+    int j = bitReverse[i];
+    if (i < j)
+    {
+      std::swap(re[i], re[j]);
+      std::swap(im[i], im[j]);
+    }
+  }
+
+  for (int half = 1; half < resolution; half *= 2)
+  {
+    const float* wr = &twiddleRe[half - 1];
+    const float* wi = &twiddleIm[half - 1];
+
+    for (int start = 0; start < resolution; start += 2 * half)
+    {
+      float* ar = re + start;
+      float* ai = im + start;
+      float* br = ar + half;
+      float* bi = ai + half;
+
+      int j = 0;
+#if OCEAN_SSE
+      for (; j + 4 <= half; j += 4)
+        butterfly4(ar + j, ai + j, br + j, bi + j, _mm_loadu_ps(wr + j), _mm_loadu_ps(wi + j));
+#endif
+      for (; j < half; j++)
+        butterfly(ar[j], ai[j], br[j], bi[j], wr[j], wi[j]);
+    }
+  }
+}
+
+/// Same transform down a strip of columns. The strip is gathered into a packed buffer first, rows of a
+/// power-of-two sized map are a power of two apart and would evict each other from the cache.
+/// Whole strip rows are then butterflied with one twiddle.
+void Ocean::fftColumns(float* re, float* im, int firstColumn, int columnCount) const
+{
+  thread_local std::vector<float> stripRe, stripIm;
+  stripRe.resize(resolution * columnCount);
+  stripIm.resize(resolution * columnCount);
+
+  for (int i = 0; i < resolution; i++)
+  {
+    int source = bitReverse[i] * resolution + firstColumn;
+    std::copy(re + source, re + source + columnCount, &stripRe[i * columnCount]);
+    std::copy(im + source, im + source + columnCount, &stripIm[i * columnCount]);
+  }
+
+  for (int half = 1; half < resolution; half *= 2)
+  {
+    for (int start = 0; start < resolution; start += 2 * half)
+    {
+      for (int j = 0; j < half; j++)
+      {
+        float wr = twiddleRe[half - 1 + j];
+        float wi = twiddleIm[half - 1 + j];
+
+        float* ar = &stripRe[(start + j) * columnCount];
+        float* ai = &stripIm[(start + j) * columnCount];
+        float* br = ar + half * columnCount;
+        float* bi = ai + half * columnCount;
+
+        int c = 0;
+#if OCEAN_SSE
+        for (; c + 4 <= columnCount; c += 4)
+          butterfly4(ar + c, ai + c, br + c, bi + c, _mm_set1_ps(wr), _mm_set1_ps(wi));
+#endif
+        for (; c < columnCount; c++)
+          butterfly(ar[c], ai[c], br[c], bi[c], wr, wi);
+      }
+    }
+  }
+
+  for (int i = 0; i < resolution; i++)
+  {
+    std::copy(&stripRe[i * columnCount], &stripRe[(i + 1) * columnCount], re + i * resolution + firstColumn);
+    std::copy(&stripIm[i * columnCount], &stripIm[(i + 1) * columnCount], im + i * resolution + firstColumn);
+  }
+}
+
+void Ocean::writeMaps(int row)
+{
+  for (int n = 0; n < resolution; n++)
+  {
+    int i = row * resolution + n;
+
+    float height = fieldRe[0][i];
+    float dx = fieldIm[0][i];
+    float dz = fieldRe[1][i];
+    float slopeX = fieldIm[1][i];
+    float slopeZ = fieldRe[2][i];
+
+    displacementMap[i * 4 + 0] = choppiness * dx;
+    displacementMap[i * 4 + 1] = height;
+    displacementMap[i * 4 + 2] = choppiness * dz;
+    displacementMap[i * 4 + 3] = 0.0f;
+
+    glm::vec3 normal = glm::normalize(glm::vec3(-slopeX, 1.0f, -slopeZ));
+    normalMap[i * 4 + 0] = normal.x;
+    normalMap[i * 4 + 1] = normal.y;
+    normalMap[i * 4 + 2] = normal.z;
+    normalMap[i * 4 + 3] = 0.0f;
+  }
+}
+
+std::vector<float> Ocean::gridMesh(const glm::vec3& boundsMin, const glm::vec3& boundsMax, int quads)
+{
+  std::vector<float> vertices;
+  vertices.reserve(quads * quads * 6 * 8);
+
+  float height = (boundsMin.y + boundsMax.y) * 0.5f;
+  glm::vec3 size = boundsMax - boundsMin;
+
+  /// Counter-clockwise seen from above: (x0, z0), (x0, z1), (x1, z1) and (x0, z0), (x1, z1), (x1, z0)
+  const int corners[6][2] = { { 0, 0 }, { 0, 1 }, { 1, 1 }, { 0, 0 }, { 1, 1 }, { 1, 0 } };
+
+  for (int z = 0; z < quads; z++)
+  {
+    for (int x = 0; x < quads; x++)
+    {
+      for (const auto& corner : corners)
+      {
+        float u = (float)(x + corner[0]) / quads;
+        float v = (float)(z + corner[1]) / quads;
+        float vertex[8] = { boundsMin.x + u * size.x, height, boundsMin.z + v * size.z, u, v, 0.0f, 1.0f, 0.0f };
+        vertices.insert(vertices.end(), vertex, vertex + 8);
+      }
+    }
+  }
+
+  return vertices;
+}
+
+void Ocean::benchmark()
+{
+  const int FRAMES = 30;
+  const int resolutions[] = { 128, 256, 512 };
+
+  unsigned int hardware = std::max(1u, std::thread::hardware_concurrency());
+  std::vector<unsigned int> threadCounts = { 1, 2, 4, hardware };
+  std::sort(threadCounts.begin(), threadCounts.end());
+  threadCounts.erase(std::unique(threadCounts.begin(), threadCounts.end()), threadCounts.end());
+
+  std::cout << "Ocean FFT benchmark (" << FRAMES << " updates each, SSE " << (OCEAN_SSE ? "on" : "off") << ")" << std::endl;
+  std::cout << std::setw(6) << "grid" << std::setw(9) << "threads" << std::setw(12) << "fft ms" << std::setw(14) << "spectrum ms" << std::setw(12) << "total ms" << std::endl;
+  std::cout << std::fixed << std::setprecision(3);
+
+  for (int resolution : resolutions)
+  {
+    for (unsigned int threads : threadCounts)
+    {
+      JobSystem jobs(threads);
+      Ocean ocean(jobs, resolution);
+
+      double fft = 0.0, spectrum = 0.0;
+      for (int frame = 0; frame < FRAMES; frame++)
+      {
+        ocean.update(frame * timerDelay / 1000.0f);
+        fft += ocean.getLastFftMs();
+        spectrum += ocean.getLastSpectrumMs();
+      }
+
+      std::cout << std::setw(6) << resolution << std::setw(9) << threads << std::setw(12) << fft / FRAMES
+                << std::setw(14) << spectrum / FRAMES << std::setw(12) << (fft + spectrum) / FRAMES << std::endl;
+    }
+  }
+}
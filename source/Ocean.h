@@ -0,0 +1,90 @@
+//----------------------------------------------------------------------------------------
+/**
+ * \file       Ocean.h
+ * \author     Bogdan Putintsev
+ * \date       2021/05/13
+ * \brief      Tessendorf FFT ocean evaluated on the CPU
+ *
+ *  A Phillips spectrum is sampled once with a fixed seed. Every tick the spectrum is
+ *  advanced with the deep water dispersion relation and three complex inverse FFTs turn it
+ *  into height, horizontal (choppy) displacement and slopes: each FFT carries two real
+ *  fields, one in the real and one in the imaginary part. The 2D FFT runs rows and then
+ *  columns in parallel on the job system, butterflies are done four at a time with SSE.
+ *  The results are a displacement map and a normal map tiling every patchSize units.
+ *
+*/
+//----------------------------------------------------------------------------------------
+
+#pragma once
+#include "RenderDevice.h"
+#include "JobSystem.h"
+
+class Ocean
+{
+public:
+  static const int DEFAULT_RESOLUTION = 256;    ///< FFT size, a power of two
+  static const int GRID_QUADS = 128;            ///< Quads per side of the water mesh
+  static constexpr float GRAVITY = 9.81f;
+
+  explicit Ocean(JobSystem& jobs, int resolution = DEFAULT_RESOLUTION);
+
+  /// Create the device textures of the maps
+  void init(RenderDevice& device);
+  void release();
+
+  /// Advance the simulation to the given time in seconds
+  void update(float time);
+  /// Upload the maps and bind them for SHADER_WATER draws
+  void draw(RenderDevice& device);
+
+  int getResolution() const { return resolution; }
+  float getPatchSize() const { return patchSize; }
+
+  /// RGBA float maps: displacement (x, height, z, 0) and normal (x, y, z, 0)
+  const std::vector<float>& getDisplacementMap() const { return displacementMap; }
+  const std::vector<float>& getNormalMap() const { return normalMap; }
+
+  double getLastSpectrumMs() const { return spectrumMs; }
+  double getLastFftMs() const { return fftMs; }
+
+  /// Flat grid over the XZ extent of the bounds at their mid height, layout of RenderDevice::createMesh
+  static std::vector<float> gridMesh(const glm::vec3& boundsMin, const glm::vec3& boundsMax, int quads);
+
+  /// Print update and FFT times for several grid sizes and thread counts
+  static void benchmark();
+
+private:
+  int resolution;
+  int log2Resolution;
+  float patchSize;
+  float choppiness;
+  JobSystem& jobs;
+
+  std::vector<float> h0Re, h0Im;                ///< h0(k)
+  std::vector<float> h0ConjRe, h0ConjIm;        ///< conj(h0(-k))
+  std::vector<float> omega;                     ///< Dispersion relation w(k)
+  std::vector<float> kx, kz;                    ///< Wave vector divided by its length
+
+  /// Three complex fields: height + i dx, dz + i slope x, slope z
+  std::vector<float> fieldRe[3], fieldIm[3];
+
+  std::vector<int> bitReverse;
+  std::vector<float> twiddleRe, twiddleIm;      ///< Stage with half size h starts at index h - 1
+
+  std::vector<float> displacementMap;
+  std::vector<float> normalMap;
+
+  RenderDevice* device = nullptr;
+  RenderDevice::Handle displacementTexture = 0;
+  RenderDevice::Handle normalTexture = 0;
+
+  double spectrumMs = 0.0;
+  double fftMs = 0.0;
+
+  void initSpectrum(float windSpeed, const glm::vec2& windDirection, float amplitude);
+  void evaluateSpectrum(float time, int row);
+  void inverseFft();
+  void fftRow(float* re, float* im) const;
+  void fftColumns(float* re, float* im, int firstColumn, int columnCount) const;
+  void writeMaps(int row);
+};
@@ -0,0 +1,571 @@
+//----------------------------------------------------------------------------------------
+/**
+ * \file       ParticleSystem.cpp
+ * \author     Bogdan Putintsev
+ * \date       2021/05/13
+ * \brief      Multi-threaded SIMD particles for the torch fire, embers and water spray
+ *
+*/
+//----------------------------------------------------------------------------------------
+
+#include "ParticleSystem.h"
+#include "Constants.h"
+#include "Profiler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PARTICLES_SSE 1
+#include <emmintrin.h>
+#else
+#define PARTICLES_SSE 0
+#endif
+
+namespace
+{
+  const float PI = 3.14159265f;
+  const float LIFE_MARGIN = 0.1f;               ///< Seconds of extra ring slots, frames do not emit exactly at the rate
+  const float OCTAVE_FREQUENCY = 2.3f;          ///< Frequency of the second curl-noise octave over the first
+  const float OCTAVE_AMPLITUDE = 0.5f;
+  const float OCTAVE_SPEED[2] = { 0.9f, -1.3f };  ///< Phase change per second of each octave
+
+  /// Behaviour and look shared by all emitters of a type
+  struct TypeParams
+  {
+    float minLife;
+    float maxLife;
+    float radius;                               ///< Particles start on a horizontal disc around the emitter
+    glm::vec3 velocity;                         ///< At birth, each axis varied by up to spread either way
+    glm::vec3 spread;
+    glm::vec3 acceleration;                     ///< Gravity, or buoyancy for the flames
+    float drag;                                 ///< Share of the velocity lost per second
+    float curlStrength;                         ///< Acceleration by the curl-noise field
+    float curlFrequency;                        ///< Of the first octave, per world unit
+    glm::vec4 startColor;
+    glm::vec4 endColor;
+    glm::vec2 size;                             ///< Half size at birth and at death
+    bool additive;
+    bool lit;
+  };
+
+  const TypeParams TYPES[ParticleSystem::EMITTER_TYPES] =
+  {
+    /// Fire
+    { 0.4f, 0.9f, 0.12f, glm::vec3(0.0f, 0.6f, 0.0f), glm::vec3(0.15f, 0.2f, 0.15f), glm::vec3(0.0f, 1.5f, 0.0f), 1.5f, 1.5f, 3.0f,
+      glm::vec4(1.0f, 0.55f, 0.15f, 0.8f), glm::vec4(0.6f, 0.1f, 0.02f, 0.0f), glm::vec2(0.1f, 0.03f), true, false },
+    /// Embers
+    { 1.5f, 3.0f, 0.08f, glm::vec3(0.0f, 1.2f, 0.0f), glm::vec3(0.4f, 0.5f, 0.4f), glm::vec3(0.0f, 0.2f, 0.0f), 0.5f, 1.2f, 1.5f,
+      glm::vec4(1.0f, 0.7f, 0.3f, 1.0f), glm::vec4(1.0f, 0.2f, 0.0f, 0.0f), glm::vec2(0.015f, 0.008f), true, false },
+    /// Spray
+    { 0.8f, 1.6f, 1.5f, glm::vec3(0.0f, 3.5f, 0.0f), glm::vec3(1.2f, 1.0f, 1.2f), glm::vec3(0.0f, -9.81f, 0.0f), 0.3f, 0.6f, 0.8f,
+      glm::vec4(0.9f, 0.95f, 1.0f, 0.5f), glm::vec4(0.9f, 0.95f, 1.0f, 0.0f), glm::vec2(0.06f, 0.2f), false, true },
+  };
+
+  /// lowbias32 integer hash (Wellons), the random stream of a particle is a function of its serial
+  inline uint32_t hash(uint32_t x)
+  {
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+  }
+
+  /// [0, 1) from the top 24 bits
+  inline float unitFloat(uint32_t h)
+  {
+    return (float)(h >> 8) * (1.0f / 16777216.0f);
+  }
+
+  /// ABC (Arnold-Beltrami-Childress) flow in two octaves. Each octave is proportional to its own
+  /// curl, so the field is the curl of a smooth potential and free of divergence: particles
+  /// swirl without bunching up or thinning out.
+  glm::vec3 curlNoise(float x, float y, float z, float frequency, float time)
+  {
+    glm::vec3 field(0.0f);
+    float amplitude = 1.0f;
+
+    for (int octave = 0; octave < 2; octave++)
+    {
+      float phase = time * OCTAVE_SPEED[octave];
+      float px = x * frequency + phase, py = y * frequency + phase, pz = z * frequency + phase;
+      field += glm::vec3(std::sin(pz) + std::cos(py), std::sin(px) + std::cos(pz), std::sin(py) + std::cos(px)) * amplitude;
+      frequency *= OCTAVE_FREQUENCY;
+      amplitude *= OCTAVE_AMPLITUDE;
+    }
+
+    return field;
+  }
+
+#if PARTICLES_SSE
+  /// Live lanes of a 4-bit compare mask
+  const int LANE_COUNT[16] = { 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4 };
+
+  /// SSE2 has no 32-bit low multiply, the even and odd lanes are multiplied apart
+  inline __m128i mullo4(__m128i a, __m128i b)
+  {
+    __m128i even = _mm_mul_epu32(a, b);
+    __m128i odd = _mm_mul_epu32(_mm_srli_si128(a, 4), _mm_srli_si128(b, 4));
+    return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)), _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+  }
+
+  inline __m128i hash4(__m128i x)
+  {
+    x = _mm_xor_si128(x, _mm_srli_epi32(x, 16));
+    x = mullo4(x, _mm_set1_epi32(0x7feb352d));
+    x = _mm_xor_si128(x, _mm_srli_epi32(x, 15));
+    x = mullo4(x, _mm_set1_epi32((int)0x846ca68bu));
+    x = _mm_xor_si128(x, _mm_srli_epi32(x, 16));
+    return x;
+  }
+
+  inline __m128 unitFloat4(__m128i h)
+  {
+    return _mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(h, 8)), _mm_set1_ps(1.0f / 16777216.0f));
+  }
+
+  /// Reduced to [-pi, pi], folded to [-pi/2, pi/2] and a degree 7 Taylor polynomial, error below 2e-4
+  inline __m128 sin4(__m128 x)
+  {
+    __m128 turns = _mm_cvtepi32_ps(_mm_cvtps_epi32(_mm_mul_ps(x, _mm_set1_ps(0.5f / PI))));
+    x = _mm_sub_ps(x, _mm_mul_ps(turns, _mm_set1_ps(2.0f * PI)));
+    x = _mm_min_ps(x, _mm_sub_ps(_mm_set1_ps(PI), x));
+    x = _mm_max_ps(x, _mm_sub_ps(_mm_set1_ps(-PI), x));
+
+    __m128 x2 = _mm_mul_ps(x, x);
+    __m128 p = _mm_add_ps(_mm_set1_ps(1.0f / 120.0f), _mm_mul_ps(x2, _mm_set1_ps(-1.0f / 5040.0f)));
+    p = _mm_add_ps(_mm_set1_ps(-1.0f / 6.0f), _mm_mul_ps(x2, p));
+    p = _mm_add_ps(_mm_set1_ps(1.0f), _mm_mul_ps(x2, p));
+    return _mm_mul_ps(x, p);
+  }
+
+  inline __m128 cos4(__m128 x)
+  {
+    return sin4(_mm_add_ps(x, _mm_set1_ps(0.5f * PI)));
+  }
+
+  /// curlNoise on four particles
+  inline void curlNoise4(__m128 x, __m128 y, __m128 z, float frequency, float time, __m128& fieldX, __m128& fieldY, __m128& fieldZ)
+  {
+    fieldX = fieldY = fieldZ = _mm_setzero_ps();
+    float amplitude = 1.0f;
+
+    for (int octave = 0; octave < 2; octave++)
+    {
+      __m128 k = _mm_set1_ps(frequency);
+      __m128 phase = _mm_set1_ps(time * OCTAVE_SPEED[octave]);
+      __m128 px = _mm_add_ps(_mm_mul_ps(x, k), phase);
+      __m128 py = _mm_add_ps(_mm_mul_ps(y, k), phase);
+      __m128 pz = _mm_add_ps(_mm_mul_ps(z, k), phase);
+      __m128 a = _mm_set1_ps(amplitude);
+
+      fieldX = _mm_add_ps(fieldX, _mm_mul_ps(a, _mm_add_ps(sin4(pz), cos4(py))));
+      fieldY = _mm_add_ps(fieldY, _mm_mul_ps(a, _mm_add_ps(sin4(px), cos4(pz))));
+      fieldZ = _mm_add_ps(fieldZ, _mm_mul_ps(a, _mm_add_ps(sin4(py), cos4(px))));
+      frequency *= OCTAVE_FREQUENCY;
+      amplitude *= OCTAVE_AMPLITUDE;
+    }
+  }
+#endif
+}
+
+ParticleSystem::ParticleSystem(JobSystem& jobs)
+  : jobs(jobs), simd(hasSimd())
+{
+}
+
+bool ParticleSystem::hasSimd()
+{
+  return PARTICLES_SSE != 0;
+}
+
+int ParticleSystem::addEmitter(EmitterType type, const glm::vec3& position, float rate)
+{
+  const TypeParams& params = TYPES[type];
+
+  Emitter emitter;
+  emitter.type = type;
+  emitter.position = position;
+  emitter.rate = rate;
+  emitter.seed = hash((uint32_t)emitters.size() + 1);
+  emitter.capacity = std::max(4, ((int)std::ceil(rate * (params.maxLife + LIFE_MARGIN)) + 3) & ~3);
+  emitter.instanceOffset = (int)instances[type].size();
+
+  /// Never born slots are dead: age * inverseLife is 1
+  emitter.positionX.assign(emitter.capacity, position.x);
+  emitter.positionY.assign(emitter.capacity, position.y);
+  emitter.positionZ.assign(emitter.capacity, position.z);
+  emitter.velocityX.assign(emitter.capacity, 0.0f);
+  emitter.velocityY.assign(emitter.capacity, 0.0f);
+  emitter.velocityZ.assign(emitter.capacity, 0.0f);
+  emitter.age.assign(emitter.capacity, 1.0f);
+  emitter.inverseLife.assign(emitter.capacity, 1.0f);
+
+  instances[type].resize(instances[type].size() + emitter.capacity, glm::vec4(position, 1.0f));
+  emitters.push_back(std::move(emitter));
+
+  stats.emitters = (int)emitters.size();
+  stats.capacity += emitters.back().capacity;
+  return (int)emitters.size() - 1;
+}
+
+void ParticleSystem::setEmitterPosition(int emitter, const glm::vec3& position)
+{
+  emitters[emitter].position = position;
+}
+
+void ParticleSystem::setEmitterVisible(int emitter, bool visible)
+{
+  emitters[emitter].visible = visible;
+}
+
+void ParticleSystem::clear()
+{
+  emitters.clear();
+  for (std::vector<glm::vec4>& stream : instances)
+    stream.clear();
+  for (size_t& live : liveByType)
+    live = 0;
+  stats = Stats();
+}
+
+void ParticleSystem::update(float dt)
+{
+  PROFILE_CPU_SCOPE("ParticleSystem::update");
+  uint64_t start = Profiler::nowNs();
+
+  Step step;
+  step.dt = dt;
+  step.time = time;
+  for (int type = 0; type < EMITTER_TYPES; type++)
+    step.drag[type] = std::exp(-TYPES[type].drag * dt);
+
+  /// Whole particles due this frame, the fraction carries over
+  stats.emitted = 0;
+  for (Emitter& emitter : emitters)
+  {
+    emitter.carry += emitter.rate * dt;
+    emitter.emitCount = std::min((int)emitter.carry, emitter.capacity);
+    emitter.carry = std::min(emitter.carry - (int)emitter.carry, 1.0f);
+    stats.emitted += emitter.emitCount;
+  }
+
+  blockJobs.clear();
+  for (size_t e = 0; e < emitters.size(); e++)
+    for (int begin = 0; begin < emitters[e].capacity; begin += BLOCK_PARTICLES)
+      blockJobs.push_back({ (int)e, begin, std::min(begin + BLOCK_PARTICLES, emitters[e].capacity) });
+
+  jobLive.assign(blockJobs.size(), 0);
+  jobs.parallelFor((unsigned int)blockJobs.size(), 1, [this, &step](unsigned int begin, unsigned int end) {
+    for (unsigned int j = begin; j < end; j++)
+      runJob(blockJobs[j], step, jobLive[j]);
+  });
+
+  for (Emitter& emitter : emitters)
+  {
+    emitter.head = (emitter.head + emitter.emitCount) % emitter.capacity;
+    emitter.serial += emitter.emitCount;
+  }
+
+  for (size_t& live : liveByType)
+    live = 0;
+  for (size_t j = 0; j < blockJobs.size(); j++)
+    liveByType[emitters[blockJobs[j].emitter].type] += jobLive[j];
+
+  stats.liveParticles = liveByType[FIRE] + liveByType[EMBERS] + liveByType[SPRAY];
+  time += dt;
+
+  stats.updateMs = (Profiler::nowNs() - start) / 1e6;
+  Profiler::counter("live particles", (double)stats.liveParticles);
+  Profiler::counter("particle update ms", stats.updateMs);
+}
+
+void ParticleSystem::runJob(const Job& job, const Step& step, uint32_t& live)
+{
+  Emitter& emitter = emitters[job.emitter];
+
+  /// The slots emitted into this frame start at head and wrap around the ring at most once
+  int ends[2] = { std::min(emitter.head + emitter.emitCount, emitter.capacity), emitter.head + emitter.emitCount - emitter.capacity };
+  int starts[2] = { emitter.head, 0 };
+  uint32_t serials[2] = { emitter.serial, emitter.serial + (uint32_t)(emitter.capacity - emitter.head) };
+
+  for (int range = 0; range < 2; range++)
+  {
+    int begin = std::max(starts[range], job.begin);
+    int end = std::min(ends[range], job.end);
+    if (begin >= end)
+      continue;
+
+    uint32_t serial = serials[range] + (uint32_t)(begin - starts[range]);
+    if (simd)
+      emitSimd(emitter, begin, end - begin, serial, step);
+    else
+      emitScalar(emitter, begin, end - begin, serial, step);
+  }
+
+  if (simd)
+    integrateSimd(emitter, job.begin, job.end, step, live);
+  else
+    integrateScalar(emitter, job.begin, job.end, step, live);
+}
+
+void ParticleSystem::emitScalar(Emitter& emitter, int slot, int count, uint32_t serial, const Step& step)
+{
+  const TypeParams& params = TYPES[emitter.type];
+  float birthStep = step.dt / emitter.emitCount;
+  uint32_t first = serial - emitter.serial;
+
+  for (int i = 0; i < count; i++)
+  {
+    uint32_t base = hash(emitter.seed ^ (serial + (uint32_t)i));
+    float random[6];
+    for (int k = 0; k < 6; k++)
+      random[k] = unitFloat(hash(base + (uint32_t)k));
+
+    /// Uniform on the disc: the radius grows with the square root
+    float radius = params.radius * std::sqrt(random[1]);
+    float angle = 2.0f * PI * random[2];
+    float life = params.minLife + (params.maxLife - params.minLife) * random[0];
+
+    int s = slot + i;
+    emitter.positionX[s] = emitter.position.x + radius * std::cos(angle);
+    emitter.positionY[s] = emitter.position.y;
+    emitter.positionZ[s] = emitter.position.z + radius * std::sin(angle);
+    emitter.velocityX[s] = params.velocity.x + params.spread.x * (2.0f * random[3] - 1.0f);
+    emitter.velocityY[s] = params.velocity.y + params.spread.y * (2.0f * random[4] - 1.0f);
+    emitter.velocityZ[s] = params.velocity.z + params.spread.z * (2.0f * random[5] - 1.0f);
+    emitter.age[s] = -birthStep * ((float)(first + (uint32_t)i) + 0.5f);
+    emitter.inverseLife[s] = 1.0f / life;
+  }
+}
+
+void ParticleSystem::integrateScalar(Emitter& emitter, int begin, int end, const Step& step, uint32_t& live)
+{
+  const TypeParams& params = TYPES[emitter.type];
+  float drag = step.drag[emitter.type];
+  glm::vec4* output = &instances[emitter.type][emitter.instanceOffset];
+
+  for (int i = begin; i < end; i++)
+  {
+    float age = emitter.age[i] + step.dt;
+    emitter.age[i] = age;
+    float t = age * emitter.inverseLife[i];
+
+    /// Dead particles only pass their age on, the vertex shader collapses them
+    if (t < 1.0f)
+    {
+      glm::vec3 force = params.acceleration + curlNoise(emitter.positionX[i], emitter.positionY[i], emitter.positionZ[i], params.curlFrequency, step.time) * params.curlStrength;
+      float vx = (emitter.velocityX[i] + force.x * step.dt) * drag;
+      float vy = (emitter.velocityY[i] + force.y * step.dt) * drag;
+      float vz = (emitter.velocityZ[i] + force.z * step.dt) * drag;
+      emitter.velocityX[i] = vx;
+      emitter.velocityY[i] = vy;
+      emitter.velocityZ[i] = vz;
+      emitter.positionX[i] += vx * step.dt;
+      emitter.positionY[i] += vy * step.dt;
+      emitter.positionZ[i] += vz * step.dt;
+      live++;
+    }
+
+    output[i] = glm::vec4(emitter.positionX[i], emitter.positionY[i], emitter.positionZ[i], t);
+  }
+}
+
+#if PARTICLES_SSE
+void ParticleSystem::emitSimd(Emitter& emitter, int slot, int count, uint32_t serial, const Step& step)
+{
+  const TypeParams& params = TYPES[emitter.type];
+  float birthStep = step.dt / emitter.emitCount;
+  uint32_t first = serial - emitter.serial;
+
+  for (int i = 0; i < count; i += 4)
+  {
+    __m128i serials = _mm_add_epi32(_mm_set1_epi32((int)(serial + (uint32_t)i)), _mm_set_epi32(3, 2, 1, 0));
+    __m128i base = hash4(_mm_xor_si128(_mm_set1_epi32((int)emitter.seed), serials));
+    __m128 random[6];
+    for (int k = 0; k < 6; k++)
+      random[k] = unitFloat4(hash4(_mm_add_epi32(base, _mm_set1_epi32(k))));
+
+    __m128 radius = _mm_mul_ps(_mm_set1_ps(params.radius), _mm_sqrt_ps(random[1]));
+    __m128 angle = _mm_mul_ps(_mm_set1_ps(2.0f * PI), random[2]);
+    __m128 life = _mm_add_ps(_mm_set1_ps(params.minLife), _mm_mul_ps(_mm_set1_ps(params.maxLife - params.minLife), random[0]));
+    __m128 one = _mm_set1_ps(1.0f);
+    __m128 two = _mm_set1_ps(2.0f);
+
+    float lanes[8][4];
+    _mm_storeu_ps(lanes[0], _mm_add_ps(_mm_set1_ps(emitter.position.x), _mm_mul_ps(radius, cos4(angle))));
+    _mm_storeu_ps(lanes[1], _mm_set1_ps(emitter.position.y));
+    _mm_storeu_ps(lanes[2], _mm_add_ps(_mm_set1_ps(emitter.position.z), _mm_mul_ps(radius, sin4(angle))));
+    _mm_storeu_ps(lanes[3], _mm_add_ps(_mm_set1_ps(params.velocity.x), _mm_mul_ps(_mm_set1_ps(params.spread.x), _mm_sub_ps(_mm_mul_ps(two, random[3]), one))));
+    _mm_storeu_ps(lanes[4], _mm_add_ps(_mm_set1_ps(params.velocity.y), _mm_mul_ps(_mm_set1_ps(params.spread.y), _mm_sub_ps(_mm_mul_ps(two, random[4]), one))));
+    _mm_storeu_ps(lanes[5], _mm_add_ps(_mm_set1_ps(params.velocity.z), _mm_mul_ps(_mm_set1_ps(params.spread.z), _mm_sub_ps(_mm_mul_ps(two, random[5]), one))));
+    __m128 order = _mm_add_ps(_mm_set1_ps((float)(first + (uint32_t)i) + 0.5f), _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f));
+    _mm_storeu_ps(lanes[6], _mm_mul_ps(_mm_set1_ps(-birthStep), order));
+    _mm_storeu_ps(lanes[7], _mm_div_ps(one, life));
+
+    /// The emitted run is not aligned to the lanes, the last group may be partial
+    float* arrays[8] = { emitter.positionX.data(), emitter.positionY.data(), emitter.positionZ.data(), emitter.velocityX.data(),
+                         emitter.velocityY.data(), emitter.velocityZ.data(), emitter.age.data(), emitter.inverseLife.data() };
+    int lanesUsed = std::min(4, count - i);
+    for (int a = 0; a < 8; a++)
+    {
+      if (lanesUsed == 4)
+        _mm_storeu_ps(arrays[a] + slot + i, _mm_loadu_ps(lanes[a]));
+      else
+        std::copy(lanes[a], lanes[a] + lanesUsed, arrays[a] + slot + i);
+    }
+  }
+}
+
+void ParticleSystem::integrateSimd(Emitter& emitter, int begin, int end, const Step& step, uint32_t& live)
+{
+  const TypeParams& params = TYPES[emitter.type];
+  float* output = &instances[emitter.type][emitter.instanceOffset].x;
+
+  __m128 dt = _mm_set1_ps(step.dt);
+  __m128 drag = _mm_set1_ps(step.drag[emitter.type]);
+  __m128 one = _mm_set1_ps(1.0f);
+  __m128 strength = _mm_set1_ps(params.curlStrength);
+  __m128 accelerationX = _mm_set1_ps(params.acceleration.x);
+  __m128 accelerationY = _mm_set1_ps(params.acceleration.y);
+  __m128 accelerationZ = _mm_set1_ps(params.acceleration.z);
+
+  /// Rings and blocks are multiples of 4 long
+  for (int i = begin; i < end; i += 4)
+  {
+    __m128 age = _mm_add_ps(_mm_loadu_ps(&emitter.age[i]), dt);
+    _mm_storeu_ps(&emitter.age[i], age);
+    __m128 t = _mm_mul_ps(age, _mm_loadu_ps(&emitter.inverseLife[i]));
+
+    __m128 px = _mm_loadu_ps(&emitter.positionX[i]);
+    __m128 py = _mm_loadu_ps(&emitter.positionY[i]);
+    __m128 pz = _mm_loadu_ps(&emitter.positionZ[i]);
+
+    /// Four dead particles skip the forces, a group with any live one moves all four
+    int alive = _mm_movemask_ps(_mm_cmplt_ps(t, one));
+    if (alive != 0)
+    {
+      live += LANE_COUNT[alive];
+
+      __m128 curlX, curlY, curlZ;
+      curlNoise4(px, py, pz, params.curlFrequency, step.time, curlX, curlY, curlZ);
+
+      __m128 vx = _mm_loadu_ps(&emitter.velocityX[i]);
+      __m128 vy = _mm_loadu_ps(&emitter.velocityY[i]);
+      __m128 vz = _mm_loadu_ps(&emitter.velocityZ[i]);
+      vx = _mm_mul_ps(_mm_add_ps(vx, _mm_mul_ps(_mm_add_ps(accelerationX, _mm_mul_ps(curlX, strength)), dt)), drag);
+      vy = _mm_mul_ps(_mm_add_ps(vy, _mm_mul_ps(_mm_add_ps(accelerationY, _mm_mul_ps(curlY, strength)), dt)), drag);
+      vz = _mm_mul_ps(_mm_add_ps(vz, _mm_mul_ps(_mm_add_ps(accelerationZ, _mm_mul_ps(curlZ, strength)), dt)), drag);
+      _mm_storeu_ps(&emitter.velocityX[i], vx);
+      _mm_storeu_ps(&emitter.velocityY[i], vy);
+      _mm_storeu_ps(&emitter.velocityZ[i], vz);
+
+      px = _mm_add_ps(px, _mm_mul_ps(vx, dt));
+      py = _mm_add_ps(py, _mm_mul_ps(vy, dt));
+      pz = _mm_add_ps(pz, _mm_mul_ps(vz, dt));
+      _mm_storeu_ps(&emitter.positionX[i], px);
+      _mm_storeu_ps(&emitter.positionY[i], py);
+      _mm_storeu_ps(&emitter.positionZ[i], pz);
+    }
+
+    /// Four columns become four instances
+    _MM_TRANSPOSE4_PS(px, py, pz, t);
+    _mm_storeu_ps(output + i * 4, px);
+    _mm_storeu_ps(output + i * 4 + 4, py);
+    _mm_storeu_ps(output + i * 4 + 8, pz);
+    _mm_storeu_ps(output + i * 4 + 12, t);
+  }
+}
+#else
+void ParticleSystem::emitSimd(Emitter& emitter, int slot, int count, uint32_t serial, const Step& step)
+{
+  emitScalar(emitter, slot, count, serial, step);
+}
+
+void ParticleSystem::integrateSimd(Emitter& emitter, int begin, int end, const Step& step, uint32_t& live)
+{
+  integrateScalar(emitter, begin, end, step, live);
+}
+#endif
+
+void ParticleSystem::draw(RenderDevice& device) const
+{
+  PROFILE_GPU_SCOPE("ParticleSystem::draw");
+
+  for (int type = 0; type < EMITTER_TYPES; type++)
+  {
+    bool visible = false;
+    for (const Emitter& emitter : emitters)
+      visible = visible || (emitter.type == type && emitter.visible);
+    if (!visible || liveByType[type] == 0)
+      continue;
+
+    const TypeParams& params = TYPES[type];
+    RenderDevice::ParticleCall call;
+    call.particles = instances[type].data();
+    call.particleCount = (int)instances[type].size();
+    call.startColor = params.startColor;
+    call.endColor = params.endColor;
+    call.size = params.size;
+    call.additive = params.additive;
+    call.lit = params.lit;
+    device.drawParticles(call);
+  }
+}
+
+void ParticleSystem::benchmark()
+{
+  const size_t TARGET = 1000000;
+  const int EMITTERS_PER_TYPE = 16;
+  const int WARMUP_STEPS = 16;                  ///< Long steps fill the rings to their steady state
+  const float WARMUP_DT = 0.25f;
+  const int FRAMES = 30;
+
+  unsigned int hardware = std::max(1u, std::thread::hardware_concurrency());
+  std::vector<unsigned int> threadCounts = { 1, 2, 4, hardware };
+  std::sort(threadCounts.begin(), threadCounts.end());
+  threadCounts.erase(std::unique(threadCounts.begin(), threadCounts.end()), threadCounts.end());
+
+  std::cout << "Particle benchmark (" << TARGET << " live particles, " << EMITTERS_PER_TYPE * EMITTER_TYPES << " emitters, " << FRAMES
+            << " updates each, SSE2 " << (hasSimd() ? "on" : "off") << ")" << std::endl;
+  std::cout << std::setw(9) << "threads" << std::setw(10) << "kernels" << std::setw(11) << "live" << std::setw(12) << "update ms"
+            << std::setw(14) << "ns/particle" << std::endl;
+  std::cout << std::fixed << std::setprecision(3);
+
+  for (unsigned int threads : threadCounts)
+  {
+    for (int kernels = 0; kernels < (hasSimd() ? 2 : 1); kernels++)
+    {
+      JobSystem jobs(threads);
+      ParticleSystem system(jobs);
+      system.setSimd(kernels == 1);
+
+      /// Every type gets a third of the particles, spread over a grid of emitters
+      for (int type = 0; type < EMITTER_TYPES; type++)
+      {
+        float meanLife = 0.5f * (TYPES[type].minLife + TYPES[type].maxLife);
+        float rate = (float)TARGET / EMITTER_TYPES / EMITTERS_PER_TYPE / meanLife;
+        for (int e = 0; e < EMITTERS_PER_TYPE; e++)
+          system.addEmitter((EmitterType)type, glm::vec3((e % 4) * 10.0f, type * 10.0f, (e / 4) * 10.0f), rate);
+      }
+
+      for (int step = 0; step < WARMUP_STEPS; step++)
+        system.update(WARMUP_DT);
+
+      double ms = 0.0, live = 0.0;
+      for (int frame = 0; frame < FRAMES; frame++)
+      {
+        system.update(timerDelay / 1000.0f);
+        ms += system.getStats().updateMs;
+        live += (double)system.getStats().liveParticles;
+      }
+
+      std::cout << std::setw(9) << threads << std::setw(10) << (kernels == 1 ? "sse2" : "scalar") << std::setw(11) << (size_t)(live / FRAMES)
+                << std::setw(12) << ms / FRAMES << std::setw(14) << ms * 1e6 / live << std::endl;
+    }
+  }
+}
@@ -0,0 +1,375 @@
+//----------------------------------------------------------------------------------------
+/**
+ * \file       PortalSystem.cpp
+ * \author     Bogdan Putintsev
+ * \date       2021/05/13
+ * \brief      Cell and portal visibility
+ *
+*/
+//----------------------------------------------------------------------------------------
+
+#include "PortalSystem.h"
+#include "Profiler.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <random>
+
+PortalSystem::PortalSystem()
+{
+  addCell("outdoors");
+}
+
+int PortalSystem::addCell(const std::string& name)
+{
+  Cell cell;
+  cell.name = name;
+  cells.push_back(cell);
+  return (int)cells.size() - 1;
+}
+
+void PortalSystem::setCellBounds(int cell, const glm::vec3& boundsMin, const glm::vec3& boundsMax)
+{
+  cells[cell].bounded = true;
+  cells[cell].boundsMin = boundsMin;
+  cells[cell].boundsMax = boundsMax;
+}
+
+int PortalSystem::addPortal(int cellA, int cellB)
+{
+  Portal portal;
+  portal.cells[0] = cellA;
+  portal.cells[1] = cellB;
+  portals.push_back(portal);
+
+  int index = (int)portals.size() - 1;
+  cells[cellA].portals.push_back(index);
+  cells[cellB].portals.push_back(index);
+  return index;
+}
+
+void PortalSystem::setPortalBounds(int portal, const glm::vec3& boundsMin, const glm::vec3& boundsMax, const glm::mat4& transform)
+{
+  Portal& target = portals[portal];
+  target.bounded = true;
+
+  for (int corner = 0; corner < 8; corner++)
+  {
+    glm::vec4 position((corner & 1) ? boundsMax.x : boundsMin.x,
+                       (corner & 2) ? boundsMax.y : boundsMin.y,
+                       (corner & 4) ? boundsMax.z : boundsMin.z, 1.0f);
+    target.corners[corner] = glm::vec3(transform * position);
+  }
+}
+
+void PortalSystem::setPortalOpen(int portal, bool open)
+{
+  portals[portal].open = open;
+}
+
+void PortalSystem::setObjectCell(size_t object, int cell, int otherCell)
+{
+  if (objectCells.size() <= object)
+    objectCells.resize(object + 1, std::make_pair(-1, -1));
+
+  objectCells[object] = std::make_pair(cell, otherCell);
+}
+
+int PortalSystem::cellAt(const glm::vec3& position) const
+{
+  for (size_t i = 0; i < cells.size(); i++)
+  {
+    const Cell& cell = cells[i];
+    if (cell.bounded && position.x >= cell.boundsMin.x && position.y >= cell.boundsMin.y && position.z >= cell.boundsMin.z &&
+        position.x <= cell.boundsMax.x && position.y <= cell.boundsMax.y && position.z <= cell.boundsMax.z)
+      return (int)i;
+  }
+
+  return OUTDOORS;
+}
+
+void PortalSystem::update(const glm::mat4& viewProjection, const glm::vec3& eyePosition)
+{
+  uint64_t start = Profiler::nowNs();
+
+  this->viewProjection = viewProjection;
+  stats = Stats();
+  testNs = 0;
+  cellRects.assign(cells.size(), Rect());
+
+  if (!enabled)
+    return;
+
+  Rect screen;
+  screen.min = glm::vec2(-1.0f);
+  screen.max = glm::vec2(1.0f);
+
+  stats.cameraCell = cellAt(eyePosition);
+  visit(stats.cameraCell, screen, 0);
+
+  for (const Rect& rect : cellRects)
+    if (!rect.isEmpty())
+      stats.visibleCells++;
+
+  stats.visibilityMs = (Profiler::nowNs() - start) / 1e6;
+}
+
+void PortalSystem::visit(int cell, const Rect& rect, int depth)
+{
+  /// A cell reached again is walked once more with the union of both rectangles. Rectangles only
+  /// grow, so the walk ends, and the result stays conservative.
+  Rect current = cellRects[cell];
+  if (!current.isEmpty() && contains(current, rect))
+    return;
+
+  current = current.isEmpty() ? rect : merge(current, rect);
+  cellRects[cell] = current;
+
+  if (depth >= MAX_DEPTH)
+    return;
+
+  for (int index : cells[cell].portals)
+  {
+    const Portal& portal = portals[index];
+    if (!portal.open)
+      continue;
+
+    stats.portalsTested++;
+    Rect through = current;
+
+    if (portal.bounded)
+    {
+      Rect opening;
+      Projection projection = project(portal.corners, 8, glm::mat4(1.0f), opening);
+      if (projection == BEHIND)
+        continue;
+
+      /// A portal the camera stands in is seen through the whole rectangle
+      if (projection == PROJECTED)
+        through = intersect(current, opening);
+    }
+
+    if (through.isEmpty())
+      continue;
+
+    stats.portalsPassed++;
+    visit(portal.cells[0] == cell ? portal.cells[1] : portal.cells[0], through, depth + 1);
+  }
+}
+
+bool PortalSystem::isCellVisible(int cell) const
+{
+  if (!enabled || cell >= (int)cellRects.size())
+    return true;
+
+  return !cellRects[cell].isEmpty();
+}
+
+bool PortalSystem::isVisible(size_t object, const glm::vec3& boundsMin, const glm::vec3& boundsMax, const glm::mat4& transform)
+{
+  if (!enabled || object >= objectCells.size() || objectCells[object].first < 0)
+    return true;
+
+  uint64_t start = Profiler::nowNs();
+  stats.objectsTested++;
+
+  glm::vec3 corners[8];
+  for (int corner = 0; corner < 8; corner++)
+    corners[corner] = glm::vec3((corner & 1) ? boundsMax.x : boundsMin.x,
+                                (corner & 2) ? boundsMax.y : boundsMin.y,
+                                (corner & 4) ? boundsMax.z : boundsMin.z);
+
+  Rect rect;
+  Projection projection = project(corners, 8, transform, rect);
+  const std::pair<int, int>& objectCell = objectCells[object];
+
+  bool visible = projection != BEHIND &&
+                 (overlaps(objectCell.first, rect, projection) || (objectCell.second >= 0 && overlaps(objectCell.second, rect, projection)));
+  if (!visible)
+    stats.objectsCulled++;
+
+  testNs += Profiler::nowNs() - start;
+  return visible;
+}
+
+void PortalSystem::end()
+{
+  stats.visibilityMs += testNs / 1e6;
+  testNs = 0;
+
+  if (!enabled)
+    return;
+
+  Profiler::counter("visible cells", stats.visibleCells);
+  Profiler::counter("portal culled objects", stats.objectsCulled);
+  Profiler::counter("portal visibility ms", stats.visibilityMs);
+}
+
+void PortalSystem::printStats() const
+{
+  std::cout << "Portal culling " << (enabled ? "on" : "off") << ": camera in " << cells[stats.cameraCell].name << ", "
+            << stats.visibleCells << " of " << cells.size() << " cells visible, " << stats.portalsPassed << " of "
+            << stats.portalsTested << " portals passed, " << stats.objectsCulled << " of " << stats.objectsTested
+            << " objects culled, " << stats.visibilityMs << " ms" << std::endl;
+}
+
+PortalSystem::Projection PortalSystem::project(const glm::vec3* points, int count, const glm::mat4& transform, Rect& rect) const
+{
+  glm::mat4 modelViewProjection = viewProjection * transform;
+  int behind = 0;
+
+  for (int i = 0; i < count; i++)
+  {
+    glm::vec4 clip = modelViewProjection * glm::vec4(points[i], 1.0f);
+    if (clip.w <= 0.0f || clip.z < -clip.w)
+    {
+      behind++;
+      continue;
+    }
+
+    glm::vec2 position = glm::vec2(clip.x, clip.y) / clip.w;
+    rect.min = i == behind ? position : glm::min(rect.min, position);
+    rect.max = i == behind ? position : glm::max(rect.max, position);
+  }
+
+  if (behind == count)
+    return BEHIND;
+  return behind > 0 ? CROSSING : PROJECTED;
+}
+
+bool PortalSystem::overlaps(int cell, const Rect& rect, Projection projection) const
+{
+  if (cellRects[cell].isEmpty())
+    return false;
+
+  return projection == CROSSING || !intersect(cellRects[cell], rect).isEmpty();
+}
+
+PortalSystem::Rect PortalSystem::merge(const Rect& a, const Rect& b)
+{
+  Rect result;
+  result.min = glm::min(a.min, b.min);
+  result.max = glm::max(a.max, b.max);
+  return result;
+}
+
+PortalSystem::Rect PortalSystem::intersect(const Rect& a, const Rect& b)
+{
+  Rect result;
+  result.min = glm::max(a.min, b.min);
+  result.max = glm::min(a.max, b.max);
+  return result;
+}
+
+bool PortalSystem::contains(const Rect& outer, const Rect& inner)
+{
+  return inner.min.x >= outer.min.x && inner.min.y >= outer.min.y && inner.max.x <= outer.max.x && inner.max.y <= outer.max.y;
+}
+
+void PortalSystem::benchmark()
+{
+  const int VIEWS = 200;
+  const int OBJECTS_PER_ROOM = 16;
+  const float ROOM_SIZE = 10.0f;
+  const float ROOM_HEIGHT = 3.0f;
+  const float DOOR_WIDTH = 1.5f;
+  const float DOOR_HEIGHT = 2.2f;
+  const float EYE_HEIGHT = 1.7f;
+  const int grids[] = { 8, 16, 32 };
+  const float openShares[] = { 0.0f, 0.5f, 1.0f };
+
+  std::cout << "Portal benchmark (" << VIEWS << " views each, " << OBJECTS_PER_ROOM << " objects per room)" << std::endl;
+  std::cout << std::setw(7) << "rooms" << std::setw(7) << "open" << std::setw(15) << "visible cells" << std::setw(15) << "drawn objects"
+            << std::setw(15) << "in frustum" << std::setw(9) << "total" << std::setw(15) << "visibility ms" << std::endl;
+  std::cout << std::fixed << std::setprecision(3);
+
+  for (int grid : grids)
+  {
+    for (float openShare : openShares)
+    {
+      std::mt19937 random(1337);
+      std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+      /// Rooms in rows along x and z, each with a doorway to the next room in both directions
+      PortalSystem system;
+      std::vector<std::pair<glm::vec3, glm::vec3>> boxes;
+
+      for (int z = 0; z < grid; z++)
+      {
+        for (int x = 0; x < grid; x++)
+        {
+          int cell = system.addCell("room");
+          glm::vec3 corner(x * ROOM_SIZE, 0.0f, z * ROOM_SIZE);
+          system.setCellBounds(cell, corner, corner + glm::vec3(ROOM_SIZE, ROOM_HEIGHT, ROOM_SIZE));
+
+          for (int i = 0; i < OBJECTS_PER_ROOM; i++)
+          {
+            glm::vec3 position = corner + glm::vec3(unit(random) * (ROOM_SIZE - 1.0f), 0.0f, unit(random) * (ROOM_SIZE - 1.0f));
+            system.setObjectCell(boxes.size(), cell);
+            boxes.push_back(std::make_pair(position, position + glm::vec3(0.5f + unit(random) * 0.5f)));
+          }
+        }
+      }
+
+      for (int z = 0; z < grid; z++)
+      {
+        for (int x = 0; x < grid; x++)
+        {
+          int cell = 1 + z * grid + x;
+          glm::vec3 center((x + 0.5f) * ROOM_SIZE, 0.0f, (z + 0.5f) * ROOM_SIZE);
+
+          if (x + 1 < grid)
+          {
+            int portal = system.addPortal(cell, cell + 1);
+            glm::vec3 doorway((x + 1) * ROOM_SIZE, 0.0f, center.z);
+            system.setPortalBounds(portal, doorway - glm::vec3(0.0f, 0.0f, DOOR_WIDTH * 0.5f), doorway + glm::vec3(0.0f, DOOR_HEIGHT, DOOR_WIDTH * 0.5f), glm::mat4(1.0f));
+            system.setPortalOpen(portal, unit(random) < openShare);
+          }
+          if (z + 1 < grid)
+          {
+            int portal = system.addPortal(cell, cell + grid);
+            glm::vec3 doorway(center.x, 0.0f, (z + 1) * ROOM_SIZE);
+            system.setPortalBounds(portal, doorway - glm::vec3(DOOR_WIDTH * 0.5f, 0.0f, 0.0f), doorway + glm::vec3(DOOR_WIDTH * 0.5f, DOOR_HEIGHT, 0.0f), glm::mat4(1.0f));
+            system.setPortalOpen(portal, unit(random) < openShare);
+          }
+        }
+      }
+
+      glm::mat4 projection = glm::perspective(glm::radians(70.0f), (float)16 / 9, 0.01f, 1000.0f);
+      double visibilityMs = 0.0, visibleCells = 0.0, drawn = 0.0, inFrustum = 0.0;
+
+      for (int view = 0; view < VIEWS; view++)
+      {
+        glm::vec3 eye(unit(random) * grid * ROOM_SIZE, EYE_HEIGHT, unit(random) * grid * ROOM_SIZE);
+        float yaw = unit(random) * 6.2832f;
+        glm::mat4 viewProjection = projection * glm::lookAt(eye, eye + glm::vec3(sinf(yaw), -0.1f, cosf(yaw)), glm::vec3(0.0f, 1.0f, 0.0f));
+
+        system.update(viewProjection, eye);
+        for (size_t i = 0; i < boxes.size(); i++)
+        {
+          if (system.isVisible(i, boxes[i].first, boxes[i].second, glm::mat4(1.0f)))
+            drawn++;
+
+          /// Baseline: the same box test against the whole screen only
+          Rect rect;
+          glm::vec3 corners[8];
+          for (int corner = 0; corner < 8; corner++)
+            corners[corner] = glm::vec3((corner & 1) ? boxes[i].second.x : boxes[i].first.x, (corner & 2) ? boxes[i].second.y : boxes[i].first.y,
+                                        (corner & 4) ? boxes[i].second.z : boxes[i].first.z);
+          Projection result = system.project(corners, 8, glm::mat4(1.0f), rect);
+          if (result == CROSSING || (result == PROJECTED && rect.max.x >= -1.0f && rect.min.x <= 1.0f && rect.max.y >= -1.0f && rect.min.y <= 1.0f))
+            inFrustum++;
+        }
+        system.end();
+
+        visibilityMs += system.getStats().visibilityMs;
+        visibleCells += system.getStats().visibleCells;
+      }
+
+      std::cout << std::setw(7) << grid * grid << std::setw(6) << (int)(openShare * 100.0f) << "%" << std::setw(15) << visibleCells / VIEWS
+                << std::setw(15) << drawn / VIEWS << std::setw(15) << inFrustum / VIEWS << std::setw(9) << boxes.size()
+                << std::setw(15) << visibilityMs / VIEWS << std::endl;
+    }
+  }
+}
@@ -0,0 +1,127 @@
+//----------------------------------------------------------------------------------------
+/**
+ * \file       PortalSystem.h
+ * \author     Bogdan Putintsev
+ * \date       2021/05/13
+ * \brief      Cell and portal visibility
+ *
+ *  The world is split into cells: the outdoors and the rooms, each room given by a box.
+ *  Cells are connected by portals, convex openings such as doorways, that are open or
+ *  closed. Each frame the view is walked from the camera cell through the open portals;
+ *  every portal narrows the screen rectangle through which the next cell is seen. Objects
+ *  belong to one cell, or to the two cells of the portal they stand in, and are drawn only
+ *  when their cell is reached and their box overlaps the rectangle of that cell.
+ *
+*/
+//----------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <pgr.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class PortalSystem
+{
+public:
+  static const int OUTDOORS = 0;                ///< Cell of everything outside the rooms
+  static const int MAX_DEPTH = 32;              ///< Portals followed from the camera cell
+
+  /// Telemetry of the last update and the tests after it
+  struct Stats
+  {
+    int cameraCell = 0;
+    int visibleCells = 0;
+    int portalsTested = 0;
+    int portalsPassed = 0;
+    int objectsTested = 0;
+    int objectsCulled = 0;
+    double visibilityMs = 0.0;
+  };
+
+  PortalSystem();
+
+  /// Room cells are entered when the camera is inside the box, the first match wins
+  int addCell(const std::string& name);
+  void setCellBounds(int cell, const glm::vec3& boundsMin, const glm::vec3& boundsMax);
+  int addPortal(int cellA, int cellB);
+  /// The opening is the convex hull of the transformed box, a portal without bounds covers the view
+  void setPortalBounds(int portal, const glm::vec3& boundsMin, const glm::vec3& boundsMax, const glm::mat4& transform);
+  void setPortalOpen(int portal, bool open);
+  /// otherCell is set for objects standing in a portal, seen from either side
+  void setObjectCell(size_t object, int cell, int otherCell = -1);
+
+  int cellAt(const glm::vec3& position) const;
+
+  /// Walk the portals from the camera cell
+  void update(const glm::mat4& viewProjection, const glm::vec3& eyePosition);
+  bool isCellVisible(int cell) const;
+  /// False when the object's cells are not reached or the box is outside their rectangles.
+  /// Objects without a cell are always visible.
+  bool isVisible(size_t object, const glm::vec3& boundsMin, const glm::vec3& boundsMax, const glm::mat4& transform);
+  /// Publish the statistics of the frame to the profiler
+  void end();
+
+  void setEnabled(bool enable) { enabled = enable; }
+  bool isEnabled() const { return enabled; }
+  int getCellCount() const { return (int)cells.size(); }
+  const Stats& getStats() const { return stats; }
+  void printStats() const;
+
+  /// Visibility cost and culled objects on generated grids of rooms
+  static void benchmark();
+
+private:
+  /// Screen rectangle in normalized device coordinates
+  struct Rect
+  {
+    glm::vec2 min = glm::vec2(1.0f);
+    glm::vec2 max = glm::vec2(-1.0f);
+
+    bool isEmpty() const { return min.x > max.x || min.y > max.y; }
+  };
+
+  struct Cell
+  {
+    std::string name;
+    bool bounded = false;
+    glm::vec3 boundsMin;
+    glm::vec3 boundsMax;
+    std::vector<int> portals;
+  };
+
+  struct Portal
+  {
+    int cells[2];
+    bool open = true;
+    bool bounded = false;
+    glm::vec3 corners[8];
+  };
+
+  /// Result of projecting a convex point set
+  enum Projection
+  {
+    BEHIND,                                     ///< All points behind the near plane
+    CROSSING,                                   ///< Some points behind, the rectangle is unknown
+    PROJECTED
+  };
+
+  bool enabled = true;
+  std::vector<Cell> cells;
+  std::vector<Portal> portals;
+  std::vector<std::pair<int, int>> objectCells;
+
+  glm::mat4 viewProjection;
+  std::vector<Rect> cellRects;                  ///< Empty for cells not reached this frame
+  Stats stats;
+  uint64_t testNs = 0;
+
+  void visit(int cell, const Rect& rect, int depth);
+  Projection project(const glm::vec3* points, int count, const glm::mat4& transform, Rect& rect) const;
+  bool overlaps(int cell, const Rect& rect, Projection projection) const;
+
+  static Rect merge(const Rect& a, const Rect& b);
+  static Rect intersect(const Rect& a, const Rect& b);
+  static bool contains(const Rect& outer, const Rect& inner);
+};
@@ -0,0 +1,515 @@
+//----------------------------------------------------------------------------------------
+/**
+ * \file       Profiler.cpp
+ * \author     Bogdan Putintsev
+ * \date       2021/05/13
+ * \brief      Frame profiler with CPU scopes, GPU timer queries and Chrome trace export
+ *
+*/
+//----------------------------------------------------------------------------------------
+
+#include "Profiler.h"
+#include "JobSystem.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <atomic>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
+
+namespace
+{
+  /// GPU scope waiting for its timestamp queries
+  struct PendingQuery
+  {
+    size_t eventIndex;
+    GLuint begin;
+    GLuint end;
+  };
+
+  /// One slot of the frame ring
+  struct Frame
+  {
+    uint64_t number = 0;
+    uint64_t cpuStartNs = 0;
+    uint64_t cpuEndNs = 0;
+    GLuint gpuStartQuery = 0;
+    GLuint gpuEndQuery = 0;
+    double gpuMs = 0.0;
+    bool valid = false;
+    bool resolved = false;
+
+    std::vector<Profiler::Event> events;
+    std::vector<Profiler::Counter> counters;
+    std::vector<PendingQuery> pending;
+    std::vector<GLuint> queryPool;
+    size_t queriesUsed = 0;
+  };
+
+  /// CPU scopes and counters one thread recorded in the open frame
+  struct ThreadBuffer
+  {
+    std::mutex mutex;                       ///< Only ever contended by endFrame
+    std::vector<Profiler::Event> events;
+    std::vector<Profiler::Counter> counters;
+    std::vector<size_t> stack;              ///< Open scopes, indices into events
+    bool retired = false;                   ///< The thread exited, freed at the next merge
+  };
+
+  Frame frames[Profiler::FRAME_HISTORY];
+  uint64_t frameNumber = 0;
+  bool enabled = true;
+  bool gpuTiming = true;                    ///< Off in the benchmark, which has no GL context
+  std::atomic<bool> inFrame(false);
+
+  std::thread::id frameThread;
+  std::atomic<int> nextThreadTrack(1);
+
+  /// Buffers of all threads that recorded something, merged into the frame at endFrame
+  std::mutex bufferMutex;
+  std::vector<ThreadBuffer*> threadBuffers;
+
+  /// Registers the buffer of a thread on its first scope and retires it when the thread exits
+  struct ThreadBufferOwner
+  {
+    ThreadBuffer* buffer = nullptr;
+
+    ~ThreadBufferOwner()
+    {
+      if (!buffer)
+        return;
+      std::lock_guard<std::mutex> lock(bufferMutex);
+      buffer->retired = true;
+    }
+  };
+
+  thread_local ThreadBufferOwner bufferOwner;
+  thread_local int threadTrack = -1;
+  std::vector<size_t> gpuStack;
+
+  ThreadBuffer& threadBuffer()
+  {
+    if (!bufferOwner.buffer)
+    {
+      bufferOwner.buffer = new ThreadBuffer();
+      std::lock_guard<std::mutex> lock(bufferMutex);
+      threadBuffers.push_back(bufferOwner.buffer);
+    }
+    return *bufferOwner.buffer;
+  }
+
+  /// Move the scopes and counters of every thread into the frame. Scopes still open are cut at the frame end.
+  void mergeThreadBuffers(Frame& frame)
+  {
+    std::lock_guard<std::mutex> lock(bufferMutex);
+    for (size_t i = 0; i < threadBuffers.size();)
+    {
+      ThreadBuffer* buffer = threadBuffers[i];
+      {
+        std::lock_guard<std::mutex> bufferLock(buffer->mutex);
+        for (Profiler::Event& event : buffer->events)
+          if (event.endNs == 0)
+            event.endNs = frame.cpuEndNs;
+
+        frame.events.insert(frame.events.end(), buffer->events.begin(), buffer->events.end());
+        frame.counters.insert(frame.counters.end(), buffer->counters.begin(), buffer->counters.end());
+        buffer->events.clear();
+        buffer->counters.clear();
+        buffer->stack.clear();
+      }
+
+      if (buffer->retired)
+      {
+        delete buffer;
+        threadBuffers[i] = threadBuffers.back();
+        threadBuffers.pop_back();
+      }
+      else
+        i++;
+    }
+  }
+
+  int currentTrack()
+  {
+    if (std::this_thread::get_id() == frameThread)
+      return 0;
+    if (threadTrack < 0)
+      threadTrack = nextThreadTrack++;
+    return threadTrack;
+  }
+
+  double lastCpuMs = 0.0;
+  double lastGpuMs = 0.0;
+  uint64_t lastResolvedFrame = 0;
+  bool anyResolved = false;
+
+  Frame& currentFrame()
+  {
+    return frames[frameNumber % Profiler::FRAME_HISTORY];
+  }
+
+  GLuint nextQuery(Frame& frame)
+  {
+    if (frame.queriesUsed == frame.queryPool.size())
+    {
+      GLuint query = 0;
+      glGenQueries(1, &query);
+      frame.queryPool.push_back(query);
+    }
+
+    return frame.queryPool[frame.queriesUsed++];
+  }
+
+  uint64_t queryResult(GLuint query)
+  {
+    GLuint64 value = 0;
+    glGetQueryObjectui64v(query, GL_QUERY_RESULT, &value);
+    return value;
+  }
+
+  /// Read the GPU timestamps of a frame and map them onto the CPU timeline of that frame
+  void resolve(Frame& frame)
+  {
+    if (!frame.valid || frame.resolved)
+      return;
+
+    uint64_t gpuStart = queryResult(frame.gpuStartQuery);
+    uint64_t gpuEnd = queryResult(frame.gpuEndQuery);
+
+    for (auto& pending : frame.pending)
+    {
+      Profiler::Event& event = frame.events[pending.eventIndex];
+      event.startNs = frame.cpuStartNs + (queryResult(pending.begin) - gpuStart);
+      event.endNs = frame.cpuStartNs + (queryResult(pending.end) - gpuStart);
+    }
+
+    frame.gpuMs = (gpuEnd - gpuStart) / 1e6;
+    frame.resolved = true;
+    lastGpuMs = frame.gpuMs;
+    lastResolvedFrame = frame.number;
+    anyResolved = true;
+  }
+
+  bool available(GLuint query)
+  {
+    GLuint ready = 0;
+    glGetQueryObjectuiv(query, GL_QUERY_RESULT_AVAILABLE, &ready);
+    return ready != 0;
+  }
+
+  void writeEscaped(std::ofstream& out, const char* text)
+  {
+    for (const char* c = text; *c; c++)
+    {
+      if (*c == '"' || *c == '\\')
+        out << '\\';
+      out << *c;
+    }
+  }
+}
+
+uint64_t Profiler::nowNs()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void Profiler::beginFrame()
+{
+  if (!enabled)
+    return;
+
+  Frame& frame = currentFrame();
+
+  /// The slot is reused after FRAME_HISTORY frames, its queries are long finished by now
+  resolve(frame);
+
+  frame.number = frameNumber;
+  frame.events.clear();
+  frame.counters.clear();
+  frame.pending.clear();
+  frame.queriesUsed = 0;
+  frame.valid = false;
+  frame.resolved = false;
+  frame.cpuStartNs = nowNs();
+
+  if (gpuTiming)
+  {
+    frame.gpuStartQuery = nextQuery(frame);
+    glQueryCounter(frame.gpuStartQuery, GL_TIMESTAMP);
+  }
+
+  gpuStack.clear();
+  frameThread = std::this_thread::get_id();
+  inFrame = true;
+}
+
+void Profiler::endFrame()
+{
+  if (!inFrame)
+    return;
+
+  Frame& frame = currentFrame();
+  if (gpuTiming)
+  {
+    frame.gpuEndQuery = nextQuery(frame);
+    glQueryCounter(frame.gpuEndQuery, GL_TIMESTAMP);
+  }
+  frame.cpuEndNs = nowNs();
+  frame.valid = true;
+  frame.resolved = !gpuTiming;
+  lastCpuMs = (frame.cpuEndNs - frame.cpuStartNs) / 1e6;
+
+  inFrame = false;
+  mergeThreadBuffers(frame);
+
+  if (!gpuTiming)
+  {
+    frameNumber++;
+    return;
+  }
+
+  /// Read back frames old enough for the GPU to have finished them, without stalling
+  uint64_t oldest = std::min<uint64_t>(FRAME_HISTORY - 1, frameNumber);
+  for (uint64_t age = oldest; age >= GPU_LATENCY && age <= oldest; age--)
+  {
+    Frame& old = frames[(frameNumber - age) % FRAME_HISTORY];
+    if (!old.valid || old.resolved)
+      continue;
+    if (!available(old.gpuEndQuery))
+      break;
+    resolve(old);
+  }
+
+  frameNumber++;
+}
+
+void Profiler::beginCpu(const char* name)
+{
+  if (!inFrame)
+    return;
+
+  ThreadBuffer& buffer = threadBuffer();
+  Event event;
+  event.name = name;
+  event.depth = (int)buffer.stack.size();
+  event.thread = currentTrack();
+  event.startNs = nowNs();
+
+  std::lock_guard<std::mutex> lock(buffer.mutex);
+  buffer.stack.push_back(buffer.events.size());
+  buffer.events.push_back(event);
+}
+
+void Profiler::endCpu()
+{
+  if (!inFrame)
+    return;
+
+  uint64_t endNs = nowNs();
+  ThreadBuffer& buffer = threadBuffer();
+  std::lock_guard<std::mutex> lock(buffer.mutex);
+  /// Empty when the scope was opened before the frame or already cut by the merge
+  if (buffer.stack.empty())
+    return;
+  buffer.events[buffer.stack.back()].endNs = endNs;
+  buffer.stack.pop_back();
+}
+
+void Profiler::beginGpu(const char* name)
+{
+  if (!inFrame || !gpuTiming || std::this_thread::get_id() != frameThread)
+    return;
+
+  /// Other threads only write their own buffers, the events of the frame belong to this thread until endFrame
+  Frame& frame = currentFrame();
+  Event event;
+  event.name = name;
+  event.depth = (int)gpuStack.size();
+  event.gpu = true;
+
+  PendingQuery pending;
+  pending.eventIndex = frame.events.size();
+  pending.begin = nextQuery(frame);
+  pending.end = 0;
+  glQueryCounter(pending.begin, GL_TIMESTAMP);
+
+  gpuStack.push_back(frame.pending.size());
+  frame.pending.push_back(pending);
+  frame.events.push_back(event);
+}
+
+void Profiler::endGpu()
+{
+  if (!inFrame || gpuStack.empty() || std::this_thread::get_id() != frameThread)
+    return;
+
+  Frame& frame = currentFrame();
+  PendingQuery& pending = frame.pending[gpuStack.back()];
+  pending.end = nextQuery(frame);
+  glQueryCounter(pending.end, GL_TIMESTAMP);
+  gpuStack.pop_back();
+}
+
+void Profiler::counter(const char* name, double value)
+{
+  if (!inFrame)
+    return;
+
+  Counter sample;
+  sample.name = name;
+  sample.timeNs = nowNs();
+  sample.value = value;
+
+  ThreadBuffer& buffer = threadBuffer();
+  std::lock_guard<std::mutex> lock(buffer.mutex);
+  buffer.counters.push_back(sample);
+}
+
+void Profiler::setEnabled(bool enable)
+{
+  enabled = enable;
+}
+
+bool Profiler::isEnabled()
+{
+  return enabled;
+}
+
+/// Return a pointer to a copy of the name that stays valid for the whole program
+const char* Profiler::intern(const std::string& name)
+{
+  static std::unordered_set<std::string> names;
+  return names.insert(name).first->c_str();
+}
+
+bool Profiler::exportChromeTrace(const std::string& path)
+{
+  std::ofstream out(path);
+  if (!out)
+    return false;
+
+  out << std::fixed << std::setprecision(3) << "{\"traceEvents\":[";
+  bool first = true;
+
+  for (uint64_t i = 0; i < FRAME_HISTORY; i++)
+  {
+    const Frame& frame = frames[(frameNumber + i) % FRAME_HISTORY];
+    if (!frame.valid)
+      continue;
+
+    out << (first ? "" : ",") << "{\"name\":\"frame " << frame.number << "\",\"cat\":\"frame\",\"ph\":\"X\",\"pid\":1,\"tid\":0"
+        << ",\"ts\":" << frame.cpuStartNs / 1000.0 << ",\"dur\":" << (frame.cpuEndNs - frame.cpuStartNs) / 1000.0 << "}";
+    first = false;
+
+    for (const auto& event : frame.events)
+    {
+      /// GPU events without read back timestamps are skipped
+      if (event.gpu && !frame.resolved)
+        continue;
+
+      out << ",{\"name\":\"";
+      writeEscaped(out, event.name);
+      out << "\",\"cat\":\"" << (event.gpu ? "gpu" : "cpu") << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << (event.gpu ? 2 : event.thread == 0 ? 1 : 2 + event.thread)
+          << ",\"ts\":" << event.startNs / 1000.0 << ",\"dur\":" << (event.endNs - event.startNs) / 1000.0 << "}";
+    }
+
+    for (const auto& sample : frame.counters)
+    {
+      out << ",{\"name\":\"";
+      writeEscaped(out, sample.name);
+      out << "\",\"ph\":\"C\",\"pid\":1,\"ts\":" << sample.timeNs / 1000.0 << ",\"args\":{\"value\":" << sample.value << "}}";
+    }
+  }
+
+  out << "],\"displayTimeUnit\":\"ms\"}" << std::endl;
+  return true;
+}
+
+double Profiler::lastFrameCpuMs()
+{
+  return lastCpuMs;
+}
+
+double Profiler::lastFrameGpuMs()
+{
+  return lastGpuMs;
+}
+
+double Profiler::lastGpuScopeMs(const char* name)
+{
+  const Frame& frame = frames[lastResolvedFrame % FRAME_HISTORY];
+  if (!anyResolved || !frame.resolved || frame.number != lastResolvedFrame)
+    return -1.0;
+
+  double ms = -1.0;
+  for (const Event& event : frame.events)
+    if (event.gpu && std::strcmp(event.name, name) == 0)
+      ms = std::max(ms, 0.0) + (event.endNs - event.startNs) / 1e6;
+  return ms;
+}
+
+/// Frame time of a parallel loop with one CPU scope per item, with the profiler off and on
+void Profiler::benchmark()
+{
+  const int FRAMES = 200;
+  const unsigned int SCOPES = 4096;             ///< Scopes per frame, one per loop item
+  const unsigned int GRAIN = 64;
+  const int WORK = 64;                          ///< Square roots inside each scope
+
+  unsigned int hardware = std::max(1u, std::thread::hardware_concurrency());
+  std::vector<unsigned int> threadCounts = { 1, 2, 4, hardware };
+  std::sort(threadCounts.begin(), threadCounts.end());
+  threadCounts.erase(std::unique(threadCounts.begin(), threadCounts.end()), threadCounts.end());
+
+  std::vector<float> values(SCOPES);
+  auto run = [&values](JobSystem& jobs, bool profile) {
+    setEnabled(profile);
+    uint64_t start = nowNs();
+    for (int frame = 0; frame < FRAMES; frame++)
+    {
+      beginFrame();
+      jobs.parallelFor(SCOPES, GRAIN, [&values](unsigned int begin, unsigned int end) {
+        for (unsigned int i = begin; i < end; i++)
+        {
+          PROFILE_CPU_SCOPE("benchmark scope");
+          float value = values[i];
+          for (int k = 0; k < WORK; k++)
+            value = std::sqrt(value + (float)k);
+          values[i] = value;
+        }
+      });
+      endFrame();
+    }
+    return (nowNs() - start) / 1e6 / FRAMES;
+  };
+
+  /// No GL context here, frames are timed on the CPU only
+  bool wasEnabled = enabled;
+  gpuTiming = false;
+
+  std::cout << "Profiler benchmark (" << FRAMES << " frames of " << SCOPES << " CPU scopes in ranges of " << GRAIN << ")" << std::endl;
+  std::cout << std::setw(9) << "threads" << std::setw(12) << "off ms" << std::setw(12) << "on ms" << std::setw(14) << "ns/scope" << std::endl;
+  std::cout << std::fixed << std::setprecision(3);
+
+  for (unsigned int threads : threadCounts)
+  {
+    JobSystem jobs(threads);
+    /// The first runs grow the job rings and the event vectors of the frame ring
+    run(jobs, false);
+    double offMs = run(jobs, false);
+    run(jobs, true);
+    double onMs = run(jobs, true);
+
+    std::cout << std::setw(9) << threads << std::setw(12) << offMs << std::setw(12) << onMs
+              << std::setw(14) << (onMs - offMs) * 1e6 / SCOPES << std::endl;
+  }
+
+  gpuTiming = true;
+  setEnabled(wasEnabled);
+}
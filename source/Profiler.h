@@ -0,0 +1,97 @@
+//----------------------------------------------------------------------------------------
+/**
+ * \file       Profiler.h
+ * \author     Bogdan Putintsev
+ * \date       2021/05/13
+ * \brief      Frame profiler with CPU scopes, GPU timer queries and Chrome trace export
+ *
+ *  CPU scopes are timed with a steady clock, GPU scopes with timestamp queries that are
+ *  read back a few frames later so the CPU never waits for the GPU. A rolling ring of
+ *  frames is kept and can be written as Chrome trace_event JSON (chrome://tracing).
+ *  CPU scopes and counters may be recorded from any thread while a frame is open, each
+ *  thread gets its own track and its own buffer, which is merged into the frame when it
+ *  ends, so threads never wait on each other. GPU scopes belong to the thread of the frame.
+ *
+*/
+//----------------------------------------------------------------------------------------
+
+#pragma once
+#include "pgr.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#define PROFILER_CONCAT_INNER(a, b) a##b
+#define PROFILER_CONCAT(a, b) PROFILER_CONCAT_INNER(a, b)
+
+/// Time the enclosing block on the CPU
+#define PROFILE_CPU_SCOPE(name) Profiler::CpuScope PROFILER_CONCAT(profilerScope, __LINE__)(name)
+/// Time the enclosing block on the CPU and on the GPU
+#define PROFILE_GPU_SCOPE(name) Profiler::GpuScope PROFILER_CONCAT(profilerScope, __LINE__)(name)
+
+class Profiler
+{
+public:
+  static const int FRAME_HISTORY = 128;     ///< Frames kept in the rolling ring
+  static const int GPU_LATENCY = 3;         ///< Frames to wait before reading GPU queries back
+
+  /// One timed scope in a frame
+  struct Event
+  {
+    const char* name = nullptr;
+    uint64_t startNs = 0;
+    uint64_t endNs = 0;
+    int depth = 0;
+    int thread = 0;                         ///< Track of the recording thread, 0 for the thread of the frame
+    bool gpu = false;
+  };
+
+  /// Value sampled in a frame, shown as a counter track in the trace
+  struct Counter
+  {
+    const char* name = nullptr;
+    uint64_t timeNs = 0;
+    double value = 0.0;
+  };
+
+  /// RAII CPU scope
+  class CpuScope
+  {
+  public:
+    explicit CpuScope(const char* name) { Profiler::beginCpu(name); }
+    ~CpuScope() { Profiler::endCpu(); }
+  };
+
+  /// RAII CPU + GPU scope
+  class GpuScope
+  {
+  public:
+    explicit GpuScope(const char* name) { Profiler::beginCpu(name); Profiler::beginGpu(name); }
+    ~GpuScope() { Profiler::endGpu(); Profiler::endCpu(); }
+  };
+
+  static void beginFrame();
+  static void endFrame();
+
+  static void beginCpu(const char* name);
+  static void endCpu();
+  static void beginGpu(const char* name);
+  static void endGpu();
+  static void counter(const char* name, double value);
+
+  static void setEnabled(bool enable);
+  static bool isEnabled();
+
+  static const char* intern(const std::string& name);
+  static bool exportChromeTrace(const std::string& path);
+
+  static double lastFrameCpuMs();
+  static double lastFrameGpuMs();
+  /// GPU time of the scopes with this name in the newest read back frame, negative when there are none
+  static double lastGpuScopeMs(const char* name);
+
+  static uint64_t nowNs();
+
+  static void benchmark();
+};
@@ -0,0 +1,164 @@
+//----------------------------------------------------------------------------------------
+/**
+ * \file       RedrawScheduler.cpp
+ * \author     Bogdan Putintsev
+ * \date       2021/05/13
+ * \brief      On-demand redraw: frames are drawn only when something on screen changes
+ *
+*/
+//----------------------------------------------------------------------------------------
+
+#include "RedrawScheduler.h"
+#include "Profiler.h"
+
+#include <ctime>
+#include <iomanip>
+#include <iostream>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#endif
+
+namespace
+{
+  const int REASON_INPUT = -1;                  ///< Input or an invalidation
+  const int REASON_TIMER = -2;                  ///< On-demand redraw is disabled
+}
+
+RedrawScheduler::RedrawScheduler()
+  : windowStartNs(Profiler::nowNs()), windowStartCpuMs(processCpuMs())
+{
+}
+
+int RedrawScheduler::addSource(const std::string& name, Interval interval)
+{
+  Source source;
+  source.name = name;
+  source.interval = interval;
+  sources.push_back(source);
+  return (int)sources.size() - 1;
+}
+
+void RedrawScheduler::notifyInput()
+{
+  dirty = true;
+  ticksSinceInput = 0;
+}
+
+bool RedrawScheduler::tick()
+{
+  stats.ticks++;
+  ticksSinceFrame++;
+  updateWindow();
+
+  int reason = REASON_TIMER;
+  bool due = !enabled;
+
+  if (!due && (dirty || ticksSinceInput < INPUT_HOLD_TICKS))
+  {
+    reason = REASON_INPUT;
+    due = true;
+  }
+
+  for (size_t i = 0; i < sources.size() && !due; i++)
+  {
+    int interval = sources[i].interval();
+    if (interval > 0 && ticksSinceFrame >= interval)
+    {
+      reason = (int)i;
+      due = true;
+    }
+  }
+
+  if (ticksSinceInput < INPUT_HOLD_TICKS)
+    ticksSinceInput++;
+
+  if (due)
+  {
+    if (reason >= 0)
+      sources[reason].frames++;
+    else if (reason == REASON_INPUT)
+      inputFrames++;
+  }
+
+  return due;
+}
+
+int RedrawScheduler::beginFrame()
+{
+  int ticks = ticksSinceFrame;
+  ticksSinceFrame = 0;
+  dirty = false;
+
+  stats.frames++;
+  windowFrames++;
+  Profiler::counter("redraw ticks", (double)ticks);
+  return ticks;
+}
+
+void RedrawScheduler::setEnabled(bool enable)
+{
+  enabled = enable;
+  dirty = true;
+}
+
+void RedrawScheduler::updateWindow()
+{
+  uint64_t now = Profiler::nowNs();
+  double seconds = (now - windowStartNs) / 1e9;
+  if (seconds < WINDOW_SECONDS)
+    return;
+
+  double cpuMs = processCpuMs();
+  double minutes = seconds / 60.0;
+  stats.framesPerMinute = windowFrames / minutes;
+  stats.cpuMsPerMinute = (cpuMs - windowStartCpuMs) / minutes;
+  stats.cpuShare = stats.cpuMsPerMinute / 60000.0;
+
+  windowStartNs = now;
+  windowStartCpuMs = cpuMs;
+  windowFrames = 0;
+}
+
+void RedrawScheduler::printStats() const
+{
+  /// The window in progress, until the first one completes
+  double minutes = (Profiler::nowNs() - windowStartNs) / 6e10;
+  double framesPerMinute = stats.framesPerMinute;
+  double cpuMsPerMinute = stats.cpuMsPerMinute;
+  if (framesPerMinute == 0.0 && minutes > 0.0)
+  {
+    framesPerMinute = windowFrames / minutes;
+    cpuMsPerMinute = (processCpuMs() - windowStartCpuMs) / minutes;
+  }
+
+  std::cout << "On-demand redraw " << (enabled ? "on" : "off") << ": " << stats.frames << " frames in " << stats.ticks << " ticks, "
+            << std::fixed << std::setprecision(0) << framesPerMinute << " frames/min, " << cpuMsPerMinute << " ms CPU/min ("
+            << std::setprecision(1) << cpuMsPerMinute / 600.0 << "% of a core)" << std::defaultfloat << std::endl;
+
+  std::cout << "  input: " << inputFrames << " frames" << std::endl;
+  for (const Source& source : sources)
+    std::cout << "  " << source.name << ": " << source.frames << " frames, interval " << source.interval() << std::endl;
+}
+
+double RedrawScheduler::processCpuMs()
+{
+#ifdef _WIN32
+  FILETIME creation, exit, kernel, user;
+  if (!GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user))
+    return 0.0;
+
+  /// 100 ns units
+  ULARGE_INTEGER kernelTime, userTime;
+  kernelTime.LowPart = kernel.dwLowDateTime;
+  kernelTime.HighPart = kernel.dwHighDateTime;
+  userTime.LowPart = user.dwLowDateTime;
+  userTime.HighPart = user.dwHighDateTime;
+  return (kernelTime.QuadPart + userTime.QuadPart) / 1e4;
+#else
+  /// CPU time of all threads of the process on POSIX
+  return std::clock() * 1000.0 / CLOCKS_PER_SEC;
+#endif
+}
@@ -0,0 +1,93 @@
+//----------------------------------------------------------------------------------------
+/**
+ * \file       RedrawScheduler.h
+ * \author     Bogdan Putintsev
+ * \date       2021/05/13
+ * \brief      On-demand redraw: frames are drawn only when something on screen changes
+ *
+ *  The window timer still ticks every timerDelay ms, but a tick only asks for a frame when
+ *  one is due. Subsystems register a source that reports how many ticks may pass between
+ *  frames while it changes the picture, 0 while it is at rest: 1 for animations that need
+ *  every frame, more for slow ambient motion, and the sun reports the ticks until its
+ *  shading moves by a visible step. The smallest interval of the active sources sets the
+ *  frame rate, so a still view with nothing moving draws no frames at all. Input draws the
+ *  next tick and keeps the full rate for INPUT_HOLD_TICKS, held keys repeat slower than the
+ *  timer. Every frame stands for the ticks since the previous one, so the simulation keeps
+ *  its speed at any frame rate.
+ *
+*/
+//----------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+class RedrawScheduler
+{
+public:
+  static const int INPUT_HOLD_TICKS = 15;       ///< Full rate kept after the last input
+  static const int WINDOW_SECONDS = 60;         ///< Length of the idle power measurement
+
+  /// Ticks between frames the source needs, 0 while it does not change the picture
+  typedef std::function<int()> Interval;
+
+  /// Idle power proxies over the last complete window, see WINDOW_SECONDS
+  struct Stats
+  {
+    uint64_t ticks = 0;
+    uint64_t frames = 0;                        ///< Since the start
+    double framesPerMinute = 0.0;
+    double cpuMsPerMinute = 0.0;                ///< Process CPU time, all threads
+    double cpuShare = 0.0;                      ///< cpuMsPerMinute over a minute of one core
+  };
+
+  RedrawScheduler();
+
+  /// Returns the index of the source
+  int addSource(const std::string& name, Interval interval);
+
+  /// Window input arrived, draw on the next tick
+  void notifyInput();
+  /// Something changed outside the sources, draw on the next tick
+  void invalidate() { dirty = true; }
+
+  /// A timer tick, true when a frame is due. Always true while on-demand redraw is disabled.
+  bool tick();
+  /// Start of a drawn frame, returns the ticks it stands for, 0 for a repaint of the window
+  int beginFrame();
+
+  void setEnabled(bool enable);
+  bool isEnabled() const { return enabled; }
+  const Stats& getStats() const { return stats; }
+  /// Frames and CPU time per minute, and the frames each source asked for
+  void printStats() const;
+
+  /// CPU time of the process since it started
+  static double processCpuMs();
+
+private:
+  struct Source
+  {
+    std::string name;
+    Interval interval;
+    uint64_t frames = 0;                        ///< Frames this source was the first due for
+  };
+
+  std::vector<Source> sources;
+  bool enabled = true;
+  bool dirty = true;                            ///< The first tick draws
+  int ticksSinceFrame = 0;
+  int ticksSinceInput = INPUT_HOLD_TICKS;
+  uint64_t inputFrames = 0;
+
+  uint64_t windowStartNs = 0;
+  double windowStartCpuMs = 0.0;
+  uint64_t windowFrames = 0;
+  Stats stats;
+
+  /// Close the measurement window once it is WINDOW_SECONDS long
+  void updateWindow();
+};
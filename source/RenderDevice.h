@@ -0,0 +1,195 @@
+//----------------------------------------------------------------------------------------
+/**
+ * \file       RenderDevice.h
+ * \author     Bogdan Putintsev
+ * \date       2021/05/13
+ * \brief      Render device abstraction used by the scene
+ *
+ *  Camera, Light, Object and Scene describe what to draw through this interface and never
+ *  talk to a graphics API directly. The OpenGL backend is GLRenderDevice, the CPU
+ *  backend for machines without a GPU is SoftwareRenderDevice.
+ *
+*/
+//----------------------------------------------------------------------------------------
+
+#pragma once
+#include "pgr.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class RenderDevice
+{
+public:
+  typedef unsigned int Handle;                  ///< Mesh or texture handle, 0 is invalid (texture 0 samples white)
+
+  static const int MAX_TERRAIN_LEVELS = 8;
+  static const int MAX_TERRAIN_CUTOUTS = 4;
+  static const int MAX_VIEWS = 4;
+
+  /// Values of the shader objectType uniform
+  enum ShaderType
+  {
+    SHADER_SKYBOX = 1,
+    SHADER_MESH = 2,
+    SHADER_WATER = 5,
+    SHADER_TERRAIN = 6,
+    SHADER_PARTICLES = 7
+  };
+
+  /// Per-frame camera values (CameraBlock uniform buffer)
+  struct CameraParams
+  {
+    glm::mat4 viewProjection;
+    glm::vec3 eyePosition;
+    glm::vec3 eyeDirection;
+
+    /// World height the view covers at a distance, the y row of the view-projection holds the focal length
+    float viewHeightAt(float distance) const
+    {
+      float focal = glm::length(glm::vec3(viewProjection[0][1], viewProjection[1][1], viewProjection[2][1]));
+      return focal > 0.0f ? 2.0f * distance / focal : 0.0f;
+    }
+  };
+
+  /// One view of a multi-view frame
+  struct ViewParams
+  {
+    CameraParams camera;
+    glm::vec4 viewport = glm::vec4(0.0f, 0.0f, 1.0f, 1.0f);   ///< Min x, min y, max x, max y of the target in [0, 1], y up
+  };
+
+  /// Per-frame light values (sun, point light, flashlight and fog uniforms)
+  struct LightParams
+  {
+    glm::vec3 sunDirection;
+    glm::vec3 color;
+    bool flashLightEnabled = false;
+    bool fogEnabled = false;
+
+    glm::vec3 pointPosition;
+    glm::vec3 pointColor;
+    float pointIntensity = 0.0f;
+  };
+
+  /// Maps sampled by SHADER_WATER draws, produced by Ocean
+  struct OceanParams
+  {
+    Handle displacementMap = 0;
+    Handle normalMap = 0;
+    float patchSize = 1.0f;                     ///< World units covered by one repeat of the maps
+  };
+
+  /// Sky tables produced by Atmosphere, sampled by SHADER_SKYBOX draws
+  struct AtmosphereParams
+  {
+    Handle transmittance = 0;                   ///< To the top of the atmosphere by zenith angle and altitude
+    Handle skyRayleigh = 0;                     ///< Azimuth slices of view by sun elevation, side by side
+    Handle skyMie = 0;                          ///< Mie without its phase function, same layout
+    glm::vec3 skySamples;                       ///< View, sun and azimuth samples of the sky tables
+    float groundRadius = 6360.0f;               ///< In km, like the other radii
+    float topRadius = 6460.0f;
+    float observerRadius = 6360.0f;
+    float mieG = 0.8f;
+    float exposure = 1.0f;                      ///< Sky radiance per unit of sun illuminance to display value
+  };
+
+  /// Froxel grid produced by VolumetricFog, read by every draw while the fog is enabled
+  struct FogParams
+  {
+    Handle volume = 0;                          ///< In-scattered light and transmittance from the eye to each froxel
+    glm::mat4 viewProjection;                   ///< Camera the grid was built for, draws of other views read it too
+    float nearDepth = 1.0f;                     ///< View depths of the first and last slices, spaced exponentially
+    float farDepth = 100.0f;
+  };
+
+  /// One object draw
+  struct DrawCall
+  {
+    Handle mesh = 0;
+    Handle texture = 0;
+    int vertexCount = 0;                        ///< Index count of an indexed mesh
+    ShaderType shaderType = SHADER_MESH;
+    int objectId = 0;                           ///< Written to the stencil/id buffer for picking
+    glm::mat4 transform;
+    Handle lightmap = 0;                        ///< Baked torch and sky light, needs lightmap uvs on the mesh
+  };
+
+  /// Quadtree terrain: one patch mesh drawn once per selected patch
+  struct TerrainCall
+  {
+    Handle mesh = 0;                            ///< Unit patch on XZ in [0, 1], patchQuads quads per side
+    Handle texture = 0;
+    Handle heightMap = 0;                       ///< Data texture: height, normal x, y, z
+    int vertexCount = 0;
+    int patchQuads = 1;
+    int objectId = 0;
+    glm::vec4 heightMapTransform;               ///< Height map uv = xz * x + (y, z), color uv = xz * w
+    std::vector<glm::vec2> morphRanges;         ///< Distances where the morph of each level starts and ends
+    std::vector<glm::vec4> patches;             ///< Origin x, origin z, size and level of each patch
+    std::vector<glm::vec3> cutouts;             ///< Min and max corners of boxes where the terrain is not drawn
+  };
+
+  /// Camera-facing quads of one particle type, one instance per particle
+  struct ParticleCall
+  {
+    const glm::vec4* particles = nullptr;       ///< Position and age over lifetime, particles at 1 or more are dead
+    int particleCount = 0;
+    glm::vec4 startColor;                       ///< Faded to endColor over the lifetime
+    glm::vec4 endColor;
+    glm::vec2 size;                             ///< Half size at birth and at death
+    bool additive = false;                      ///< Adds light, otherwise blended over the scene by alpha
+    bool lit = false;                           ///< Scaled by the sun color, otherwise emissive
+  };
+
+  virtual ~RenderDevice() {}
+
+  /// Upload interleaved vertices (position 3, uv 2, normal 3), drawn as a triangle list through
+  /// indices, or in order when there are none
+  virtual Handle createMesh(const std::vector<float>& vertices, const std::vector<uint32_t>& indices, const std::string& name) = 0;
+  /// Decode the content of an image file read from path, the path names the texture and lets
+  /// backends that stream mips read the file again
+  virtual Handle createTexture(const std::string& path, const std::vector<unsigned char>& content) = 0;
+  /// Second vertex stream of a mesh, 2 floats per vertex, read with DrawCall::lightmap
+  virtual void setMeshLightmapUvs(Handle mesh, const std::vector<float>& uvs) = 0;
+  virtual void destroyMesh(Handle mesh) = 0;
+  virtual void destroyTexture(Handle texture) = 0;
+
+  /// RGBA float texture with linear filtering and repeat wrapping, contents set by updateDataTexture
+  virtual Handle createDataTexture(int width, int height) = 0;
+  /// Replace all texels, width * height * 4 floats
+  virtual void updateDataTexture(Handle texture, const float* texels) = 0;
+  /// RGBA float 3D texture with linear filtering and clamped edges, contents set by updateVolumeTexture
+  virtual Handle createVolumeTexture(int width, int height, int depth) = 0;
+  /// Replace all texels, width * height * depth * 4 floats, the slices one after another
+  virtual void updateVolumeTexture(Handle texture, const float* texels) = 0;
+
+  /// Memory used by a texture including its mip chain, in bytes
+  virtual size_t getTextureBytes(Handle texture) const = 0;
+  /// Ask for the detail a draw of this frame needs from a createTexture texture: the uv units
+  /// the height of the view covers where the object is closest. Backends that stream mips
+  /// keep the finest level any request needs.
+  virtual void requestTextureDetail(Handle texture, float uvPerViewHeight) = 0;
+
+  virtual void beginFrame() = 0;
+  /// One view covering the whole target
+  virtual void setCamera(const CameraParams& camera) = 0;
+  /// Up to MAX_VIEWS views, every following draw is rendered into all of them in one submission
+  virtual void setViews(const std::vector<ViewParams>& views) = 0;
+  virtual void setLights(const LightParams& lights) = 0;
+  virtual void setOcean(const OceanParams& ocean) = 0;
+  virtual void setAtmosphere(const AtmosphereParams& atmosphere) = 0;
+  virtual void setFog(const FogParams& fog) = 0;
+  virtual void draw(const DrawCall& call) = 0;
+  virtual void drawTerrain(const TerrainCall& call) = 0;
+  /// Blended without depth writes, after everything opaque
+  virtual void drawParticles(const ParticleCall& call) = 0;
+
+  /// Draws between beginStaticLayer and endStaticLayer are kept with the key. Returns true when
+  /// the layer of the same key is still kept and the draws can be skipped.
+  virtual bool beginStaticLayer(uint64_t key) = 0;
+  virtual void endStaticLayer() = 0;
+
+  virtual void endFrame() = 0;
+};
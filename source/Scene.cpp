@@ -9,69 +9,495 @@
 //----------------------------------------------------------------------------------------
 
 #include "Scene.h"
+#include "MeshOptimizer.h"
+#include "Profiler.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+#include <thread>
+
+namespace
+{
+  /// FNV-1a over the bytes of a value, folded into the running key
+  template <typename T>
+  void hashValue(uint64_t& key, const T& value)
+  {
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(&value);
+    for (size_t i = 0; i < sizeof(T); i++)
+      key = (key ^ bytes[i]) * 1099511628211ull;
+  }
+
+  const float MAX_PARTICLE_STEP = 0.25f;        ///< Seconds, longer frames would emit more than the rings hold
+
+  void hashCamera(uint64_t& key, const RenderDevice::CameraParams& camera)
+  {
+    hashValue(key, camera.viewProjection);
+    hashValue(key, camera.eyePosition);
+    hashValue(key, camera.eyeDirection);
+  }
+}
 
 Scene::Scene()
-  : light(glm::vec3(1.0f, 0.65f, 0.8f), glm::vec3(3.0f, 1.0f, 1.0f))
+  : light(glm::vec3(1.0f, 0.65f, 0.8f), glm::vec3(3.0f, 1.0f, 1.0f)), culler(jobs), ocean(jobs), atmosphere(jobs), fog(jobs), particles(jobs)
 {
-  objects = std::vector<Object>();
+  addFrameTasks();
 }
 
+void Scene::addFrameTasks()
+{
+  int lightTask = frameTasks.add("light", [this]() { light.update(frameTicks); });
+  frameTasks.add("atmosphere", [this]() { atmosphere.update(); });
+
+  /// The door moves its portal and occluder, so visibility waits for it
+  int animationTask = frameTasks.add("animation", [this]() {
+    for (Object& object : objects)
+      object.animate();
+  });
+  int visibilityTask = frameTasks.add("visibility", [this]() { updateVisibility(*frameViews); });
+  frameTasks.precede(animationTask, visibilityTask);
+
+  /// Built for the first view, the others read it through its frustum
+  int fogTask = frameTasks.add("fog", [this]() {
+    if (light.isFogEnabled())
+      fog.update(frameViews->front(), light.getFrameParams());
+  });
+  frameTasks.precede(lightTask, fogTask);
+
+  int terrainTask = frameTasks.add("terrain", [this]() {
+    if (outdoorsVisible)
+      terrain.selectPatches(*frameViews);
+  });
+  int oceanTask = frameTasks.add("ocean", [this]() {
+    if (outdoorsVisible)
+      ocean.update(oceanTime);
+  });
+  int particleTask = frameTasks.add("particles", [this]() {
+    /// The torch is object 7, it holds the fire
+    for (int emitter : torchEmitters)
+      particles.setEmitterVisible(emitter, visibleObjects[7]);
+    for (int emitter : sprayEmitters)
+      particles.setEmitterVisible(emitter, outdoorsVisible);
+    /// After a long still spell the particles only need to look settled
+    particles.update(std::min(frameTicks * timerDelay / 1000.0f, MAX_PARTICLE_STEP));
+  });
+  frameTasks.precede(visibilityTask, terrainTask);
+  frameTasks.precede(visibilityTask, oceanTask);
+  frameTasks.precede(visibilityTask, particleTask);
+}
+
+
+void Scene::init(RenderDevice& device)
+{
+  /// Skybox and water span the whole island and stay loaded
+  for (size_t i = 0; i < objects.size(); i++)
+    streamer.add(&objects[i], i == 0 || i == 6);
+
+  streamer.init(device, assets);
+  terrain.init(device, assets);
+  ocean.init(device);
+  atmosphere.init(device);
+  fog.init(device);
+  addEmitters();
+}
 
-void Scene::init(GLuint shaderProgram)
+void Scene::addEmitters()
 {
-  light.init(shaderProgram);
+  particles.clear();
+  torchEmitters.clear();
+  sprayEmitters.clear();
+
+  /// The point light sits in the flame, the fire starts a little below it
+  glm::vec3 flame = light.getPointPosition() - glm::vec3(0.0f, 0.15f, 0.0f);
+  torchEmitters.push_back(particles.addEmitter(ParticleSystem::FIRE, flame, particleFireRate));
+  torchEmitters.push_back(particles.addEmitter(ParticleSystem::EMBERS, flame, particleEmberRate));
+
+  /// The water is pinned, its bounds are known once the streamer is initialized
+  const Object& water = objects.at(6);
+  if (!water.hasBounds())
+    return;
 
-  for (auto& object : objects)
-    object.init(shaderProgram);
+  for (int i = 0; i < particleSprayEmitters; i++)
+  {
+    float u = (i + 0.5f) / particleSprayEmitters;
+    float v = (i % 2 == 0) ? 0.3f : 0.7f;
+    glm::vec3 position = water.getBoundsMin() + (water.getBoundsMax() - water.getBoundsMin()) * glm::vec3(u, 1.0f, v);
+    sprayEmitters.push_back(particles.addEmitter(ParticleSystem::SPRAY, position, particleSprayRate));
+  }
+}
 
-  CHECK_GL_ERROR();
+void Scene::prepare(RenderDevice& device, const RenderDevice::CameraParams& camera)
+{
+  prepare(device, std::vector<RenderDevice::CameraParams>(1, camera));
 }
 
-void Scene::draw()
+void Scene::prepare(RenderDevice& device, const std::vector<RenderDevice::CameraParams>& views)
 {
-  light.draw();
-  CHECK_GL_ERROR();
+  PROFILE_CPU_SCOPE("Scene::prepare");
 
-  glEnable(GL_STENCIL_TEST);
-  glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
+  const RenderDevice::CameraParams& camera = views[0];
+  streamer.update(device, camera.eyePosition);
 
-  int objectId = 0;
+  /// The CPU work of the frame on all threads, the device is used again once it finished
+  frameViews = &views;
+  frameTasks.run(jobs);
+  frameViews = nullptr;
 
-  for (auto& object : objects)
+  /// Texture mips follow the nearest view that sees each object
+  for (const RenderDevice::CameraParams& view : views)
   {
-    glStencilFunc(GL_ALWAYS, objectId++, 255);
-    object.draw();
+    for (size_t i = 0; i < objects.size(); i++)
+      if (visibleObjects[i] && objects[i].isResident())
+        objects[i].requestTextures(device, view);
+    if (outdoorsVisible)
+      terrain.requestTextures(device, view);
   }
+  oceanTime += frameTicks * timerDelay / 1000.0f;
 
-  glDisable(GL_STENCIL_TEST);
+  /// Everything of the frame the static layer depends on except the latched camera and the light
+  staticKey = 14695981039346656037ull;
+  for (const RenderDevice::CameraParams& view : views)
+    hashCamera(staticKey, view);
+  hashValue(staticKey, outdoorsVisible);
+  for (size_t i = 0; i < objects.size(); i++)
+  {
+    if (!isStatic(i))
+      continue;
+    hashValue(staticKey, (bool)visibleObjects[i]);
+    hashValue(staticKey, objects[i].isResident());
+  }
 
-  CHECK_GL_ERROR();
+  Profiler::counter("views", (double)views.size());
+}
 
+void Scene::updateVisibility(const std::vector<RenderDevice::CameraParams>& views)
+{
+  updatePortals();
+
+  /// An object is drawn into all views when any of them sees it
+  outdoorsVisible = false;
+  visibleObjects.assign(objects.size(), false);
+
+  for (const RenderDevice::CameraParams& view : views)
+  {
+    portals.update(view.viewProjection, view.eyePosition);
+    /// From inside the closed room nothing outdoors can be seen
+    outdoorsVisible = outdoorsVisible || portals.isCellVisible(PortalSystem::OUTDOORS);
+
+    /// The depth buffer of the culler holds one view, several views are only portal culled
+    bool occlusion = views.size() == 1;
+    if (occlusion)
+      rasterizeOccluders(view);
+
+    for (size_t i = 0; i < objects.size(); i++)
+    {
+      const Object& object = objects[i];
+      if (visibleObjects[i])
+        continue;
+
+      bool occluder = std::find(occluders.begin(), occluders.end(), i) != occluders.end();
+      visibleObjects[i] = !object.hasBounds() ||
+                          (portals.isVisible(i, object.getBoundsMin(), object.getBoundsMax(), object.getTransform()) &&
+                           (!occlusion || occluder || culler.isVisible(object.getBoundsMin(), object.getBoundsMax(), object.getTransform())));
+    }
+  }
+}
+
+bool Scene::isStatic(size_t object) const
+{
+  return objects[object].getType() == Object::MESH;
+}
+
+void Scene::rasterizeOccluders(const RenderDevice::CameraParams& camera)
+{
+  culler.begin(camera.viewProjection);
+  for (size_t i : occluders)
+    culler.addOccluder(objects[i].getOccluderTriangles(), objects[i].getTransform());
+
+  /// The terrain occluder lies under the ground, it would hide the room from inside the hill
+  const glm::vec3& eye = camera.eyePosition;
+  if (eye.y >= terrain.heightAt(eye.x, eye.z) && !terrain.isCutOut(eye))
+    culler.addOccluder(terrain.getOccluderTriangles(), glm::mat4(1.0f));
+  culler.rasterize();
+}
+
+void Scene::submit(RenderDevice& device, const RenderDevice::CameraParams& camera)
+{
+  PROFILE_GPU_SCOPE("Scene::submit");
+
+  light.draw(device);
+  if (light.isFogEnabled())
+    fog.draw(device);
+
+  /// Placed with the latched eye, the skybox must not lag behind the camera
+  objects.at(0).setPlacement(camera.eyePosition, skyboxScale);
+
+  uint64_t key = staticKey;
+  hashCamera(key, camera);
+  hashValue(key, light.getStaticKey());
+
+  /// While nothing static changed the layer of the last frame is composited instead
+  if (!device.beginStaticLayer(key))
+  {
+    if (outdoorsVisible)
+      terrain.draw(device, (int)objects.size());
+
+    for (size_t i = 0; i < objects.size(); i++)
+      if (visibleObjects[i] && isStatic(i))
+        streamer.draw(device, i, (int)i);
+  }
+  device.endStaticLayer();
+
+  if (outdoorsVisible)
+    ocean.draw(device);
+
+  {
+    PROFILE_GPU_SCOPE("sky");
+    atmosphere.draw(device);
+    if (visibleObjects[0])
+      streamer.draw(device, 0, 0);
+  }
+
+  for (size_t i = 1; i < objects.size(); i++)
+    if (visibleObjects[i] && !isStatic(i))
+      streamer.draw(device, i, (int)i);
+
+  /// Blended over everything opaque
+  particles.draw(device);
+
+  portals.end();
+  culler.end();
+}
+
+void Scene::draw(RenderDevice& device, const RenderDevice::CameraParams& camera)
+{
+  prepare(device, camera);
+  submit(device, camera);
+}
+
+void Scene::updatePortals()
+{
+  /// The room is the space inside its walls and floor, the portal is the doorway the closed door fills
+  const Object& indoor = objects.at(3);
+  const Object& indoorFloor = objects.at(4);
+  if (indoor.hasBounds() && indoorFloor.hasBounds())
+    portals.setCellBounds(roomCell, glm::min(indoor.getBoundsMin(), indoorFloor.getBoundsMin()), glm::max(indoor.getBoundsMax(), indoorFloor.getBoundsMax()));
+
+  const Object& door = objects.at(1);
+  if (door.isDoorClosed() && door.hasBounds())
+    portals.setPortalBounds(doorPortal, door.getBoundsMin(), door.getBoundsMax(), door.getTransform());
+
+  portals.setPortalOpen(doorPortal, !door.isDoorClosed());
 }
 
 void Scene::loadObjects()
 {
-  Object skybox = Object("data/skybox/skybox.obj", "data/skybox/skybox.png", Object::SKYBOX);
-  Object floor = Object("data/floor/floor.obj", "data/floor/grass.jpg", Object::MESH);
-  Object door = Object("data/door/door.obj", "data/door/door.jpg", Object::DOOR);
-  Object threshold = Object("data/threshold/threshold.obj", "data/door/door.jpg", Object::MESH);
-  Object indoor = Object("data/indoor/indoor.obj", "data/indoor/brick.jpg", Object::MESH);
-  Object indoorFloor = Object("data/indoor/indoor_floor.obj", "data/indoor/floor.jpg", Object::MESH);
-  Object mouse = Object("data/mouse/mouse.obj", "data/mouse/mouse.png", Object::ANIMATED);
-  Object water = Object("data/water/water.obj", "data/water/water.jpg", Object::WATER);
-  Object torch = Object("data/torch/torch.obj", "data/torch/textures/torch.jpg", Object::MESH);
-  Object chest = Object("data/chest/chest.obj", "data/chest/textures/chest.jpg", Object::MESH);
-
-  objects.push_back(skybox);
-  objects.push_back(floor);
-  objects.push_back(door);
-  objects.push_back(threshold);
-  objects.push_back(indoor);
-  objects.push_back(indoorFloor);
-  objects.push_back(mouse);
-  objects.push_back(water);
-  objects.push_back(torch);
-  objects.push_back(chest);
+  objects.reserve(9);
+
+  objects.emplace_back("data/skybox/skybox.obj", "data/skybox/skybox.png", Object::SKYBOX);
+  objects.emplace_back("data/door/door.obj", "data/door/door.jpg", Object::DOOR);
+  objects.emplace_back("data/threshold/threshold.obj", "data/door/door.jpg", Object::MESH);
+  objects.emplace_back("data/indoor/indoor.obj", "data/indoor/brick.jpg", Object::MESH);
+  objects.emplace_back("data/indoor/indoor_floor.obj", "data/indoor/floor.jpg", Object::MESH);
+  objects.emplace_back("data/mouse/mouse.obj", "data/mouse/mouse.png", Object::ANIMATED);
+  objects.emplace_back("data/water/water.obj", "data/water/water.jpg", Object::WATER);
+  objects.emplace_back("data/torch/torch.obj", "data/torch/textures/torch.jpg", Object::MESH);
+  objects.emplace_back("data/chest/chest.obj", "data/chest/textures/chest.jpg", Object::MESH);
+
+  /// The torch holds the point light and stays lit at runtime, the other static meshes are baked
+  for (size_t i : { 2, 3, 4, 8 })
+    objects[i].setLightmapped(true);
+
+  /// The door and threshold stand in the doorway, everything else inside the hill is in the room
+  roomCell = portals.addCell("room");
+  doorPortal = portals.addPortal(PortalSystem::OUTDOORS, roomCell);
+
+  const int cells[] = { PortalSystem::OUTDOORS, PortalSystem::OUTDOORS, PortalSystem::OUTDOORS, roomCell, roomCell, roomCell, PortalSystem::OUTDOORS, roomCell, roomCell };
+  for (size_t i = 0; i < objects.size(); i++)
+    portals.setObjectCell(i, cells[i], i == 1 || i == 2 ? roomCell : -1);
+
+  /// With the closed door and the hill around it the whole room is hidden
+  occluders = { 1 };
+  for (size_t i : occluders)
+    objects[i].setOccluder(true);
+
+  /// The floor mesh is baked into the terrain, the doorway in the hill is cut out of it
+  terrain.build(terrainFloorMeshPath);
+  terrain.addCutout(glm::vec3(0.0f, 38.0f, -59.0f), glm::vec3(20.0f, 62.0f, -39.0f));
+}
+
+bool Scene::prepareBaker(LightmapBaker& baker, std::vector<size_t>& receivers) const
+{
+  /// The torch mesh surrounds the light and would shadow everything, the moving objects are left out
+  const size_t torch = 7;
+
+  for (size_t i = 0; i < objects.size(); i++)
+  {
+    const Object& object = objects[i];
+    if (object.getType() != Object::MESH || i == torch)
+      continue;
+
+    std::vector<float> vertices;
+    if (!Object::readMesh(object.getMeshPath(), vertices))
+      continue;
+
+    if (object.isLightmapped())
+    {
+      baker.addReceiver(vertices, object.getTransform());
+      receivers.push_back(i);
+    }
+    else
+      baker.addOccluder(vertices, object.getTransform());
+  }
+
+  baker.setTorch(light.getPointPosition());
+  baker.build();
+  return !receivers.empty();
+}
+
+bool Scene::bakeLightmaps(int samples)
+{
+  LightmapBaker baker;
+  std::vector<size_t> receivers;
+  if (!prepareBaker(baker, receivers))
+  {
+    std::cout << "No static meshes to bake" << std::endl;
+    return false;
+  }
+
+  LightmapBaker::Settings settings;
+  settings.samples = samples;
+
+  std::vector<Image> lightmaps;
+  LightmapBaker::printStats(baker.bake(settings, &lightmaps));
+
+  bool written = true;
+  for (size_t i = 0; i < receivers.size(); i++)
+  {
+    std::string path = Lightmap::pathFor(objects[receivers[i]].getMeshPath());
+    if (lightmaps[i].savePPM(path))
+      std::cout << "  " << path << ": " << lightmaps[i].width << "x" << lightmaps[i].height << std::endl;
+    else
+    {
+      std::cout << "Failed to write " << path << std::endl;
+      written = false;
+    }
+  }
+
+  return written;
+}
+
+void Scene::benchmarkLightmaps(int samples)
+{
+  LightmapBaker baker;
+  std::vector<size_t> receivers;
+  if (!prepareBaker(baker, receivers))
+  {
+    std::cout << "No static meshes to bake" << std::endl;
+    return;
+  }
+
+  unsigned int hardware = std::max(1u, std::thread::hardware_concurrency());
+  std::vector<unsigned int> threadCounts = { 1, 2, 4, hardware };
+  std::sort(threadCounts.begin(), threadCounts.end());
+  threadCounts.erase(std::unique(threadCounts.begin(), threadCounts.end()), threadCounts.end());
+
+  std::cout << "Lightmap bake benchmark (" << samples << " paths per texel)" << std::endl;
+  std::cout << std::setw(9) << "threads" << std::setw(10) << "texels" << std::setw(14) << "rays" << std::setw(10) << "s"
+            << std::setw(12) << "Mrays/s" << std::setw(10) << "speedup" << std::endl;
+  std::cout << std::fixed << std::setprecision(3);
+
+  double single = 0.0;
+  for (unsigned int threads : threadCounts)
+  {
+    LightmapBaker::Settings settings;
+    settings.samples = samples;
+    settings.threads = threads;
+
+    LightmapBaker::Stats stats = baker.bake(settings, nullptr);
+    if (single == 0.0)
+      single = stats.raysPerSecond;
+
+    std::cout << std::setw(9) << stats.threads << std::setw(10) << stats.texels << std::setw(14) << stats.rays << std::setw(10) << stats.seconds
+              << std::setw(12) << stats.raysPerSecond / 1e6 << std::setw(10) << (single > 0.0 ? stats.raysPerSecond / single : 0.0) << std::endl;
+  }
+}
+
+void Scene::printMeshOptimization() const
+{
+  std::cout << "Mesh optimization (FIFO cache of " << MeshOptimizer::CACHE_SIZE << " vertices, before -> after)" << std::endl;
+  std::cout << std::setw(36) << "mesh" << std::setw(10) << "triangles" << std::setw(10) << "vertices" << std::setw(16) << "ACMR"
+            << std::setw(16) << "ATVR" << std::setw(16) << "overfetch" << std::setw(10) << "ms" << std::endl;
+  std::cout << std::fixed << std::setprecision(3);
+
+  for (const Object& object : objects)
+  {
+    std::vector<float> vertices;
+    if (!Object::readMesh(object.getMeshPath(), vertices))
+      continue;
+
+    /// Welding and the three passes are what a load pays, the first analysis is left out
+    uint64_t start = Profiler::nowNs();
+    MeshOptimizer::Mesh mesh = MeshOptimizer::weld(vertices, 8);
+    uint64_t welded = Profiler::nowNs();
+    MeshOptimizer::Stats before = MeshOptimizer::analyze(mesh);
+    uint64_t optimizing = Profiler::nowNs();
+    MeshOptimizer::optimize(mesh);
+    double ms = ((welded - start) + (Profiler::nowNs() - optimizing)) / 1e6;
+    MeshOptimizer::Stats after = MeshOptimizer::analyze(mesh);
+
+    std::ostringstream acmr, atvr, overfetch;
+    acmr << std::fixed << std::setprecision(3) << before.acmr << " -> " << after.acmr;
+    atvr << std::fixed << std::setprecision(3) << before.atvr << " -> " << after.atvr;
+    overfetch << std::fixed << std::setprecision(3) << before.overfetch << " -> " << after.overfetch;
+
+    std::cout << std::setw(36) << object.getMeshPath() << std::setw(10) << mesh.indices.size() / 3 << std::setw(10) << mesh.vertices.size() / mesh.stride
+              << std::setw(16) << acmr.str() << std::setw(16) << atvr.str() << std::setw(16) << overfetch.str() << std::setw(10) << ms << std::endl;
+  }
+}
+
+void Scene::unload()
+{
+  streamer.unload();
+  terrain.release();
+  ocean.release();
+  atmosphere.release();
+  fog.release();
+}
+
+void Scene::setStreamingSynchronous(bool enable)
+{
+  streamer.setSynchronous(enable);
+}
+
+void Scene::printStreamingStats() const
+{
+  streamer.printStats();
+  assets.printStats();
+}
+
+void Scene::printTaskStats() const
+{
+  std::cout << "Job system: " << jobs.getThreadCount() << " threads" << std::endl;
+  frameTasks.printStats();
+}
+
+void Scene::printMemoryReport() const
+{
+  size_t cpuBytes = 0;
+  std::cout << "Memory per object:" << std::endl;
+
+  for (const auto& object : objects)
+  {
+    object.printMemory();
+    cpuBytes += object.getCpuBytes();
+  }
+
+  std::cout << "  terrain: CPU " << terrain.getCpuBytes() << " B, device " << terrain.getGpuBytes() << " B" << std::endl;
+  cpuBytes += terrain.getCpuBytes();
+
+  std::cout << "Total: CPU " << cpuBytes << " B, device " << assets.getStats().uniqueBytes << " B ("
+            << assets.getStats().savedBytes << " B saved by sharing)" << std::endl;
 }
 
 void Scene::switchFlashLight()
@@ -82,14 +508,55 @@ void Scene::switchFlashLight()
 void Scene::switchFog()
 {
   light.switchFog();
+  if (light.isFogEnabled())
+    fog.printStats();
+}
+
+void Scene::cycleHaze()
+{
+  const float MIE_SCALES[] = { 1.0f, 3.0f, 8.0f };
+  hazeLevel = (hazeLevel + 1) % 3;
+
+  Atmosphere::Params params;
+  params.mieScattering *= MIE_SCALES[hazeLevel];
+  params.mieAbsorption *= MIE_SCALES[hazeLevel];
+  atmosphere.setParams(params);
+  atmosphere.update();
+
+  std::cout << "Haze " << MIE_SCALES[hazeLevel] << "x: ";
+  atmosphere.printStats(Profiler::lastGpuScopeMs("sky"));
+}
+
+void Scene::switchOcclusionCulling()
+{
+  culler.setEnabled(!culler.isEnabled());
+  culler.printStats();
+}
+
+void Scene::switchPortalCulling()
+{
+  portals.setEnabled(!portals.isEnabled());
+  portals.printStats();
+}
+
+void Scene::addRedrawSources(RedrawScheduler& redraw)
+{
+  redraw.addSource("door", [this]() { return objects.at(1).isDoorMoving() ? 1 : 0; });
+  /// The mouse only runs while it is drawn
+  redraw.addSource("mouse", [this]() { return objects.at(5).isMouseEnabled() && visibleObjects.size() > 5 && visibleObjects[5] ? 1 : 0; });
+  redraw.addSource("sun", [this]() { return light.ticksToNextStep(); });
+  redraw.addSource("water", [this]() { return outdoorsVisible ? redrawAmbientTicks : 0; });
+  /// Fire, embers and the flicker of the torch light
+  redraw.addSource("torch", [this]() { return visibleObjects.size() > 7 && visibleObjects[7] ? redrawAmbientTicks : 0; });
+  redraw.addSource("world streaming", [this]() { return streamer.getStats().requestsInFlight > 0 ? 1 : 0; });
 }
 
 void Scene::pushDoor()
 {
-  objects.at(2).pushDoor();
+  objects.at(1).pushDoor();
 }
 
 void Scene::touchMouse()
 {
-  objects.at(6).mouseClick();
+  objects.at(5).mouseClick();
 }
@@ -10,24 +10,119 @@
 
 
 #pragma once
+#include "Atmosphere.h"
 #include "Camera.h"
 #include "Object.h"
+#include "OcclusionCuller.h"
+#include "PortalSystem.h"
 #include "Light.h"
+#include "LightmapBaker.h"
+#include "Ocean.h"
+#include "JobSystem.h"
+#include "ParticleSystem.h"
+#include "RedrawScheduler.h"
+#include "TaskGraph.h"
+#include "Terrain.h"
+#include "VolumetricFog.h"
 #include "Constants.h"
+#include "WorldStreamer.h"
 
 class Scene
 {
 public:
   Scene();
-  void init(GLuint program);
-  void draw();
+  void init(RenderDevice& device);
+  /// CPU work of the frame: streaming, visibility, terrain selection and the ocean spectrum
+  void prepare(RenderDevice& device, const RenderDevice::CameraParams& camera);
+  /// Cull once for several views drawn in one submission, the first view streams the world
+  void prepare(RenderDevice& device, const std::vector<RenderDevice::CameraParams>& views);
+  /// Device work of the frame, the camera may have moved slightly since prepare
+  void submit(RenderDevice& device, const RenderDevice::CameraParams& camera);
+  void draw(RenderDevice& device, const RenderDevice::CameraParams& camera);
   void loadObjects();
 
+  /// Release all device resources while the device still exists
+  void unload();
+
+  const Terrain& getTerrain() const { return terrain; }
+
+  /// Timer ticks the next frame stands for, the water, particles and sun move on by them
+  void setFrameTicks(int ticks) { frameTicks = ticks; }
+  /// Seed of the torch flicker, a recorded session replays with the seed it was recorded with
+  void setSeed(uint32_t seed) { light.setSeed(seed); }
+  /// Door, mouse, sun, water, torch and world streaming as sources of the redraw scheduler
+  void addRedrawSources(RedrawScheduler& redraw);
+
+  /// Bake the lightmaps of the static meshes next to their OBJ files, no device is needed
+  bool bakeLightmaps(int samples);
+  /// Bake throughput on 1, 2, 4 and all hardware threads, nothing is written
+  void benchmarkLightmaps(int samples);
+  /// ACMR, ATVR and vertex overfetch of every mesh in exporter order and after MeshOptimizer
+  void printMeshOptimization() const;
+
+  void setStreamingSynchronous(bool enable);
+  void printStreamingStats() const;
+  void printMemoryReport() const;
+  /// Time and thread of every task of prepare
+  void printTaskStats() const;
+
   void switchFlashLight();
   void switchFog();
+  /// Clear, hazy and foggy air, the sky tables are rebuilt and their cost printed
+  void cycleHaze();
+  void switchOcclusionCulling();
+  void switchPortalCulling();
   void pushDoor();
   void touchMouse();
 private:
+  /// Declared first so it is destroyed after the objects and the streamer holding references into it
+  AssetCache assets;
+  /// Runs the frame tasks and the parallel loops of the subsystems inside them, so it is created before them
+  JobSystem jobs;
+
   Light light;
   std::vector<Object> objects;
+  WorldStreamer streamer;
+
+  PortalSystem portals;
+  int roomCell = 0;
+  int doorPortal = 0;
+
+  OcclusionCuller culler;
+  std::vector<size_t> occluders;                ///< Objects rasterized by the culler, never culled themselves
+
+  Terrain terrain;
+  Ocean ocean;
+  float oceanTime = 0.0f;                       ///< Advanced by the timer ticks of each frame
+  int frameTicks = 1;
+
+  Atmosphere atmosphere;
+  VolumetricFog fog;
+  int hazeLevel = 0;
+
+  ParticleSystem particles;
+  std::vector<int> torchEmitters;               ///< Fire and embers, shown with the torch
+  std::vector<int> sprayEmitters;               ///< Shown with the outdoors
+
+  /// Light, sky, animation, visibility, fog, terrain, ocean and particles of prepare run as a task graph
+  TaskGraph frameTasks;
+  const std::vector<RenderDevice::CameraParams>* frameViews = nullptr;  ///< Views of the running graph
+  void addFrameTasks();
+
+  /// Fire and embers at the torch flame, spray spread over the water
+  void addEmitters();
+
+  bool outdoorsVisible = true;                  ///< Results of prepare, used by submit
+  std::vector<bool> visibleObjects;
+  uint64_t staticKey = 0;                       ///< Hash of the views and of the visible static objects
+
+  /// Static meshes and the terrain are cached by the device, the rest is drawn every frame
+  bool isStatic(size_t object) const;
+
+  void updatePortals();
+  /// Portal and occlusion culling of all views into visibleObjects and outdoorsVisible
+  void updateVisibility(const std::vector<RenderDevice::CameraParams>& views);
+  /// Static meshes as receivers or occluders of the baker, false when no receiver could be read
+  bool prepareBaker(LightmapBaker& baker, std::vector<size_t>& receivers) const;
+  void rasterizeOccluders(const RenderDevice::CameraParams& camera);
 };
@@ -0,0 +1,647 @@
+//----------------------------------------------------------------------------------------
+/**
+ * \file       SoftwareRenderDevice.cpp
+ * \author     Bogdan Putintsev
+ * \date       2021/05/13
+ * \brief      Tile-based multi-threaded software rasterizer backend of the render device
+ *
+*/
+//----------------------------------------------------------------------------------------
+
+#include "SoftwareRenderDevice.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#include <IL/il.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SOFTWARE_RASTERIZER_SSE 1
+#include <emmintrin.h>
+#else
+#define SOFTWARE_RASTERIZER_SSE 0
+#endif
+
+namespace
+{
+  const float GUARD_BAND = 2.0f;                ///< Triangles are clipped to twice the viewport in x and y
+  const int MAX_CLIPPED_VERTICES = 3 + 5;       ///< Triangle clipped by the near and four guard planes
+  const int CLIP_FLOATS = 4 + SoftwareShader::VARYING_COUNT;
+
+  /// glClearColor(0.2f, 0.1f, 0.3f, 1.0f)
+  const uint32_t CLEAR_COLOR = 0xFF4C1A33;
+
+  uint32_t pack(const glm::vec3& color)
+  {
+    uint32_t r = (uint32_t)(std::min(std::max(color.x, 0.0f), 1.0f) * 255.0f + 0.5f);
+    uint32_t g = (uint32_t)(std::min(std::max(color.y, 0.0f), 1.0f) * 255.0f + 0.5f);
+    uint32_t b = (uint32_t)(std::min(std::max(color.z, 0.0f), 1.0f) * 255.0f + 0.5f);
+    return 0xFF000000 | (b << 16) | (g << 8) | r;
+  }
+
+  /// Signed distance of a clip-space vertex to clipping plane i (inside when >= 0)
+  float clipDistance(const float* clip, int plane)
+  {
+    switch (plane)
+    {
+    case 0:  return clip[2] + clip[3];                   ///< near
+    case 1:  return GUARD_BAND * clip[3] + clip[0];      ///< left guard band
+    case 2:  return GUARD_BAND * clip[3] - clip[0];      ///< right guard band
+    case 3:  return GUARD_BAND * clip[3] + clip[1];      ///< bottom guard band
+    default: return GUARD_BAND * clip[3] - clip[1];      ///< top guard band
+    }
+  }
+
+  /// Bits set for view frustum planes the vertex is outside of, used for trivial rejection
+  int outcode(const float* clip)
+  {
+    int code = 0;
+    if (clip[0] < -clip[3]) code |= 1;
+    if (clip[0] > clip[3]) code |= 2;
+    if (clip[1] < -clip[3]) code |= 4;
+    if (clip[1] > clip[3]) code |= 8;
+    if (clip[2] < -clip[3]) code |= 16;
+    if (clip[2] > clip[3]) code |= 32;
+    return code;
+  }
+
+  bool needsClipping(const float* clip)
+  {
+    for (int plane = 0; plane < 5; plane++)
+      if (clipDistance(clip, plane) < 0.0f)
+        return true;
+    return false;
+  }
+}
+
+SoftwareRenderDevice::SoftwareRenderDevice(int width, int height, unsigned int threadCount)
+  : width(width), height(height), pool(threadCount)
+{
+  tilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+  tilesY = (height + TILE_SIZE - 1) / TILE_SIZE;
+  tileBins.resize(tilesX * tilesY);
+
+  colorBuffer.resize(width * height);
+  depthBuffer.resize(width * height);
+  idBuffer.resize(width * height);
+
+  /// Handle 0 is a white texture used by objects without one
+  textures.push_back(SoftwareShader::Texture());
+
+  ilInit();
+  ilEnable(IL_ORIGIN_SET);
+  ilOriginFunc(IL_ORIGIN_LOWER_LEFT);
+
+}
+
+RenderDevice::Handle SoftwareRenderDevice::createMesh(const std::vector<float>& vertices, const std::vector<uint32_t>& indices, const std::string& name)
+{
+  /// The vertex stage walks triangle lists in order, indexed meshes are expanded
+  Mesh mesh;
+  mesh.indices = indices;
+  for (uint32_t index : indices)
+    mesh.vertices.insert(mesh.vertices.end(), vertices.begin() + index * 8, vertices.begin() + index * 8 + 8);
+  if (indices.empty())
+    mesh.vertices = vertices;
+
+  if (!freeMeshes.empty())
+  {
+    Handle handle = freeMeshes.back();
+    freeMeshes.pop_back();
+    meshes[handle - 1] = std::move(mesh);
+    return handle;
+  }
+
+  meshes.push_back(std::move(mesh));
+  return (Handle)meshes.size();
+}
+
+void SoftwareRenderDevice::setMeshLightmapUvs(Handle handle, const std::vector<float>& uvs)
+{
+  Mesh& mesh = meshes[handle - 1];
+  mesh.lightmapUvs.clear();
+  for (uint32_t index : mesh.indices)
+    mesh.lightmapUvs.insert(mesh.lightmapUvs.end(), uvs.begin() + index * 2, uvs.begin() + index * 2 + 2);
+  if (mesh.indices.empty())
+    mesh.lightmapUvs = uvs;
+}
+
+RenderDevice::Handle SoftwareRenderDevice::createTexture(const std::string& path, const std::vector<unsigned char>& content)
+{
+  ILuint image;
+  ilGenImages(1, &image);
+  ilBindImage(image);
+
+  if (!ilLoadL(IL_TYPE_UNKNOWN, content.data(), (ILuint)content.size()) || !ilConvertImage(IL_RGBA, IL_UNSIGNED_BYTE))
+  {
+    std::cout << "Failed to load texture: " << path << "." << std::endl;
+    ilDeleteImages(1, &image);
+    return 0;
+  }
+
+  SoftwareShader::Texture texture;
+  texture.width = ilGetInteger(IL_IMAGE_WIDTH);
+  texture.height = ilGetInteger(IL_IMAGE_HEIGHT);
+  texture.texels.resize(texture.width * texture.height);
+  memcpy(texture.texels.data(), ilGetData(), texture.texels.size() * sizeof(uint32_t));
+
+  ilDeleteImages(1, &image);
+
+  return addTexture(std::move(texture));
+}
+
+RenderDevice::Handle SoftwareRenderDevice::createDataTexture(int width, int height)
+{
+  SoftwareShader::Texture texture;
+  texture.width = width;
+  texture.height = height;
+  texture.texels.clear();
+  texture.values.resize(width * height);
+
+  return addTexture(std::move(texture));
+}
+
+void SoftwareRenderDevice::updateDataTexture(Handle texture, const float* texels)
+{
+  std::vector<glm::vec4>& values = textures[texture].values;
+  memcpy(&values[0].x, texels, values.size() * sizeof(glm::vec4));
+}
+
+RenderDevice::Handle SoftwareRenderDevice::createVolumeTexture(int width, int height, int depth)
+{
+  SoftwareShader::Texture texture;
+  texture.width = width;
+  texture.height = height;
+  texture.depth = depth;
+  texture.texels.clear();
+  texture.values.resize((size_t)width * height * depth);
+
+  return addTexture(std::move(texture));
+}
+
+void SoftwareRenderDevice::updateVolumeTexture(Handle texture, const float* texels)
+{
+  updateDataTexture(texture, texels);
+}
+
+void SoftwareRenderDevice::destroyMesh(Handle mesh)
+{
+  meshes[mesh - 1] = Mesh();
+  freeMeshes.push_back(mesh);
+}
+
+void SoftwareRenderDevice::destroyTexture(Handle texture)
+{
+  if (texture == 0)
+    return;
+
+  textures[texture] = SoftwareShader::Texture();
+  freeTextures.push_back(texture);
+}
+
+size_t SoftwareRenderDevice::getTextureBytes(Handle texture) const
+{
+  return textures[texture].texels.size() * sizeof(uint32_t) + textures[texture].values.size() * sizeof(glm::vec4);
+}
+
+void SoftwareRenderDevice::beginFrame()
+{
+  draws.clear();
+  terrainCalls.clear();
+}
+
+void SoftwareRenderDevice::setCamera(const CameraParams& camera)
+{
+  currentViews.assign(1, ViewParams());
+  currentViews[0].camera = camera;
+}
+
+void SoftwareRenderDevice::setViews(const std::vector<ViewParams>& views)
+{
+  currentViews.assign(views.begin(), views.begin() + std::min((int)views.size(), MAX_VIEWS));
+}
+
+void SoftwareRenderDevice::setLights(const LightParams& lights)
+{
+  currentLights = lights;
+}
+
+void SoftwareRenderDevice::setOcean(const OceanParams& ocean)
+{
+  currentOcean = ocean;
+}
+
+void SoftwareRenderDevice::setAtmosphere(const AtmosphereParams& atmosphere)
+{
+  currentAtmosphere = atmosphere;
+}
+
+void SoftwareRenderDevice::setFog(const FogParams& fog)
+{
+  currentFog = fog;
+}
+
+/// No instancing on the CPU, every view gets its own draw
+void SoftwareRenderDevice::draw(const DrawCall& call)
+{
+  QueuedDraw queued;
+  queued.call = call;
+  queued.lights = currentLights;
+  queued.ocean = currentOcean;
+  queued.atmosphere = currentAtmosphere;
+  queued.fog = currentFog;
+
+  for (const ViewParams& view : currentViews)
+  {
+    queued.camera = view.camera;
+    queued.viewport = view.viewport;
+    draws.push_back(queued);
+  }
+}
+
+/// Every patch becomes a draw of the patch mesh in every view
+void SoftwareRenderDevice::drawTerrain(const TerrainCall& call)
+{
+  terrainCalls.push_back(call);
+
+  QueuedDraw queued;
+  queued.call.mesh = call.mesh;
+  queued.call.texture = call.texture;
+  queued.call.vertexCount = call.vertexCount;
+  queued.call.shaderType = SHADER_TERRAIN;
+  queued.call.objectId = call.objectId;
+  queued.call.transform = glm::mat4(1.0f);
+  queued.lights = currentLights;
+  queued.ocean = currentOcean;
+  queued.fog = currentFog;
+  queued.terrain = (int)terrainCalls.size() - 1;
+
+  for (const ViewParams& view : currentViews)
+  {
+    queued.camera = view.camera;
+    queued.viewport = view.viewport;
+    for (const glm::vec4& patch : call.patches)
+    {
+      queued.patch = patch;
+      draws.push_back(queued);
+    }
+  }
+}
+
+void SoftwareRenderDevice::endFrame()
+{
+  shaders.clear();
+  batches.clear();
+
+  for (int drawIndex = 0; drawIndex < (int)draws.size(); drawIndex++)
+  {
+    const QueuedDraw& queued = draws[drawIndex];
+    shaders.push_back(SoftwareShader(queued.call, queued.camera, queued.lights, queued.ocean, &textures[queued.call.texture],
+                                     &textures[queued.ocean.displacementMap], &textures[queued.ocean.normalMap]));
+    if (queued.terrain >= 0)
+    {
+      const TerrainCall& terrain = terrainCalls[queued.terrain];
+      shaders.back().setTerrain(&terrain, queued.patch, &textures[terrain.heightMap]);
+    }
+    if (queued.call.shaderType == SHADER_SKYBOX && queued.atmosphere.skyRayleigh != 0)
+    {
+      const AtmosphereParams& atmosphere = queued.atmosphere;
+      shaders.back().setAtmosphere(atmosphere, &textures[atmosphere.transmittance], &textures[atmosphere.skyRayleigh], &textures[atmosphere.skyMie]);
+    }
+    if (queued.lights.fogEnabled && queued.fog.volume != 0)
+      shaders.back().setFog(queued.fog, &textures[queued.fog.volume]);
+    if (queued.call.lightmap != 0 && queued.terrain < 0 && !meshes[queued.call.mesh - 1].lightmapUvs.empty())
+      shaders.back().setLightmap(&textures[queued.call.lightmap]);
+
+    for (int first = 0; first < queued.call.vertexCount; first += BATCH_SIZE * 3)
+    {
+      Batch batch;
+      batch.drawIndex = drawIndex;
+      batch.firstVertex = first;
+      batch.vertexCount = std::min(BATCH_SIZE * 3, queued.call.vertexCount - first);
+      batches.push_back(batch);
+    }
+  }
+
+  if (batchTriangles.size() < batches.size())
+    batchTriangles.resize(batches.size());
+
+  pool.parallelFor((unsigned int)batches.size(), [this](unsigned int i) {
+    batchTriangles[i].clear();
+    processBatch(batches[i], batchTriangles[i]);
+  });
+
+  binTriangles();
+
+  pool.parallelFor((unsigned int)tileBins.size(), [this](unsigned int i) {
+    rasterizeTile(i);
+  });
+}
+
+RenderDevice::Handle SoftwareRenderDevice::addTexture(SoftwareShader::Texture&& texture)
+{
+  if (!freeTextures.empty())
+  {
+    Handle handle = freeTextures.back();
+    freeTextures.pop_back();
+    textures[handle] = std::move(texture);
+    return handle;
+  }
+
+  textures.push_back(std::move(texture));
+  return (Handle)(textures.size() - 1);
+}
+
+void SoftwareRenderDevice::processBatch(const Batch& batch, std::vector<Triangle>& output) const
+{
+  const SoftwareShader& shader = shaders[batch.drawIndex];
+  const Mesh& mesh = meshes[draws[batch.drawIndex].call.mesh - 1];
+  const float* lightmapUvs = mesh.lightmapUvs.empty() ? nullptr : mesh.lightmapUvs.data();
+
+  ClipVertex polygon[2][MAX_CLIPPED_VERTICES + 1];
+
+  for (int i = 0; i + 2 < batch.vertexCount; i += 3)
+  {
+    ClipVertex* input = polygon[0];
+
+    for (int k = 0; k < 3; k++)
+    {
+      glm::vec4 clip;
+      int vertex = batch.firstVertex + i + k;
+      shader.vertex(&mesh.vertices[vertex * 8], lightmapUvs != nullptr ? lightmapUvs + vertex * 2 : nullptr, clip, input[k].data + 4);
+      input[k].data[0] = clip.x;
+      input[k].data[1] = clip.y;
+      input[k].data[2] = clip.z;
+      input[k].data[3] = clip.w;
+    }
+
+    if (outcode(input[0].data) & outcode(input[1].data) & outcode(input[2].data))
+      continue;
+
+    if (!needsClipping(input[0].data) && !needsClipping(input[1].data) && !needsClipping(input[2].data))
+    {
+      setupTriangle(input[0], input[1], input[2], batch.drawIndex, output);
+      continue;
+    }
+
+    /// Sutherland-Hodgman against the near plane and the guard band
+    int count = 3;
+    int current = 0;
+
+    for (int plane = 0; plane < 5 && count >= 3; plane++)
+    {
+      ClipVertex* in = polygon[current];
+      ClipVertex* out = polygon[1 - current];
+      int outCount = 0;
+
+      for (int v = 0; v < count; v++)
+      {
+        const ClipVertex& a = in[v];
+        const ClipVertex& b = in[(v + 1) % count];
+        float distanceA = clipDistance(a.data, plane);
+        float distanceB = clipDistance(b.data, plane);
+
+        if (distanceA >= 0.0f)
+          out[outCount++] = a;
+
+        if ((distanceA >= 0.0f) != (distanceB >= 0.0f))
+        {
+          float t = distanceA / (distanceA - distanceB);
+          ClipVertex& intersection = out[outCount++];
+          for (int f = 0; f < CLIP_FLOATS; f++)
+            intersection.data[f] = a.data[f] + (b.data[f] - a.data[f]) * t;
+        }
+      }
+
+      count = outCount;
+      current = 1 - current;
+    }
+
+    for (int v = 1; v + 1 < count; v++)
+      setupTriangle(polygon[current][0], polygon[current][v], polygon[current][v + 1], batch.drawIndex, output);
+  }
+}
+
+void SoftwareRenderDevice::setupTriangle(const ClipVertex& v0, const ClipVertex& v1, const ClipVertex& v2, int drawIndex, std::vector<Triangle>& output) const
+{
+  const ClipVertex* vertices[3] = { &v0, &v1, &v2 };
+  const glm::vec4& viewport = draws[drawIndex].viewport;
+  Triangle triangle;
+
+  for (int k = 0; k < 3; k++)
+  {
+    const float* data = vertices[k]->data;
+    float invW = 1.0f / data[3];
+
+    triangle.x[k] = (viewport.x + (data[0] * invW * 0.5f + 0.5f) * (viewport.z - viewport.x)) * width;
+    triangle.y[k] = (1.0f - viewport.y - (data[1] * invW * 0.5f + 0.5f) * (viewport.w - viewport.y)) * height;
+    triangle.depth[k] = data[2] * invW * 0.5f + 0.5f;
+    triangle.invW[k] = invW;
+
+    for (int j = 0; j < SoftwareShader::VARYING_COUNT; j++)
+      triangle.varyings[k][j] = data[4 + j] * invW;
+  }
+
+  const float* x = triangle.x;
+  const float* y = triangle.y;
+
+  double area = (double)x[0] * (y[1] - y[2]) + (double)x[1] * (y[2] - y[0]) + (double)x[2] * (y[0] - y[1]);
+  if (fabs(area) < 1e-8)
+    return;
+
+  /// Pixel centers lie at +0.5, only pixels whose center is inside the bounds can be covered
+  /// and inside the viewport, which also clips what the guard band lets through
+  int viewMinX = std::max(0, (int)ceilf(viewport.x * width - 0.5f));
+  int viewMaxX = std::min(width, (int)ceilf(viewport.z * width - 0.5f)) - 1;
+  int viewMinY = std::max(0, (int)ceilf((1.0f - viewport.w) * height - 0.5f));
+  int viewMaxY = std::min(height, (int)ceilf((1.0f - viewport.y) * height - 0.5f)) - 1;
+
+  triangle.minX = std::max(viewMinX, (int)ceilf(std::min(x[0], std::min(x[1], x[2])) - 0.5f));
+  triangle.maxX = std::min(viewMaxX, (int)floorf(std::max(x[0], std::max(x[1], x[2])) - 0.5f));
+  triangle.minY = std::max(viewMinY, (int)ceilf(std::min(y[0], std::min(y[1], y[2])) - 0.5f));
+  triangle.maxY = std::min(viewMaxY, (int)floorf(std::max(y[0], std::max(y[1], y[2])) - 0.5f));
+
+  if (triangle.minX > triangle.maxX || triangle.minY > triangle.maxY)
+    return;
+
+  triangle.orientation = area > 0.0 ? 1.0f : -1.0f;
+  triangle.drawIndex = drawIndex;
+  output.push_back(triangle);
+}
+
+void SoftwareRenderDevice::binTriangles()
+{
+  triangles.clear();
+  for (auto& bin : tileBins)
+    bin.clear();
+
+  /// Batches are merged in submission order so tiles see triangles in draw order
+  for (size_t i = 0; i < batches.size(); i++)
+    triangles.insert(triangles.end(), batchTriangles[i].begin(), batchTriangles[i].end());
+
+  for (uint32_t i = 0; i < triangles.size(); i++)
+  {
+    const Triangle& triangle = triangles[i];
+
+    for (int tileY = triangle.minY / TILE_SIZE; tileY <= triangle.maxY / TILE_SIZE; tileY++)
+      for (int tileX = triangle.minX / TILE_SIZE; tileX <= triangle.maxX / TILE_SIZE; tileX++)
+        tileBins[tileY * tilesX + tileX].push_back(i);
+  }
+}
+
+void SoftwareRenderDevice::rasterizeTile(int tileIndex)
+{
+  int tileMinX = (tileIndex % tilesX) * TILE_SIZE;
+  int tileMinY = (tileIndex / tilesX) * TILE_SIZE;
+  int tileMaxX = std::min(tileMinX + TILE_SIZE, width) - 1;
+  int tileMaxY = std::min(tileMinY + TILE_SIZE, height) - 1;
+
+  for (int y = tileMinY; y <= tileMaxY; y++)
+  {
+    std::fill(&colorBuffer[y * width + tileMinX], &colorBuffer[y * width + tileMaxX] + 1, CLEAR_COLOR);
+    std::fill(&depthBuffer[y * width + tileMinX], &depthBuffer[y * width + tileMaxX] + 1, 1.0f);
+    std::fill(&idBuffer[y * width + tileMinX], &idBuffer[y * width + tileMaxX] + 1, 0);
+  }
+
+  float varyings[SoftwareShader::VARYING_COUNT];
+
+  for (uint32_t triangleIndex : tileBins[tileIndex])
+  {
+    const Triangle& t = triangles[triangleIndex];
+    const SoftwareShader& shader = shaders[t.drawIndex];
+
+    /// Rows start on a multiple of four pixels from the tile origin, so the 4-wide depth loads
+    /// stay inside the tile that this thread owns. The lanes left of firstX are masked: it can
+    /// be the viewport edge, which guard band triangles rely on
+    int firstX = std::max(t.minX, tileMinX);
+    int minX = tileMinX + ((firstX - tileMinX) & ~3);
+    int maxX = std::min(t.maxX, tileMaxX);
+    int minY = std::max(t.minY, tileMinY);
+    int maxY = std::min(t.maxY, tileMaxY);
+
+    /// Edge functions relative to the tile origin. Neighbouring triangles evaluate a shared edge
+    /// from the same operands with swapped roles, so the results are exact negations and no
+    /// pixel on the edge is lost.
+    float edgeA[3], edgeB[3], edgeC[3];
+    for (int k = 0; k < 3; k++)
+    {
+      int a = (k + 1) % 3;
+      int b = (k + 2) % 3;
+      float xa = t.x[a] - tileMinX, ya = t.y[a] - tileMinY;
+      float xb = t.x[b] - tileMinX, yb = t.y[b] - tileMinY;
+
+      edgeA[k] = (ya - yb) * t.orientation;
+      edgeB[k] = (xb - xa) * t.orientation;
+      edgeC[k] = (xa * yb - xb * ya) * t.orientation;
+    }
+
+    for (int y = minY; y <= maxY; y++)
+    {
+      float py = y - tileMinY + 0.5f;
+      float* depthRow = &depthBuffer[y * width];
+
+      for (int x = minX; x <= maxX; x += 4)
+      {
+        float b0[4], b1[4], b2[4], z[4];
+        int mask = 0;
+
+#if SOFTWARE_RASTERIZER_SSE
+        __m128 px = _mm_add_ps(_mm_set1_ps(x - tileMinX + 0.5f), _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f));
+        __m128 e0 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(edgeA[0]), px), _mm_set1_ps(edgeB[0] * py)), _mm_set1_ps(edgeC[0]));
+        __m128 e1 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(edgeA[1]), px), _mm_set1_ps(edgeB[1] * py)), _mm_set1_ps(edgeC[1]));
+        __m128 e2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(edgeA[2]), px), _mm_set1_ps(edgeB[2] * py)), _mm_set1_ps(edgeC[2]));
+        __m128 zero = _mm_setzero_ps();
+
+        __m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(e0, zero), _mm_cmpge_ps(e1, zero)), _mm_cmpge_ps(e2, zero));
+        inside = _mm_and_ps(inside, _mm_cmpge_ps(px, _mm_set1_ps(firstX - tileMinX + 0.5f)));
+        inside = _mm_and_ps(inside, _mm_cmple_ps(px, _mm_set1_ps(maxX - tileMinX + 0.5f)));
+
+        /// Normalizing by the sum instead of the area keeps the depth of distant slivers from rounding past the far plane
+        __m128 invSum = _mm_div_ps(_mm_set1_ps(1.0f), _mm_add_ps(_mm_add_ps(e0, e1), e2));
+        e0 = _mm_mul_ps(e0, invSum);
+        e1 = _mm_mul_ps(e1, invSum);
+        e2 = _mm_mul_ps(e2, invSum);
+
+        __m128 depth = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e0, _mm_set1_ps(t.depth[0])), _mm_mul_ps(e1, _mm_set1_ps(t.depth[1]))), _mm_mul_ps(e2, _mm_set1_ps(t.depth[2])));
+        /// Only the last tile of a row whose width is not a multiple of four ends mid-group
+        __m128 stored;
+        if (x + 3 <= tileMaxX)
+          stored = _mm_loadu_ps(depthRow + x);
+        else
+        {
+          float edge[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+          for (int lane = 0; x + lane <= tileMaxX; lane++)
+            edge[lane] = depthRow[x + lane];
+          stored = _mm_loadu_ps(edge);
+        }
+        __m128 pass = _mm_and_ps(inside, _mm_cmplt_ps(depth, stored));
+        pass = _mm_and_ps(pass, _mm_cmple_ps(depth, _mm_set1_ps(1.0f)));
+
+        mask = _mm_movemask_ps(pass);
+        if (mask == 0)
+          continue;
+
+        _mm_storeu_ps(b0, e0);
+        _mm_storeu_ps(b1, e1);
+        _mm_storeu_ps(b2, e2);
+        _mm_storeu_ps(z, depth);
+#else
+        for (int lane = 0; lane < 4 && x + lane <= maxX; lane++)
+        {
+          float px = x - tileMinX + lane + 0.5f;
+          float e0 = edgeA[0] * px + edgeB[0] * py + edgeC[0];
+          float e1 = edgeA[1] * px + edgeB[1] * py + edgeC[1];
+          float e2 = edgeA[2] * px + edgeB[2] * py + edgeC[2];
+
+          float invSum = 1.0f / (e0 + e1 + e2);
+          b0[lane] = e0 * invSum;
+          b1[lane] = e1 * invSum;
+          b2[lane] = e2 * invSum;
+          z[lane] = b0[lane] * t.depth[0] + b1[lane] * t.depth[1] + b2[lane] * t.depth[2];
+
+          if (x + lane >= firstX && e0 >= 0.0f && e1 >= 0.0f && e2 >= 0.0f && z[lane] < depthRow[x + lane] && z[lane] <= 1.0f)
+            mask |= 1 << lane;
+        }
+
+        if (mask == 0)
+          continue;
+#endif
+
+        for (int lane = 0; lane < 4; lane++)
+        {
+          if (!(mask & (1 << lane)))
+            continue;
+
+          float invW = b0[lane] * t.invW[0] + b1[lane] * t.invW[1] + b2[lane] * t.invW[2];
+          float w = 1.0f / invW;
+
+          for (int j = 0; j < SoftwareShader::VARYING_COUNT; j++)
+            varyings[j] = (b0[lane] * t.varyings[0][j] + b1[lane] * t.varyings[1][j] + b2[lane] * t.varyings[2][j]) * w;
+
+          if (shader.discarded(varyings))
+            continue;
+
+          int pixel = y * width + x + lane;
+          colorBuffer[pixel] = pack(shader.fragment(varyings));
+          depthBuffer[pixel] = z[lane];
+          idBuffer[pixel] = (unsigned char)shader.objectId();
+        }
+      }
+    }
+  }
+}
+
+unsigned char SoftwareRenderDevice::objectIdAt(int x, int y) const
+{
+  if (x < 0 || y < 0 || x >= width || y >= height)
+    return 0;
+  return idBuffer[y * width + x];
+}
+
+void SoftwareRenderDevice::readPixels(Image& image) const
+{
+  image.width = width;
+  image.height = height;
+  image.pixels = colorBuffer;
+}
@@ -0,0 +1,154 @@
+//----------------------------------------------------------------------------------------
+/**
+ * \file       SoftwareRenderDevice.h
+ * \author     Bogdan Putintsev
+ * \date       2021/05/13
+ * \brief      Tile-based multi-threaded software rasterizer backend of the render device
+ *
+ *  Draws are queued during the frame and rendered in endFrame in three stages: vertex
+ *  shading, clipping and triangle setup in parallel over triangle batches, binning into
+ *  screen tiles, and rasterization/shading in parallel over tiles. Coverage and depth are
+ *  tested four pixels at a time with SSE2.
+ *
+*/
+//----------------------------------------------------------------------------------------
+
+#pragma once
+#include "RenderDevice.h"
+#include "Image.h"
+#include "SoftwareShader.h"
+#include "ThreadPool.h"
+
+#include <cstdint>
+
+class SoftwareRenderDevice : public RenderDevice
+{
+public:
+  static const int TILE_SIZE = 64;              ///< Tile edge in pixels, a multiple of 4
+  static const int BATCH_SIZE = 2048;           ///< Triangles per vertex stage job
+
+  SoftwareRenderDevice(int width, int height, unsigned int threadCount = 0);
+
+  Handle createMesh(const std::vector<float>& vertices, const std::vector<uint32_t>& indices, const std::string& name) override;
+  Handle createTexture(const std::string& path, const std::vector<unsigned char>& content) override;
+  void setMeshLightmapUvs(Handle mesh, const std::vector<float>& uvs) override;
+  void destroyMesh(Handle mesh) override;
+  void destroyTexture(Handle texture) override;
+  Handle createDataTexture(int width, int height) override;
+  void updateDataTexture(Handle texture, const float* texels) override;
+  Handle createVolumeTexture(int width, int height, int depth) override;
+  void updateVolumeTexture(Handle texture, const float* texels) override;
+  size_t getTextureBytes(Handle texture) const override;
+  /// Textures are sampled at full size, there are no mips to stream
+  void requestTextureDetail(Handle texture, float uvPerViewHeight) override {}
+
+  void beginFrame() override;
+  void setCamera(const CameraParams& camera) override;
+  void setViews(const std::vector<ViewParams>& views) override;
+  void setLights(const LightParams& lights) override;
+  void setOcean(const OceanParams& ocean) override;
+  void setAtmosphere(const AtmosphereParams& atmosphere) override;
+  void setFog(const FogParams& fog) override;
+  void draw(const DrawCall& call) override;
+  void drawTerrain(const TerrainCall& call) override;
+  /// The rasterizer has no blending, particles are left out
+  void drawParticles(const ParticleCall& call) override {}
+  /// Every frame is drawn in full, there is no static layer
+  bool beginStaticLayer(uint64_t key) override { return false; }
+  void endStaticLayer() override {}
+  void endFrame() override;
+
+  int getWidth() const { return width; }
+  int getHeight() const { return height; }
+  unsigned int getThreadCount() const { return pool.getThreadCount(); }
+
+  /// RGBA8 pixels, first row at the top
+  const std::vector<uint32_t>& getColorBuffer() const { return colorBuffer; }
+  unsigned char objectIdAt(int x, int y) const;
+  void readPixels(Image& image) const;
+
+private:
+  /// Draw recorded during the frame together with the state it was issued with
+  struct QueuedDraw
+  {
+    DrawCall call;
+    CameraParams camera;
+    glm::vec4 viewport;                         ///< Scissor of the view, see ViewParams
+    LightParams lights;
+    OceanParams ocean;
+    AtmosphereParams atmosphere;
+    FogParams fog;
+    int terrain = -1;                           ///< Index into terrainCalls for terrain patches
+    glm::vec4 patch;
+  };
+
+  /// Vertex after the vertex stage: clip position followed by the varyings
+  struct ClipVertex
+  {
+    float data[4 + SoftwareShader::VARYING_COUNT];
+  };
+
+  /// Screen-space triangle ready for rasterization
+  struct Triangle
+  {
+    float x[3], y[3];                           ///< Window coordinates, first row at the top
+    float orientation;                          ///< 1 or -1, makes edge functions positive inside
+    float depth[3];
+    float invW[3];
+    float varyings[3][SoftwareShader::VARYING_COUNT];   ///< Varyings divided by w
+    int minX, minY, maxX, maxY;
+    int drawIndex;
+  };
+
+  /// Part of a draw processed by one vertex stage job
+  struct Batch
+  {
+    int drawIndex;
+    int firstVertex;
+    int vertexCount;
+  };
+
+  int width;
+  int height;
+  int tilesX;
+  int tilesY;
+
+  /// Triangle list of createMesh and the lightmap uvs of its vertices
+  struct Mesh
+  {
+    std::vector<float> vertices;                ///< Indexed meshes expanded, 8 floats per vertex
+    std::vector<uint32_t> indices;              ///< Kept to expand the lightmap uvs the same way
+    std::vector<float> lightmapUvs;             ///< 2 floats per expanded vertex, empty without a lightmap
+  };
+
+  std::vector<Mesh> meshes;
+  std::vector<SoftwareShader::Texture> textures;
+  std::vector<Handle> freeMeshes;               ///< Slots of destroyed meshes, reused first
+  std::vector<Handle> freeTextures;             ///< Slots of destroyed textures, reused first
+
+  std::vector<ViewParams> currentViews = std::vector<ViewParams>(1);
+  LightParams currentLights;
+  OceanParams currentOcean;
+  AtmosphereParams currentAtmosphere;
+  FogParams currentFog;
+  std::vector<QueuedDraw> draws;
+  std::vector<TerrainCall> terrainCalls;
+  std::vector<SoftwareShader> shaders;
+
+  std::vector<Batch> batches;
+  std::vector<std::vector<Triangle>> batchTriangles;
+  std::vector<Triangle> triangles;
+  std::vector<std::vector<uint32_t>> tileBins;
+
+  std::vector<uint32_t> colorBuffer;
+  std::vector<float> depthBuffer;
+  std::vector<unsigned char> idBuffer;
+
+  ThreadPool pool;
+
+  Handle addTexture(SoftwareShader::Texture&& texture);
+  void processBatch(const Batch& batch, std::vector<Triangle>& output) const;
+  void setupTriangle(const ClipVertex& v0, const ClipVertex& v1, const ClipVertex& v2, int drawIndex, std::vector<Triangle>& output) const;
+  void binTriangles();
+  void rasterizeTile(int tileIndex);
+};
@@ -0,0 +1,370 @@
+//----------------------------------------------------------------------------------------
+/**
+ * \file       SoftwareShader.cpp
+ * \author     Bogdan Putintsev
+ * \date       2021/05/13
+ * \brief      C++ version of vertexShader.vs and fragmentShader.fs for the software rasterizer
+ *
+*/
+//----------------------------------------------------------------------------------------
+
+#include "SoftwareShader.h"
+#include "Atmosphere.h"
+#include "Lightmap.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+  const float AMBIENT = 0.5f;
+  const float SPECULAR_STRENGTH = 0.8f;
+  const float DIFFUSE_STRENGTH = 0.8f;
+  const float PI = 3.14159265f;
+  const float SUN_ANGULAR_RADIUS = 0.00467f;
+
+  /// pow(x, 128) by repeated squaring
+  float pow128(float x)
+  {
+    for (int i = 0; i < 7; i++)
+      x *= x;
+    return x;
+  }
+
+  glm::vec4 unpack(uint32_t texel)
+  {
+    return glm::vec4((texel & 0xFF) / 255.0f, ((texel >> 8) & 0xFF) / 255.0f, ((texel >> 16) & 0xFF) / 255.0f, (texel >> 24) / 255.0f);
+  }
+
+  /// Bilinear sample with GL_REPEAT wrapping, fetch(index) returns one texel
+  template <typename Fetch>
+  glm::vec4 bilinear(int width, int height, float u, float v, Fetch fetch)
+  {
+    float x = (u - floorf(u)) * width - 0.5f;
+    float y = (v - floorf(v)) * height - 0.5f;
+
+    int x0 = (int)floorf(x);
+    int y0 = (int)floorf(y);
+    float fx = x - x0;
+    float fy = y - y0;
+
+    int x1 = (x0 + 1) % width;
+    int y1 = (y0 + 1) % height;
+    x0 = (x0 + width) % width;
+    y0 = (y0 + height) % height;
+
+    glm::vec4 top = glm::mix(fetch(y0 * width + x0), fetch(y0 * width + x1), fx);
+    glm::vec4 bottom = glm::mix(fetch(y1 * width + x0), fetch(y1 * width + x1), fx);
+    return glm::mix(top, bottom, fy);
+  }
+}
+
+SoftwareShader::SoftwareShader(const RenderDevice::DrawCall& call, const RenderDevice::CameraParams& camera, const RenderDevice::LightParams& lights,
+                               const RenderDevice::OceanParams& ocean, const Texture* texture, const Texture* displacementMap, const Texture* normalMap)
+  : call(call), camera(camera), lights(lights), ocean(ocean), texture(texture), displacementMap(displacementMap), normalMap(normalMap)
+{
+  modelViewProjection = camera.viewProjection * call.transform;
+  normalMatrix = glm::mat3(glm::transpose(glm::inverse(call.transform)));
+}
+
+void SoftwareShader::setTerrain(const RenderDevice::TerrainCall* terrainCall, const glm::vec4& terrainPatch, const Texture* terrainHeightMap)
+{
+  terrain = terrainCall;
+  patch = terrainPatch;
+  heightMap = terrainHeightMap;
+}
+
+void SoftwareShader::vertex(const float* vertex, const float* lightmapUv, glm::vec4& clipPosition, float* varyings) const
+{
+  glm::vec4 position = glm::vec4(vertex[0], vertex[1], vertex[2], 1.0f);
+
+  glm::vec4 fragPos = call.transform * position;
+  glm::vec3 normal = normalMatrix * glm::vec3(vertex[5], vertex[6], vertex[7]);
+  float u = vertex[3];
+  float v = vertex[4];
+
+  if (call.shaderType == RenderDevice::SHADER_WATER && !displacementMap->values.empty())
+  {
+    u = fragPos.x / ocean.patchSize;
+    v = fragPos.z / ocean.patchSize;
+    fragPos += glm::vec4(glm::vec3(sampleValues(*displacementMap, u, v)), 0.0f);
+    clipPosition = camera.viewProjection * fragPos;
+  }
+  else if (terrain != nullptr)
+  {
+    /// Odd grid vertices slide onto the coarser grid as the distance approaches the end of the level
+    glm::vec2 grid(vertex[0], vertex[2]);
+    glm::vec2 world = glm::vec2(patch.x, patch.y) + grid * patch.z;
+    float distance = glm::length(camera.eyePosition - glm::vec3(world.x, sampleHeightMap(world.x, world.y).x, world.y));
+
+    const glm::vec2& morph = terrain->morphRanges[(int)patch.w];
+    float k = std::min(std::max((distance - morph.x) / (morph.y - morph.x), 0.0f), 1.0f);
+    glm::vec2 half = grid * (terrain->patchQuads * 0.5f);
+    grid -= (half - glm::vec2(floorf(half.x), floorf(half.y))) * (2.0f / terrain->patchQuads) * k;
+
+    world = glm::vec2(patch.x, patch.y) + grid * patch.z;
+    fragPos = glm::vec4(world.x, sampleHeightMap(world.x, world.y).x, world.y, 1.0f);
+    clipPosition = camera.viewProjection * fragPos;
+    u = world.x * terrain->heightMapTransform.w;
+    v = world.y * terrain->heightMapTransform.w;
+  }
+  else
+    clipPosition = modelViewProjection * position;
+
+  varyings[0] = fragPos.x;
+  varyings[1] = fragPos.y;
+  varyings[2] = fragPos.z;
+  varyings[3] = normal.x;
+  varyings[4] = normal.y;
+  varyings[5] = normal.z;
+  varyings[6] = u;
+  varyings[7] = v;
+  varyings[8] = lightmapUv != nullptr ? lightmapUv[0] : 0.0f;
+  varyings[9] = lightmapUv != nullptr ? lightmapUv[1] : 0.0f;
+}
+
+glm::vec3 SoftwareShader::fragment(const float* varyings) const
+{
+  glm::vec3 fragPos = glm::vec3(varyings[0], varyings[1], varyings[2]);
+  glm::vec3 normal = glm::vec3(varyings[3], varyings[4], varyings[5]);
+  float u = varyings[6];
+  float v = varyings[7];
+
+  if (call.shaderType == RenderDevice::SHADER_WATER && !normalMap->values.empty())
+    normal = glm::vec3(sampleValues(*normalMap, u, v));
+  else if (terrain != nullptr)
+  {
+    glm::vec4 texel = sampleHeightMap(fragPos.x, fragPos.z);
+    normal = glm::vec3(texel.y, texel.z, texel.w);
+  }
+
+  /// Baked meshes: torch irradiance per unit intensity and sky light, square-root encoded (Lightmap.h)
+  glm::vec2 baked(0.0f, 1.0f);
+  if (lightmap != nullptr)
+  {
+    glm::vec4 texel = sampleTexels(*lightmap, varyings[8], varyings[9]);
+    baked = glm::vec2(texel.x * texel.x * Lightmap::TORCH_RANGE, texel.y * texel.y);
+  }
+
+  glm::vec3 lighting = directionPhong(normal, fragPos, baked.y) * lights.color;
+  glm::vec4 color;
+
+  if (call.shaderType == RenderDevice::SHADER_SKYBOX && skyRayleigh != nullptr)
+  {
+    /// The sky texture shows through where the atmosphere is dark
+    glm::vec3 radiance = atmosphereSky(glm::normalize(fragPos - camera.eyePosition), glm::normalize(lights.sunDirection));
+    glm::vec3 sky = glm::vec3(1.0f) - glm::exp(radiance * -atmosphere.exposure);
+    float night = 1.0f - std::min(std::max(glm::dot(sky, glm::vec3(0.2126f, 0.7152f, 0.0722f)) * 4.0f, 0.0f), 1.0f);
+    color = glm::vec4(sky, 1.0f) + glm::vec4(lights.color, 1.0f) * sample(u, v) * night;
+  }
+  else if (call.shaderType == RenderDevice::SHADER_SKYBOX)
+    color = glm::vec4(lights.color, 1.0f) * sample(u, v);
+  else if (call.shaderType == RenderDevice::SHADER_WATER)
+  {
+    /// First tile of the water atlas, repeated once per patch
+    color = glm::vec4(lighting, 1.0f) * sample((u - floorf(u)) * 0.25f, (v - floorf(v)) * 0.25f);
+  }
+  else
+  {
+    if (lights.flashLightEnabled)
+      lighting += flashlightPhong(normal, fragPos) * lights.color;
+
+    color = glm::vec4(lighting, 1.0f) * sample(u, v);
+    float pointWeight = lightmap != nullptr ? baked.x : pointLight(normal, fragPos);
+    color = color + pointWeight * lights.pointIntensity * glm::vec4(lights.pointColor, 1.0f);
+  }
+
+  if (lights.fogEnabled && fogVolume != nullptr)
+  {
+    glm::vec4 fogged = froxelFog(fragPos);
+    color = glm::vec4(glm::vec3(color) * fogged.w + glm::vec3(fogged), color.w);
+  }
+
+  return glm::vec3(color.x, color.y, color.z);
+}
+
+bool SoftwareShader::discarded(const float* varyings) const
+{
+  if (terrain == nullptr)
+    return false;
+
+  for (size_t i = 0; i + 1 < terrain->cutouts.size(); i += 2)
+  {
+    const glm::vec3& boxMin = terrain->cutouts[i];
+    const glm::vec3& boxMax = terrain->cutouts[i + 1];
+    if (varyings[0] > boxMin.x && varyings[1] > boxMin.y && varyings[2] > boxMin.z &&
+        varyings[0] < boxMax.x && varyings[1] < boxMax.y && varyings[2] < boxMax.z)
+      return true;
+  }
+
+  return false;
+}
+
+glm::vec4 SoftwareShader::sample(float u, float v) const
+{
+  return sampleTexels(*texture, u, v);
+}
+
+glm::vec4 SoftwareShader::sampleTexels(const Texture& map, float u, float v)
+{
+  const uint32_t* texels = map.texels.data();
+  return bilinear(map.width, map.height, u, v, [texels](int index) { return unpack(texels[index]); });
+}
+
+void SoftwareShader::setFog(const RenderDevice::FogParams& fogParams, const Texture* volume)
+{
+  fog = fogParams;
+  fogVolume = volume;
+}
+
+void SoftwareShader::setAtmosphere(const RenderDevice::AtmosphereParams& atmosphereParams, const Texture* transmittance, const Texture* rayleigh, const Texture* mie)
+{
+  atmosphere = atmosphereParams;
+  skyTransmittance = transmittance;
+  skyRayleigh = rayleigh;
+  skyMie = mie;
+}
+
+glm::vec3 SoftwareShader::skySlice(const Texture& table, float x, float y, float slice) const
+{
+  const glm::vec3& samples = atmosphere.skySamples;
+  float u = (0.5f + x * (samples.x - 1.0f)) / samples.x;
+  float v = (0.5f + y * (samples.y - 1.0f)) / samples.y;
+  return glm::vec3(sampleValues(table, (u + slice) / samples.z, v));
+}
+
+glm::vec3 SoftwareShader::transmittanceToTop(float r, float mu) const
+{
+  float groundRadius = atmosphere.groundRadius, topRadius = atmosphere.topRadius;
+  float horizon = std::sqrt(topRadius * topRadius - groundRadius * groundRadius);
+  float rho = std::sqrt(std::max(r * r - groundRadius * groundRadius, 0.0f));
+  float distance = std::max(-r * mu + std::sqrt(std::max(r * r * (mu * mu - 1.0f) + topRadius * topRadius, 0.0f)), 0.0f);
+  float minDistance = topRadius - r;
+  float x = (distance - minDistance) / (rho + horizon - minDistance);
+  float y = rho / horizon;
+
+  float width = (float)skyTransmittance->width, height = (float)skyTransmittance->height;
+  return glm::vec3(sampleValues(*skyTransmittance, (0.5f + x * (width - 1.0f)) / width, (0.5f + y * (height - 1.0f)) / height));
+}
+
+glm::vec3 SoftwareShader::atmosphereSky(const glm::vec3& view, const glm::vec3& sun) const
+{
+  glm::vec2 viewFlat(view.x, view.z), sunFlat(sun.x, sun.z);
+  float azimuth = 0.0f;
+  if (glm::length(viewFlat) > 1e-4f && glm::length(sunFlat) > 1e-4f)
+    azimuth = std::acos(std::min(std::max(glm::dot(glm::normalize(viewFlat), glm::normalize(sunFlat)), -1.0f), 1.0f));
+
+  float x = Atmosphere::elevationToUnit(std::asin(std::min(std::max(view.y, -1.0f), 1.0f)));
+  float y = Atmosphere::elevationToUnit(std::asin(std::min(std::max(sun.y, -1.0f), 1.0f)));
+
+  float slice = azimuth / PI * (atmosphere.skySamples.z - 1.0f);
+  float slice0 = std::min(floorf(slice), atmosphere.skySamples.z - 2.0f);
+  float weight = slice - slice0;
+  glm::vec3 rayleigh = glm::mix(skySlice(*skyRayleigh, x, y, slice0), skySlice(*skyRayleigh, x, y, slice0 + 1.0f), weight);
+  glm::vec3 mie = glm::mix(skySlice(*skyMie, x, y, slice0), skySlice(*skyMie, x, y, slice0 + 1.0f), weight);
+
+  float nu = glm::dot(view, sun);
+  float g = atmosphere.mieG;
+  float miePhase = 3.0f / (8.0f * PI) * (1.0f - g * g) * (1.0f + nu * nu) / ((2.0f + g * g) * std::pow(1.0f + g * g - 2.0f * g * nu, 1.5f));
+  glm::vec3 radiance = rayleigh + mie * miePhase;
+
+  /// The sun disk, as bright as the sun illuminance spread over its solid angle
+  float edge0 = std::cos(SUN_ANGULAR_RADIUS * 1.2f), edge1 = std::cos(SUN_ANGULAR_RADIUS);
+  float t = std::min(std::max((nu - edge0) / (edge1 - edge0), 0.0f), 1.0f);
+  float disk = t * t * (3.0f - 2.0f * t);
+  if (disk > 0.0f && view.y > -0.01f)
+    radiance = radiance + transmittanceToTop(atmosphere.observerRadius, view.y) * (disk / (PI * SUN_ANGULAR_RADIUS * SUN_ANGULAR_RADIUS));
+  return radiance;
+}
+
+glm::vec4 SoftwareShader::sampleValues(const Texture& map, float u, float v)
+{
+  const glm::vec4* values = map.values.data();
+  return bilinear(map.width, map.height, u, v, [values](int index) { return values[index]; });
+}
+
+glm::vec4 SoftwareShader::sampleHeightMap(float x, float z) const
+{
+  const glm::vec4& transform = terrain->heightMapTransform;
+  return sampleValues(*heightMap, x * transform.x + transform.y, z * transform.x + transform.z);
+}
+
+float SoftwareShader::directionPhong(const glm::vec3& normal, const glm::vec3& fragPos, float skyLight) const
+{
+  glm::vec3 normalizedNormal = glm::normalize(normal);
+  glm::vec3 lightDir = glm::normalize(lights.sunDirection);
+  glm::vec3 viewDir = glm::normalize(camera.eyePosition - fragPos);
+  glm::vec3 reflectDir = glm::reflect(-lightDir, normal);
+  float specular = pow128(std::max(glm::dot(viewDir, reflectDir), 0.0f)) * SPECULAR_STRENGTH;
+
+  float diffuse = std::max(glm::dot(normalizedNormal, lightDir), 0.0f) * DIFFUSE_STRENGTH;
+  return diffuse + AMBIENT * skyLight + specular;
+}
+
+float SoftwareShader::flashlightPhong(const glm::vec3& normal, const glm::vec3& fragPos) const
+{
+  glm::vec3 normalizedNormal = glm::normalize(normal);
+  glm::vec3 lightDir = glm::normalize(camera.eyePosition - fragPos);
+
+  float spotAngle = std::max(0.0f, glm::dot(-lightDir, glm::normalize(camera.eyeDirection)));
+  if (spotAngle < 0.95f)
+    return 0.0f;
+
+  glm::vec3 reflectDir = glm::reflect(-lightDir, normal);
+  float specular = pow128(std::max(glm::dot(lightDir, reflectDir), 0.0f)) * SPECULAR_STRENGTH;
+  float diffuse = std::max(glm::dot(normalizedNormal, lightDir), 0.0f) * DIFFUSE_STRENGTH;
+
+  return (diffuse + AMBIENT + specular) * powf(spotAngle, 102);
+}
+
+float SoftwareShader::pointLight(const glm::vec3& normal, const glm::vec3& fragPos) const
+{
+  glm::vec3 normalizedNormal = glm::normalize(normal);
+  glm::vec3 lightDir = glm::normalize(fragPos - lights.pointPosition);
+  float diffuse = std::max(glm::dot(normalizedNormal, lightDir), 0.0f) * DIFFUSE_STRENGTH;
+
+  glm::vec3 viewDir = glm::normalize(camera.eyePosition - fragPos);
+  glm::vec3 reflectDir = glm::reflect(-lightDir, normal);
+  float specular = pow128(std::max(glm::dot(viewDir, reflectDir), 0.0f)) * SPECULAR_STRENGTH;
+  float distance = glm::length(lights.pointPosition - fragPos);
+  float attenuation = 1.0f / (0.5f * distance + 0.5f * distance * distance);
+
+  return (diffuse + specular) * attenuation;
+}
+
+glm::vec4 SoftwareShader::sampleVolume(const Texture& map, const glm::vec3& coord)
+{
+  glm::vec3 size((float)map.width, (float)map.height, (float)map.depth);
+  glm::vec3 texel = coord * size - glm::vec3(0.5f);
+
+  int x0 = (int)floorf(texel.x), y0 = (int)floorf(texel.y), z0 = (int)floorf(texel.z);
+  float fx = texel.x - x0, fy = texel.y - y0, fz = texel.z - z0;
+
+  auto clampIndex = [](int i, int count) { return std::min(std::max(i, 0), count - 1); };
+  int x[2] = { clampIndex(x0, map.width), clampIndex(x0 + 1, map.width) };
+  int y[2] = { clampIndex(y0, map.height), clampIndex(y0 + 1, map.height) };
+  int z[2] = { clampIndex(z0, map.depth), clampIndex(z0 + 1, map.depth) };
+
+  glm::vec4 slices[2];
+  for (int k = 0; k < 2; k++)
+  {
+    const glm::vec4* slice = map.values.data() + (size_t)z[k] * map.width * map.height;
+    glm::vec4 bottom = glm::mix(slice[y[0] * map.width + x[0]], slice[y[0] * map.width + x[1]], fx);
+    glm::vec4 top = glm::mix(slice[y[1] * map.width + x[0]], slice[y[1] * map.width + x[1]], fx);
+    slices[k] = glm::mix(bottom, top, fy);
+  }
+  return glm::mix(slices[0], slices[1], fz);
+}
+
+glm::vec4 SoftwareShader::froxelFog(const glm::vec3& fragPos) const
+{
+  glm::vec4 clip = fog.viewProjection * glm::vec4(fragPos, 1.0f);
+  float depth = std::max(clip.w, 1e-4f);
+  glm::vec3 coord(clip.x / depth * 0.5f + 0.5f, clip.y / depth * 0.5f + 0.5f,
+                  std::log(std::max(depth / fog.nearDepth, 1.0f)) / std::log(fog.farDepth / fog.nearDepth));
+
+  /// The sky is infinitely far, behind all of the fog
+  if (call.shaderType == RenderDevice::SHADER_SKYBOX)
+    coord.z = 1.0f;
+  return sampleVolume(*fogVolume, coord);
+}
@@ -0,0 +1,104 @@
+//----------------------------------------------------------------------------------------
+/**
+ * \file       SoftwareShader.h
+ * \author     Bogdan Putintsev
+ * \date       2021/05/13
+ * \brief      C++ version of vertexShader.vs and fragmentShader.fs for the software rasterizer
+ *
+ *  Keep in sync with the GLSL shaders: sun, point light, flashlight, fog and the displaced,
+ *  normal mapped water follow the same formulas, including their quirks.
+ *
+*/
+//----------------------------------------------------------------------------------------
+
+#pragma once
+#include "RenderDevice.h"
+
+#include <cstdint>
+#include <vector>
+
+class SoftwareShader
+{
+public:
+  static const int VARYING_COUNT = 10;          ///< FragPos (3), normal (3), texture coordinates (2), lightmap coordinates (2)
+
+  /// RGBA8 texture with the first row at the bottom, like a GL texture, data and volume textures keep floats in values instead
+  struct Texture
+  {
+    int width = 1;
+    int height = 1;
+    int depth = 1;                              ///< Slices of a volume texture
+    std::vector<uint32_t> texels = std::vector<uint32_t>(1, 0xFFFFFFFF);
+    std::vector<glm::vec4> values;
+  };
+
+  SoftwareShader(const RenderDevice::DrawCall& call, const RenderDevice::CameraParams& camera, const RenderDevice::LightParams& lights,
+                 const RenderDevice::OceanParams& ocean, const Texture* texture, const Texture* displacementMap, const Texture* normalMap);
+
+  /// Draw one patch of a terrain call, heightMap is its data texture
+  void setTerrain(const RenderDevice::TerrainCall* terrainCall, const glm::vec4& terrainPatch, const Texture* terrainHeightMap);
+
+  /// Sky tables of SHADER_SKYBOX draws, without them the sky texture is drawn alone
+  void setAtmosphere(const RenderDevice::AtmosphereParams& atmosphereParams, const Texture* transmittance, const Texture* rayleigh, const Texture* mie);
+
+  /// Froxel grid of the volumetric fog, without it the fog is not drawn
+  void setFog(const RenderDevice::FogParams& fogParams, const Texture* volume);
+
+  /// Baked torch and sky light of a static mesh, replaces the runtime torch and scales the ambient term
+  void setLightmap(const Texture* map) { lightmap = map; }
+
+  /// vertexShader.vs: writes the clip position and the varyings of one vertex, lightmapUv may be null
+  void vertex(const float* vertex, const float* lightmapUv, glm::vec4& clipPosition, float* varyings) const;
+
+  /// fragmentShader.fs: varyings are perspective-correct
+  glm::vec3 fragment(const float* varyings) const;
+
+  /// The discard at the start of fragmentShader.fs
+  bool discarded(const float* varyings) const;
+
+  int objectId() const { return call.objectId; }
+
+private:
+  RenderDevice::DrawCall call;
+  RenderDevice::CameraParams camera;
+  RenderDevice::LightParams lights;
+  RenderDevice::OceanParams ocean;
+  const Texture* texture;
+  const Texture* displacementMap;
+  const Texture* normalMap;
+
+  const RenderDevice::TerrainCall* terrain = nullptr;
+  glm::vec4 patch;
+  const Texture* heightMap = nullptr;
+
+  RenderDevice::AtmosphereParams atmosphere;
+  const Texture* skyTransmittance = nullptr;
+  const Texture* skyRayleigh = nullptr;
+  const Texture* skyMie = nullptr;
+
+  RenderDevice::FogParams fog;
+  const Texture* fogVolume = nullptr;
+
+  const Texture* lightmap = nullptr;
+
+  glm::mat4 modelViewProjection;
+  glm::mat3 normalMatrix;
+
+  glm::vec4 sample(float u, float v) const;
+  static glm::vec4 sampleTexels(const Texture& map, float u, float v);
+  static glm::vec4 sampleValues(const Texture& map, float u, float v);
+  glm::vec4 sampleHeightMap(float x, float z) const;
+
+  float directionPhong(const glm::vec3& normal, const glm::vec3& fragPos, float skyLight) const;
+  float flashlightPhong(const glm::vec3& normal, const glm::vec3& fragPos) const;
+  float pointLight(const glm::vec3& normal, const glm::vec3& fragPos) const;
+  /// froxelFog of fragmentShader.fs: in-scattered light and transmittance from the eye
+  glm::vec4 froxelFog(const glm::vec3& fragPos) const;
+  /// Trilinear sample with clamped edges
+  static glm::vec4 sampleVolume(const Texture& map, const glm::vec3& coord);
+
+  /// atmosphereSky of fragmentShader.fs
+  glm::vec3 atmosphereSky(const glm::vec3& view, const glm::vec3& sun) const;
+  glm::vec3 skySlice(const Texture& table, float x, float y, float slice) const;
+  glm::vec3 transmittanceToTop(float r, float mu) const;
+};
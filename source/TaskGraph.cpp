@@ -0,0 +1,104 @@
+//----------------------------------------------------------------------------------------
+/**
+ * \file       TaskGraph.cpp
+ * \author     Bogdan Putintsev
+ * \date       2021/05/13
+ * \brief      Named tasks with dependencies run once per frame on a job system
+ *
+*/
+//----------------------------------------------------------------------------------------
+
+#include "TaskGraph.h"
+#include "Profiler.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+
+int TaskGraph::add(const char* name, const Task& task)
+{
+  Node node;
+  node.task = task;
+  nodes.push_back(node);
+
+  Stats taskStats;
+  taskStats.name = name;
+  stats.push_back(taskStats);
+  return (int)nodes.size() - 1;
+}
+
+void TaskGraph::precede(int before, int after)
+{
+  std::vector<int>& successors = nodes.at(before).successors;
+  if ((int)successors.size() >= JobSystem::MAX_CONTINUATIONS)
+  {
+    std::cout << "Task " << stats[before].name << " already has " << successors.size() << " successors, "
+              << stats.at(after).name << " is not ordered after it" << std::endl;
+    return;
+  }
+  successors.push_back(after);
+}
+
+void TaskGraph::run(JobSystem& jobs)
+{
+  PROFILE_CPU_SCOPE("TaskGraph::run");
+
+  uint64_t start = Profiler::nowNs();
+  JobSystem* system = &jobs;
+
+  JobSystem::Job* root = jobs.create([] {});
+  jobsOfRun.resize(nodes.size());
+  for (size_t i = 0; i < nodes.size(); i++)
+  {
+    jobsOfRun[i] = jobs.create([this, system, i, start] {
+      uint64_t taskStart = Profiler::nowNs();
+      {
+        PROFILE_CPU_SCOPE(stats[i].name);
+        nodes[i].task();
+      }
+      uint64_t taskEnd = Profiler::nowNs();
+
+      /// Only this task writes its stats, they are read after the run
+      Stats& taskStats = stats[i];
+      taskStats.runs++;
+      taskStats.lastStartMs = (taskStart - start) / 1e6;
+      taskStats.lastMs = (taskEnd - taskStart) / 1e6;
+      taskStats.totalMs += taskStats.lastMs;
+      taskStats.maxMs = std::max(taskStats.maxMs, taskStats.lastMs);
+      taskStats.lastThread = system->getCurrentThread();
+    }, root);
+  }
+
+  for (size_t i = 0; i < nodes.size(); i++)
+    for (int successor : nodes[i].successors)
+      jobs.addDependency(jobsOfRun[i], jobsOfRun[successor]);
+
+  for (JobSystem::Job* job : jobsOfRun)
+    jobs.run(job);
+  jobs.run(root);
+  jobs.wait(root);
+
+  runs++;
+  totalMs += (Profiler::nowNs() - start) / 1e6;
+  for (const Stats& taskStats : stats)
+    totalTaskMs += taskStats.lastMs;
+}
+
+void TaskGraph::printStats() const
+{
+  if (runs == 0)
+  {
+    std::cout << "Frame tasks: not run yet" << std::endl;
+    return;
+  }
+
+  std::cout << std::fixed << std::setprecision(3) << "Frame tasks: " << runs << " runs, " << totalMs / runs << " ms per run, "
+            << totalTaskMs / runs << " ms of tasks, parallelism " << (totalMs > 0.0 ? totalTaskMs / totalMs : 0.0) << std::endl;
+
+  for (const Stats& taskStats : stats)
+  {
+    std::cout << "  " << std::left << std::setw(12) << taskStats.name << std::right << " average " << taskStats.totalMs / std::max(taskStats.runs, 1)
+              << " ms, max " << taskStats.maxMs << " ms, last started at " << taskStats.lastStartMs << " ms on thread " << taskStats.lastThread << std::endl;
+  }
+  std::cout << std::defaultfloat;
+}
@@ -0,0 +1,65 @@
+//----------------------------------------------------------------------------------------
+/**
+ * \file       TaskGraph.h
+ * \author     Bogdan Putintsev
+ * \date       2021/05/13
+ * \brief      Named tasks with dependencies run once per frame on a job system
+ *
+ *  The graph is built once: tasks and the order some of them need. Every run turns it
+ *  into jobs of the job system, starts the tasks without dependencies and returns when all
+ *  tasks finished, so the caller has a sync point to use their results. Each run records
+ *  the time and the thread of every task.
+ *
+*/
+//----------------------------------------------------------------------------------------
+
+#pragma once
+#include "JobSystem.h"
+
+#include <functional>
+#include <vector>
+
+class TaskGraph
+{
+public:
+  typedef std::function<void()> Task;
+
+  /// Timings of one task over all runs
+  struct Stats
+  {
+    const char* name = nullptr;
+    int runs = 0;
+    double totalMs = 0.0;
+    double maxMs = 0.0;
+    double lastStartMs = 0.0;                   ///< Since the start of the last run
+    double lastMs = 0.0;
+    unsigned int lastThread = 0;
+  };
+
+  /// Index of the new task, name must outlive the graph
+  int add(const char* name, const Task& task);
+  /// after starts only once before finished
+  void precede(int before, int after);
+
+  /// Run all tasks and wait for them
+  void run(JobSystem& jobs);
+
+  const std::vector<Stats>& getStats() const { return stats; }
+  /// Average time of every task, of the whole graph and the parallelism it reached
+  void printStats() const;
+
+private:
+  struct Node
+  {
+    Task task;
+    std::vector<int> successors;
+  };
+
+  std::vector<Node> nodes;
+  std::vector<Stats> stats;
+  std::vector<JobSystem::Job*> jobsOfRun;
+
+  int runs = 0;
+  double totalMs = 0.0;                         ///< Wall time of all runs
+  double totalTaskMs = 0.0;                     ///< Sum of the task times of all runs
+};
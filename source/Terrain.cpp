@@ -0,0 +1,613 @@
+//----------------------------------------------------------------------------------------
+/**
+ * \file       Terrain.cpp
+ * \author     Bogdan Putintsev
+ * \date       2021/05/13
+ * \brief      Heightmap terrain rendered with continuous distance-dependent LOD (CDLOD)
+ *
+*/
+//----------------------------------------------------------------------------------------
+
+#include "Terrain.h"
+#include "Constants.h"
+#include "Object.h"
+#include "Profiler.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cstdint>
+
+namespace
+{
+  const uint32_t SEED = 7;
+  const int HILL_OCTAVES = 5;
+  const float HILL_HEIGHT = 90.0f;              ///< Highest procedural hill above the base height
+  const float HILL_WAVELENGTH = 300.0f;         ///< Size of the largest hills
+  const float BLEND_DISTANCE = 150.0f;          ///< Hills grow from zero over this distance around the floor mesh
+
+  float hash(int x, int z)
+  {
+    uint32_t h = (uint32_t)x * 374761393u + (uint32_t)z * 668265263u + SEED * 2246822519u;
+    h = (h ^ (h >> 13)) * 1274126177u;
+    h ^= h >> 16;
+    return (h & 0xFFFFFF) / 16777215.0f;
+  }
+
+  /// Smoothly interpolated lattice of random values in [0, 1]
+  float valueNoise(float x, float z)
+  {
+    int x0 = (int)floorf(x);
+    int z0 = (int)floorf(z);
+    float fx = x - x0;
+    float fz = z - z0;
+    fx = fx * fx * (3.0f - 2.0f * fx);
+    fz = fz * fz * (3.0f - 2.0f * fz);
+
+    float top = hash(x0, z0) + (hash(x0 + 1, z0) - hash(x0, z0)) * fx;
+    float bottom = hash(x0, z0 + 1) + (hash(x0 + 1, z0 + 1) - hash(x0, z0 + 1)) * fx;
+    return top + (bottom - top) * fz;
+  }
+
+  float smoothstep(float edge0, float edge1, float x)
+  {
+    float t = std::min(std::max((x - edge0) / (edge1 - edge0), 0.0f), 1.0f);
+    return t * t * (3.0f - 2.0f * t);
+  }
+
+  bool intersectsSphere(const glm::vec3& boxMin, const glm::vec3& boxMax, const glm::vec3& center, float radius)
+  {
+    glm::vec3 closest = glm::min(glm::max(center, boxMin), boxMax);
+    glm::vec3 offset = closest - center;
+    return glm::dot(offset, offset) <= radius * radius;
+  }
+}
+
+Terrain::Terrain()
+  : resolution(terrainResolution), size(terrainSize)
+{
+  spacing = size / (resolution - 1);
+}
+
+void Terrain::build(const std::string& floorMeshPath)
+{
+  PROFILE_CPU_SCOPE("Terrain::build");
+
+  heights.assign(resolution * resolution, 0.0f);
+  std::vector<unsigned char> baked(resolution * resolution, 0);
+
+  std::vector<float> vertices;
+  if (!floorMeshPath.empty())
+    Object::readMesh(floorMeshPath, vertices);
+
+  float origin = -size * 0.5f;
+  glm::vec2 bakedMin(0.0f), bakedMax(0.0f);
+  float baseHeight = 0.0f;
+  bool hasMesh = vertices.size() >= 24;
+
+  if (hasMesh)
+  {
+    bakeMesh(vertices, baked);
+
+    bakedMin = bakedMax = glm::vec2(vertices[0], vertices[2]);
+    baseHeight = vertices[1];
+    for (size_t i = 0; i < vertices.size(); i += 8)
+    {
+      bakedMin = glm::min(bakedMin, glm::vec2(vertices[i], vertices[i + 2]));
+      bakedMax = glm::max(bakedMax, glm::vec2(vertices[i], vertices[i + 2]));
+      baseHeight = std::min(baseHeight, vertices[i + 1]);
+    }
+  }
+
+  /// Outside the floor mesh the terrain starts at its lowest point and rises into hills
+  for (int z = 0; z < resolution; z++)
+  {
+    for (int x = 0; x < resolution; x++)
+    {
+      int i = z * resolution + x;
+      if (baked[i])
+        continue;
+
+      glm::vec2 position(origin + x * spacing, origin + z * spacing);
+      float blend = 1.0f;
+      if (hasMesh)
+      {
+        glm::vec2 outside = glm::max(glm::max(bakedMin - position, position - bakedMax), glm::vec2(0.0f));
+        blend = smoothstep(0.0f, BLEND_DISTANCE, sqrtf(glm::dot(outside, outside)));
+      }
+
+      heights[i] = baseHeight + hills(position.x, position.y) * blend;
+    }
+  }
+
+  buildLevels();
+}
+
+/// Rasterize the triangles of the mesh from above, keeping the highest surface of every sample
+void Terrain::bakeMesh(const std::vector<float>& vertices, std::vector<unsigned char>& baked)
+{
+  float origin = -size * 0.5f;
+
+  for (size_t t = 0; t + 24 <= vertices.size(); t += 24)
+  {
+    glm::vec3 p[3];
+    for (int k = 0; k < 3; k++)
+      p[k] = glm::vec3((vertices[t + k * 8] - origin) / spacing, vertices[t + k * 8 + 1], (vertices[t + k * 8 + 2] - origin) / spacing);
+
+    float area = (p[1].x - p[0].x) * (p[2].z - p[0].z) - (p[2].x - p[0].x) * (p[1].z - p[0].z);
+    if (fabsf(area) < 1e-12f)
+      continue;
+
+    int minX = std::max(0, (int)ceilf(std::min(p[0].x, std::min(p[1].x, p[2].x))));
+    int maxX = std::min(resolution - 1, (int)floorf(std::max(p[0].x, std::max(p[1].x, p[2].x))));
+    int minZ = std::max(0, (int)ceilf(std::min(p[0].z, std::min(p[1].z, p[2].z))));
+    int maxZ = std::min(resolution - 1, (int)floorf(std::max(p[0].z, std::max(p[1].z, p[2].z))));
+
+    for (int z = minZ; z <= maxZ; z++)
+    {
+      for (int x = minX; x <= maxX; x++)
+      {
+        float b1 = ((x - p[0].x) * (p[2].z - p[0].z) - (p[2].x - p[0].x) * (z - p[0].z)) / area;
+        float b2 = ((p[1].x - p[0].x) * (z - p[0].z) - (x - p[0].x) * (p[1].z - p[0].z)) / area;
+        float b0 = 1.0f - b1 - b2;
+        if (b0 < -1e-4f || b1 < -1e-4f || b2 < -1e-4f)
+          continue;
+
+        float height = b0 * p[0].y + b1 * p[1].y + b2 * p[2].y;
+        int i = z * resolution + x;
+        if (!baked[i] || height > heights[i])
+          heights[i] = height;
+        baked[i] = 1;
+      }
+    }
+  }
+}
+
+/// Height ranges of the quadtree, a leaf node covers two patches per side
+void Terrain::buildLevels()
+{
+  int cellsPerLeaf = 2 * PATCH_QUADS;
+  int leafNodes = (resolution - 1) / cellsPerLeaf;
+
+  levels.clear();
+  levelCount = 0;
+  for (int nodes = leafNodes; nodes >= 1 && levelCount < RenderDevice::MAX_TERRAIN_LEVELS; nodes /= 2)
+  {
+    Level level;
+    level.nodesPerSide = nodes;
+    level.nodeSize = size / nodes;
+    level.heightRange.resize(nodes * nodes);
+    levels.push_back(level);
+    levelCount++;
+  }
+
+  Level& leaves = levels[0];
+  for (int nodeZ = 0; nodeZ < leafNodes; nodeZ++)
+  {
+    for (int nodeX = 0; nodeX < leafNodes; nodeX++)
+    {
+      glm::vec2 range(heights[nodeZ * cellsPerLeaf * resolution + nodeX * cellsPerLeaf]);
+      for (int z = nodeZ * cellsPerLeaf; z <= (nodeZ + 1) * cellsPerLeaf; z++)
+      {
+        for (int x = nodeX * cellsPerLeaf; x <= (nodeX + 1) * cellsPerLeaf; x++)
+        {
+          range.x = std::min(range.x, heights[z * resolution + x]);
+          range.y = std::max(range.y, heights[z * resolution + x]);
+        }
+      }
+      leaves.heightRange[nodeZ * leafNodes + nodeX] = range;
+    }
+  }
+
+  for (int l = 1; l < levelCount; l++)
+  {
+    const Level& children = levels[l - 1];
+    Level& parents = levels[l];
+    for (int z = 0; z < parents.nodesPerSide; z++)
+    {
+      for (int x = 0; x < parents.nodesPerSide; x++)
+      {
+        glm::vec2 range = children.heightRange[(z * 2) * children.nodesPerSide + x * 2];
+        for (int q = 1; q < 4; q++)
+        {
+          const glm::vec2& child = children.heightRange[(z * 2 + (q >> 1)) * children.nodesPerSide + x * 2 + (q & 1)];
+          range = glm::vec2(std::min(range.x, child.x), std::max(range.y, child.y));
+        }
+        parents.heightRange[z * parents.nodesPerSide + x] = range;
+      }
+    }
+  }
+
+  /// Ranges double per level, each level morphs into the next over the end of its range
+  ranges.resize(levelCount);
+  call.morphRanges.resize(levelCount);
+  for (int l = 0; l < levelCount; l++)
+  {
+    ranges[l] = terrainLodRange * (float)(1 << l);
+    float previous = l > 0 ? ranges[l - 1] : 0.0f;
+    call.morphRanges[l] = glm::vec2(previous + (ranges[l] - previous) * MORPH_START, ranges[l]);
+  }
+}
+
+void Terrain::init(RenderDevice& renderDevice, AssetCache& assets)
+{
+  release();
+  device = &renderDevice;
+
+  std::vector<float> vertices = patchMesh();
+  mesh = assets.acquireMesh(renderDevice, vertices, "terrain");
+  texture = assets.acquireTexture(renderDevice, terrainTexturePath);
+
+  /// Height and the normal from central differences
+  std::vector<float> texels(resolution * resolution * 4);
+  for (int z = 0; z < resolution; z++)
+  {
+    for (int x = 0; x < resolution; x++)
+    {
+      glm::vec3 normal = glm::normalize(glm::vec3(sample(x - 1, z) - sample(x + 1, z), 2.0f * spacing, sample(x, z - 1) - sample(x, z + 1)));
+      float* texel = &texels[(z * resolution + x) * 4];
+      texel[0] = sample(x, z);
+      texel[1] = normal.x;
+      texel[2] = normal.y;
+      texel[3] = normal.z;
+    }
+  }
+
+  heightMap = renderDevice.createDataTexture(resolution, resolution);
+  renderDevice.updateDataTexture(heightMap, texels.data());
+
+  /// Sample centers sit on the grid points
+  float scale = 1.0f / (spacing * resolution);
+  float offset = 0.5f / resolution + size * 0.5f * scale;
+
+  call.mesh = mesh.get();
+  call.texture = texture.get();
+  call.heightMap = heightMap;
+  call.vertexCount = (int)(vertices.size() / 8);
+  call.patchQuads = PATCH_QUADS;
+  call.heightMapTransform = glm::vec4(scale, offset, offset, 1.0f / terrainTextureRepeat);
+
+  buildOccluder();
+}
+
+void Terrain::release()
+{
+  mesh.reset();
+  texture.reset();
+
+  if (device != nullptr && heightMap != 0)
+    device->destroyTexture(heightMap);
+
+  heightMap = 0;
+  device = nullptr;
+}
+
+void Terrain::addCutout(const glm::vec3& boxMin, const glm::vec3& boxMax)
+{
+  if ((int)call.cutouts.size() / 2 >= RenderDevice::MAX_TERRAIN_CUTOUTS)
+    return;
+
+  call.cutouts.push_back(boxMin);
+  call.cutouts.push_back(boxMax);
+}
+
+bool Terrain::isCutOut(const glm::vec3& position) const
+{
+  for (size_t i = 0; i + 1 < call.cutouts.size(); i += 2)
+  {
+    const glm::vec3& boxMin = call.cutouts[i];
+    const glm::vec3& boxMax = call.cutouts[i + 1];
+    if (position.x >= boxMin.x && position.y >= boxMin.y && position.z >= boxMin.z &&
+        position.x <= boxMax.x && position.y <= boxMax.y && position.z <= boxMax.z)
+      return true;
+  }
+  return false;
+}
+
+void Terrain::selectPatches(const RenderDevice::CameraParams& camera)
+{
+  selectPatches(std::vector<RenderDevice::CameraParams>(1, camera));
+}
+
+void Terrain::selectPatches(const std::vector<RenderDevice::CameraParams>& views)
+{
+  PROFILE_CPU_SCOPE("Terrain::selectPatches");
+
+  frustums.clear();
+  eyes.clear();
+  for (const RenderDevice::CameraParams& view : views)
+  {
+    /// Planes of the clip volume, Gribb and Hartmann
+    const glm::mat4& m = view.viewProjection;
+    for (int i = 0; i < 3; i++)
+    {
+      glm::vec4 row(m[0][i], m[1][i], m[2][i], m[3][i]);
+      glm::vec4 w(m[0][3], m[1][3], m[2][3], m[3][3]);
+      frustums.push_back(w + row);
+      frustums.push_back(w - row);
+    }
+    eyes.push_back(view.eyePosition);
+  }
+
+  call.patches.clear();
+
+  const Level& top = levels[levelCount - 1];
+  for (int z = 0; z < top.nodesPerSide; z++)
+    for (int x = 0; x < top.nodesPerSide; x++)
+      if (!select(levelCount - 1, x, z))
+        addPatches(levelCount - 1, x, z, 15);
+
+  Profiler::counter("terrain patches", (double)call.patches.size());
+}
+
+void Terrain::draw(RenderDevice& renderDevice, int objectId)
+{
+  PROFILE_GPU_SCOPE("Terrain::draw");
+
+  call.objectId = objectId;
+  if (!call.patches.empty())
+    renderDevice.drawTerrain(call);
+}
+
+void Terrain::requestTextures(RenderDevice& renderDevice, const RenderDevice::CameraParams& camera) const
+{
+  if (!texture)
+    return;
+
+  const glm::vec3& eye = camera.eyePosition;
+  float distance = std::max(eye.y - heightAt(eye.x, eye.z), 0.1f);
+  renderDevice.requestTextureDetail(texture.get(), camera.viewHeightAt(distance) / terrainTextureRepeat);
+}
+
+/// Returns false when the node is out of its LOD range and the parent has to cover it
+bool Terrain::select(int level, int x, int z)
+{
+  glm::vec3 boxMin = nodeMin(level, x, z);
+  glm::vec3 boxMax = nodeMax(level, x, z);
+
+  if (!inRange(boxMin, boxMax, ranges[level]))
+    return false;
+
+  if (!inFrustum(boxMin, boxMax))
+    return true;
+
+  if (level == 0 || !inRange(boxMin, boxMax, ranges[level - 1]))
+  {
+    addPatches(level, x, z, 15);
+    return true;
+  }
+
+  int quadrants = 0;
+  for (int q = 0; q < 4; q++)
+    if (!select(level - 1, x * 2 + (q & 1), z * 2 + (q >> 1)))
+      quadrants |= 1 << q;
+
+  if (quadrants != 0)
+    addPatches(level, x, z, quadrants);
+
+  return true;
+}
+
+/// One patch per quadrant in the mask, bit 0 is the -x -z corner
+void Terrain::addPatches(int level, int x, int z, int quadrants)
+{
+  float half = levels[level].nodeSize * 0.5f;
+  glm::vec3 corner = nodeMin(level, x, z);
+
+  for (int q = 0; q < 4; q++)
+  {
+    if (!(quadrants & (1 << q)))
+      continue;
+
+    /// Quadrants of a leaf share its height range, coarser ones have the range of their child
+    if (level > 0 && !inFrustum(nodeMin(level - 1, x * 2 + (q & 1), z * 2 + (q >> 1)), nodeMax(level - 1, x * 2 + (q & 1), z * 2 + (q >> 1))))
+      continue;
+
+    glm::vec2 origin(corner.x + (q & 1) * half, corner.z + (q >> 1) * half);
+
+    call.patches.push_back(glm::vec4(origin.x, origin.y, half, (float)level));
+  }
+}
+
+glm::vec3 Terrain::nodeMin(int level, int x, int z) const
+{
+  const Level& l = levels[level];
+  return glm::vec3(-size * 0.5f + x * l.nodeSize, l.heightRange[z * l.nodesPerSide + x].x, -size * 0.5f + z * l.nodeSize);
+}
+
+glm::vec3 Terrain::nodeMax(int level, int x, int z) const
+{
+  const Level& l = levels[level];
+  return glm::vec3(-size * 0.5f + (x + 1) * l.nodeSize, l.heightRange[z * l.nodesPerSide + x].y, -size * 0.5f + (z + 1) * l.nodeSize);
+}
+
+bool Terrain::inRange(const glm::vec3& boxMin, const glm::vec3& boxMax, float range) const
+{
+  for (const glm::vec3& eye : eyes)
+    if (intersectsSphere(boxMin, boxMax, eye, range))
+      return true;
+  return false;
+}
+
+/// Inside the frustum of any view
+bool Terrain::inFrustum(const glm::vec3& boxMin, const glm::vec3& boxMax) const
+{
+  for (size_t view = 0; view < frustums.size(); view += 6)
+  {
+    bool inside = true;
+    for (size_t i = view; i < view + 6 && inside; i++)
+    {
+      const glm::vec4& plane = frustums[i];
+      glm::vec3 corner(plane.x > 0.0f ? boxMax.x : boxMin.x, plane.y > 0.0f ? boxMax.y : boxMin.y, plane.z > 0.0f ? boxMax.z : boxMin.z);
+      inside = plane.x * corner.x + plane.y * corner.y + plane.z * corner.z + plane.w >= 0.0f;
+    }
+    if (inside)
+      return true;
+  }
+  return false;
+}
+
+float Terrain::heightAt(float x, float z) const
+{
+  float gx = std::min(std::max((x + size * 0.5f) / spacing, 0.0f), (float)(resolution - 1));
+  float gz = std::min(std::max((z + size * 0.5f) / spacing, 0.0f), (float)(resolution - 1));
+
+  int x0 = std::min((int)gx, resolution - 2);
+  int z0 = std::min((int)gz, resolution - 2);
+  float fx = gx - x0;
+  float fz = gz - z0;
+
+  float top = sample(x0, z0) + (sample(x0 + 1, z0) - sample(x0, z0)) * fx;
+  float bottom = sample(x0, z0 + 1) + (sample(x0 + 1, z0 + 1) - sample(x0, z0 + 1)) * fx;
+  return top + (bottom - top) * fz;
+}
+
+void Terrain::buildOccluder()
+{
+  PROFILE_CPU_SCOPE("Terrain::buildOccluder");
+
+  occluderTriangles.clear();
+  int cells = (resolution - 1) / OCCLUDER_STEP;
+
+  /// Every vertex takes the lowest sample of the cells around it, so the coarse surface stays under the terrain
+  std::vector<float> lowest((cells + 1) * (cells + 1));
+  for (int z = 0; z <= cells; z++)
+    for (int x = 0; x <= cells; x++)
+      lowest[z * (cells + 1) + x] = lowestSample((x - 1) * OCCLUDER_STEP, (z - 1) * OCCLUDER_STEP, (x + 1) * OCCLUDER_STEP, (z + 1) * OCCLUDER_STEP);
+
+  for (int z = 0; z < cells; z++)
+  {
+    for (int x = 0; x < cells; x++)
+    {
+      int x0 = x * OCCLUDER_STEP, z0 = z * OCCLUDER_STEP;
+      int x1 = x0 + OCCLUDER_STEP, z1 = z0 + OCCLUDER_STEP;
+      float cutoutBottom;
+
+      if (!overlapsCutout(x0, z0, x1, z1, cutoutBottom))
+      {
+        const float corners[4] = { lowest[z * (cells + 1) + x], lowest[z * (cells + 1) + x + 1],
+                                   lowest[(z + 1) * (cells + 1) + x], lowest[(z + 1) * (cells + 1) + x + 1] };
+        addOccluderQuad(x0, z0, x1, z1, corners);
+        continue;
+      }
+
+      /// Around a cutout the cell is split into single samples, those under the box drop below it
+      for (int fz = z0; fz < z1; fz++)
+      {
+        for (int fx = x0; fx < x1; fx++)
+        {
+          float corners[4] = { lowestSample(fx - 1, fz - 1, fx + 1, fz + 1), lowestSample(fx, fz - 1, fx + 2, fz + 1),
+                               lowestSample(fx - 1, fz, fx + 1, fz + 2), lowestSample(fx, fz, fx + 2, fz + 2) };
+
+          if (overlapsCutout(fx, fz, fx + 1, fz + 1, cutoutBottom))
+            for (float& corner : corners)
+              corner = std::min(corner, cutoutBottom);
+
+          addOccluderQuad(fx, fz, fx + 1, fz + 1, corners);
+        }
+      }
+    }
+  }
+}
+
+float Terrain::lowestSample(int x0, int z0, int x1, int z1) const
+{
+  float lowest = sample(x0, z0);
+  for (int z = z0; z <= z1; z++)
+    for (int x = x0; x <= x1; x++)
+      lowest = std::min(lowest, sample(x, z));
+  return lowest;
+}
+
+void Terrain::addOccluderQuad(int x0, int z0, int x1, int z1, const float corners[4])
+{
+  float half = size * 0.5f;
+  glm::vec3 p00(x0 * spacing - half, corners[0], z0 * spacing - half);
+  glm::vec3 p10(x1 * spacing - half, corners[1], z0 * spacing - half);
+  glm::vec3 p01(x0 * spacing - half, corners[2], z1 * spacing - half);
+  glm::vec3 p11(x1 * spacing - half, corners[3], z1 * spacing - half);
+
+  const glm::vec3 quad[6] = { p00, p01, p10, p10, p01, p11 };
+  occluderTriangles.insert(occluderTriangles.end(), quad, quad + 6);
+}
+
+bool Terrain::overlapsCutout(int x0, int z0, int x1, int z1, float& cutoutBottom) const
+{
+  float half = size * 0.5f;
+  bool overlaps = false;
+  cutoutBottom = FLT_MAX;
+
+  for (size_t i = 0; i + 1 < call.cutouts.size(); i += 2)
+  {
+    const glm::vec3& boxMin = call.cutouts[i];
+    const glm::vec3& boxMax = call.cutouts[i + 1];
+    if (x1 * spacing - half < boxMin.x || x0 * spacing - half > boxMax.x ||
+        z1 * spacing - half < boxMin.z || z0 * spacing - half > boxMax.z)
+      continue;
+
+    overlaps = true;
+    cutoutBottom = std::min(cutoutBottom, boxMin.y);
+  }
+  return overlaps;
+}
+
+size_t Terrain::getCpuBytes() const
+{
+  size_t bytes = sizeof(Terrain) + heights.capacity() * sizeof(float) + occluderTriangles.capacity() * sizeof(glm::vec3);
+  for (const Level& level : levels)
+    bytes += level.heightRange.capacity() * sizeof(glm::vec2);
+  return bytes;
+}
+
+size_t Terrain::getGpuBytes() const
+{
+  return mesh.getBytes() + texture.getBytes() + (heightMap != 0 ? (size_t)resolution * resolution * 4 * sizeof(float) : 0);
+}
+
+float Terrain::sample(int x, int z) const
+{
+  x = std::min(std::max(x, 0), resolution - 1);
+  z = std::min(std::max(z, 0), resolution - 1);
+  return heights[z * resolution + x];
+}
+
+/// Unit square on XZ, counter-clockwise seen from above, uv equal to the position
+std::vector<float> Terrain::patchMesh()
+{
+  std::vector<float> vertices;
+  vertices.reserve(PATCH_QUADS * PATCH_QUADS * 6 * 8);
+
+  const int corners[6][2] = { { 0, 0 }, { 0, 1 }, { 1, 1 }, { 0, 0 }, { 1, 1 }, { 1, 0 } };
+
+  for (int z = 0; z < PATCH_QUADS; z++)
+  {
+    for (int x = 0; x < PATCH_QUADS; x++)
+    {
+      for (const auto& corner : corners)
+      {
+        float u = (float)(x + corner[0]) / PATCH_QUADS;
+        float v = (float)(z + corner[1]) / PATCH_QUADS;
+        float vertex[8] = { u, 0.0f, v, u, v, 0.0f, 1.0f, 0.0f };
+        vertices.insert(vertices.end(), vertex, vertex + 8);
+      }
+    }
+  }
+
+  return vertices;
+}
+
+/// Fractal value noise in [0, HILL_HEIGHT]
+float Terrain::hills(float x, float z)
+{
+  float value = 0.0f;
+  float amplitude = 0.5f;
+  float frequency = 1.0f / HILL_WAVELENGTH;
+
+  for (int octave = 0; octave < HILL_OCTAVES; octave++)
+  {
+    value += valueNoise(x * frequency, z * frequency) * amplitude;
+    amplitude *= 0.5f;
+    frequency *= 2.0f;
+  }
+
+  return value * HILL_HEIGHT;
+}
@@ -0,0 +1,112 @@
+//----------------------------------------------------------------------------------------
+/**
+ * \file       Terrain.h
+ * \author     Bogdan Putintsev
+ * \date       2021/05/13
+ * \brief      Heightmap terrain rendered with continuous distance-dependent LOD (CDLOD)
+ *
+ *  The height map is baked from the island floor mesh and continued with procedural hills
+ *  around it. A quadtree over the map keeps the height range of every node. Each frame the
+ *  nodes inside the view frustum are selected by distance: a node is split while it lies in
+ *  the LOD range of the finer level, and every selected node is drawn as up to four
+ *  instances of one shared patch mesh. The vertex shader displaces the patch with the
+ *  height map and morphs odd vertices onto the coarser grid towards the end of each range,
+ *  so levels meet without cracks or popping.
+ *
+*/
+//----------------------------------------------------------------------------------------
+
+#pragma once
+#include "AssetCache.h"
+
+class Terrain
+{
+public:
+  static const int PATCH_QUADS = 16;            ///< Quads per side of the patch mesh, a node is drawn as four patches
+  static constexpr float MORPH_START = 0.7f;    ///< Fraction of a LOD range where morphing starts
+  static const int OCCLUDER_STEP = 16;          ///< Height map samples per cell of the occluder grid
+
+  Terrain();
+
+  /// Bake the height map, floorMeshPath may be empty or missing for purely procedural terrain
+  void build(const std::string& floorMeshPath);
+
+  /// Upload the patch mesh, the height map and the texture
+  void init(RenderDevice& device, AssetCache& assets);
+  void release();
+
+  /// Select the patches visible from the camera
+  void selectPatches(const RenderDevice::CameraParams& camera);
+  /// One selection for several views: the union of their frusta, each node refined for the
+  /// nearest eye. Every view morphs with its own eye, which is never nearer, so no cracks open.
+  void selectPatches(const std::vector<RenderDevice::CameraParams>& views);
+  /// Draw the patches of the last selection
+  void draw(RenderDevice& device, int objectId);
+  /// Ask for the texture mips the ground under the eye needs, the nearest terrain the view can see
+  void requestTextures(RenderDevice& device, const RenderDevice::CameraParams& camera) const;
+
+  /// Do not draw the terrain inside the box, for openings the height map cannot represent
+  void addCutout(const glm::vec3& boxMin, const glm::vec3& boxMax);
+
+  /// Whether the position lies inside one of the cutout boxes
+  bool isCutOut(const glm::vec3& position) const;
+
+  /// Bilinear height at a world position, clamped to the edge of the map
+  float heightAt(float x, float z) const;
+
+  /// World-space triangles lying under the terrain, for the occlusion culler. Built in init, the
+  /// cells around the cutouts are refined and lowered under the cutout boxes.
+  const std::vector<glm::vec3>& getOccluderTriangles() const { return occluderTriangles; }
+
+  float getSize() const { return size; }
+  int getLevelCount() const { return levelCount; }
+  int getLastPatchCount() const { return (int)call.patches.size(); }
+  size_t getCpuBytes() const;
+  size_t getGpuBytes() const;
+
+private:
+  /// Lowest and highest height inside every node of a level, nodes in rows
+  struct Level
+  {
+    int nodesPerSide = 0;
+    float nodeSize = 0.0f;
+    std::vector<glm::vec2> heightRange;
+  };
+
+  int resolution;                               ///< Height map samples per side
+  float size;                                   ///< World size of the map, centered on the origin
+  float spacing;                                ///< World distance between samples
+  std::vector<float> heights;
+
+  int levelCount = 0;
+  std::vector<Level> levels;                    ///< Level 0 has the smallest nodes
+  std::vector<float> ranges;                    ///< LOD range of each level
+
+  RenderDevice* device = nullptr;
+  AssetCache::Reference mesh;
+  AssetCache::Reference texture;
+  RenderDevice::Handle heightMap = 0;
+  RenderDevice::TerrainCall call;
+
+  std::vector<glm::vec4> frustums;              ///< Six clip planes per view
+  std::vector<glm::vec3> eyes;
+  std::vector<glm::vec3> occluderTriangles;
+
+  void bakeMesh(const std::vector<float>& vertices, std::vector<unsigned char>& baked);
+  void buildLevels();
+  void buildOccluder();
+  float lowestSample(int x0, int z0, int x1, int z1) const;
+  void addOccluderQuad(int x0, int z0, int x1, int z1, const float corners[4]);
+  bool overlapsCutout(int x0, int z0, int x1, int z1, float& cutoutBottom) const;
+
+  bool select(int level, int x, int z);
+  bool inRange(const glm::vec3& boxMin, const glm::vec3& boxMax, float range) const;
+  void addPatches(int level, int x, int z, int quadrants);
+  glm::vec3 nodeMin(int level, int x, int z) const;
+  glm::vec3 nodeMax(int level, int x, int z) const;
+  bool inFrustum(const glm::vec3& boxMin, const glm::vec3& boxMax) const;
+
+  float sample(int x, int z) const;
+  static std::vector<float> patchMesh();
+  static float hills(float x, float z);
+};
@@ -0,0 +1,558 @@
+//----------------------------------------------------------------------------------------
+/**
+ * \file       TextureStreamer.cpp
+ * \author     Bogdan Putintsev
+ * \date       2021/05/13
+ * \brief      Mip streaming of file textures under a video memory budget
+ *
+*/
+//----------------------------------------------------------------------------------------
+
+#include "TextureStreamer.h"
+#include "Constants.h"
+#include "GLDebug.h"
+#include "GLState.h"
+#include "Profiler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+#include <IL/il.h>
+
+namespace
+{
+  /// DevIL keeps the bound image in global state, the main and the loader thread take turns
+  std::mutex imageMutex;
+
+  int levelSize(int size, int level)
+  {
+    return std::max(1, size >> level);
+  }
+}
+
+TextureStreamer::TextureStreamer()
+{
+  stats.budgetBytes = (size_t)textureBudgetMB << 20;
+}
+
+TextureStreamer::~TextureStreamer()
+{
+  if (!loader.joinable())
+    return;
+
+  {
+    std::lock_guard<std::mutex> lock(queueMutex);
+    stopLoader = true;
+  }
+  queueWake.notify_all();
+  loader.join();
+}
+
+void TextureStreamer::init()
+{
+  GL_DEBUG_SCOPE();
+
+  {
+    std::lock_guard<std::mutex> lock(imageMutex);
+    ilInit();
+    ilEnable(IL_ORIGIN_SET);
+    ilOriginFunc(IL_ORIGIN_LOWER_LEFT);
+  }
+
+  for (UploadBuffer& upload : uploadBuffers)
+  {
+    glGenBuffers(1, &upload.buffer);
+    GL_LABEL(GL_BUFFER, upload.buffer, "texture upload");
+  }
+
+  if (!loader.joinable())
+  {
+    stopLoader = false;
+    loader = std::thread(&TextureStreamer::loaderLoop, this);
+  }
+}
+
+void TextureStreamer::release()
+{
+  if (loader.joinable())
+  {
+    {
+      std::lock_guard<std::mutex> lock(queueMutex);
+      stopLoader = true;
+    }
+    queueWake.notify_all();
+    loader.join();
+  }
+
+  requests.clear();
+  completed.clear();
+  stats.requestsInFlight = 0;
+
+  for (UploadBuffer& upload : uploadBuffers)
+  {
+    if (upload.fence != 0)
+      glDeleteSync(upload.fence);
+    if (upload.buffer != 0)
+      glDeleteBuffers(1, &upload.buffer);
+    upload = UploadBuffer();
+  }
+}
+
+GLuint TextureStreamer::create(const std::string& path, const std::vector<unsigned char>& content)
+{
+  GL_DEBUG_SCOPE();
+
+  int width = 0, height = 0;
+  std::vector<uint32_t> pixels;
+  if (!decode(path, &content, width, height, pixels))
+    return 0;
+
+  Texture texture;
+  texture.id = nextId++;
+  texture.path = path;
+  texture.width = width;
+  texture.height = height;
+  texture.levels = 1;
+  while ((std::max(width, height) >> texture.levels) > 0)
+    texture.levels++;
+
+  texture.permanentLevel = 0;
+  while (std::max(levelSize(width, texture.permanentLevel), levelSize(height, texture.permanentLevel)) > RESIDENT_SIZE)
+    texture.permanentLevel++;
+  texture.residentLevel = texture.permanentLevel;
+  texture.wantedLevel = texture.neededLevel = texture.permanentLevel;
+
+  GLuint name = 0;
+  glGenTextures(1, &name);
+  GLState::activeTexture(GL_TEXTURE0);
+  GLState::bindTexture(GL_TEXTURE_2D, name);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, texture.residentLevel);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, texture.levels - 1);
+
+  /// The finer mips are only needed to filter down to the permanent ones
+  std::vector<uint32_t> smaller;
+  for (int level = 0; level < texture.levels; level++)
+  {
+    if (level > 0)
+    {
+      downsample(pixels, levelSize(width, level - 1), levelSize(height, level - 1), smaller);
+      pixels.swap(smaller);
+    }
+
+    if (level >= texture.permanentLevel)
+      glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, levelSize(width, level), levelSize(height, level), 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+  }
+
+  GL_LABEL(GL_TEXTURE, name, path);
+
+  textures[name] = texture;
+  stats.residentBytes += getBytes(name);
+  return name;
+}
+
+void TextureStreamer::destroy(GLuint name)
+{
+  auto found = textures.find(name);
+  if (found == textures.end())
+    return;
+
+  size_t bytes = getBytes(name);
+  stats.residentBytes -= bytes;
+  stats.streamedBytes -= bytes - levelBytes(found->second, found->second.permanentLevel);
+  textures.erase(found);
+}
+
+size_t TextureStreamer::getBytes(GLuint name) const
+{
+  auto found = textures.find(name);
+  if (found == textures.end())
+    return 0;
+
+  return levelBytes(found->second, found->second.residentLevel);
+}
+
+void TextureStreamer::request(GLuint name, float uvPerViewHeight, int viewHeight)
+{
+  auto found = textures.find(name);
+  if (found == textures.end() || viewHeight <= 0)
+    return;
+
+  Texture& texture = found->second;
+  float texelsPerPixel = uvPerViewHeight * std::max(texture.width, texture.height) / viewHeight;
+  int level = texelsPerPixel > 1.0f ? (int)std::floor(std::log2(texelsPerPixel)) : 0;
+
+  texture.wantedLevel = std::min(texture.wantedLevel, std::min(level, texture.permanentLevel));
+  texture.lastRequestFrame = frame;
+}
+
+bool TextureStreamer::update()
+{
+  PROFILE_CPU_SCOPE("TextureStreamer::update");
+  GL_DEBUG_SCOPE();
+
+  frame++;
+  overBudget = false;
+  uint64_t uploads = stats.uploads;
+  uint64_t drops = stats.drops;
+
+  for (auto& entry : textures)
+  {
+    entry.second.neededLevel = entry.second.wantedLevel;
+    entry.second.wantedLevel = entry.second.permanentLevel;
+  }
+
+  /// Decoded mips go up until the frame's upload budget or the ring runs out
+  stats.uploadedBytes = 0;
+  uploadCompleted();
+  dropOverBudget();
+  queueRequests();
+  if (synchronous)
+    uploadCompleted();
+  if (overBudget)
+    stats.overBudgetFrames++;
+
+  Profiler::counter("texture resident MB", stats.residentBytes / 1048576.0);
+  Profiler::counter("texture streamed MB", stats.streamedBytes / 1048576.0);
+  Profiler::counter("texture upload KB", stats.uploadedBytes / 1024.0);
+  Profiler::counter("texture requests in flight", (double)stats.requestsInFlight);
+
+  return stats.uploads != uploads || stats.drops != drops;
+}
+
+void TextureStreamer::printResidency() const
+{
+  std::vector<std::pair<std::string, GLuint>> sorted;
+  for (const auto& entry : textures)
+    sorted.push_back(std::make_pair(entry.second.path, entry.first));
+  std::sort(sorted.begin(), sorted.end());
+
+  std::cout << "Texture residency: " << stats.residentBytes / 1048576.0 << " MB resident, " << stats.streamedBytes / 1048576.0 << " of "
+            << stats.budgetBytes / 1048576.0 << " MB streamed, " << stats.requestsInFlight << " requests in flight, " << stats.uploads
+            << " uploads, " << stats.drops << " drops, " << stats.overBudgetFrames << " frames over budget" << std::endl;
+
+  for (const auto& entry : sorted)
+  {
+    const Texture& texture = textures.at(entry.second);
+    std::cout << "  " << texture.path << ": " << texture.width << "x" << texture.height << ", resident mip " << texture.residentLevel << " ("
+              << levelSize(texture.width, texture.residentLevel) << "x" << levelSize(texture.height, texture.residentLevel) << "), needed mip "
+              << texture.neededLevel << ", " << levelBytes(texture, texture.residentLevel) / 1024 << " of " << levelBytes(texture, 0) / 1024 << " KB"
+              << (texture.loading ? ", loading" : "") << std::endl;
+  }
+}
+
+void TextureStreamer::uploadCompleted()
+{
+  while (synchronous || stats.uploadedBytes < UPLOAD_BYTES)
+  {
+    std::unique_lock<std::mutex> lock(queueMutex);
+    if (completed.empty())
+      break;
+    Job& job = completed.front();
+    lock.unlock();
+
+    auto found = textures.find(job.texture);
+    bool current = found != textures.end() && found->second.id == job.id;
+
+    if (current && found->second.residentLevel > job.firstLevel && !job.pixels.empty())
+    {
+      if (!uploadLevel(job, found->second))
+        break;
+      continue;
+    }
+
+    /// A file that cannot be decoded keeps its permanent mips
+    if (current)
+    {
+      found->second.loading = false;
+      found->second.failed = job.pixels.empty();
+    }
+    stats.requestsInFlight--;
+
+    lock.lock();
+    completed.pop_front();
+  }
+}
+
+void TextureStreamer::loaderLoop()
+{
+  while (true)
+  {
+    Job job;
+    {
+      std::unique_lock<std::mutex> lock(queueMutex);
+      queueWake.wait(lock, [this] { return stopLoader || !requests.empty(); });
+      if (stopLoader)
+        return;
+
+      job = std::move(requests.front());
+      requests.pop_front();
+    }
+
+    decodeJob(job);
+
+    std::lock_guard<std::mutex> lock(queueMutex);
+    completed.push_back(std::move(job));
+  }
+}
+
+bool TextureStreamer::uploadLevel(Job& job, Texture& texture)
+{
+  UploadBuffer& upload = uploadBuffers[nextUploadBuffer];
+  if (upload.fence != 0)
+  {
+    GLuint64 timeout = synchronous ? GL_TIMEOUT_IGNORED : 0;
+    if (glClientWaitSync(upload.fence, synchronous ? GL_SYNC_FLUSH_COMMANDS_BIT : 0, timeout) == GL_TIMEOUT_EXPIRED)
+      return false;
+    glDeleteSync(upload.fence);
+    upload.fence = 0;
+  }
+
+  /// Coarsest first, every uploaded mip completes the chain below the new base level
+  int level = texture.residentLevel - 1;
+  std::vector<uint32_t>& pixels = job.pixels[level - job.firstLevel];
+  size_t bytes = pixels.size() * sizeof(uint32_t);
+
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, upload.buffer);
+  if (upload.capacity < bytes)
+  {
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, bytes, nullptr, GL_STREAM_DRAW);
+    upload.capacity = bytes;
+  }
+
+  /// The fence guarantees the GPU is done with the previous contents
+  void* mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+  if (mapped == nullptr)
+  {
+    /// The rest of the job is given up, the texture keeps the mips it has
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    job.pixels.clear();
+    return true;
+  }
+
+  memcpy(mapped, pixels.data(), bytes);
+  glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+  GLState::activeTexture(GL_TEXTURE0);
+  GLState::bindTexture(GL_TEXTURE_2D, job.texture);
+  glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, levelSize(texture.width, level), levelSize(texture.height, level), 0, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level);
+  upload.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+  /// Texture uploads elsewhere read client memory
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+  nextUploadBuffer = (nextUploadBuffer + 1) % UPLOAD_BUFFERS;
+
+  size_t added = levelBytes(texture, level) - levelBytes(texture, level + 1);
+  texture.residentLevel = level;
+  stats.residentBytes += added;
+  stats.streamedBytes += added;
+  stats.uploadedBytes += bytes;
+  stats.uploads++;
+
+  std::vector<uint32_t>().swap(pixels);
+  return true;
+}
+
+void TextureStreamer::dropLevel(GLuint name, Texture& texture)
+{
+  int level = texture.residentLevel;
+  size_t removed = levelBytes(texture, level) - levelBytes(texture, level + 1);
+
+  /// An empty image frees the storage of the mip, the base level skips it
+  GLState::activeTexture(GL_TEXTURE0);
+  GLState::bindTexture(GL_TEXTURE_2D, name);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level + 1);
+  glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, 0, 0, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+
+  texture.residentLevel = level + 1;
+  stats.residentBytes -= removed;
+  stats.streamedBytes -= removed;
+  stats.drops++;
+}
+
+void TextureStreamer::dropOverBudget()
+{
+  while (stats.streamedBytes > stats.budgetBytes)
+  {
+    /// Mips finer than needed go first, then the least recently requested texture loses its finest mip
+    GLuint victim = 0;
+    Texture* worst = nullptr;
+    for (auto& entry : textures)
+    {
+      Texture& texture = entry.second;
+      if (texture.loading || texture.residentLevel >= texture.permanentLevel)
+        continue;
+
+      bool surplus = texture.residentLevel < texture.neededLevel;
+      bool worstSurplus = worst != nullptr && worst->residentLevel < worst->neededLevel;
+      if (worst == nullptr || (surplus && !worstSurplus) ||
+          (surplus == worstSurplus && texture.lastRequestFrame < worst->lastRequestFrame))
+      {
+        victim = entry.first;
+        worst = &texture;
+      }
+    }
+
+    if (worst == nullptr)
+      return;
+
+    overBudget = overBudget || (worst->residentLevel >= worst->neededLevel && worst->lastRequestFrame + 1 == frame);
+
+    dropLevel(victim, *worst);
+  }
+}
+
+void TextureStreamer::queueRequests()
+{
+  /// Streamed bytes that the next updates will drop, they do not block requests
+  size_t surplus = 0;
+  std::vector<std::pair<int, GLuint>> missing;
+  for (auto& entry : textures)
+  {
+    Texture& texture = entry.second;
+    if (texture.loading || texture.failed)
+      continue;
+
+    if (texture.residentLevel < texture.neededLevel)
+      surplus += levelBytes(texture, texture.residentLevel) - levelBytes(texture, texture.neededLevel);
+    else if (texture.residentLevel > texture.neededLevel)
+      missing.push_back(std::make_pair(texture.neededLevel - texture.residentLevel, entry.first));
+  }
+
+  /// The blurriest textures first
+  std::sort(missing.begin(), missing.end());
+
+  size_t planned = stats.streamedBytes - std::min(surplus, stats.streamedBytes);
+  for (const auto& candidate : missing)
+  {
+    if (!synchronous && stats.requestsInFlight >= MAX_REQUESTS_IN_FLIGHT)
+      break;
+
+    Texture& texture = textures[candidate.second];
+
+    /// Under pressure a texture gets the finest mips that still fit
+    int firstLevel = texture.neededLevel;
+    while (firstLevel < texture.residentLevel && planned + levelBytes(texture, firstLevel) - levelBytes(texture, texture.residentLevel) > stats.budgetBytes)
+      firstLevel++;
+    if (firstLevel == texture.residentLevel)
+    {
+      overBudget = true;
+      continue;
+    }
+    planned += levelBytes(texture, firstLevel) - levelBytes(texture, texture.residentLevel);
+
+    Job job;
+    job.texture = candidate.second;
+    job.id = texture.id;
+    job.path = texture.path;
+    job.firstLevel = firstLevel;
+    job.lastLevel = texture.residentLevel;
+
+    texture.loading = true;
+    stats.requestsInFlight++;
+
+    if (synchronous)
+    {
+      decodeJob(job);
+      std::lock_guard<std::mutex> lock(queueMutex);
+      completed.push_back(std::move(job));
+      continue;
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(queueMutex);
+      requests.push_back(std::move(job));
+    }
+    queueWake.notify_one();
+  }
+}
+
+/// Bytes of the mip chain from level down to 1x1
+size_t TextureStreamer::levelBytes(const Texture& texture, int level)
+{
+  size_t bytes = 0;
+  for (int l = level; l < texture.levels; l++)
+    bytes += (size_t)levelSize(texture.width, l) * levelSize(texture.height, l) * 4;
+  return bytes;
+}
+
+void TextureStreamer::decodeJob(Job& job)
+{
+  /// The file is decoded at full size again, the permanent mips did not keep it
+  int width = 0, height = 0;
+  std::vector<uint32_t> pixels, smaller;
+  if (decode(job.path, nullptr, width, height, pixels))
+  {
+    for (int level = 0; level < job.lastLevel; level++)
+    {
+      if (level > 0)
+      {
+        downsample(pixels, levelSize(width, level - 1), levelSize(height, level - 1), smaller);
+        pixels.swap(smaller);
+      }
+      if (level >= job.firstLevel)
+        job.pixels.push_back(pixels);
+    }
+  }
+}
+
+bool TextureStreamer::decode(const std::string& path, const std::vector<unsigned char>* content, int& width, int& height, std::vector<uint32_t>& pixels)
+{
+  std::lock_guard<std::mutex> lock(imageMutex);
+
+  ILuint image;
+  ilGenImages(1, &image);
+  ilBindImage(image);
+
+  bool loaded = content != nullptr ? ilLoadL(IL_TYPE_UNKNOWN, content->data(), (ILuint)content->size()) : ilLoadImage(path.c_str());
+  if (!loaded || !ilConvertImage(IL_RGBA, IL_UNSIGNED_BYTE))
+  {
+    std::cout << "Failed to load texture: " << path << "." << std::endl;
+    ilDeleteImages(1, &image);
+    return false;
+  }
+
+  width = ilGetInteger(IL_IMAGE_WIDTH);
+  height = ilGetInteger(IL_IMAGE_HEIGHT);
+  pixels.resize((size_t)width * height);
+  memcpy(pixels.data(), ilGetData(), pixels.size() * sizeof(uint32_t));
+
+  ilDeleteImages(1, &image);
+  return true;
+}
+
+void TextureStreamer::downsample(const std::vector<uint32_t>& source, int width, int height, std::vector<uint32_t>& target)
+{
+  int targetWidth = std::max(1, width / 2);
+  int targetHeight = std::max(1, height / 2);
+  target.resize((size_t)targetWidth * targetHeight);
+
+  for (int y = 0; y < targetHeight; y++)
+  {
+    const uint32_t* row0 = &source[(size_t)std::min(y * 2, height - 1) * width];
+    const uint32_t* row1 = &source[(size_t)std::min(y * 2 + 1, height - 1) * width];
+
+    for (int x = 0; x < targetWidth; x++)
+    {
+      int x0 = std::min(x * 2, width - 1);
+      int x1 = std::min(x * 2 + 1, width - 1);
+      uint32_t texels[4] = { row0[x0], row0[x1], row1[x0], row1[x1] };
+
+      uint32_t result = 0;
+      for (int channel = 0; channel < 32; channel += 8)
+      {
+        uint32_t sum = 2;
+        for (uint32_t texel : texels)
+          sum += (texel >> channel) & 0xFF;
+        result |= (sum / 4) << channel;
+      }
+      target[(size_t)y * targetWidth + x] = result;
+    }
+  }
+}
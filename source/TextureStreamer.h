@@ -0,0 +1,149 @@
+//----------------------------------------------------------------------------------------
+/**
+ * \file       TextureStreamer.h
+ * \author     Bogdan Putintsev
+ * \date       2021/05/13
+ * \brief      Mip streaming of file textures under a video memory budget
+ *
+ *  A texture is created with the mips of at most RESIDENT_SIZE texels per side, which stay
+ *  until it is destroyed. Draws request the finest mip their screen-space footprint needs;
+ *  a loader thread decodes the file again and downsamples it to the missing mips, and the
+ *  main thread uploads them coarsest first through a ring of pixel unpack buffers, moving
+ *  GL_TEXTURE_BASE_LEVEL down as each one arrives. When the streamed mips exceed the
+ *  budget, mips finer than their texture needs are dropped first, least recently
+ *  requested textures first.
+ *
+*/
+//----------------------------------------------------------------------------------------
+
+#pragma once
+#include "pgr.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+class TextureStreamer
+{
+public:
+  static const int RESIDENT_SIZE = 64;          ///< Mips up to this size are uploaded with the texture
+  static const int UPLOAD_BUFFERS = 4;          ///< Pixel unpack buffers in the ring
+  static const size_t UPLOAD_BYTES = 16 << 20;  ///< Upload budget per frame, at least one mip is uploaded
+  static const int MAX_REQUESTS_IN_FLIGHT = 2;  ///< Textures being decoded on the loader thread at once
+
+  struct Stats
+  {
+    size_t budgetBytes = 0;
+    size_t residentBytes = 0;                   ///< All mips on the device, the permanent ones included
+    size_t streamedBytes = 0;                   ///< Mips above RESIDENT_SIZE, the part the budget limits
+    size_t uploadedBytes = 0;                   ///< This frame
+    int requestsInFlight = 0;
+    uint64_t uploads = 0;                       ///< Mips uploaded since the start
+    uint64_t drops = 0;
+    uint64_t overBudgetFrames = 0;              ///< Frames where the needed mips alone exceed the budget
+  };
+
+  TextureStreamer();
+  ~TextureStreamer();
+
+  /// Upload buffers and the loader thread, needs the GL context
+  void init();
+  /// Finish the loader thread and delete the buffers, the textures belong to the caller
+  void release();
+
+  /// Decode the content read from the file and upload its coarse mips, 0 when it cannot be decoded
+  GLuint create(const std::string& path, const std::vector<unsigned char>& content);
+  /// Forget a texture before it is deleted, mips still being decoded for it are thrown away
+  void destroy(GLuint texture);
+  bool isStreamed(GLuint texture) const { return textures.count(texture) != 0; }
+  size_t getBytes(GLuint texture) const;
+
+  /// Texels per screen pixel of a draw using the texture, the finest request of a frame wins
+  void request(GLuint texture, float uvPerViewHeight, int viewHeight);
+  /// Upload decoded mips, drop mips over the budget and queue the missing ones, once per frame.
+  /// Returns true when the mips of some texture changed.
+  bool update();
+
+  void setBudget(size_t bytes) { stats.budgetBytes = bytes; }
+  /// Decode and upload every missing mip inside update, for reproducible frames
+  void setSynchronous(bool enable) { synchronous = enable; }
+  const Stats& getStats() const { return stats; }
+  /// One line per texture: size, resident and needed mips, memory
+  void printResidency() const;
+
+private:
+  /// Streaming state of one texture, levels count from the full size
+  struct Texture
+  {
+    uint64_t id = 0;                            ///< Tells a texture from a later one with the same GL name
+    std::string path;
+    int width = 0;
+    int height = 0;
+    int levels = 0;
+    int permanentLevel = 0;                     ///< Finest of the mips that always stay
+    int residentLevel = 0;                      ///< Finest mip on the device, the base level
+    int wantedLevel = 0;                        ///< Finest request since the last update
+    int neededLevel = 0;                        ///< wantedLevel of the last update
+    uint64_t lastRequestFrame = 0;
+    bool loading = false;
+    bool failed = false;                        ///< The file could not be decoded again
+  };
+
+  /// Decoded mips from firstLevel up to the resident level of the texture when it was queued
+  struct Job
+  {
+    GLuint texture = 0;
+    uint64_t id = 0;
+    std::string path;
+    int firstLevel = 0;
+    int lastLevel = 0;                          ///< Exclusive
+    std::vector<std::vector<uint32_t>> pixels;  ///< One per level, RGBA8, first row at the bottom
+  };
+
+  /// Slot of the upload ring, reused once the GPU has read it
+  struct UploadBuffer
+  {
+    GLuint buffer = 0;
+    size_t capacity = 0;
+    GLsync fence = 0;
+  };
+
+  std::unordered_map<GLuint, Texture> textures;
+  uint64_t nextId = 1;
+  uint64_t frame = 0;
+  bool overBudget = false;                      ///< Set during update when needed mips did not fit
+  bool synchronous = false;
+  Stats stats;
+
+  UploadBuffer uploadBuffers[UPLOAD_BUFFERS];
+  int nextUploadBuffer = 0;
+
+  std::thread loader;
+  std::mutex queueMutex;
+  std::condition_variable queueWake;
+  std::deque<Job> requests;
+  std::deque<Job> completed;
+  bool stopLoader = false;
+
+  void loaderLoop();
+  /// Mips of the completed jobs, until the upload budget of the frame or the ring runs out
+  void uploadCompleted();
+  /// Upload the next coarser missing mip of the front job, false when the ring is busy
+  bool uploadLevel(Job& job, Texture& texture);
+  void dropLevel(GLuint name, Texture& texture);
+  void queueRequests();
+  void dropOverBudget();
+
+  static size_t levelBytes(const Texture& texture, int level);
+  /// Fill the pixels of a job, empty when the file cannot be decoded
+  static void decodeJob(Job& job);
+  /// Decode a file, or its content when already read, into RGBA8 pixels with the first row at the bottom, safe on any thread
+  static bool decode(const std::string& path, const std::vector<unsigned char>* content, int& width, int& height, std::vector<uint32_t>& pixels);
+  /// 2x2 box filter, odd sizes repeat their last row or column
+  static void downsample(const std::vector<uint32_t>& source, int width, int height, std::vector<uint32_t>& target);
+};
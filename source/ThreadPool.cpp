@@ -0,0 +1,90 @@
+//----------------------------------------------------------------------------------------
+/**
+ * \file       ThreadPool.cpp
+ * \author     Bogdan Putintsev
+ * \date       2021/05/13
+ * \brief      Fixed set of worker threads running parallel loops
+ *
+*/
+//----------------------------------------------------------------------------------------
+
+#include "ThreadPool.h"
+
+#include <algorithm>
+
+ThreadPool::ThreadPool(unsigned int threadCount)
+  : next(0)
+{
+  if (threadCount == 0)
+    threadCount = std::max(1u, std::thread::hardware_concurrency());
+
+  for (unsigned int i = 1; i < threadCount; i++)
+    workers.push_back(std::thread(&ThreadPool::workerLoop, this));
+}
+
+ThreadPool::~ThreadPool()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stop = true;
+  }
+  wake.notify_all();
+
+  for (auto& worker : workers)
+    worker.join();
+}
+
+void ThreadPool::parallelFor(unsigned int count, const std::function<void(unsigned int)>& newJob)
+{
+  if (count == 0)
+    return;
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    job = &newJob;
+    jobCount = count;
+    next = 0;
+    busy = (unsigned int)workers.size();
+    generation++;
+  }
+  wake.notify_all();
+
+  runJobs();
+
+  std::unique_lock<std::mutex> lock(mutex);
+  done.wait(lock, [this] { return busy == 0; });
+  job = nullptr;
+}
+
+void ThreadPool::workerLoop()
+{
+  uint64_t seenGeneration = 0;
+
+  while (true)
+  {
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      wake.wait(lock, [this, seenGeneration] { return stop || generation != seenGeneration; });
+      if (stop)
+        return;
+      seenGeneration = generation;
+    }
+
+    runJobs();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (--busy == 0)
+      done.notify_one();
+  }
+}
+
+void ThreadPool::runJobs()
+{
+  while (true)
+  {
+    unsigned int index = next++;
+    if (index >= jobCount)
+      return;
+    (*job)(index);
+  }
+}
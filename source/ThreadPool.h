@@ -0,0 +1,47 @@
+//----------------------------------------------------------------------------------------
+/**
+ * \file       ThreadPool.h
+ * \author     Bogdan Putintsev
+ * \date       2021/05/13
+ * \brief      Fixed set of worker threads running parallel loops
+ *
+*/
+//----------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool
+{
+public:
+  /// threadCount 0 uses all hardware threads, the calling thread counts as one of them
+  explicit ThreadPool(unsigned int threadCount = 0);
+  ~ThreadPool();
+
+  /// Run job(0) .. job(count - 1) on all threads and wait for them
+  void parallelFor(unsigned int count, const std::function<void(unsigned int)>& job);
+
+  unsigned int getThreadCount() const { return (unsigned int)workers.size() + 1; }
+
+private:
+  std::vector<std::thread> workers;
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::condition_variable done;
+  const std::function<void(unsigned int)>* job = nullptr;
+  unsigned int jobCount = 0;
+  std::atomic<unsigned int> next;
+  unsigned int busy = 0;
+  uint64_t generation = 0;
+  bool stop = false;
+
+  void workerLoop();
+  void runJobs();
+};
@@ -0,0 +1,228 @@
+//----------------------------------------------------------------------------------------
+/**
+ * \file       VolumetricFog.cpp
+ * \author     Bogdan Putintsev
+ * \date       2021/05/13
+ * \brief      Lit fog in a frustum-aligned froxel grid, evaluated on the CPU
+ *
+*/
+//----------------------------------------------------------------------------------------
+
+#include "VolumetricFog.h"
+#include "Constants.h"
+#include "Profiler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <thread>
+
+namespace
+{
+  const float SUN_PHASE_G = 0.3f;               ///< Forward scattering of the sun, brighter towards it
+  const float AMBIENT = 0.5f;                   ///< Like the ambient term of the shaders
+  const float SUN_STRENGTH = 0.6f;
+  const float FLASHLIGHT_STRENGTH = 2.0f;
+  const float FLASHLIGHT_FALLOFF = 0.02f;       ///< Per squared unit of distance
+  const float TORCH_INTENSITY = 3.0f;           ///< Steady, the flicker of the torch stays out of the fog
+  const float TORCH_MIN_DISTANCE = 0.5f;        ///< Keeps the inverse square finite at the flame
+}
+
+bool VolumetricFog::Inputs::operator==(const Inputs& other) const
+{
+  return viewProjection == other.viewProjection && eyePosition == other.eyePosition && eyeDirection == other.eyeDirection &&
+         sunDirection == other.sunDirection && color == other.color && pointPosition == other.pointPosition &&
+         pointColor == other.pointColor && flashLightEnabled == other.flashLightEnabled;
+}
+
+VolumetricFog::VolumetricFog(JobSystem& jobs, int width, int height, int slices)
+  : width(width), height(height), slices(slices), jobs(jobs), froxels((size_t)width * height * slices, glm::vec4(0.0f, 0.0f, 0.0f, 1.0f))
+{
+  sliceDepths.resize(slices);
+  for (int slice = 0; slice < slices; slice++)
+    sliceDepths[slice] = fogNearDepth * std::pow(fogFarDepth / fogNearDepth, (slice + 0.5f) / slices);
+}
+
+void VolumetricFog::init(RenderDevice& renderDevice)
+{
+  release();
+
+  device = &renderDevice;
+  volumeTexture = device->createVolumeTexture(width, height, slices);
+  uploaded = false;
+}
+
+void VolumetricFog::release()
+{
+  if (device == nullptr)
+    return;
+
+  device->destroyTexture(volumeTexture);
+  volumeTexture = 0;
+  device = nullptr;
+}
+
+/// Inject and integrate the columns of one row of tiles, front to back
+void VolumetricFog::buildRow(int row)
+{
+  float g = SUN_PHASE_G;
+  float sunLight = SUN_STRENGTH * std::max(inputs.sunDirection.y, 0.0f);
+
+  glm::vec4 depthRow(inputs.viewProjection[0][3], inputs.viewProjection[1][3], inputs.viewProjection[2][3], inputs.viewProjection[3][3]);
+  float eyeDepth = glm::dot(depthRow, glm::vec4(inputs.eyePosition, 1.0f));
+  float ndcY = (row + 0.5f) / height * 2.0f - 1.0f;
+
+  for (int column = 0; column < width; column++)
+  {
+    float ndcX = (column + 0.5f) / width * 2.0f - 1.0f;
+    glm::vec4 farPoint = inverseViewProjection * glm::vec4(ndcX, ndcY, 1.0f, 1.0f);
+    glm::vec3 rayDirection = glm::normalize(glm::vec3(farPoint) / farPoint.w - inputs.eyePosition);
+
+    /// View depth grows linearly along the ray
+    float distancePerDepth = 1.0f / std::max(glm::dot(glm::vec3(depthRow), rayDirection), 1e-4f);
+
+    /// The sun phase and the flashlight cone only depend on the direction of the column.
+    /// Henyey-Greenstein is normalized to 1 for isotropic scattering.
+    float cosine = glm::dot(rayDirection, inputs.sunDirection);
+    float phase = (1.0f - g * g) / std::pow(1.0f + g * g - 2.0f * g * cosine, 1.5f);
+    glm::vec3 columnLight = inputs.color * (AMBIENT + sunLight * phase);
+
+    float spotAngle = glm::dot(rayDirection, inputs.eyeDirection);
+    float flashlight = inputs.flashLightEnabled && spotAngle >= 0.95f ? FLASHLIGHT_STRENGTH * std::pow(spotAngle, 102.0f) : 0.0f;
+
+    glm::vec3 scattered(0.0f);
+    float transmittance = 1.0f;
+    float previousDepth = eyeDepth;
+
+    for (int slice = 0; slice < slices; slice++)
+    {
+      float depth = sliceDepths[slice];
+      float distance = (depth - eyeDepth) * distancePerDepth;
+      glm::vec3 position = inputs.eyePosition + rayDirection * distance;
+
+      float torchDistance = std::max(glm::length(inputs.pointPosition - position), TORCH_MIN_DISTANCE);
+      glm::vec3 light = columnLight + inputs.pointColor * (TORCH_INTENSITY / (0.5f * torchDistance + 0.5f * torchDistance * torchDistance));
+      if (flashlight > 0.0f)
+        light = light + inputs.color * (flashlight / (1.0f + FLASHLIGHT_FALLOFF * distance * distance));
+
+      /// Homogeneous fog that scatters all it absorbs: the light of the segment is
+      /// (1 - segment transmittance) times its in-scattering, seen through the fog in front
+      float segment = (depth - previousDepth) * distancePerDepth;
+      float segmentTransmittance = std::exp(-fogDensity * segment);
+      scattered = scattered + light * (transmittance * (1.0f - segmentTransmittance));
+      transmittance *= segmentTransmittance;
+      previousDepth = depth;
+
+      froxels[((size_t)slice * height + row) * width + column] = glm::vec4(scattered, transmittance);
+    }
+  }
+}
+
+void VolumetricFog::update(const RenderDevice::CameraParams& camera, const RenderDevice::LightParams& lights)
+{
+  PROFILE_CPU_SCOPE("VolumetricFog::update");
+
+  Inputs next;
+  next.viewProjection = camera.viewProjection;
+  next.eyePosition = camera.eyePosition;
+  next.eyeDirection = glm::normalize(camera.eyeDirection);
+  next.sunDirection = glm::normalize(lights.sunDirection);
+  next.color = lights.color;
+  next.pointPosition = lights.pointPosition;
+  next.pointColor = lights.pointColor;
+  next.flashLightEnabled = lights.flashLightEnabled;
+
+  if (built && next == inputs)
+    return;
+
+  uint64_t start = Profiler::nowNs();
+  inputs = next;
+  inverseViewProjection = glm::inverse(inputs.viewProjection);
+
+  jobs.parallelFor((unsigned int)height, 1, [&](unsigned int begin, unsigned int end) {
+    for (unsigned int row = begin; row < end; row++)
+      buildRow((int)row);
+  });
+
+  buildMs = (Profiler::nowNs() - start) / 1e6;
+  builds++;
+  built = true;
+  uploaded = false;
+  Profiler::counter("fog build ms", buildMs);
+}
+
+void VolumetricFog::draw(RenderDevice& renderDevice)
+{
+  if (!uploaded)
+  {
+    renderDevice.updateVolumeTexture(volumeTexture, &froxels[0].x);
+    uploaded = true;
+  }
+
+  RenderDevice::FogParams params;
+  params.volume = volumeTexture;
+  params.viewProjection = inputs.viewProjection;
+  params.nearDepth = fogNearDepth;
+  params.farDepth = fogFarDepth;
+  renderDevice.setFog(params);
+}
+
+void VolumetricFog::printStats() const
+{
+  std::cout << std::fixed << std::setprecision(2) << "Volumetric fog: " << width << "x" << height << "x" << slices << " froxels, built "
+            << builds << " times, last in " << buildMs << " ms on " << jobs.getThreadCount() << " threads, "
+            << (size_t)getFroxelCount() * sizeof(glm::vec4) / 1024 << " KB uploaded per build" << std::defaultfloat << std::endl;
+}
+
+void VolumetricFog::benchmark()
+{
+  const int FRAMES = 30;
+  const int sizes[][3] = { { 32, 18, 32 }, { 64, 36, 64 }, { 128, 72, 64 }, { 160, 90, 128 } };
+
+  unsigned int hardware = std::max(1u, std::thread::hardware_concurrency());
+  std::vector<unsigned int> threadCounts = { 1, 2, 4, hardware };
+  std::sort(threadCounts.begin(), threadCounts.end());
+  threadCounts.erase(std::unique(threadCounts.begin(), threadCounts.end()), threadCounts.end());
+
+  RenderDevice::LightParams lights;
+  lights.sunDirection = glm::vec3(0.6f, 0.8f, 0.0f);
+  lights.color = glm::vec3(1.0f, 0.65f, 0.8f);
+  lights.flashLightEnabled = true;
+  lights.pointPosition = glm::vec3(-12.26f, 52.24f, -12.73f);
+  lights.pointColor = glm::vec3(1.0f, 0.5f, 0.0f);
+
+  std::cout << "Volumetric fog benchmark (" << FRAMES << " builds each, the camera turns every frame)" << std::endl;
+  std::cout << std::setw(14) << "grid" << std::setw(10) << "froxels" << std::setw(9) << "threads" << std::setw(12) << "build ms" << std::setw(14) << "ns/froxel" << std::endl;
+  std::cout << std::fixed << std::setprecision(3);
+
+  for (const int* size : sizes)
+  {
+    for (unsigned int threads : threadCounts)
+    {
+      JobSystem jobs(threads);
+      VolumetricFog fog(jobs, size[0], size[1], size[2]);
+
+      double total = 0.0;
+      for (int frame = 0; frame < FRAMES; frame++)
+      {
+        float yaw = frame * 0.05f;
+        RenderDevice::CameraParams camera;
+        camera.eyePosition = glm::vec3(-10.0f, 53.0f, -5.0f);
+        camera.eyeDirection = glm::vec3(std::sin(yaw), 0.0f, -std::cos(yaw));
+        camera.viewProjection = glm::perspective(glm::radians(60.0f), (float)WINDOW_WIDTH / WINDOW_HEIGHT, 0.1f, 1000.0f) *
+                                glm::lookAt(camera.eyePosition, camera.eyePosition + camera.eyeDirection, glm::vec3(0.0f, 1.0f, 0.0f));
+
+        fog.update(camera, lights);
+        total += fog.getLastBuildMs();
+      }
+
+      std::ostringstream grid;
+      grid << size[0] << "x" << size[1] << "x" << size[2];
+      double ms = total / FRAMES;
+      std::cout << std::setw(14) << grid.str() << std::setw(10) << fog.getFroxelCount() << std::setw(9) << threads << std::setw(12) << ms
+                << std::setw(14) << ms * 1e6 / fog.getFroxelCount() << std::endl;
+    }
+  }
+}
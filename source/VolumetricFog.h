@@ -0,0 +1,91 @@
+//----------------------------------------------------------------------------------------
+/**
+ * \file       VolumetricFog.h
+ * \author     Bogdan Putintsev
+ * \date       2021/05/13
+ * \brief      Lit fog in a frustum-aligned froxel grid, evaluated on the CPU
+ *
+ *  The view frustum of the camera is cut into width x height tiles and slices whose view
+ *  depths grow exponentially from nearDepth to farDepth. Every froxel gets the density of
+ *  the fog and the light it scatters towards the eye: ambient and sun light through a
+ *  Henyey-Greenstein phase function, the torch and the flashlight cone. Each column is
+ *  then integrated front to back on the job system, so a froxel holds the light scattered
+ *  in and the transmittance from the eye to its center. Shading reads it with one lookup
+ *  of a 3D texture per fragment: color * transmittance + in-scattered light. The cost is
+ *  the grid resolution per frame whatever the overdraw, and the grid is only rebuilt when
+ *  the camera or the lights moved.
+ *
+ *  The torch is injected at a steady intensity: the static layer keeps the fog of the
+ *  static geometry and relights only the torch weight of its surfaces every frame.
+ *
+*/
+//----------------------------------------------------------------------------------------
+
+#pragma once
+#include "RenderDevice.h"
+#include "JobSystem.h"
+
+class VolumetricFog
+{
+public:
+  static const int DEFAULT_WIDTH = 64;          ///< Tiles across the view
+  static const int DEFAULT_HEIGHT = 36;
+  static const int DEFAULT_SLICES = 64;         ///< Depth slices
+
+  explicit VolumetricFog(JobSystem& jobs, int width = DEFAULT_WIDTH, int height = DEFAULT_HEIGHT, int slices = DEFAULT_SLICES);
+
+  /// Create the device texture of the grid
+  void init(RenderDevice& device);
+  void release();
+
+  /// Inject and integrate the grid for the camera, nothing is done while neither moved
+  void update(const RenderDevice::CameraParams& camera, const RenderDevice::LightParams& lights);
+  /// Upload a rebuilt grid and bind it for all draws
+  void draw(RenderDevice& device);
+
+  /// RGBA floats, slices of rows: in-scattered light and transmittance from the eye
+  const std::vector<glm::vec4>& getFroxels() const { return froxels; }
+  int getFroxelCount() const { return width * height * slices; }
+  int getBuilds() const { return builds; }
+  double getLastBuildMs() const { return buildMs; }
+  void printStats() const;
+
+  /// Print build times for several grid sizes and thread counts
+  static void benchmark();
+
+private:
+  int width;
+  int height;
+  int slices;
+  JobSystem& jobs;
+
+  std::vector<glm::vec4> froxels;
+  std::vector<float> sliceDepths;               ///< View depths of the slice centers, exponentially spaced
+
+  /// What the grid was built for
+  struct Inputs
+  {
+    glm::mat4 viewProjection;
+    glm::vec3 eyePosition;
+    glm::vec3 eyeDirection;
+    glm::vec3 sunDirection;
+    glm::vec3 color;
+    glm::vec3 pointPosition;
+    glm::vec3 pointColor;
+    bool flashLightEnabled = false;
+
+    bool operator==(const Inputs& other) const;
+  };
+
+  Inputs inputs;
+  glm::mat4 inverseViewProjection;
+  bool built = false;
+  bool uploaded = false;                        ///< The device texture holds the last build
+  int builds = 0;
+  double buildMs = 0.0;
+
+  RenderDevice* device = nullptr;
+  RenderDevice::Handle volumeTexture = 0;
+
+  void buildRow(int row);
+};
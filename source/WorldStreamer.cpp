@@ -0,0 +1,440 @@
+//----------------------------------------------------------------------------------------
+/**
+ * \file       WorldStreamer.cpp
+ * \author     Bogdan Putintsev
+ * \date       2021/05/13
+ * \brief      Tile-based streaming of scene objects under a memory budget
+ *
+*/
+//----------------------------------------------------------------------------------------
+
+#include "WorldStreamer.h"
+#include "Constants.h"
+#include "Profiler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+namespace
+{
+  /// Unit cube from -1 to 1 in the interleaved layout of createMesh (position 3, uv 2, normal 3)
+  std::vector<float> placeholderVertices()
+  {
+    static const int faces[6][3] = { { 0, 1, 2 }, { 0, 1, 2 }, { 1, 2, 0 }, { 1, 2, 0 }, { 2, 0, 1 }, { 2, 0, 1 } };
+    static const float corners[6][2] = { { -1, -1 }, { 1, -1 }, { 1, 1 }, { -1, -1 }, { 1, 1 }, { -1, 1 } };
+
+    std::vector<float> vertices;
+    for (int face = 0; face < 6; face++)
+    {
+      /// Even faces point to +axis, odd ones to -axis; flipping the second tangent keeps them counter-clockwise from outside
+      float side = face % 2 == 0 ? 1.0f : -1.0f;
+      const int* axes = faces[face];
+
+      for (int corner = 0; corner < 6; corner++)
+      {
+        float position[3];
+        float normal[3] = { 0.0f, 0.0f, 0.0f };
+        position[axes[0]] = side;
+        position[axes[1]] = corners[corner][0];
+        position[axes[2]] = corners[corner][1] * side;
+        normal[axes[0]] = side;
+
+        vertices.insert(vertices.end(), position, position + 3);
+        vertices.push_back(corners[corner][0] * 0.5f + 0.5f);
+        vertices.push_back(corners[corner][1] * 0.5f + 0.5f);
+        vertices.insert(vertices.end(), normal, normal + 3);
+      }
+    }
+
+    return vertices;
+  }
+
+  glm::vec3 worldCenter(const Object& object)
+  {
+    glm::vec3 center = (object.getBoundsMin() + object.getBoundsMax()) * 0.5f;
+    glm::vec4 world = object.getTransform() * glm::vec4(center, 1.0f);
+    return glm::vec3(world.x, world.y, world.z);
+  }
+}
+
+WorldStreamer::WorldStreamer()
+{
+  stats.budgetBytes = (size_t)streamingBudgetMB << 20;
+}
+
+WorldStreamer::~WorldStreamer()
+{
+  if (!loader.joinable())
+    return;
+
+  {
+    std::lock_guard<std::mutex> lock(queueMutex);
+    stopLoader = true;
+  }
+  queueWake.notify_all();
+  loader.join();
+}
+
+void WorldStreamer::add(Object* object, bool pinned)
+{
+  Entry entry;
+  entry.object = object;
+  entry.pinned = pinned;
+  entries.push_back(entry);
+}
+
+void WorldStreamer::init(RenderDevice& device, AssetCache& assetCache)
+{
+  assets = &assetCache;
+  placeholderMesh = assets->acquireMesh(device, placeholderVertices(), "placeholder");
+
+  placeInTiles();
+
+  if (!synchronous && !loader.joinable())
+    loader = std::thread(&WorldStreamer::loaderLoop, this);
+
+  for (size_t index = 0; index < entries.size(); index++)
+  {
+    if (!entries[index].pinned)
+      continue;
+
+    std::vector<float> vertices;
+    Object::readMesh(entries[index].object->getMeshPath(), vertices);
+    finish(device, index, std::move(vertices));
+  }
+}
+
+void WorldStreamer::update(RenderDevice& device, const glm::vec3& viewerPosition)
+{
+  PROFILE_CPU_SCOPE("WorldStreamer::update");
+
+  uint64_t start = Profiler::nowNs();
+  frame++;
+
+  Profiler::counter("streaming placeholders", stats.placeholders);
+  stats.placeholders = 0;
+
+  /// Upload parsed meshes until the time slice is used up, the rest waits for the next frame
+  while (!synchronous && (Profiler::nowNs() - start) / 1e6 < UPLOAD_BUDGET_MS)
+  {
+    Completed done;
+    {
+      std::lock_guard<std::mutex> lock(queueMutex);
+      if (completed.empty())
+        break;
+      done = std::move(completed.front());
+      completed.pop_front();
+    }
+
+    finish(device, done.index, std::move(done.vertices));
+  }
+
+  /// Mark the objects in the tiles around the viewer, pinned ones are always wanted
+  int viewerX = tileCoordinate(viewerPosition.x);
+  int viewerZ = tileCoordinate(viewerPosition.z);
+
+  for (int z = viewerZ - streamingRadius; z <= viewerZ + streamingRadius; z++)
+  {
+    for (int x = viewerX - streamingRadius; x <= viewerX + streamingRadius; x++)
+    {
+      auto tile = tiles.find(tileKey(x, z));
+      if (tile == tiles.end())
+        continue;
+
+      for (size_t index : tile->second)
+        entries[index].lastWantedFrame = frame;
+    }
+  }
+
+  size_t wantedBytes = 0;
+  std::vector<std::pair<float, size_t>> missing;
+
+  for (size_t index = 0; index < entries.size(); index++)
+  {
+    Entry& entry = entries[index];
+    if (entry.pinned)
+      entry.lastWantedFrame = frame;
+
+    if (entry.lastWantedFrame != frame)
+      continue;
+
+    if (entry.object->isResident())
+      wantedBytes += entry.residentBytes;
+    else if (!entry.inFlight)
+    {
+      float distance = entry.pinned ? 0.0f : glm::length(worldCenter(*entry.object) - viewerPosition);
+      missing.push_back(std::make_pair(distance, index));
+    }
+  }
+
+  /// Closest first; cached objects that are no longer wanted do not block requests, they get evicted
+  std::sort(missing.begin(), missing.end());
+
+  for (const auto& candidate : missing)
+  {
+    size_t index = candidate.second;
+
+    if (synchronous)
+    {
+      std::vector<float> vertices;
+      Object::readMesh(entries[index].object->getMeshPath(), vertices);
+      finish(device, index, std::move(vertices));
+      continue;
+    }
+
+    if (stats.requestsInFlight >= MAX_REQUESTS_IN_FLIGHT || wantedBytes + stats.bytesInFlight >= stats.budgetBytes)
+      break;
+
+    request(index);
+  }
+
+  evict();
+
+  stats.uploadMs = (Profiler::nowNs() - start) / 1e6;
+  if (stats.uploadMs > HITCH_MS)
+    stats.hitches++;
+
+  Profiler::counter("streaming resident MB", stats.residentBytes / 1048576.0);
+  Profiler::counter("streaming in flight MB", stats.bytesInFlight / 1048576.0);
+  Profiler::counter("streaming budget %", 100.0 * stats.residentBytes / std::max<size_t>(stats.budgetBytes, 1));
+}
+
+void WorldStreamer::draw(RenderDevice& device, size_t index, int objectId)
+{
+  Entry& entry = entries[index];
+  Object& object = *entry.object;
+
+  if (object.isResident())
+  {
+    object.draw(device, objectId);
+    return;
+  }
+
+  /// Objects outside the streaming radius are not drawn at all
+  if (!object.hasBounds() || entry.lastWantedFrame != frame)
+    return;
+
+  stats.placeholders++;
+
+  glm::vec3 center = (object.getBoundsMin() + object.getBoundsMax()) * 0.5f;
+  glm::vec3 halfExtent = (object.getBoundsMax() - object.getBoundsMin()) * 0.5f;
+
+  RenderDevice::DrawCall call;
+  call.mesh = placeholderMesh.get();
+  call.vertexCount = 36;
+  call.objectId = objectId;
+  call.transform = glm::scale(glm::translate(object.getTransform(), center), halfExtent);
+
+  device.draw(call);
+}
+
+void WorldStreamer::unload()
+{
+  for (auto& entry : entries)
+  {
+    if (!entry.object->isResident())
+      continue;
+
+    entry.object->release();
+    entry.residentBytes = 0;
+    stats.residentObjects--;
+  }
+
+  placeholderMesh.reset();
+  if (assets != nullptr)
+    updateResidentBytes();
+}
+
+void WorldStreamer::printStats() const
+{
+  std::cout << "Streaming: " << stats.residentObjects << "/" << entries.size() << " objects, "
+            << stats.residentBytes / 1048576.0 << " of " << stats.budgetBytes / 1048576.0 << " MB, "
+            << stats.requestsInFlight << " requests (" << stats.bytesInFlight / 1048576.0 << " MB) in flight, "
+            << stats.placeholders << " placeholders, " << stats.loads << " loads, " << stats.evictions << " evictions, "
+            << stats.hitches << " hitches, " << stats.overBudgetFrames << " frames over budget" << std::endl;
+}
+
+void WorldStreamer::placeInTiles()
+{
+  PROFILE_CPU_SCOPE("WorldStreamer::placeInTiles");
+
+  /// One line per OBJ file: path, file size, modification time and model-space bounds
+  struct Cached
+  {
+    size_t fileBytes;
+    int64_t modified;
+    glm::vec3 minimum;
+    glm::vec3 maximum;
+  };
+
+  std::unordered_map<std::string, Cached> manifest;
+  std::ifstream input(streamingBoundsPath);
+  std::string line;
+  while (std::getline(input, line))
+  {
+    std::istringstream fields(line);
+    std::string path;
+    Cached cached;
+    if (fields >> path >> cached.fileBytes >> cached.modified >> cached.minimum.x >> cached.minimum.y >> cached.minimum.z
+               >> cached.maximum.x >> cached.maximum.y >> cached.maximum.z)
+      manifest[path] = cached;
+  }
+
+  bool changed = false;
+  for (size_t index = 0; index < entries.size(); index++)
+  {
+    Entry& entry = entries[index];
+    if (entry.pinned)
+      continue;
+
+    const std::string& path = entry.object->getMeshPath();
+    struct stat info;
+    if (stat(path.c_str(), &info) != 0)
+    {
+      std::cout << "Failed to read file: " << path << "." << std::endl;
+      continue;
+    }
+    size_t fileBytes = (size_t)info.st_size;
+    int64_t modified = (int64_t)info.st_mtime;
+
+    /// An edit changes the modification time even when the size stays, the bounds are read again
+    auto cached = manifest.find(path);
+    if (cached == manifest.end() || cached->second.fileBytes != fileBytes || cached->second.modified != modified)
+    {
+      Cached bounds;
+      bounds.fileBytes = fileBytes;
+      bounds.modified = modified;
+      if (!Object::readBounds(path, bounds.minimum, bounds.maximum))
+        continue;
+      manifest[path] = bounds;
+      cached = manifest.find(path);
+      changed = true;
+    }
+
+    /// The tile is fixed by the position at start, animated objects stay in it
+    entry.object->setBounds(cached->second.minimum, cached->second.maximum);
+    glm::vec3 center = worldCenter(*entry.object);
+    entry.tile = tileKey(tileCoordinate(center.x), tileCoordinate(center.z));
+    tiles[entry.tile].push_back(index);
+  }
+
+  /// The command line modes only read the cache, so benchmarks and replays leave no files behind but their reports
+  if (!changed || synchronous)
+    return;
+
+  std::ofstream output(streamingBoundsPath);
+  for (const auto& cached : manifest)
+  {
+    output << cached.first << " " << cached.second.fileBytes << " " << cached.second.modified << " " << cached.second.minimum.x << " "
+           << cached.second.minimum.y << " " << cached.second.minimum.z << " " << cached.second.maximum.x << " " << cached.second.maximum.y << " "
+           << cached.second.maximum.z << "\n";
+  }
+}
+
+void WorldStreamer::loaderLoop()
+{
+  while (true)
+  {
+    std::pair<size_t, std::string> next;
+    {
+      std::unique_lock<std::mutex> lock(queueMutex);
+      queueWake.wait(lock, [this] { return stopLoader || !requests.empty(); });
+      if (stopLoader)
+        return;
+
+      next = requests.front();
+      requests.pop_front();
+    }
+
+    Completed done;
+    done.index = next.first;
+    Object::readMesh(next.second, done.vertices);
+
+    std::lock_guard<std::mutex> lock(queueMutex);
+    completed.push_back(std::move(done));
+  }
+}
+
+void WorldStreamer::request(size_t index)
+{
+  Entry& entry = entries[index];
+  const std::string& path = entry.object->getMeshPath();
+
+  std::ifstream file(path, std::ios::binary | std::ios::ate);
+  entry.fileBytes = file ? (size_t)file.tellg() : 0;
+  entry.inFlight = true;
+
+  stats.bytesInFlight += entry.fileBytes;
+  stats.requestsInFlight++;
+
+  {
+    std::lock_guard<std::mutex> lock(queueMutex);
+    requests.push_back(std::make_pair(index, path));
+  }
+  queueWake.notify_one();
+}
+
+void WorldStreamer::finish(RenderDevice& device, size_t index, std::vector<float>&& vertices)
+{
+  Entry& entry = entries[index];
+
+  if (entry.inFlight)
+  {
+    entry.inFlight = false;
+    stats.bytesInFlight -= entry.fileBytes;
+    stats.requestsInFlight--;
+  }
+
+  entry.residentBytes = entry.object->upload(device, *assets, std::move(vertices));
+  updateResidentBytes();
+  stats.residentObjects++;
+  stats.loads++;
+}
+
+/// Release the least recently wanted objects until the resident data fits the budget
+void WorldStreamer::evict()
+{
+  while (stats.residentBytes > stats.budgetBytes)
+  {
+    Entry* victim = nullptr;
+    for (auto& entry : entries)
+    {
+      if (entry.pinned || !entry.object->isResident() || entry.lastWantedFrame == frame)
+        continue;
+      if (victim == nullptr || entry.lastWantedFrame < victim->lastWantedFrame)
+        victim = &entry;
+    }
+
+    if (victim == nullptr)
+    {
+      stats.overBudgetFrames++;
+      return;
+    }
+
+    victim->object->release();
+    updateResidentBytes();
+    stats.residentObjects--;
+    stats.evictions++;
+    victim->residentBytes = 0;
+  }
+}
+
+/// Shared assets are counted once, so evicting an object frees only what no other object uses
+void WorldStreamer::updateResidentBytes()
+{
+  stats.residentBytes = assets->getStats().uniqueBytes;
+}
+
+int64_t WorldStreamer::tileKey(int x, int z)
+{
+  return ((int64_t)x << 32) ^ (uint32_t)z;
+}
+
+int WorldStreamer::tileCoordinate(float position)
+{
+  return (int)floorf(position / streamingTileSize);
+}
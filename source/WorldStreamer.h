@@ -0,0 +1,121 @@
+//----------------------------------------------------------------------------------------
+/**
+ * \file       WorldStreamer.h
+ * \author     Bogdan Putintsev
+ * \date       2021/05/13
+ * \brief      Tile-based streaming of scene objects under a memory budget
+ *
+ *  The island is split into square tiles on the XZ plane. Each object is placed into a tile
+ *  at start by the bounds of its OBJ file, found by scanning only the vertex positions and
+ *  cached with the file size in a manifest, so no mesh is loaded to decide it. Objects in
+ *  tiles around the camera are parsed on a loader thread and uploaded on the main thread within a small
+ *  time slice per frame. When resident data exceeds the budget, objects whose tiles were
+ *  needed least recently are evicted. Objects that are known but not resident are drawn
+ *  as boxes of their bounds until the data arrives.
+ *
+*/
+//----------------------------------------------------------------------------------------
+
+#pragma once
+#include "Object.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+class WorldStreamer
+{
+public:
+  static const int MAX_REQUESTS_IN_FLIGHT = 4;  ///< Objects queued on the loader thread at once
+  static constexpr double UPLOAD_BUDGET_MS = 2.0;   ///< Main thread time for uploads per frame
+  static constexpr double HITCH_MS = 8.0;       ///< Streaming work above this counts as a hitch
+
+  /// Telemetry of the current frame, totals are counted from the start
+  struct Stats
+  {
+    size_t budgetBytes = 0;
+    size_t residentBytes = 0;                   ///< Device memory of the asset cache
+    size_t bytesInFlight = 0;                   ///< File size of objects being read or waiting for upload
+    int residentObjects = 0;
+    int requestsInFlight = 0;
+    int placeholders = 0;                       ///< Wanted objects drawn as placeholders this frame
+    double uploadMs = 0.0;
+
+    uint64_t loads = 0;
+    uint64_t evictions = 0;
+    uint64_t hitches = 0;
+    uint64_t overBudgetFrames = 0;              ///< Frames where the wanted objects alone exceed the budget
+  };
+
+  WorldStreamer();
+  ~WorldStreamer();
+
+  /// Pinned objects are loaded up front and never evicted
+  void add(Object* object, bool pinned);
+  void init(RenderDevice& device, AssetCache& assetCache);
+
+  /// Finish uploads, request objects near the viewer and evict over the budget
+  void update(RenderDevice& device, const glm::vec3& viewerPosition);
+
+  /// Draw the object or its placeholder box
+  void draw(RenderDevice& device, size_t index, int objectId);
+
+  /// Load everything on the calling thread as soon as it is wanted, for reproducible frames
+  void setSynchronous(bool enable) { synchronous = enable; }
+  /// Release every streamed object and the placeholder, the device must still be alive
+  void unload();
+  void setBudget(size_t bytes) { stats.budgetBytes = bytes; }
+
+  const Stats& getStats() const { return stats; }
+  void printStats() const;
+
+private:
+  /// Streaming state of one object
+  struct Entry
+  {
+    Object* object = nullptr;
+    bool pinned = false;
+    bool inFlight = false;
+    int64_t tile = 0;
+    uint64_t lastWantedFrame = 0;
+    size_t residentBytes = 0;                   ///< Footprint of the object, shared assets counted in full
+    size_t fileBytes = 0;
+  };
+
+  /// Parsed mesh waiting for its upload
+  struct Completed
+  {
+    size_t index;
+    std::vector<float> vertices;
+  };
+
+  std::vector<Entry> entries;
+  std::unordered_map<int64_t, std::vector<size_t>> tiles;
+
+  AssetCache* assets = nullptr;
+  AssetCache::Reference placeholderMesh;
+  uint64_t frame = 0;
+  bool synchronous = false;
+  Stats stats;
+
+  std::thread loader;
+  std::mutex queueMutex;
+  std::condition_variable queueWake;
+  std::deque<std::pair<size_t, std::string>> requests;
+  std::deque<Completed> completed;
+  bool stopLoader = false;
+
+  /// Read the bounds of every streamed object from the manifest or its OBJ file and put it into its tile
+  void placeInTiles();
+  void loaderLoop();
+  void request(size_t index);
+  void finish(RenderDevice& device, size_t index, std::vector<float>&& vertices);
+  void evict();
+  void updateResidentBytes();
+
+  static int64_t tileKey(int x, int z);
+  static int tileCoordinate(float position);
+};